@@ -216,6 +216,7 @@ bool Baboon::start(IOService *provider)
 	// OSSymbols we use
 	symReadMBHWID = OSSymbol::withCStringNoCopy("readMBHWID");
 	symSetMediaBayPower = OSSymbol::withCStringNoCopy("setMediaBayPower");
+	symWaitForWakePowerUp = OSSymbol::withCStringNoCopy("waitForWakePowerUp");
 	
 	regsMap = provider->mapDeviceMemoryWithIndex(0);
 	if (!regsMap) {
@@ -365,6 +366,8 @@ void Baboon::free()
 		symReadMBHWID->release();
 	if (symSetMediaBayPower)
 		symSetMediaBayPower->release();
+	if (symWaitForWakePowerUp)
+		symWaitForWakePowerUp->release();
 		
 	super::free();
 
@@ -581,6 +584,11 @@ IOReturn Baboon::setPowerState(UInt32 newState, IOService *device)
 					savedBaboonCtrls |= kATA1IntMask;
 			}
 		} else {
+			// The PMU powers the HD and the media bay up after wake on its
+			//  own; the drives below us must not be woken before that
+			if (pmu && symWaitForWakePowerUp)
+				pmu->callPlatformFunction(symWaitForWakePowerUp, true, NULL, NULL, NULL, NULL);
+
 			// Set this first so we get MB/power interrupts
 			baboonRegs[BABOON_CONTROLS] = savedBaboonCtrls;
 			OSSynchronizeIO();
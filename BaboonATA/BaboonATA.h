@@ -51,6 +51,7 @@ protected:
 	
 	const OSSymbol *symReadMBHWID;
 	const OSSymbol *symSetMediaBayPower;
+	const OSSymbol *symWaitForWakePowerUp;
 	
 	IOService *ata1Nub, *pmu;
 
@@ -686,32 +686,37 @@ void ECSC::setLCDEnable(bool enable)
 #endif
 }
 
+// LCD registers kept while the panel is off (from MacOS code). 0x3C goes
+//  back last, after the others have reached the controller.
+#define LCD_REGISTER(r) { r, 1, 0, 0, 0, 0xFF }
+
+static const M2SnapshotEntry lcdEntries[ECSC_LCD_REGISTERS] = {
+    LCD_REGISTER(0x06), LCD_REGISTER(0x08), LCD_REGISTER(0x0A), LCD_REGISTER(0x0C),
+    LCD_REGISTER(0x0E), LCD_REGISTER(0x10), LCD_REGISTER(0x12), LCD_REGISTER(0x14),
+    LCD_REGISTER(0x16), LCD_REGISTER(0x18), LCD_REGISTER(0x1A), LCD_REGISTER(0x1C),
+    LCD_REGISTER(0x1E), LCD_REGISTER(0x20), LCD_REGISTER(0x22), LCD_REGISTER(0x24),
+    LCD_REGISTER(0x26), LCD_REGISTER(0x28), LCD_REGISTER(0x2A), LCD_REGISTER(0x2C),
+    LCD_REGISTER(0x2E), LCD_REGISTER(0x30), LCD_REGISTER(0x32), LCD_REGISTER(0x34),
+    LCD_REGISTER(0x36), LCD_REGISTER(0x38), LCD_REGISTER(0x3A),
+    { 0x3C, 1, 1, 0, 0, 0xFF }
+};
+
 void ECSC::saveRegisters()
 {
-    unsigned int i;
-    char *lcdSavePtr = lcdSave;
-
-    // From MacOS code
-    
     VerboseIOLog("ECSC::saveRegisters()\n");
 
-    for (i = 0x6; i <= 0x3C; i++)
-	*lcdSavePtr++ = regs[i];
+    if (lcdSnapshot.base != regs)
+	m2SnapshotInit(&lcdSnapshot, regs, lcdEntries, ECSC_LCD_REGISTERS, lcdValues);
+    m2SnapshotSave(&lcdSnapshot);
 }
 
 void ECSC::restoreRegisters()
 {
-    unsigned int i;
-    char *lcdSavePtr = lcdSave;
-
-    // From MacOS code
-    
     VerboseIOLog("ECSC::restoreRegisters()\n");
 
-    for (i = 0x6; i <= 0x38; i++)
-		regs[i] = *lcdSavePtr++;
-    
-    regs[0x3C] = lcdSave[(0x3C - 0x6) >> 1];
+    m2SnapshotRestore(&lcdSnapshot);
+    if (m2SnapshotVerify(&lcdSnapshot))
+	IOLog("ECSC: LCD register 0x%02x did not restore\n", (unsigned int) lcdSnapshot.lastMismatch);
 }
 
 void ECSC::setGammaAndCLUT()
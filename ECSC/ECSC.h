@@ -4,10 +4,14 @@
 #include <IOKit/graphics/IOFramebuffer.h>
 #include <IOKit/IOService.h>
 
+#include "../M2PE/M2RegisterSnapshot.h"
+
 
 // Configuration options
 #define ECSC_CACHE_VRAM 0			// 1 = enable caching of VRAM
 
+#define ECSC_LCD_REGISTERS 28			// 0x6 to 0x3C, every other byte
+
 typedef struct {
 	UInt8 red;
 	UInt8 green;
@@ -29,7 +33,8 @@ protected:
         
 	bool haveCLUT, haveGamma, lcdEnabled;
         
-        char lcdSave[0x1C];
+        M2Snapshot lcdSnapshot;			// LCD registers while the panel is off
+        UInt32 lcdValues[ECSC_LCD_REGISTERS];
         
 public:
         virtual bool start(IOService *myProvider);
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "M2L2CR.h"
+
+// M2L2CR.h, the L2CR arithmetic M2CPU configures the L2 of a G3 upgrade
+// card with.
+//
+//	l2crtest [--check] [--verbose]
+//
+// The cases give a firmware L2CR and overrides and the L2CR that
+// m2L2ComputeL2CR must give: the firmware's value without L2E, L2I and
+// L2IP, with each override in its field, and 0 for an override out of
+// range or a size or clock that stays unknown. The round trips take
+// every size and clock field through its decoding and back. The fuzz
+// gives random firmware values and overrides and checks what always
+// holds: a result is 0 or has a known size and clock, never L2E, L2I
+// or L2IP, has every override in it and leaves every other bit as the
+// firmware had it. Last, m2L2FlushBytes is twice the L2, or twice the
+// largest one when L2CR does not say.
+//
+// --check fails on any case that does not hold.
+
+static unsigned int gFailures;
+static int gVerbose;
+
+#define U kL2Unset
+
+struct L2CRCase {
+	const char *name;
+	unsigned int firmware;
+	struct M2L2Settings settings;	// sizeKB, clockHalves, ramType, outputHold, writeThrough, parity
+	unsigned int want;
+};
+
+// 0x29000000 is a 512 KB pipelined burst L2 at half the processor clock
+static const L2CRCase cases[] = {
+	{ "firmware's, L2E off",	0xA9000000, { U, U, U, U, U, U }, 0x29000000 },
+	{ "L2I and L2IP off",		0x29200001, { U, U, U, U, U, U }, 0x29000000 },
+	{ "other bits kept",		0x29144000, { U, U, U, U, U, U }, 0x29144000 },
+	{ "nothing set",		0x00000000, { U, U, U, U, U, U }, 0 },
+	{ "all from overrides",		0x00000000, { 1024, 5, 2, U, U, U }, 0x3B000000 },
+	{ "every override",		0xA9200001, { 1024, 6, 3, 1, 1, 1 }, 0x7D890000 },
+	{ "size 256",			0x29000000, { 256, U, U, U, U, U }, 0x19000000 },
+	{ "size 1024",			0x29000000, { 1024, U, U, U, U, U }, 0x39000000 },
+	{ "size 768",			0x29000000, { 768, U, U, U, U, U }, 0 },
+	{ "size 0",			0x29000000, { 0, U, U, U, U, U }, 0 },
+	{ "clock 1:1",			0x29000000, { U, 2, U, U, U, U }, 0x23000000 },
+	{ "clock 1.5:1",		0x29000000, { U, 3, U, U, U, U }, 0x25000000 },
+	{ "clock 2.5:1",		0x29000000, { U, 5, U, U, U, U }, 0x2B000000 },
+	{ "clock 3:1",			0x29000000, { U, 6, U, U, U, U }, 0x2D000000 },
+	{ "clock 3.5:1",		0x29000000, { U, 7, U, U, U, U }, 0 },
+	{ "clock 0",			0x29000000, { U, 0, U, U, U, U }, 0 },
+	{ "firmware clock reserved",	0x27000000, { U, U, U, U, U, U }, 0 },
+	{ "reserved clock overridden",	0x27000000, { U, 4, U, U, U, U }, 0x29000000 },
+	{ "firmware clock off",		0x21000000, { U, U, U, U, U, U }, 0 },
+	{ "firmware size off",		0x09000000, { U, U, U, U, U, U }, 0 },
+	{ "flow-through",		0x29000000, { U, U, 0, U, U, U }, 0x28000000 },
+	{ "late write",			0x29000000, { U, U, 3, U, U, U }, 0x29800000 },
+	{ "RAM type 1",			0x29000000, { U, U, 1, U, U, U }, 0 },
+	{ "RAM type 4",			0x29000000, { U, U, 4, U, U, U }, 0 },
+	{ "output hold 2",		0x29000000, { U, U, U, 2, U, U }, 0x29020000 },
+	{ "output hold 0",		0x29030000, { U, U, U, 0, U, U }, 0x29000000 },
+	{ "output hold 4",		0x29000000, { U, U, U, 4, U, U }, 0 },
+	{ "write-through on",		0x29000000, { U, U, U, U, 1, U }, 0x29080000 },
+	{ "write-through off",		0x29080000, { U, U, U, U, 0, U }, 0x29000000 },
+	{ "write-through any value",	0x29000000, { U, U, U, U, 7, U }, 0x29080000 },
+	{ "parity on",			0x29000000, { U, U, U, U, U, 1 }, 0x69000000 },
+	{ "parity off",			0xE9000000, { U, U, U, U, U, 0 }, 0x29000000 }
+};
+
+static void check(bool ok, const char *what, unsigned int got, unsigned int want)
+{
+	if (!ok) {
+		gFailures++;
+		if (gFailures <= 20)
+			printf("  %s: got 0x%08x, want 0x%08x\n", what, got, want);
+	} else if (gVerbose)
+		printf("  %s: 0x%08x\n", what, got);
+}
+
+static void runCases(void)
+{
+	unsigned int i, got;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		got = m2L2ComputeL2CR(cases[i].firmware, &cases[i].settings);
+		check(got == cases[i].want, cases[i].name, got, cases[i].want);
+	}
+}
+
+static void runRoundTrips(void)
+{
+	unsigned int field, value;
+	char what[64];
+
+	for (field = 0; field < 4; field++) {
+		value = m2L2SizeKB(field << kL2CRSizeShift);
+		snprintf(what, sizeof(what), "size field %u (%u KB)", field, value);
+		check(field ? (m2L2SizeField(value) == field) : (value == 0), what, m2L2SizeField(value), field);
+	}
+	for (field = 0; field < 8; field++) {
+		value = m2L2ClockHalves(field << kL2CRClockShift);
+		snprintf(what, sizeof(what), "clock field %u (%u halves)", field, value);
+		if ((field == 0) || (field == 3) || (field == 7))
+			check(value == 0, what, value, 0);
+		else
+			check(m2L2ClockField(value) == field, what, m2L2ClockField(value), field);
+	}
+}
+
+// The value of an override picked at random: unset half the time, else
+// anything up to twice the largest valid value
+static unsigned int randomSetting(unsigned int largest)
+{
+	if (rand() & 1)
+		return kL2Unset;
+	return rand() % (2 * largest + 1);
+}
+
+static void runFuzz(unsigned int iterations)
+{
+	static const unsigned int sizes[] = { 256, 512, 768, 1024, 2048 };
+	struct M2L2Settings settings;
+	unsigned int i, firmware, got, mask, want;
+	bool ok;
+
+	srand(1);
+	for (i = 0; i < iterations; i++) {
+		firmware = ((unsigned int) rand() << 16) ^ (unsigned int) rand();
+		m2L2ClearSettings(&settings);
+		settings.sizeKB = (rand() & 1) ? kL2Unset : sizes[rand() % 5];
+		settings.clockHalves = randomSetting(6);
+		settings.ramType = randomSetting(3);
+		settings.outputHold = randomSetting(3);
+		settings.writeThrough = randomSetting(1);
+		settings.parity = randomSetting(1);
+
+		got = m2L2ComputeL2CR(firmware, &settings);
+		if (!got)
+			continue;
+
+		ok = m2L2SizeKB(got) && m2L2ClockHalves(got)
+		  && !(got & (kL2CREnable | kL2CRInvalidate | kL2CRInvalidating));
+
+		mask = kL2CREnable | kL2CRInvalidate | kL2CRInvalidating;
+		if (settings.sizeKB != kL2Unset) {
+			ok = ok && (m2L2SizeKB(got) == settings.sizeKB);
+			mask |= kL2CRSizeMask;
+		}
+		if (settings.clockHalves != kL2Unset) {
+			ok = ok && (m2L2ClockHalves(got) == settings.clockHalves);
+			mask |= kL2CRClockMask;
+		}
+		if (settings.ramType != kL2Unset) {
+			ok = ok && (((got & kL2CRRAMTypeMask) >> kL2CRRAMTypeShift) == settings.ramType);
+			mask |= kL2CRRAMTypeMask;
+		}
+		if (settings.outputHold != kL2Unset) {
+			ok = ok && (((got & kL2CROutputHoldMask) >> kL2CROutputHoldShift) == settings.outputHold);
+			mask |= kL2CROutputHoldMask;
+		}
+		if (settings.writeThrough != kL2Unset) {
+			ok = ok && (!(got & kL2CRWriteThrough) == !settings.writeThrough);
+			mask |= kL2CRWriteThrough;
+		}
+		if (settings.parity != kL2Unset) {
+			ok = ok && (!(got & kL2CRParity) == !settings.parity);
+			mask |= kL2CRParity;
+		}
+		want = firmware & ~mask;
+		ok = ok && ((got & ~mask) == want);
+
+		if (!ok || gVerbose) {
+			char what[64];
+
+			snprintf(what, sizeof(what), "fuzz %u, firmware 0x%08x", i, firmware);
+			check(ok, what, got, want | (got & mask));
+		}
+	}
+}
+
+static void runFlushBytes(void)
+{
+	static const struct { unsigned int l2cr, want; } flushes[] = {
+		{ 0x19000000, 512 * 1024 },
+		{ 0x29000000, 1024 * 1024 },
+		{ 0x39000000, 2048 * 1024 },
+		{ 0x09000000, 2048 * 1024 },
+		{ 0x00000000, 2048 * 1024 }
+	};
+	unsigned int i, got;
+	char what[64];
+
+	for (i = 0; i < sizeof(flushes) / sizeof(flushes[0]); i++) {
+		got = m2L2FlushBytes(flushes[i].l2cr);
+		snprintf(what, sizeof(what), "flush bytes, L2CR 0x%08x", flushes[i].l2cr);
+		check((got == flushes[i].want) && !(got % kL2LineBytes), what, got, flushes[i].want);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: l2crtest [--check] [--verbose]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	bool check = false;
+	unsigned int before;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (strcmp(arg, "--check") == 0) check = true;
+		else if (strcmp(arg, "--verbose") == 0) gVerbose = 1;
+		else usage();
+	}
+
+	before = gFailures;
+	runCases();
+	printf("cases: %u, %u failures\n", (unsigned int) (sizeof(cases) / sizeof(cases[0])), gFailures - before);
+
+	before = gFailures;
+	runRoundTrips();
+	printf("round trips: %u failures\n", gFailures - before);
+
+	before = gFailures;
+	runFuzz(100000);
+	printf("fuzz: 100000 settings, %u failures\n", gFailures - before);
+
+	before = gFailures;
+	runFlushBytes();
+	printf("flush bytes: %u failures\n", gFailures - before);
+
+	if (check)
+		printf("%s\n", gFailures ? "FAIL" : "PASS");
+
+	return (check && gFailures) ? 1 : 0;
+}
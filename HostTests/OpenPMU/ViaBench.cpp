@@ -0,0 +1,379 @@
+#include "ViaModel.h"
+
+#include "OpenViaInterface.h"
+#include "../../OpenPMU/OpenPMUTables.h"
+
+#include <vector>
+#include <algorithm>
+
+// Drives the polled and the interrupt driven VIA interface against the
+// model with a few mixes of PMU commands and a few fault profiles, checks
+// every transaction against what the PMU saw, and reports throughput and
+// latency in modelled time.
+//
+//	viabench [--check] [-n transactions] [--seed n] [--mix name]
+//		 [--interface polled|interrupt] [--profile name]
+//		 [--access ns] [--shift us] [--release us] [--command us]
+//		 [--stats] [--verbose]
+//
+// --check runs only the profiles the driver has to survive unharmed (no
+// faults, and bytes late by less than the driver's timeouts) and fails
+// if a single transaction went wrong.
+
+struct Profile {
+	const char *name;
+	bool mustConform;
+	ViaModelFaults faults;
+};
+
+static const Profile gProfiles[] = {
+	{ "none",	true,	{ 0, 0, 0, 0, 0 } },
+	// 2% of the bytes up to 5 ms late, well inside the 32 ms the driver waits
+	{ "delay",	true,	{ 0, 20000, 5000, 0, 0 } },
+	// a read of the handshake line in 5000 sees it flip while it is changing
+	{ "glitch",	false,	{ 0, 0, 0, 200, 0 } },
+	// the PMU misses one /REQ in 500
+	{ "drop",	false,	{ 0, 0, 0, 0, 2000 } },
+};
+
+static const char *gMixes[] = { "autopoll", "battery", "xpram", "rtc", "boot" };
+
+enum {
+	kProfiles = sizeof(gProfiles) / sizeof(gProfiles[0]),
+	kMixes = sizeof(gMixes) / sizeof(gMixes[0])
+};
+
+struct RunResult {
+	UInt32 transactions;
+	UInt32 correct;
+	UInt32 failures;	// the driver said so
+	UInt32 silent;		// the driver said it went fine, and it did not
+	UInt32 hangs;		// the driver would have waited forever
+	UInt64 accesses;
+	UInt32 sleeps;
+	ViaModelCounters model;
+	std::vector<UInt64> latencies;
+};
+
+static UInt32 gRandom = 1;
+
+static UInt32 nextRandom(void)
+{
+	gRandom ^= gRandom << 13;
+	gRandom ^= gRandom >> 17;
+	gRandom ^= gRandom << 5;
+	return gRandom;
+}
+
+// What the host expects the xpram to hold, to check the round trips
+static UInt8 gShadowXPRAM[256];
+
+static void setCommand(PMUrequest *request, UInt8 command, const UInt8 *data, UInt32 length)
+{
+	memset(request, 0, sizeof(*request));
+	request->pmCommand = command;
+	request->pmSLength = length;
+	if (length != 0)
+		memcpy(request->pmSBuffer, data, length);
+}
+
+// Builds transaction number index of a mix, posting the PMU interrupts
+// the autopoll reads need.
+static void makeRequest(const char *mix, UInt32 index, OpenPMUViaModel *model, PMUrequest *request)
+{
+	UInt8 data[8];
+	UInt32 step;
+
+	if (strcmp(mix, "autopoll") == 0) {
+		// an ADB autopoll packet: kPMUADBint | kPMUautopoll, the command
+		// (talk register 0 of the mouse) and two bytes of data
+		data[0] = 0x10 | 0x04;
+		data[1] = 0x3C;
+		data[2] = nextRandom();
+		data[3] = nextRandom();
+		model->postInterrupt(data, 4);
+		setCommand(request, 0x78, 0, 0);
+	}
+	else if (strcmp(mix, "battery") == 0) {
+		setCommand(request, (index & 1) ? 0x68 : 0x6B, 0, 0);
+	}
+	else if (strcmp(mix, "xpram") == 0) {
+		// writes four bytes, then reads them back
+		data[0] = (UInt8) (index * 4);
+		data[1] = 4;
+		if ((index & 1) == 0) {
+			for (step = 0; step < 4; step++)
+				data[2 + step] = nextRandom();
+			setCommand(request, 0x32, data, 6);
+		}
+		else {
+			data[0] = (UInt8) ((index - 1) * 4);
+			setCommand(request, 0x3A, data, 2);
+		}
+	}
+	else if (strcmp(mix, "rtc") == 0) {
+		if ((index % 16) == 15) {
+			data[0] = 0xB6; data[1] = 0x00; data[2] = (UInt8) (index >> 8); data[3] = (UInt8) index;
+			setCommand(request, 0x30, data, 4);
+		}
+		else {
+			setCommand(request, 0x38, 0, 0);
+		}
+	}
+	else {
+		// what the PMU driver does as it starts: the version, the
+		// switches, a block of xpram, the clock, the battery, power
+		// control and the interrupts
+		switch (index % 7) {
+			case 0: setCommand(request, 0xEA, 0, 0); break;
+			case 1: setCommand(request, 0xDC, 0, 0); break;
+			case 2: data[0] = 0x00; data[1] = 0x20; setCommand(request, 0x3A, data, 2); break;
+			case 3: setCommand(request, 0x38, 0, 0); break;
+			case 4: setCommand(request, 0x6B, 0, 0); break;
+			case 5: data[0] = 0x81; setCommand(request, 0x10, data, 1); break;
+			default:
+				data[0] = 0x20;
+				data[1] = 0x00;
+				data[2] = 0x55;
+				model->postInterrupt(data, 3);
+				setCommand(request, 0x78, 0, 0);
+				break;
+		}
+	}
+}
+
+// Did the transaction do what was asked, as far as both ends can tell
+static bool transactionCorrect(const PMUrequest *request, const ViaModelTransaction *seen, UInt32 completedBefore, UInt32 completedAfter)
+{
+	SInt8 commandLength = cmdLengthTable[request->pmCommand];
+	UInt32 sendLength = (commandLength < 0) ? request->pmSLength : (UInt32) commandLength;
+
+	if ((completedAfter == completedBefore) || !seen->complete || seen->aborted)
+		return false;
+	if (seen->command != request->pmCommand)
+		return false;
+	if ((seen->sentLength != sendLength) || (memcmp(seen->sent, request->pmSBuffer, sendLength) != 0))
+		return false;
+	if ((request->pmRLength != seen->replyLength) || (memcmp(request->pmRBuffer, seen->reply, seen->replyLength) != 0))
+		return false;
+
+	// the xpram has to hold what was written to it
+	if (request->pmCommand == 0x32) {
+		memcpy(&gShadowXPRAM[request->pmSBuffer[0]], &request->pmSBuffer[2], request->pmSBuffer[1]);
+	}
+	else if (request->pmCommand == 0x3A) {
+		if (memcmp(request->pmRBuffer, &gShadowXPRAM[request->pmSBuffer[0]], request->pmSBuffer[1]) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+static OpenViaInterface *createInterface(bool interrupt, OpenPMUViaModel *model, HostInterruptNub *nub)
+{
+	if (interrupt)
+		return OpenPMUViaModelHarness::createInterrupt(model, true, nub);
+	return OpenPMUViaModelHarness::createPolled(model, true);
+}
+
+static void run(bool interrupt, const Profile *profile, const char *mix, UInt32 count, UInt32 seed,
+		const ViaModelTiming *timing, bool showStatistics, RunResult *result)
+{
+	ViaModelFaults faults = profile->faults;
+	faults.seed = seed;
+
+	OpenPMUViaModel model(true, timing, &faults);
+	HostInterruptNub *nub = new HostInterruptNub;
+	OpenViaInterface *via;
+	PMUrequest request;
+	UInt32 index;
+
+	nub->init();
+	via = createInterface(interrupt, &model, nub);
+
+	gRandom = seed;
+	memset(gShadowXPRAM, 0, sizeof(gShadowXPRAM));
+	hostSleeps = 0;
+
+	result->transactions = count;
+	result->correct = result->failures = result->silent = result->hangs = 0;
+	result->latencies.clear();
+	result->latencies.reserve(count);
+
+	for (index = 0; index < count; index++) {
+		UInt32 completedBefore, hangsBefore;
+		UInt64 start;
+		bool success;
+
+		makeRequest(mix, index, &model, &request);
+		completedBefore = model.counters.transactions;
+		hangsBefore = model.counters.hangs;
+
+		// a transfer takes milliseconds at worst, a second is a hang
+		start = hostNow();
+		model.waitDeadline = start + 1000000000ULL;
+
+		success = via->processPMURequest(&request);
+
+		result->latencies.push_back(hostNow() - start);
+
+		if (model.counters.hangs != hangsBefore) {
+			// the real thing would wait forever: start over, as
+			// after a reset
+			result->hangs++;
+			OpenPMUViaModelHarness::destroy(via);
+			model.reset();
+			via = createInterface(interrupt, &model, nub);
+		}
+		else if (!success) {
+			result->failures++;
+		}
+		else if (transactionCorrect(&request, &model.last, completedBefore, model.counters.transactions)) {
+			result->correct++;
+		}
+		else {
+			result->silent++;
+		}
+	}
+
+	result->accesses = model.counters.accesses;
+	result->sleeps = hostSleeps;
+	result->model = model.counters;
+
+	if (showStatistics) {
+		OSSerialize *s = OSSerialize::withCapacity(1024);
+
+		printf("  %s PMUTransferStatistics: %s\n", interrupt ? "interrupt" : "polled",
+		       hostSerializeProperty(via, "PMUTransferStatistics", s));
+		s->release();
+	}
+
+	OpenPMUViaModelHarness::destroy(via);
+	nub->release();
+}
+
+static double percentile(const std::vector<UInt64> &sorted, double fraction)
+{
+	size_t index;
+
+	if (sorted.empty())
+		return 0;
+
+	index = (size_t) (fraction * (sorted.size() - 1) + 0.5);
+	return sorted[index] / 1000.0;
+}
+
+static void report(bool interrupt, const Profile *profile, const char *mix, RunResult *result)
+{
+	std::vector<UInt64> sorted = result->latencies;
+	UInt64 total = 0;
+	size_t i;
+
+	std::sort(sorted.begin(), sorted.end());
+	for (i = 0; i < sorted.size(); i++)
+		total += sorted[i];
+
+	printf("%-9s %-6s %-8s %6u %7.0f %7.1f %7.1f %7.1f %8.1f %8.1f %6.1f %6u %5u %6u %4u %5u %4u\n",
+	       interrupt ? "interrupt" : "polled", profile->name, mix,
+	       result->transactions,
+	       (total != 0) ? result->transactions / (total / 1e9) : 0.0,
+	       percentile(sorted, 0.50), percentile(sorted, 0.90), percentile(sorted, 0.99),
+	       percentile(sorted, 0.999), percentile(sorted, 1.0),
+	       (double) result->accesses / result->transactions,
+	       result->sleeps,
+	       result->failures, result->silent, result->hangs,
+	       result->model.aborts, result->model.directionErrors);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: viabench [--check] [-n transactions] [--seed n] [--mix name]\n"
+			"                [--interface polled|interrupt] [--profile name]\n"
+			"                [--access ns] [--shift us] [--release us] [--command us]\n"
+			"                [--stats] [--verbose]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	ViaModelTiming timing;
+	UInt32 count = 2000, seed = 0x1400;
+	const char *onlyMix = 0, *onlyProfile = 0, *onlyInterface = 0;
+	bool check = false, showStatistics = false;
+	int broken = 0;
+	int i, p, m, interrupt;
+
+	OpenPMUViaModel::defaultTiming(&timing);
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *value = (i + 1 < argc) ? argv[i + 1] : 0;
+
+		if (strcmp(arg, "--check") == 0) { check = true; continue; }
+		if (strcmp(arg, "--stats") == 0) { showStatistics = true; continue; }
+		if (strcmp(arg, "--verbose") == 0) { hostVerbose = 1; continue; }
+		if (value == 0)
+			usage();
+		i++;
+		if (strcmp(arg, "-n") == 0) count = strtoul(value, 0, 0);
+		else if (strcmp(arg, "--seed") == 0) seed = strtoul(value, 0, 0);
+		else if (strcmp(arg, "--mix") == 0) onlyMix = value;
+		else if (strcmp(arg, "--profile") == 0) onlyProfile = value;
+		else if (strcmp(arg, "--interface") == 0) onlyInterface = value;
+		else if (strcmp(arg, "--access") == 0) timing.accessNanoseconds = strtoul(value, 0, 0);
+		else if (strcmp(arg, "--shift") == 0) timing.shiftMicroseconds = strtoul(value, 0, 0);
+		else if (strcmp(arg, "--release") == 0) timing.releaseMicroseconds = strtoul(value, 0, 0);
+		else if (strcmp(arg, "--command") == 0) timing.commandMicroseconds = strtoul(value, 0, 0);
+		else usage();
+	}
+
+	if ((count == 0) || (seed == 0))
+		usage();
+
+	printf("VIA access %u ns, PMU byte %u us, ACK release %u us, command %u us, %u transactions a run\n",
+	       timing.accessNanoseconds, timing.shiftMicroseconds, timing.releaseMicroseconds,
+	       timing.commandMicroseconds, count);
+	printf("%-9s %-6s %-8s %6s %7s %7s %7s %7s %8s %8s %6s %6s %5s %6s %4s %5s %4s\n",
+	       "interface", "faults", "mix", "n", "tps", "p50us", "p90us", "p99us", "p99.9us", "maxus",
+	       "acc/tx", "sleeps", "fail", "silent", "hang", "abort", "dir");
+
+	for (interrupt = 0; interrupt < 2; interrupt++) {
+		if ((onlyInterface != 0) && (strcmp(onlyInterface, interrupt ? "interrupt" : "polled") != 0))
+			continue;
+
+		for (p = 0; p < kProfiles; p++) {
+			const Profile *profile = &gProfiles[p];
+
+			if (check && !profile->mustConform)
+				continue;
+			if ((onlyProfile != 0) && (strcmp(onlyProfile, profile->name) != 0))
+				continue;
+
+			for (m = 0; m < kMixes; m++) {
+				RunResult result;
+
+				if ((onlyMix != 0) && (strcmp(onlyMix, gMixes[m]) != 0))
+					continue;
+
+				run(interrupt, profile, gMixes[m], count, seed, &timing,
+				    showStatistics || (!check && (p == 0) && (strcmp(gMixes[m], "boot") == 0)),
+				    &result);
+				report(interrupt, profile, gMixes[m], &result);
+
+				// the driver must not lose a transaction, nor break
+				// the handshake, when the PMU plays by the rules
+				if (profile->mustConform &&
+				    ((result.correct != result.transactions) ||
+				     (result.model.aborts != 0) || (result.model.directionErrors != 0))) {
+					printf("  ^ does not conform\n");
+					broken++;
+				}
+			}
+		}
+	}
+
+	if (check)
+		printf("%s\n", broken ? "FAIL" : "PASS");
+
+	return (check && broken) ? 1 : 0;
+}
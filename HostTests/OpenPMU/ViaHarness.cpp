@@ -0,0 +1,79 @@
+#include "ViaModel.h"
+
+#include "OpenPMU.h"
+
+// OpenViaInterface::start wants an OpenPMUInterface as provider, which
+// would bring in the whole PMU driver. The harness does what start does
+// instead, so only the cast's target type is needed here.
+static const OSMetaClass OpenPMUInterfaceHostMetaClass("OpenPMUInterface", &IOService::metaClass);
+const OSMetaClass * const OpenPMUInterface::metaClass = &OpenPMUInterfaceHostMetaClass;
+
+// What OpenViaInterface::start does, past finding its provider
+void OpenPMUViaModelHarness::start(OpenViaInterface *via, OpenPMUViaModel *model, bool isM2)
+{
+	via->isM2 = isM2;
+	via->interruptSource = 0;
+	via->enablesOwner = 0;
+	via->updateEnablesSymbol = 0;
+	via->mutex = 0;
+	via->preemptionMutex = 0;
+	via->trustTheKernel(true);
+	via->ackSpinMicroseconds = kPMUAckSpinMicroseconds;
+
+	OSSerializer *statisticsSerializer = OSSerializer::forTarget(via, &OpenViaInterface::serializeTransferStatistics);
+	via->setProperty("PMUTransferStatistics", statisticsSerializer);
+	statisticsSerializer->release();
+
+	if (!via->hwInit(model->base()))
+		panic("OpenViaInterface::hwInit failed");
+}
+
+int OpenPMUViaModelHarness::srInterruptNumber(bool isM2)
+{
+	return isM2 ? (int) OpenViaInterface::sr_int_index_m2 : (int) OpenViaInterface::VIA_DEV_VIA0;
+}
+
+OpenViaInterface *OpenPMUViaModelHarness::createPolled(OpenPMUViaModel *model, bool isM2)
+{
+	OpenViaInterface *via = new OpenViaInterface;
+
+	via->init();
+	start(via, model, isM2);
+
+	return via;
+}
+
+OpenIntrrViaInterface *OpenPMUViaModelHarness::createInterrupt(OpenPMUViaModel *model, bool isM2, HostInterruptNub *nub)
+{
+	OpenIntrrViaInterface *via = new OpenIntrrViaInterface;
+	int source = srInterruptNumber(isM2);
+
+	via->init();
+	start(via, model, isM2);
+
+	// and what OpenIntrrViaInterface::start adds
+	via->interruptSource = nub;
+	if (nub->registerInterrupt(source, via, (IOInterruptAction) OpenIntrrViaInterface::shiftRegisterInt) != kIOReturnSuccess)
+		panic("could not register the shift register interrupt");
+	model->setInterruptNub(nub, source);
+
+	return via;
+}
+
+void OpenPMUViaModelHarness::destroy(OpenViaInterface *via)
+{
+	if (via->interruptSource != 0) {
+		via->interruptSource->unregisterInterrupt(srInterruptNumber(via->isM2));
+	}
+	via->release();
+}
+
+const PMUTransferStatistics *OpenPMUViaModelHarness::statistics(OpenViaInterface *via)
+{
+	return &via->transferStatistics;
+}
+
+void OpenPMUViaModelHarness::clearStatistics(OpenViaInterface *via)
+{
+	memset(&via->transferStatistics, 0, sizeof(via->transferStatistics));
+}
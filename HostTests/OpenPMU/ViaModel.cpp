@@ -0,0 +1,512 @@
+#include "ViaModel.h"
+
+// The framing of commands and replies, as the driver has it
+#include "../../OpenPMU/OpenPMUTables.h"
+
+// The model the driver's register accesses go to
+static OpenPMUViaModel *gModel = 0;
+
+extern "C" UInt8 OpenPMUViaModelRead(volatile UInt8 *reg)
+{
+	if (gModel == 0)
+		panic("VIA read with no model");
+	return gModel->read(reg);
+}
+
+extern "C" void OpenPMUViaModelWrite(volatile UInt8 *reg, UInt8 value)
+{
+	if (gModel == 0)
+		panic("VIA write with no model");
+	gModel->write(reg, value);
+}
+
+static int waitHook(void *ref)
+{
+	return ((OpenPMUViaModel *) ref)->runUntilInterrupt();
+}
+
+// The defaults are estimates, not measurements: a VIA access takes about
+// one cycle of the 783.36 kHz E clock; the PMU handles a byte in a few
+// tens of microseconds, and needs a few hundred to act on a command
+// before the first byte of the reply. Change them from the bench command
+// line to see how the driver copes with a slower or faster PMU.
+void OpenPMUViaModel::defaultTiming(ViaModelTiming *timing)
+{
+	timing->accessNanoseconds = 1277;
+	timing->shiftMicroseconds = 35;
+	timing->releaseMicroseconds = 10;
+	timing->commandMicroseconds = 200;
+	timing->protocolTimeoutMicroseconds = 20000;
+}
+
+OpenPMUViaModel::OpenPMUViaModel(bool isM2, const ViaModelTiming *newTiming, const ViaModelFaults *newFaults)
+{
+	if (gModel != 0)
+		panic("only one VIA model at a time");
+	gModel = this;
+
+	memset(registers, 0, sizeof(registers));
+	memset(xpram, 0, sizeof(xpram));
+	memset(&last, 0, sizeof(last));
+	memset(&counters, 0, sizeof(counters));
+	memset(pending, 0, sizeof(pending));
+	memset(pendingLength, 0, sizeof(pendingLength));
+
+	m2 = isM2;
+	reqBit = isM2 ? 0x04 : 0x10;
+	ackBit = isM2 ? 0x02 : 0x08;
+	timing = *newTiming;
+	if (newFaults != 0)
+		faults = *newFaults;
+	else
+		memset(&faults, 0, sizeof(faults));
+	random = (faults.seed != 0) ? faults.seed : 0x2545F491;
+
+	clockSeconds = 0xB5E0C800;
+	pendingHead = pendingCount = 0;
+	interruptNub = 0;
+	srInterruptSource = 0;
+	waitDeadline = 0;
+
+	shift = 0;
+	auxControl = 0x1C;
+	intFlag = 0;
+	intEnable = 0;
+	reset();
+
+	hostSetWaitHook(waitHook, this);
+}
+
+OpenPMUViaModel::~OpenPMUViaModel()
+{
+	hostSetWaitHook(0, 0);
+	gModel = 0;
+}
+
+void OpenPMUViaModel::reset()
+{
+	dataB = 0xFF;
+	ackLow = false;
+	state = kWaitCommand;
+	expected = 0;
+	replyIndex = replyTotal = 0;
+	requestMissed = false;
+	replyStarting = false;
+	lastByteTime = hostNow();
+	event = kNoEvent;
+	eventTime = 0;
+	intFlag &= ~kIFRShift;
+}
+
+// xorshift32, so a seed gives the same faults on every host
+bool OpenPMUViaModel::chance(UInt32 ppm)
+{
+	if (ppm == 0)
+		return false;
+
+	random ^= random << 13;
+	random ^= random >> 17;
+	random ^= random << 5;
+
+	return (random % 1000000) < ppm;
+}
+
+void OpenPMUViaModel::access()
+{
+	counters.accesses++;
+	hostAdvance(timing.accessNanoseconds);
+	catchUp();
+}
+
+void OpenPMUViaModel::catchUp()
+{
+	while ((event != kNoEvent) && (eventTime <= hostNow())) {
+		EventType fired = event;
+
+		event = kNoEvent;
+		if (fired == kByteDone) {
+			byteDone();
+		}
+		else {
+			ackLow = false;
+
+			// The host asserted /REQ before ACK went back up: the
+			// PMU sees it now
+			if ((dataB & reqBit) == 0)
+				requestAsserted();
+		}
+	}
+}
+
+UInt8 OpenPMUViaModel::read(volatile UInt8 *reg)
+{
+	UInt32 offset = (UInt32) (reg - registers);
+	UInt8 value = 0;
+
+	access();
+
+	switch (offset) {
+		case kVIA1Shift:
+			value = shift;
+			intFlag &= ~kIFRShift;
+			break;
+
+		case kVIA1AuxControl:
+			value = auxControl;
+			break;
+
+		case kVIA1IntFlag:
+			value = intFlag & 0x7F;
+			if ((intFlag & intEnable & 0x7F) != 0)
+				value |= 0x80;
+			break;
+
+		case kVIA1IntEnable:
+			value = intEnable | 0x80;
+			break;
+
+		default:
+			if (offset != (UInt32) (m2 ? kVIA2DataB : kVIA1DataB))
+				panic("VIA read of unmodelled register 0x%04x", offset);
+
+			value = dataB & ~ackBit;
+			if (!ackLow)
+				value |= ackBit;
+
+			// A line that is about to change can read either way
+			if ((event != kNoEvent) && chance(faults.glitchPPM)) {
+				counters.glitches++;
+				value ^= ackBit;
+			}
+			break;
+	}
+
+	return value;
+}
+
+void OpenPMUViaModel::write(volatile UInt8 *reg, UInt8 value)
+{
+	UInt32 offset = (UInt32) (reg - registers);
+	UInt8 oldDataB;
+
+	access();
+
+	switch (offset) {
+		case kVIA1Shift:
+			shift = value;
+			intFlag &= ~kIFRShift;
+			break;
+
+		case kVIA1AuxControl:
+			auxControl = value;
+			break;
+
+		case kVIA1IntFlag:
+			intFlag &= ~(value & 0x7F);
+			break;
+
+		case kVIA1IntEnable:
+			if (value & 0x80)
+				intEnable |= value & 0x7F;
+			else
+				intEnable &= ~value;
+			break;
+
+		default:
+			if (offset != (UInt32) (m2 ? kVIA2DataB : kVIA1DataB))
+				panic("VIA write of unmodelled register 0x%04x", offset);
+
+			oldDataB = dataB;
+			dataB = value;
+
+			if ((oldDataB & reqBit) && !(value & reqBit)) {
+				// /REQ asserted. If ACK is still on its way up the
+				// PMU sees it when ACK is up.
+				if (event != kAckRelease)
+					requestAsserted();
+			}
+			else if (!(oldDataB & reqBit) && (value & reqBit)) {
+				// /REQ released
+				if (requestMissed) {
+					requestMissed = false;
+				}
+				else if (event == kByteDone) {
+					// before the PMU acked the byte: it gives up
+					event = kNoEvent;
+					abortTransaction();
+				}
+				else if (ackLow) {
+					event = kAckRelease;
+					eventTime = hostNow() + (UInt64) timing.releaseMicroseconds * 1000;
+				}
+			}
+			break;
+	}
+}
+
+void OpenPMUViaModel::requestAsserted()
+{
+	bool pmuSends = (state == kSendLength) || (state == kSendData);
+	bool hostSends = (auxControl & kACRShiftOut) != 0;
+	UInt64 when;
+
+	if ((state != kWaitCommand) &&
+	    ((hostNow() - lastByteTime) > (UInt64) timing.protocolTimeoutMicroseconds * 1000)) {
+		abortTransaction();
+		pmuSends = false;
+	}
+
+	if (chance(faults.dropPPM)) {
+		counters.drops++;
+		requestMissed = true;
+		return;
+	}
+
+	if (pmuSends == hostSends) {
+		// Both ends want to drive the shift register, or neither:
+		// nothing moves and the PMU drops the transaction
+		counters.directionErrors++;
+		abortTransaction();
+		requestMissed = true;
+		return;
+	}
+
+	when = hostNow() + (UInt64) timing.shiftMicroseconds * 1000;
+	if (replyStarting)
+		when += (UInt64) timing.commandMicroseconds * 1000;
+	if ((faults.delayMaxMicroseconds != 0) && chance(faults.delayPPM)) {
+		counters.delays++;
+		when += (UInt64) (1 + (random % faults.delayMaxMicroseconds)) * 1000;
+	}
+
+	event = kByteDone;
+	eventTime = when;
+}
+
+void OpenPMUViaModel::byteDone()
+{
+	lastByteTime = hostNow();
+	counters.bytes++;
+
+	if ((state == kSendLength) || (state == kSendData)) {
+		replyStarting = false;
+		shift = nextReplyByte();
+	}
+	else {
+		receiveByte(shift);
+	}
+
+	ackLow = true;
+	intFlag |= kIFRShift;
+}
+
+void OpenPMUViaModel::receiveByte(UInt8 byte)
+{
+	SInt8 length;
+
+	switch (state) {
+		case kWaitCommand:
+			memset(&last, 0, sizeof(last));
+			last.command = byte;
+			length = cmdLengthTable[byte];
+			if (length < 0) {
+				state = kWaitLength;
+			}
+			else if (length > 0) {
+				expected = length;
+				state = kWaitData;
+			}
+			else {
+				execute();
+			}
+			break;
+
+		case kWaitLength:
+			expected = byte;
+			if (expected == 0) {
+				execute();
+			}
+			else {
+				state = kWaitData;
+			}
+			break;
+
+		case kWaitData:
+			last.sent[last.sentLength++] = byte;
+			if (--expected == 0)
+				execute();
+			break;
+
+		default:
+			break;
+	}
+}
+
+// Acts on the command in last and frames the reply
+void OpenPMUViaModel::execute()
+{
+	SInt8 framing = rspLengthTable[last.command];
+	UInt8 data[256];
+	UInt32 length = 0, i;
+	UInt8 address, count;
+
+	memset(data, 0, sizeof(data));
+
+	// made up content for the commands the model knows nothing about,
+	// so a byte out of place shows
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (UInt8) (last.command ^ (i * 0x5B));
+
+	switch (last.command) {
+		case 0x30:	// kPMUtimeWrite
+			clockSeconds = ((UInt32) last.sent[0] << 24) | ((UInt32) last.sent[1] << 16) |
+				       ((UInt32) last.sent[2] << 8) | last.sent[3];
+			break;
+
+		case 0x38:	// kPMUtimeRead
+			data[0] = clockSeconds >> 24;
+			data[1] = clockSeconds >> 16;
+			data[2] = clockSeconds >> 8;
+			data[3] = clockSeconds;
+			length = 4;
+			break;
+
+		case 0x32:	// kPMUxPramWrite: address, count, bytes
+			address = last.sent[0];
+			count = last.sent[1];
+			for (i = 0; (i < count) && (i + 2 < last.sentLength); i++)
+				xpram[(UInt8) (address + i)] = last.sent[i + 2];
+			break;
+
+		case 0x3A:	// kPMUxPramRead: address, count
+			address = last.sent[0];
+			count = last.sent[1];
+			for (i = 0; i < count; i++)
+				data[i] = xpram[(UInt8) (address + i)];
+			length = count;
+			break;
+
+		case 0x78:	// kPMUreadINT
+			if (pendingCount != 0) {
+				length = pendingLength[pendingHead];
+				memcpy(data, pending[pendingHead], length);
+				pendingHead = (pendingHead + 1) % kMaxPending;
+				pendingCount--;
+			}
+			else {
+				data[0] = 0;
+				length = 1;
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	if (framing < 0) {
+		replyBuffer[0] = (UInt8) length;
+		memcpy(&replyBuffer[1], data, length);
+		replyTotal = length + 1;
+	}
+	else {
+		length = (framing > 1) ? (UInt32) (framing - 1) : (UInt32) framing;
+		memcpy(replyBuffer, data, length);
+		replyTotal = length;
+	}
+
+	last.replyLength = length;
+	memcpy(last.reply, data, length);
+
+	if (replyTotal == 0) {
+		complete();
+	}
+	else {
+		state = (framing < 0) ? kSendLength : kSendData;
+		replyIndex = 0;
+		replyStarting = true;
+	}
+}
+
+UInt8 OpenPMUViaModel::nextReplyByte()
+{
+	UInt8 byte = replyBuffer[replyIndex++];
+
+	if (state == kSendLength)
+		state = kSendData;
+	if (replyIndex == replyTotal)
+		complete();
+
+	return byte;
+}
+
+void OpenPMUViaModel::complete()
+{
+	last.complete = true;
+	counters.transactions++;
+	state = kWaitCommand;
+
+	if (pendingCount != 0)
+		intFlag |= kIFRPMU;
+}
+
+void OpenPMUViaModel::abortTransaction()
+{
+	last.aborted = true;
+	counters.aborts++;
+	state = kWaitCommand;
+	replyStarting = false;
+}
+
+bool OpenPMUViaModel::postInterrupt(const UInt8 *data, UInt32 length)
+{
+	UInt32 slot;
+
+	if (pendingCount == kMaxPending)
+		return false;
+	if (length > sizeof(pending[0]))
+		length = sizeof(pending[0]);
+
+	slot = (pendingHead + pendingCount) % kMaxPending;
+	memcpy(pending[slot], data, length);
+	pendingLength[slot] = length;
+	pendingCount++;
+
+	intFlag |= kIFRPMU;
+	return true;
+}
+
+bool OpenPMUViaModel::interruptPending()
+{
+	return (interruptNub != 0) &&
+	       ((intFlag & intEnable & kIFRShift) != 0) &&
+	       interruptNub->sources[srInterruptSource].enabled;
+}
+
+// Called while the driver waits for its transfer to finish: moves time to
+// the next thing the PMU does and delivers the shift register interrupt
+// when it is up and enabled. The interrupt is level triggered, as the
+// VIA's is: a handler that leaves the flag up is called again.
+bool OpenPMUViaModel::runUntilInterrupt()
+{
+	if ((waitDeadline != 0) && (hostNow() > waitDeadline)) {
+		counters.hangs++;
+		return false;
+	}
+
+	if (interruptPending()) {
+		counters.srInterrupts++;
+		interruptNub->deliver(srInterruptSource);
+		return true;
+	}
+
+	if (event != kNoEvent) {
+		if (eventTime > hostNow())
+			hostAdvance(eventTime - hostNow());
+		catchUp();
+		return true;
+	}
+
+	// nothing will ever raise the interrupt
+	counters.hangs++;
+	return false;
+}
@@ -0,0 +1,203 @@
+#ifndef _OPENPMU_VIA_MODEL_H
+#define _OPENPMU_VIA_MODEL_H
+
+#include "HostKernel.h"
+
+// A model of the VIA shift register and handshake lines and of the PMU at
+// the other end, for OpenViaInterface and OpenIntrrViaInterface built with
+// OPENPMU_VIA_MODEL.
+//
+// The VIA side: the shift register (a write or a read clears its flag),
+// the auxiliary control register (only the shift direction, bit 4, is
+// looked at), the interrupt flags (write 1 to clear, bit 7 is the summary
+// of the enabled ones), the enables (bit 7 says set or clear) and data
+// port B with /REQ driven by the host and ACK driven by the PMU.
+//
+// The PMU side follows the handshake: /REQ going low starts a byte, which
+// after shiftMicroseconds is in (or out of) the shift register; then the
+// PMU raises the SR flag and pulls ACK low. /REQ going high lets ACK go
+// back high after releaseMicroseconds. The first byte of a reply also
+// waits commandMicroseconds. Command and reply lengths come from the
+// driver's own tables (OpenPMUTables.h, which say how the PMU frames
+// them), so the model checks the transport, not the tables.
+//
+// A /REQ that goes high before the PMU acked aborts the transaction, and
+// so does a gap of more than protocolTimeoutMicroseconds between two
+// bytes: the PMU starts again from a command byte.
+//
+// Every register access costs accessNanoseconds of virtual time, the
+// E clock synchronisation of a real VIA access.
+
+struct ViaModelTiming {
+	UInt32 accessNanoseconds;
+	UInt32 shiftMicroseconds;
+	UInt32 releaseMicroseconds;
+	UInt32 commandMicroseconds;
+	UInt32 protocolTimeoutMicroseconds;
+};
+
+// Faults, each a chance in a million per opportunity
+struct ViaModelFaults {
+	UInt32 seed;
+	UInt32 delayPPM;		// a byte is late ...
+	UInt32 delayMaxMicroseconds;	// ... by up to this
+	UInt32 glitchPPM;		// a read of port B while a byte is moving sees ACK flipped
+	UInt32 dropPPM;			// the PMU misses a /REQ and never acks
+};
+
+// One transaction as the PMU saw it
+struct ViaModelTransaction {
+	UInt8 command;
+	UInt32 sentLength;		// data bytes received
+	UInt8 sent[256];
+	UInt32 replyLength;		// data bytes of the reply (without the count)
+	UInt8 reply[256];
+	bool complete;			// the whole reply went out
+	bool aborted;
+};
+
+struct ViaModelCounters {
+	UInt64 accesses;		// register accesses
+	UInt32 bytes;			// bytes moved
+	UInt32 transactions;		// complete ones
+	UInt32 aborts;			// /REQ released before the ack, or a timeout
+	UInt32 directionErrors;		// SR direction did not match the PMU's
+	UInt32 delays;
+	UInt32 glitches;
+	UInt32 drops;
+	UInt32 srInterrupts;		// delivered to the interrupt driver
+	UInt32 hangs;			// waits for an interrupt that could never come
+};
+
+class OpenPMUViaModel {
+public:
+	// Register offsets from the base, as OpenViaInterface::hwInit has them
+	enum {
+		kVIA1DataB	= 0x0000,
+		kVIA1Shift	= 0x1400,
+		kVIA1AuxControl	= 0x1600,
+		kVIA1IntFlag	= 0x1A00,
+		kVIA1IntEnable	= 0x1C00,
+		kVIA2DataB	= 0x2000,
+		kSpanBytes	= 0x2001
+	};
+
+	enum {
+		kIFRShift	= 0x04,		// ifSR
+		kIFRPMU		= 0x10,		// ifCB1
+		kACRShiftOut	= 0x10
+	};
+
+	static void defaultTiming(ViaModelTiming *timing);
+
+	OpenPMUViaModel(bool isM2, const ViaModelTiming *timing, const ViaModelFaults *faults);
+	~OpenPMUViaModel();
+
+	UInt8 *base() { return registers; }
+
+	UInt8 read(volatile UInt8 *reg);
+	void write(volatile UInt8 *reg, UInt8 value);
+
+	// Interrupt delivery for the interrupt driven interface
+	void setInterruptNub(HostInterruptNub *nub, int srSource) { interruptNub = nub; srInterruptSource = srSource; }
+	bool runUntilInterrupt();	// the semaphore_wait hook
+	UInt64 waitDeadline;		// ... gives up (a hang) after this time
+
+	// Puts the PMU back to waiting for a command and lets /REQ go, as
+	// after a reset of the machine
+	void reset();
+
+	// Queues an event for kPMUreadINT and raises the PMU interrupt,
+	// false if the queue is full
+	bool postInterrupt(const UInt8 *data, UInt32 length);
+
+	// PMU state the transactions act on
+	UInt8 xpram[256];
+	UInt32 clockSeconds;
+
+	// The last transaction the PMU worked on, and the counters
+	ViaModelTransaction last;
+	ViaModelCounters counters;
+
+	void resetCounters() { memset(&counters, 0, sizeof(counters)); }
+
+private:
+	enum PMUState {
+		kWaitCommand,
+		kWaitLength,
+		kWaitData,
+		kSendLength,
+		kSendData
+	};
+
+	enum EventType {
+		kNoEvent,
+		kByteDone,
+		kAckRelease
+	};
+
+	UInt8 registers[kSpanBytes];
+	bool m2;
+	UInt8 reqBit, ackBit;
+	ViaModelTiming timing;
+	ViaModelFaults faults;
+	UInt32 random;
+
+	// VIA state
+	UInt8 shift, auxControl, intFlag, intEnable, dataB;
+	bool ackLow;
+
+	// PMU state
+	PMUState state;
+	UInt32 expected;		// bytes still to receive or send in this state
+	UInt8 replyBuffer[257];
+	UInt32 replyIndex, replyTotal;
+	bool requestMissed;
+	bool replyStarting;
+	UInt64 lastByteTime;
+
+	EventType event;
+	UInt64 eventTime;
+
+	// readINT events
+	enum { kMaxPending = 16 };
+	UInt8 pending[kMaxPending][32];
+	UInt32 pendingLength[kMaxPending];
+	UInt32 pendingHead, pendingCount;
+
+	HostInterruptNub *interruptNub;
+	int srInterruptSource;
+
+	bool chance(UInt32 ppm);
+	void access();
+	void catchUp();
+	void requestAsserted();
+	void requestReleased();
+	void byteDone();
+	void receiveByte(UInt8 byte);
+	UInt8 nextReplyByte();
+	void execute();
+	void complete();
+	void abortTransaction();
+	bool interruptPending();
+};
+
+// Sets up the real interfaces on the model, as their start would on the
+// real machine, and gets at their statistics.
+class OpenViaInterface;
+class OpenIntrrViaInterface;
+
+class OpenPMUViaModelHarness {
+public:
+	static OpenViaInterface *createPolled(OpenPMUViaModel *model, bool isM2);
+	static OpenIntrrViaInterface *createInterrupt(OpenPMUViaModel *model, bool isM2, HostInterruptNub *nub);
+	static void destroy(OpenViaInterface *via);
+	static const struct PMUTransferStatistics *statistics(OpenViaInterface *via);
+	static void clearStatistics(OpenViaInterface *via);
+
+private:
+	static void start(OpenViaInterface *via, OpenPMUViaModel *model, bool isM2);
+	static int srInterruptNumber(bool isM2);
+};
+
+#endif
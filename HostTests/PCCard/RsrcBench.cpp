@@ -0,0 +1,477 @@
+#include "HostKernel.h"
+
+#include <time.h>
+
+// rsrc_mgr.cpp itself, so that the bench can switch best_fit and look
+// at the arrays it keeps
+#include "rsrc_mgr.cpp"
+
+#include "RsrcLists.h"
+
+// rsrc_mgr's resource databases, the sorted arrays against the linked
+// lists they replaced (RsrcLists.cpp).
+//
+//	rsrcbench [--check] [--seeds n] [--ops n] [--verbose]
+//
+// The fuzz runs random sequences of what Card Services does with the
+// databases: adjust_resource_info adding and removing memory and I/O
+// ranges, find_mem_region and find_io_region at random sizes,
+// alignments and passes, clients requesting fixed ranges and releasing
+// what they got, and now and then release_resource_db. After every call
+// both sides must have returned the same and hold the same intervals
+// and blocks. With best_fit off the arrays must pick what the lists'
+// first fit picks; with it on, what the smallest hole on the lists
+// gives, and the lists then take the same range.
+//
+// The growth run fills the databases well past their static pools and
+// empties them again, which must leave nothing allocated.
+//
+// The timings are of find_mem_region and release_mem_region with n
+// windows allocated, in host nanoseconds (the only report here not in
+// modelled time). The churn run has clients of a 1 MB window space
+// taking and giving back windows of 4 to 64 KB, with up to 7/8 of it in
+// use, and counts the requests that failed with enough space free in
+// total, for first and best fit.
+//
+// --check fails on any difference in the fuzz or the growth run.
+
+extern "C" {
+socket_t sockets = 0;
+socket_info_t *socket_table[MAX_SOCK];
+void release_cis_mem(socket_info_t *s) { }
+void cb_release_cis_mem(socket_info_t *s) { }
+}
+
+enum {
+	kHighBase = 0x90000000,		// TREXModelHarness::kWindowBase
+	kHighLength = 0x100000,
+	kLowBase = 0xC0000,		// below 1 MB, find_mem_region's second pass
+	kLowLength = 0x40000,
+	kIOBase = 0x100,
+	kIOLength = 0x1000,
+	kMaxHeld = 4096,
+	kMaxDump = 4096
+};
+
+static UInt32 gFailures;
+static UInt32 gSeed;
+
+static UInt32 rnd(UInt32 n)
+{
+	gSeed = gSeed * 1103515245 + 12345;
+	return n ? (gSeed >> 8) % n : 0;
+}
+
+static UInt64 hostClock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UInt64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct Held {
+	int io;
+	u_long base, num;
+};
+
+static Held gHeld[kMaxHeld];
+static int gHeldCount;
+
+static void hold(int io, u_long base, u_long num)
+{
+	if (gHeldCount < (int) kMaxHeld) {
+		gHeld[gHeldCount].io = io;
+		gHeld[gHeldCount].base = base;
+		gHeld[gHeldCount].num = num;
+		gHeldCount++;
+	}
+}
+
+static int adjust(int io, int action, u_long base, u_long num)
+{
+	adjust_t adj;
+
+	memset(&adj, 0, sizeof(adj));
+	adj.Action = action;
+	if (io) {
+		adj.Resource = RES_IO_RANGE;
+		adj.resource.io.BasePort = base;
+		adj.resource.io.NumPorts = num;
+	} else {
+		adj.Resource = RES_MEMORY_RANGE;
+		adj.resource.memory.Base = base;
+		adj.resource.memory.Size = num;
+	}
+	return adjust_resource_info((client_handle_t) CS_ADJUST_FAKE_HANDLE, &adj);
+}
+
+static void fail(const char *what, UInt32 seed, int op)
+{
+	gFailures++;
+	if (gFailures <= 10)
+		printf("  seed %u op %d: %s\n", seed, op, what);
+}
+
+// Both sides hold the same intervals and blocks
+static bool sameState(void)
+{
+	static u_long base[kMaxDump], num[kMaxDump];
+	int io, n, i;
+
+	for (io = 0; io < 2; io++) {
+		resource_db_t *db = io ? &io_db : &mem_db;
+		resource_list_t *list = io ? &io_list : &mem_list;
+
+		n = lists_free(io, base, num, kMaxDump);
+		if (n != db->count)
+			return false;
+		for (i = 0; i < n; i++)
+			if ((db->map[i].base != base[i]) || (db->map[i].num != num[i]))
+				return false;
+
+		n = lists_blocks(io, base, num, kMaxDump);
+		if (n != list->count)
+			return false;
+		for (i = 0; i < n; i++)
+			if ((list->entry[i].base != base[i]) || (list->entry[i].num != num[i]))
+				return false;
+	}
+	return true;
+}
+
+static void resetBoth(void)
+{
+	release_resource_db();
+	lists_release_resource_db();
+	gHeldCount = 0;
+}
+
+static void randomRange(int io, u_long *base, u_long *num)
+{
+	if (io) {
+		*base = kIOBase + rnd(kIOLength);
+		*num = 1 + rnd(0x100);
+	} else if (rnd(4) == 0) {
+		*base = kLowBase + rnd(kLowLength / 0x1000) * 0x1000;
+		*num = (1 + rnd(16)) * 0x1000;
+	} else {
+		*base = kHighBase + rnd(kHighLength / 0x1000) * 0x1000;
+		*num = (1 + rnd(64)) * 0x1000;
+	}
+}
+
+// What find_mem_region or find_io_region should pick, from the lists
+static int expectedFind(int io, u_long *base, u_long num, u_long align, int forceLow)
+{
+	int low;
+
+	if (!best_fit) {
+		if (io) {
+			ioaddr_t b = *base;
+			int ret = lists_find_io_region(&b, num, align);
+
+			*base = b;
+			return ret;
+		}
+		return lists_find_mem_region(base, num, align, forceLow);
+	}
+
+	if (io) {
+		if (lists_best_fit(1, base, num, align, -1) != 0)
+			return -1;
+	} else {
+		for (low = forceLow; low < 2; low++)
+			if (lists_best_fit(0, base, num, align, low) == 0)
+				break;
+		if (low == 2)
+			return -1;
+	}
+	lists_request_region(io, *base, num);
+	return 0;
+}
+
+static void fuzz(UInt32 seed, int ops)
+{
+	int op;
+
+	gSeed = seed;
+	resetBoth();
+
+	for (op = 0; op < ops; op++) {
+		int io = rnd(3) == 0, what = rnd(100);
+		u_long base, num, align, expect;
+		int ret, want, i;
+
+		if (what < 15) {
+			// a range for Card Services to manage, or one taken away
+			int action = (rnd(3) == 0) ? REMOVE_MANAGED_RESOURCE : ADD_MANAGED_RESOURCE;
+
+			randomRange(io, &base, &num);
+			ret = adjust(io, action, base, num);
+			want = lists_adjust(io, action, base, num);
+			if (ret != want)
+				fail("adjust_resource_info returned differently", seed, op);
+		} else if (what < 55) {
+			// find_*_region for a window or a card's ports
+			int forceLow = !io && (rnd(4) == 0);
+
+			if (io) {
+				num = 1 << rnd(6);
+				align = (rnd(6) == 0) ? 0 : num << rnd(2);
+			} else {
+				num = 0x1000 << rnd(5);
+				align = (rnd(8) == 0) ? 0 : num << rnd(2);
+			}
+			if (align)
+				base = rnd(align / num) * num;
+			else
+				randomRange(io, &base, &expect);
+
+			expect = base;
+			want = expectedFind(io, &expect, num, align, forceLow);
+			if (io) {
+				ioaddr_t b = base;
+
+				ret = find_io_region(&b, num, align, (char *) "fuzz");
+				base = b;
+			} else
+				ret = find_mem_region(&base, num, align, forceLow, (char *) "fuzz");
+
+			if ((ret != want) || ((ret == 0) && (base != expect)))
+				fail(best_fit ? "best fit picked differently" : "first fit picked differently", seed, op);
+			else if (ret == 0)
+				hold(io, base, num);
+		} else if (what < 80) {
+			// a client gives back what it got, or something it never had
+			if (gHeldCount && (rnd(8) != 0)) {
+				i = rnd(gHeldCount);
+				io = gHeld[i].io;
+				base = gHeld[i].base;
+				num = gHeld[i].num;
+				gHeld[i] = gHeld[--gHeldCount];
+			} else
+				randomRange(io, &base, &num);
+			if (io)
+				release_io_region(base, num);
+			else
+				release_mem_region(base, num);
+			lists_release_region(io, base, num);
+		} else if (what < 99) {
+			// a client asks for a fixed range
+			randomRange(io, &base, &num);
+			ret = io ? check_io_region(base, num) : check_mem_region(base, num);
+			want = lists_check_region(io, base, num);
+			if ((ret != 0) != (want != 0))
+				fail("check_*_region answered differently", seed, op);
+			if (ret == 0) {
+				if (io)
+					request_io_region(base, num, (char *) "fuzz");
+				else
+					request_mem_region(base, num, (char *) "fuzz");
+				lists_request_region(io, base, num);
+				hold(io, base, num);
+			}
+		} else
+			resetBoth();
+
+		if (!sameState()) {
+			fail("the databases differ", seed, op);
+			resetBoth();
+		}
+	}
+
+	resetBoth();
+}
+
+// Far more intervals and blocks than the static pools hold
+static void growth(void)
+{
+	UInt32 allocations = hostAllocations;
+	u_long base;
+	int i, ret;
+
+	resetBoth();
+	for (i = 0; i < 8 * MAX_RESOURCE_MAPS; i++) {
+		base = kHighBase + i * 0x20000;
+		if (adjust(0, ADD_MANAGED_RESOURCE, base, 0x10000) != CS_SUCCESS)
+			break;
+		lists_adjust(0, ADD_MANAGED_RESOURCE, base, 0x10000);
+	}
+	if ((i != 8 * MAX_RESOURCE_MAPS) || (mem_db.size <= MAX_RESOURCE_MAPS))
+		fail("adding intervals stopped at the pool", 0, i);
+
+	// Splitting every one of them grows the array again
+	for (i = 0; i < 8 * MAX_RESOURCE_MAPS; i++) {
+		base = kHighBase + i * 0x20000 + 0x8000;
+		ret = adjust(0, REMOVE_MANAGED_RESOURCE, base, 0x1000);
+		if (ret != CS_SUCCESS)
+			break;
+		lists_adjust(0, REMOVE_MANAGED_RESOURCE, base, 0x1000);
+	}
+	if (i != 8 * MAX_RESOURCE_MAPS)
+		fail("splitting intervals stopped at the pool", 0, i);
+
+	for (i = 0; i < 8 * MAX_RESOURCE_ENTRIES; i++) {
+		base = 0;
+		if (find_mem_region(&base, 0x1000, 0x1000, 0, (char *) "growth") != 0)
+			break;
+		lists_request_region(0, base, 0x1000);
+	}
+	if ((i != 8 * MAX_RESOURCE_ENTRIES) || (mem_list.size <= MAX_RESOURCE_ENTRIES))
+		fail("allocating blocks stopped at the pool", 0, i);
+
+	if (!sameState())
+		fail("the databases differ after growing", 0, 0);
+
+	resetBoth();
+	if (hostAllocations != allocations)
+		fail("release_resource_db left arrays allocated", 0, hostAllocations - allocations);
+	if ((mem_db.map != mem_db.pool) || (mem_list.entry != mem_list.pool))
+		fail("release_resource_db did not go back to the pools", 0, 0);
+}
+
+// Nanoseconds of host time per find_mem_region and release_mem_region,
+// with n 4 KB windows allocated in a space of 2n and a hole by each
+static double timeWindows(int n, bool lists, int iterations)
+{
+	u_long held[kMaxHeld], base;
+	UInt64 start;
+	int i, k;
+
+	resetBoth();
+	adjust(0, ADD_MANAGED_RESOURCE, kHighBase, 2 * n * 0x1000);
+	lists_adjust(0, ADD_MANAGED_RESOURCE, kHighBase, 2 * n * 0x1000);
+	gSeed = n;
+	for (i = 0; i < n; i++) {
+		held[i] = kHighBase + 2 * i * 0x1000;
+		if (lists)
+			lists_request_region(0, held[i], 0x1000);
+		else
+			request_mem_region(held[i], 0x1000, (char *) "bench");
+	}
+
+	start = hostClock();
+	for (i = 0; i < iterations; i++) {
+		k = rnd(n);
+		if (lists) {
+			lists_release_region(0, held[k], 0x1000);
+			base = 0;
+			lists_find_mem_region(&base, 0x1000, 0x1000, 0);
+		} else {
+			release_mem_region(held[k], 0x1000);
+			base = 0;
+			find_mem_region(&base, 0x1000, 0x1000, 0, (char *) "bench");
+		}
+		held[k] = base;
+	}
+	return (double) (hostClock() - start) / iterations;
+}
+
+// Requests that fail with enough space free, in churn of 4 to 64 KB windows
+static void churn(UInt32 *failed, UInt32 *requests)
+{
+	u_long base, num;
+	UInt32 used = 0;
+	int i;
+
+	resetBoth();
+	adjust(0, ADD_MANAGED_RESOURCE, kHighBase, kHighLength);
+	gSeed = 1400;
+	*failed = *requests = 0;
+
+	for (i = 0; i < 20000; i++) {
+		if (gHeldCount && ((used > kHighLength * 7 / 8) || (rnd(2) == 0))) {
+			int k = rnd(gHeldCount);
+
+			release_mem_region(gHeld[k].base, gHeld[k].num);
+			used -= gHeld[k].num;
+			gHeld[k] = gHeld[--gHeldCount];
+			continue;
+		}
+		num = 0x1000 << rnd(5);
+		if (used + num > kHighLength)
+			continue;
+		(*requests)++;
+		base = 0;
+		if (find_mem_region(&base, num, num, 0, (char *) "churn") != 0) {
+			(*failed)++;
+			continue;
+		}
+		used += num;
+		hold(0, base, num);
+	}
+	resetBoth();
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: rsrcbench [--check] [--seeds n] [--ops n] [--verbose]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	UInt32 seeds = 50, ops = 2000, seed;
+	bool check = false;
+	int i, policy;
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (strcmp(arg, "--check") == 0) check = true;
+		else if (strcmp(arg, "--verbose") == 0) hostVerbose = 1;
+		else if ((strcmp(arg, "--seeds") == 0) && (i + 1 < argc)) seeds = strtoul(argv[++i], 0, 0);
+		else if ((strcmp(arg, "--ops") == 0) && (i + 1 < argc)) ops = strtoul(argv[++i], 0, 0);
+		else usage();
+	}
+
+	for (policy = 0; policy < 2; policy++) {
+		UInt32 before = gFailures;
+
+		best_fit = policy;
+		for (seed = 1; seed <= seeds; seed++)
+			fuzz(seed, ops);
+		printf("fuzz, %s fit: %u seeds of %u calls, %u differences\n",
+		       best_fit ? "best" : "first", seeds, ops, gFailures - before);
+	}
+
+	for (policy = 0; policy < 2; policy++) {
+		UInt32 before = gFailures;
+
+		best_fit = policy;
+		growth();
+		printf("growth, %s fit: %u failures\n", best_fit ? "best" : "first", gFailures - before);
+	}
+
+	if (!check) {
+		static const int sizes[] = { 8, 32, 128, 512 };
+		UInt32 failed, requests;
+
+		printf("\n%-8s %12s %12s %12s\n", "windows", "lists ns", "first ns", "best ns");
+		for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++) {
+			int n = sizes[i], iterations = 400000 / n;
+			double lists, first, best;
+
+			lists = timeWindows(n, true, iterations);
+			best_fit = 0;
+			first = timeWindows(n, false, iterations);
+			best_fit = 1;
+			best = timeWindows(n, false, iterations);
+			printf("%-8d %12.0f %12.0f %12.0f\n", n, lists, first, best);
+		}
+
+		printf("\n%-8s %12s %12s\n", "churn", "requests", "failed");
+		for (policy = 0; policy < 2; policy++) {
+			best_fit = policy;
+			churn(&failed, &requests);
+			printf("%-8s %12u %12u\n", best_fit ? "best" : "first", requests, failed);
+		}
+		resetBoth();
+	}
+
+	if (check)
+		printf("%s\n", gFailures ? "FAIL" : "PASS");
+
+	return (check && gFailures) ? 1 : 0;
+}
@@ -0,0 +1,333 @@
+#include "RsrcLists.h"
+
+#include <IOKit/pccard/cs.h>
+
+// rsrc_mgr.c 1.79's databases, as the family had them before the sorted
+// arrays: the code is theirs, with the lists passed in by which one.
+
+typedef struct resource_map_t {
+    u_long			base, num;
+    struct resource_map_t	*next;
+} resource_map_t;
+
+static resource_map_t mem_db = { 0, 0, &mem_db };
+static resource_map_t io_db = { 0, 0, &io_db };
+
+typedef struct resource_entry_t {
+    u_long			base, num;
+    char			*name;
+    struct resource_entry_t	*next;
+} resource_entry_t;
+
+static resource_entry_t io_list = { 0, 0, NULL, NULL };
+static resource_entry_t mem_list = { 0, 0, NULL, NULL };
+
+#define DB(io)		((io) ? &io_db : &mem_db)
+#define LIST(io)	((io) ? &io_list : &mem_list)
+
+/*====================================================================*/
+
+static resource_entry_t *find_gap(resource_entry_t *root,
+				  resource_entry_t *entry)
+{
+    resource_entry_t *p;
+
+    if (entry->base > entry->base+entry->num-1)
+	return NULL;
+    for (p = root; ; p = p->next) {
+	if ((p != root) && (p->base+p->num-1 >= entry->base)) {
+	    p = NULL;
+	    break;
+	}
+	if ((p->next == NULL) ||
+	    (p->next->base > entry->base+entry->num-1))
+	    break;
+    }
+    return p;
+}
+
+static int register_my_resource(resource_entry_t *list,
+				u_long base, u_long num, char *name)
+{
+    resource_entry_t *p, *entry;
+
+    entry = (resource_entry_t *)kmalloc(sizeof(resource_entry_t), GFP_ATOMIC);
+    if (!entry) return -ENOMEM;
+    entry->base = base;
+    entry->num = num;
+    entry->name = name;
+
+    p = find_gap(list, entry);
+    if (p == NULL) {
+	kfree(entry);
+	return -EBUSY;
+    }
+    entry->next = p->next;
+    p->next = entry;
+    return 0;
+}
+
+static void release_my_resource(resource_entry_t *list,
+				u_long base, u_long num)
+{
+    resource_entry_t *p, *q;
+
+    for (p = list; ; p = q) {
+	q = p->next;
+	if (q == NULL) break;
+	if ((q->base == base) && (q->num == num)) {
+	    p->next = q->next;
+	    kfree(q);
+	    return;
+	}
+    }
+    return;
+}
+
+static int check_my_resource(resource_entry_t *list,
+			     u_long base, u_long num)
+{
+    if (register_my_resource(list, base, num, NULL) != 0)
+	return -EBUSY;
+    release_my_resource(list, base, num);
+    return 0;
+}
+
+int lists_check_region(int io, u_long base, u_long num)
+{
+    return check_my_resource(LIST(io), base, num);
+}
+
+void lists_request_region(int io, u_long base, u_long num)
+{
+    register_my_resource(LIST(io), base, num, NULL);
+}
+
+void lists_release_region(int io, u_long base, u_long num)
+{
+    release_my_resource(LIST(io), base, num);
+}
+
+/*====================================================================*/
+
+static int add_interval(resource_map_t *map, u_long base, u_long num)
+{
+    resource_map_t *p, *q;
+
+    for (p = map; ; p = p->next) {
+	if ((p != map) && (p->base+p->num-1 >= base))
+	    return -1;
+	if ((p->next == map) || (p->next->base > base+num-1))
+	    break;
+    }
+    q = (resource_map_t *)kmalloc(sizeof(resource_map_t), GFP_KERNEL);
+    if (!q) return CS_OUT_OF_RESOURCE;
+    q->base = base; q->num = num;
+    q->next = p->next; p->next = q;
+    return CS_SUCCESS;
+}
+
+static int sub_interval(resource_map_t *map, u_long base, u_long num)
+{
+    resource_map_t *p, *q;
+
+    for (p = map; ; p = q) {
+	q = p->next;
+	if (q == map)
+	    break;
+	if ((q->base+q->num > base) && (base+num > q->base)) {
+	    if (q->base >= base) {
+		if (q->base+q->num <= base+num) {
+		    /* Delete whole block */
+		    p->next = q->next;
+		    kfree(q);
+		    /* don't advance the pointer yet */
+		    q = p;
+		} else {
+		    /* Cut off bit from the front */
+		    q->num = q->base + q->num - base - num;
+		    q->base = base + num;
+		}
+	    } else if (q->base+q->num <= base+num) {
+		/* Cut off bit from the end */
+		q->num = base - q->base;
+	    } else {
+		/* Split the block into two pieces */
+		p = (resource_map_t *)kmalloc(sizeof(resource_map_t), GFP_KERNEL);
+		if (!p) return CS_OUT_OF_RESOURCE;
+		p->base = base+num;
+		p->num = q->base+q->num - p->base;
+		q->num = base - q->base;
+		p->next = q->next ; q->next = p;
+	    }
+	}
+    }
+    return CS_SUCCESS;
+}
+
+// adjust_memory and adjust_io, the checks of their arguments included
+int lists_adjust(int io, int action, u_long base, u_long num)
+{
+    if (io) {
+	if (base > 0xffff)
+	    return CS_BAD_BASE;
+	if ((num <= 0) || (base+num > 0x10000) || (base+num <= base))
+	    return CS_BAD_SIZE;
+	if (action == ADD_MANAGED_RESOURCE) {
+	    if (add_interval(&io_db, base, num) != 0)
+		return CS_IN_USE;
+	} else
+	    sub_interval(&io_db, base, num);
+	return CS_SUCCESS;
+    }
+
+    if ((num == 0) || (base+num-1 < base))
+	return CS_BAD_SIZE;
+    if (action == ADD_MANAGED_RESOURCE)
+	return add_interval(&mem_db, base, num);
+    return sub_interval(&mem_db, base, num);
+}
+
+/*====================================================================*/
+
+int lists_find_io_region(ioaddr_t *base, ioaddr_t num, ioaddr_t align)
+{
+    ioaddr_t _try;
+    resource_map_t *m;
+
+    for (m = io_db.next; m != &io_db; m = m->next) {
+	_try = (m->base & ~(align-1)) + *base;
+	for (_try = (_try >= m->base) ? _try : _try+align;
+	     (_try >= m->base) && (_try+num <= m->base+m->num);
+	     _try += align) {
+	    if (check_my_resource(&io_list, _try, num) == 0) {
+		*base = _try;
+		register_my_resource(&io_list, _try, num, NULL);
+		return 0;
+	    }
+	    if (!align) break;
+	}
+    }
+    return -1;
+}
+
+int lists_find_mem_region(u_long *base, u_long num, u_long align, int force_low)
+{
+    u_long _try;
+    resource_map_t *m;
+
+    while (1) {
+	for (m = mem_db.next; m != &mem_db; m = m->next) {
+	    /* first pass >1MB, second pass <1MB */
+	    if ((force_low != 0) ^ (m->base < 0x100000)) continue;
+	    _try = (m->base & ~(align-1)) + *base;
+	    for (_try = (_try >= m->base) ? _try : _try+align;
+		 (_try >= m->base) && (_try+num <= m->base+m->num);
+		 _try += align) {
+		if (check_my_resource(&mem_list, _try, num) == 0) {
+		    register_my_resource(&mem_list, _try, num, NULL);
+		    *base = _try;
+		    return 0;
+		}
+		if (!align) break;
+	    }
+	}
+	if (force_low) break;
+	force_low++;
+    }
+    return -1;
+}
+
+// Every aligned start in every free interval, kept if nothing is
+// allocated in its way, scored by the hole around it
+int lists_best_fit(int io, u_long *base, u_long num, u_long align, int low)
+{
+    resource_map_t *m, *db = DB(io);
+    resource_entry_t *e;
+    u_long _try, start, stop, best = 0, best_hole = 0;
+    int found = 0;
+
+    for (m = db->next; m != db; m = m->next) {
+	if ((low >= 0) && ((low != 0) ^ (m->base < 0x100000))) continue;
+	_try = (m->base & ~(align-1)) + *base;
+	for (_try = (_try >= m->base) ? _try : _try+align;
+	     (_try >= m->base) && (_try+num <= m->base+m->num);
+	     _try += align) {
+	    if (check_my_resource(LIST(io), _try, num) == 0) {
+		start = m->base;
+		stop = m->base+m->num-1;
+		for (e = LIST(io)->next; e; e = e->next) {
+		    if ((e->base+e->num-1 < _try) && (e->base+e->num > start))
+			start = e->base+e->num;
+		    if ((e->base > _try) && (e->base-1 < stop))
+			stop = e->base-1;
+		}
+		if (!found || (stop-start+1 < best_hole)) {
+		    best = _try;
+		    best_hole = stop-start+1;
+		    found = 1;
+		}
+	    }
+	    if (!align) break;
+	}
+    }
+    if (!found)
+	return -1;
+    *base = best;
+    return 0;
+}
+
+/*====================================================================*/
+
+int lists_free(int io, u_long *base, u_long *num, int max)
+{
+    resource_map_t *m, *db = DB(io);
+    int n = 0;
+
+    for (m = db->next; m != db; m = m->next, n++)
+	if (n < max) {
+	    base[n] = m->base;
+	    num[n] = m->num;
+	}
+    return n;
+}
+
+int lists_blocks(int io, u_long *base, u_long *num, int max)
+{
+    resource_entry_t *e;
+    int n = 0;
+
+    for (e = LIST(io)->next; e; e = e->next, n++)
+	if (n < max) {
+	    base[n] = e->base;
+	    num[n] = e->num;
+	}
+    return n;
+}
+
+void lists_release_resource_db(void)
+{
+    resource_map_t *p, *q;
+    resource_entry_t *u, *v;
+
+    for (p = mem_db.next; p != &mem_db; p = q) {
+	q = p->next;
+	kfree(p);
+    }
+    mem_db.next = &mem_db;
+    for (p = io_db.next; p != &io_db; p = q) {
+	q = p->next;
+	kfree(p);
+    }
+    io_db.next = &io_db;
+    for (u = io_list.next; u; u = v) {
+	v = u->next;
+	kfree(u);
+    }
+    io_list.next = NULL;
+    for (u = mem_list.next; u; u = v) {
+	v = u->next;
+	kfree(u);
+    }
+    mem_list.next = NULL;
+}
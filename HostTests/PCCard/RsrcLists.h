@@ -0,0 +1,36 @@
+#ifndef _RSRC_LISTS_H
+#define _RSRC_LISTS_H
+
+#include <IOKit/pccard/config.h>
+#include <IOKit/pccard/k_compat.h>
+#include <IOKit/pccard/cs_types.h>
+
+// rsrc_mgr's databases as they were before the sorted arrays: the free
+// intervals and the allocated blocks in kmalloc'd linked lists, walked
+// from the head (RsrcLists.cpp). rsrcbench runs them next to the arrays
+// as the reference, and as the baseline for the timings.
+//
+// The calls are the database's own, with what rsrc_mgr wraps around them
+// (adjust_resource_info, the probes, the locking) left out.
+
+int lists_adjust(int io, int action, u_long base, u_long num);
+
+int lists_find_io_region(ioaddr_t *base, ioaddr_t num, ioaddr_t align);
+int lists_find_mem_region(u_long *base, u_long num, u_long align, int force_low);
+
+// Best fit on the lists, walked the slow way: the smallest hole between
+// the allocated blocks in the free intervals that holds an aligned range
+int lists_best_fit(int io, u_long *base, u_long num, u_long align, int low);
+
+int lists_check_region(int io, u_long base, u_long num);
+void lists_request_region(int io, u_long base, u_long num);
+void lists_release_region(int io, u_long base, u_long num);
+
+// What is in a list, in order: the free intervals or the allocated
+// blocks, at most max of them; returns how many there are
+int lists_free(int io, u_long *base, u_long *num, int max);
+int lists_blocks(int io, u_long *base, u_long *num, int max);
+
+void lists_release_resource_db(void);
+
+#endif
@@ -0,0 +1,232 @@
+#include "TREXModel.h"
+#include "TREXPseudoPCIBridge.h"
+
+#include <IOKit/pccard/config.h>
+#include <IOKit/pccard/k_compat.h>
+#include <IOKit/pccard/cs_types.h>
+#include <IOKit/pccard/ss.h>
+#include <IOKit/pccard/cs.h>
+
+// The bandwidth of the TREX memory windows as trex_set_mem_map times
+// them. A memory card goes in, Card Services reads its CIS through map 0
+// (attribute memory, at cis_speed) and gives its client windows at the
+// speeds of the card's DEVICE tuple, and the client moves data through
+// them 16 bits at a time. Some cards have their CIS read again while the
+// data moves, as a client asking for a tuple would.
+//
+//	trexbench [--check] [--access ns] [--kbytes n] [--verbose]
+//
+// For each card the report gives the rMemTiming the data moved at, the
+// window bandwidth (data accesses only), what the slowest window's own
+// speed allows and what the CIS speed would allow, the effective
+// bandwidth (everything the run took, the CIS and the rMemTiming writes
+// included), and how often rMemTiming was written. Bandwidths are in
+// modelled time, KB/s.
+//
+// --check fails unless the data moves at exactly the slowest window's
+// speed, the CIS is read at cis_speed, and every access is made to the
+// space rCfg0 selects.
+
+enum {
+	kCISSpeed = 300,			// cs.c's cis_speed
+	kCISBytes = 256,			// what validating a CIS typically reads
+	kWindowSize = 0x10000,
+	kBurstBytes = 4096,			// a client's transfer
+	kMaxWindows = 4				// maps 1-4
+};
+
+struct Card {
+	const char *name;
+	int windows;
+	UInt16 speed[kMaxWindows];		// ns, from the DEVICE tuple
+	UInt32 cisEvery;			// CIS read again every so many bytes, 0 = never
+};
+
+static const Card gCards[] = {
+	{ "sram-100",		1, { 100 },		0 },
+	{ "flash-150",		2, { 150, 150 },	0 },
+	{ "flash-200",		1, { 200 },		0 },
+	{ "ata-250",		1, { 250 },		0 },
+	{ "mixed-100-250",	2, { 100, 250 },	0 },
+	{ "sram-100-tuples",	1, { 100 },		16 * 1024 },
+	{ "ata-250-tuples",	1, { 250 },		16 * 1024 }
+};
+
+enum { kCards = sizeof(gCards) / sizeof(gCards[0]) };
+
+static TREXModel *gModel;
+
+static int gSocket = 0;
+static UInt32 gFailures;
+
+// Cycles as trex_set_mem_map counts them for a speed
+static UInt32 cyclesFor(UInt32 speed)
+{
+	UInt32 cycles = (speed + kTREXModelCycleNanoseconds - 1) / kTREXModelCycleNanoseconds;
+
+	return cycles ? cycles : 1;
+}
+
+static double kBytesPerSecond(UInt64 bytes, UInt64 nanoseconds)
+{
+	return nanoseconds ? (double) bytes * 1e9 / 1024.0 / (double) nanoseconds : 0.0;
+}
+
+static void setMemMap(int map, u_char flags, UInt16 speed, u_int cardStart)
+{
+	pccard_mem_map mem;
+
+	memset(&mem, 0, sizeof(mem));
+	mem.map = map;
+	mem.flags = flags;
+	mem.speed = speed;
+	mem.card_start = cardStart;
+	mem.sys_stop = kWindowSize - 1;
+	if (TREXModelHarness::service(gSocket, SS_SetMemMap, &mem) != 0)
+		panic("SS_SetMemMap failed for map %d", map);
+}
+
+// read_cis_mem: map 0 on attribute memory, the bytes, then the signal
+//  that tells socket services attribute memory is done with
+static void readCIS(UInt32 *wrongCycles)
+{
+	pccard_mem_map done;
+	int i;
+
+	setMemMap(0, MAP_ACTIVE | MAP_ATTRIB, kCISSpeed, 0);
+	if (gModel->memoryCycles(gSocket) != cyclesFor(kCISSpeed))
+		(*wrongCycles)++;
+	for (i = 0; i < kCISBytes; i++)
+		gModel->windowAccess(gSocket, true);
+
+	memset(&done, 0, sizeof(done));
+	done.map = (u_char) -1;
+	TREXModelHarness::service(gSocket, SS_SetMemMap, &done);
+}
+
+struct CardResult {
+	UInt32 cycles;				// rMemTiming while the data moved
+	UInt64 dataNanoseconds;
+	UInt64 totalNanoseconds;
+	UInt32 timingWrites;
+	UInt32 wrongCycles;
+	UInt32 wrongSpace;
+};
+
+static void run(const Card *card, UInt32 bytes, CardResult *result)
+{
+	socket_state_t state;
+	UInt32 moved, sinceCIS, slowest, cycles;
+	UInt64 start;
+	int w;
+
+	memset(result, 0, sizeof(*result));
+	TREXModelHarness::reset();
+
+	gModel->insert(gSocket);
+	TREXModelHarness::interrupt();
+
+	start = hostNow();
+
+	// Card Services resets and powers the socket, then reads the CIS
+	memset(&state, 0, sizeof(state));
+	state.Vcc = 50;
+	state.flags = SS_OUTPUT_ENA | SS_RESET;
+	TREXModelHarness::service(gSocket, SS_SetSocket, &state);
+	state.flags = SS_OUTPUT_ENA;
+	TREXModelHarness::service(gSocket, SS_SetSocket, &state);
+	readCIS(&result->wrongCycles);
+
+	// The client's windows, at the speeds request_window gives them
+	for (w = 0, slowest = 0; w < card->windows; w++) {
+		setMemMap(w + 1, MAP_ACTIVE | MAP_16BIT, card->speed[w], w * kWindowSize);
+		slowest = max(slowest, (UInt32) card->speed[w]);
+	}
+
+	for (moved = 0, sinceCIS = 0; moved < bytes; ) {
+		UInt32 burst;
+
+		if (card->cisEvery && (sinceCIS >= card->cisEvery)) {
+			readCIS(&result->wrongCycles);
+			sinceCIS = 0;
+		}
+
+		cycles = gModel->memoryCycles(gSocket);
+		if (cycles != cyclesFor(slowest))
+			result->wrongCycles++;
+		result->cycles = cycles;
+
+		for (burst = 0; burst < kBurstBytes; burst += 2)
+			result->dataNanoseconds += gModel->windowAccess(gSocket, false);
+		moved += kBurstBytes;
+		sinceCIS += kBurstBytes;
+	}
+
+	result->totalNanoseconds = hostNow() - start;
+	result->timingWrites = gModel->counters.memTimingWrites;
+	result->wrongSpace = gModel->counters.wrongSpaceAccesses;
+
+	gModel->remove(gSocket);
+	TREXModelHarness::interrupt();
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: trexbench [--check] [--access ns] [--kbytes n] [--verbose]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	UInt32 accessNanoseconds = 240, kbytes = 1024;
+	bool check = false;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (strcmp(arg, "--check") == 0) check = true;
+		else if (strcmp(arg, "--verbose") == 0) hostVerbose = 1;
+		else if ((strcmp(arg, "--access") == 0) && (i + 1 < argc)) accessNanoseconds = strtoul(argv[++i], 0, 0);
+		else if ((strcmp(arg, "--kbytes") == 0) && (i + 1 < argc)) kbytes = strtoul(argv[++i], 0, 0);
+		else usage();
+	}
+
+	if (kbytes == 0)
+		usage();
+
+	gModel = new TREXModel(accessNanoseconds);
+	TREXModelHarness::start(gModel);
+
+	printf("TREX access %u ns, %u ns cycles, CIS at %u ns, %u KB a card\n",
+	       accessNanoseconds, kTREXModelCycleNanoseconds, kCISSpeed, kbytes);
+	printf("%-16s %6s %9s %9s %9s %9s %7s %5s\n",
+	       "card", "cycles", "window", "card", "at-cis", "effective", "timing", "fail");
+
+	for (i = 0; i < kCards; i++) {
+		const Card *card = &gCards[i];
+		CardResult result;
+		UInt32 slowest, w, failures;
+		UInt64 bytes = (UInt64) kbytes * 1024;
+
+		run(card, kbytes * 1024, &result);
+
+		for (w = 0, slowest = 0; w < (UInt32) card->windows; w++)
+			slowest = max(slowest, (UInt32) card->speed[w]);
+
+		failures = result.wrongCycles + result.wrongSpace;
+		gFailures += failures;
+
+		printf("%-16s %6u %9.0f %9.0f %9.0f %9.0f %7u %5u\n", card->name, result.cycles,
+		       kBytesPerSecond(bytes, result.dataNanoseconds),
+		       kBytesPerSecond(2, accessNanoseconds + cyclesFor(slowest) * kTREXModelCycleNanoseconds),
+		       kBytesPerSecond(2, accessNanoseconds + cyclesFor(kCISSpeed) * kTREXModelCycleNanoseconds),
+		       kBytesPerSecond(bytes, result.totalNanoseconds),
+		       result.timingWrites, failures);
+	}
+
+	if (check)
+		printf("%s\n", gFailures ? "FAIL" : "PASS");
+
+	return (check && gFailures) ? 1 : 0;
+}
@@ -0,0 +1,240 @@
+#include "TREXModel.h"
+#include "TREXPseudoPCIBridge.h"
+
+#include <IOKit/pccard/config.h>
+#include <IOKit/pccard/k_compat.h>
+#include <IOKit/pccard/cs_types.h>
+#include <IOKit/pccard/ss.h>
+#include <IOKit/pccard/cs.h>
+
+#include "trexss.h"
+
+TREXHarnessSocket TREXModelHarness::sockets[kTREXModelSockets];
+TREXPseudoPCIBridge *TREXModelHarness::bridge;
+IOInterruptController *TREXModelHarness::controller;
+HostInterruptNub *TREXModelHarness::platformNub;
+
+static TREXModel *gModel;
+static int (*gService)(u_int, u_int, void *);
+
+// What trex socket services calls:
+// --------------------------------
+
+extern "C" int IOPCCardAddCSCInterruptHandlers(IOPCCardBridge *bus, unsigned int socket, unsigned int irq,
+					       u_int (*top_handler)(u_int), u_int (*bottom_handler)(u_int),
+					       u_int (*enable_functional)(u_int), u_int (*disable_functional)(u_int),
+					       const char *name)
+{
+	if (socket >= kTREXModelSockets)
+		return 1;
+
+	TREXModelHarness::sockets[socket].top = top_handler;
+	TREXModelHarness::sockets[socket].bottom = bottom_handler;
+	return 0;
+}
+
+extern "C" int register_ss_entry(int ssock, int esock, ss_entry_t entry)
+{
+	gService = (int (*)(u_int, u_int, void *)) entry;
+	return 0;
+}
+
+// Card Services' callback
+static void cardServicesHandler(void *info, u_int events)
+{
+	((TREXHarnessSocket *) info)->csc |= events;
+}
+
+// IOPCCardBridge's controller on the status change vector, at interrupt time
+static void cscVector(void *target, void *refCon, void *nub, int source)
+{
+	TREXHarnessSocket *s = (TREXHarnessSocket *) target;
+	TREXModelPhase phase = gModel->phase;
+
+	gModel->phase = kTREXPhaseBottom;
+	if (s->bottom(s->index))
+		s->topPending = true;
+	gModel->phase = phase;
+}
+
+// A card driver on the card IRQ vector
+static void irqVector(void *target, void *refCon, void *nub, int source)
+{
+	((TREXHarnessSocket *) target)->irqCalls++;
+}
+
+// Setting up, as the machine does it:
+// ------------------------------------
+
+struct WindowMem {
+	unsigned long addr;
+	unsigned long len;
+};
+
+void TREXModelHarness::start(TREXModel *model)
+{
+	OSArray *memory;
+	IODeviceMemory *registers;
+	WindowMem windows = { kWindowBase, kWindowLength };
+	OSData *windowMem;
+	char name[50];
+	int i;
+
+	gModel = model;
+
+	// The device tree nub of TREX, with its registers and windows
+	platformNub = new HostInterruptNub;
+	platformNub->init();
+	memory = OSArray::withCapacity(1);
+	registers = IODeviceMemory::withRange(TREXModel::kBase, kTREXModelSockets * sockOffStep);
+	memory->setObject(registers);
+	registers->release();
+	platformNub->setDeviceMemory(memory);
+	memory->release();
+	windowMem = OSData::withBytes(&windows, sizeof(windows));
+	platformNub->setProperty("window-mem", windowMem);
+	windowMem->release();
+
+	bridge = new TREXPseudoPCIBridge;
+	bridge->init();
+	bridge->attach(platformNub);
+	if (!bridge->start(platformNub))
+		panic("TREXPseudoPCIBridge::start failed");
+
+	snprintf(name, sizeof(name), "TREXInterruptController%08x", (unsigned int) TREXModel::kBase);
+	controller = getPlatform()->lookUpInterruptController(name);
+	if (controller == 0)
+		panic("no %s", name);
+
+	for (i = 0; i < kTREXModelSockets; i++) {
+		TREXHarnessSocket *s = &sockets[i];
+		OSArray *specifiers;
+		OSData *specifier;
+		ss_callback_t callback;
+
+		s->index = i;
+
+		// The socket's PCI nub, as IOPCIBridge would make it
+		s->nub = new IOPCIDevice;
+		s->nub->init();
+		s->nub->space.bits = 0;
+		s->nub->space.s.deviceNum = 0x0F;
+		s->nub->space.s.functionNum = i;
+		s->nub->attach(bridge);
+		if (bridge->getNubResources(s->nub) != kIOReturnSuccess)
+			panic("getNubResources failed for socket %d", i);
+
+		// Its vectors are the ones the harness uses
+		specifiers = OSDynamicCast(OSArray, s->nub->getProperty(gIOInterruptSpecifiersKey));
+		if ((specifiers == 0) || (specifiers->getCount() != 2))
+			panic("socket %d has no interrupt specifiers", i);
+		specifier = OSDynamicCast(OSData, specifiers->getObject(0));
+		if (*(long *) specifier->getBytesNoCopy() != 2 * i)
+			panic("socket %d: status change vector is not %d", i, 2 * i);
+		specifier = OSDynamicCast(OSData, specifiers->getObject(1));
+		if (*(long *) specifier->getBytesNoCopy() != 2 * i + 1)
+			panic("socket %d: card IRQ vector is not %d", i, 2 * i + 1);
+
+		// What TREXPCCard16Bridge::initializeSocketServices does
+		if (s->nub->callPlatformFunction(kTREXGetSocketEvents, false, (void *) (uintptr_t) i,
+						 (void *) &s->events, 0, 0) != kIOReturnSuccess)
+			panic("no socket events for socket %d", i);
+		if (init_trex((IOPCCardBridge *) s, s->nub, (void *) (uintptr_t) (TREXModel::kBase + i * sockOffStep),
+			      (void *) (uintptr_t) (windows.addr + i * woSocketStep), s->events) != 0)
+			panic("init_trex failed for socket %d", i);
+
+		// Card Services registers
+		callback.handler = cardServicesHandler;
+		callback.info = s;
+		gService(i, SS_RegisterCallback, &callback);
+
+		// and IOPCCardBridge puts its controller on the status change vector
+		if ((controller->registerInterrupt(s->nub, 2 * i, s, cscVector, 0) != kIOReturnSuccess) ||
+		    (controller->enableInterrupt(s->nub, 2 * i) != kIOReturnSuccess))
+			panic("could not register the status change vector of socket %d", i);
+	}
+}
+
+void TREXModelHarness::reset()
+{
+	socket_state_t state;
+	pccard_mem_map mem;
+	int i, map;
+
+	gModel->unplug();
+
+	for (i = 0; i < kTREXModelSockets; i++) {
+		TREXHarnessSocket *s = &sockets[i];
+
+		if (s->driver) {
+			controller->unregisterInterrupt(s->nub, 2 * i + 1);
+			s->driver = false;
+		}
+		s->events->cscEvents = 0;
+		s->topPending = false;
+		s->caused = 0;
+		s->csc = 0;
+		s->irqCalls = 0;
+
+		memset(&state, 0, sizeof(state));
+		gService(i, SS_SetSocket, &state);
+
+		// and no memory windows
+		for (map = 0; map < 5; map++) {
+			memset(&mem, 0, sizeof(mem));
+			mem.map = map;
+			gService(i, SS_SetMemMap, &mem);
+		}
+	}
+
+	platformNub->sources[0].caused = 0;
+	gModel->resetCounters();
+}
+
+// The controller's SpuriousInterrupts, from the registry
+UInt32 TREXModelHarness::spuriousInterrupts()
+{
+	OSSerialize *s = OSSerialize::withCapacity(256);
+	const char *text = hostSerializeProperty(bridge, "InterruptStatistics", s);
+	const char *count = text ? strstr(text, "\"SpuriousInterrupts\"=") : 0;
+	UInt32 value = count ? strtoul(count + strlen("\"SpuriousInterrupts\"="), 0, 10) : ~0U;
+
+	s->release();
+	return value;
+}
+
+int TREXModelHarness::service(unsigned int socket, unsigned int cmd, void *arg)
+{
+	return gService(socket, cmd, arg);
+}
+
+bool TREXModelHarness::addDriver(int socket)
+{
+	TREXHarnessSocket *s = &sockets[socket];
+
+	if (s->driver)
+		return true;
+	if ((controller->registerInterrupt(s->nub, 2 * socket + 1, s, irqVector, 0) != kIOReturnSuccess) ||
+	    (controller->enableInterrupt(s->nub, 2 * socket + 1) != kIOReturnSuccess))
+		return false;
+	s->driver = true;
+	return true;
+}
+
+void TREXModelHarness::interrupt()
+{
+	int i;
+
+	// at interrupt time
+	gModel->phase = kTREXPhaseController;
+	platformNub->deliver(0);
+
+	// on the workloop
+	gModel->phase = kTREXPhaseTop;
+	for (i = 0; i < kTREXModelSockets; i++)
+		if (sockets[i].topPending) {
+			sockets[i].topPending = false;
+			sockets[i].top(i);
+		}
+	gModel->phase = kTREXPhaseSetup;
+}
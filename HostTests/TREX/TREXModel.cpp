@@ -0,0 +1,194 @@
+#include "TREXModel.h"
+
+// The TREX_REG_MODEL hooks go to the one model there is
+
+static TREXModel *gModel = 0;
+
+extern "C" UInt8 TREXModelRead(volatile UInt8 *reg)
+{
+	if (gModel == 0)
+		panic("TREX register read without a model");
+	return gModel->read(reg);
+}
+
+extern "C" void TREXModelWrite(volatile UInt8 *reg, UInt8 value)
+{
+	if (gModel == 0)
+		panic("TREX register write without a model");
+	gModel->write(reg, value);
+}
+
+TREXModel::TREXModel(UInt32 newAccessNanoseconds)
+{
+	if (gModel != 0)
+		panic("only one TREX model at a time");
+	gModel = this;
+
+	accessNanoseconds = newAccessNanoseconds;
+	reset();
+}
+
+TREXModel::~TREXModel()
+{
+	gModel = 0;
+}
+
+void TREXModel::reset()
+{
+	int socket;
+
+	memset(regs, 0, sizeof(regs));
+	memset(card, 0, sizeof(card));
+	for (socket = 0; socket < kTREXModelSockets; socket++)
+		setPins(socket);
+
+	phase = kTREXPhaseSetup;
+	resetCounters();
+}
+
+void TREXModel::unplug()
+{
+	int socket;
+
+	for (socket = 0; socket < kTREXModelSockets; socket++) {
+		card[socket] = false;
+		setPins(socket);
+		regs[socket][rEvents] = 0;
+	}
+
+	phase = kTREXPhaseSetup;
+	resetCounters();
+}
+
+bool TREXModel::decode(volatile UInt8 *reg, int *socket, int *which)
+{
+	uintptr_t offset = (uintptr_t) reg - kBase;
+
+	if (offset >= kTREXModelSockets * kTREXModelRegisters) {
+		counters.strayAccesses++;
+		return false;
+	}
+
+	*socket = offset / kTREXModelRegisters;
+	*which = offset % kTREXModelRegisters;
+	return true;
+}
+
+// Card detects and battery lines are low active, RDY/BSY says ready
+void TREXModel::setPins(int socket)
+{
+	if (card[socket])
+		regs[socket][rInputs] = mRDYBSY | mBVD2 | mBVD1;
+	else
+		regs[socket][rInputs] = mCDa | mCDb | mBVD2 | mBVD1;
+}
+
+bool TREXModel::interruptLine()
+{
+	int socket;
+
+	for (socket = 0; socket < kTREXModelSockets; socket++)
+		if (regs[socket][rEvents] & regs[socket][rIntEnable])
+			return true;
+
+	return false;
+}
+
+UInt8 TREXModel::read(volatile UInt8 *reg)
+{
+	int socket, which;
+	UInt8 *r;
+
+	hostAdvance(accessNanoseconds);
+	counters.reads[phase]++;
+	if (!decode(reg, &socket, &which))
+		return 0xFF;
+
+	r = regs[socket];
+	switch (which) {
+		case rIntFlag:
+			return (r[rEvents] & r[rIntEnable]) ? mIntFlag : 0;
+
+		case rEvents:
+			if ((r[rCfg0] & mSetForIO) && (r[rCfg0] & mAttr))
+				counters.attrEventReads++;
+			return r[rEvents];
+
+		default:
+			return r[which];
+	}
+}
+
+void TREXModel::write(volatile UInt8 *reg, UInt8 value)
+{
+	int socket, which;
+	UInt8 *r;
+
+	hostAdvance(accessNanoseconds);
+	counters.writes[phase]++;
+	if (!decode(reg, &socket, &which))
+		return;
+
+	r = regs[socket];
+	switch (which) {
+		case rIntFlag:
+		case rInputs:
+			break;
+
+		case rEvents:
+			r[rEvents] &= value;
+			break;
+
+		case rReset:
+			if (card[socket])
+				r[rEvents] |= mCD;
+			break;
+
+		case rMemTiming:
+			counters.memTimingWrites++;
+			r[rMemTiming] = value;
+			break;
+
+		default:
+			r[which] = value;
+			break;
+	}
+}
+
+void TREXModel::insert(int socket)
+{
+	card[socket] = true;
+	setPins(socket);
+	regs[socket][rEvents] |= mCD;
+}
+
+void TREXModel::remove(int socket)
+{
+	card[socket] = false;
+	setPins(socket);
+	regs[socket][rEvents] |= mCD;
+}
+
+void TREXModel::raise(int socket, UInt8 events)
+{
+	regs[socket][rEvents] |= events;
+}
+
+// 0 is the longest timing there is
+UInt32 TREXModel::memoryCycles(int socket)
+{
+	UInt32 cycles = regs[socket][rMemTiming] & mMemSpeedMask;
+
+	return cycles ? cycles : mMemSpeedMask + 1;
+}
+
+UInt32 TREXModel::windowAccess(int socket, bool attribute)
+{
+	UInt32 nanoseconds = accessNanoseconds + memoryCycles(socket) * kTREXModelCycleNanoseconds;
+
+	hostAdvance(nanoseconds);
+	counters.windowAccesses++;
+	if (attribute != ((regs[socket][rCfg0] & mAttr) != 0))
+		counters.wrongSpaceAccesses++;
+	return nanoseconds;
+}
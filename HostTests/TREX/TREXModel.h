@@ -0,0 +1,159 @@
+#ifndef _TREX_MODEL_H
+#define _TREX_MODEL_H
+
+#include "HostKernel.h"
+#include "TREXRegisters.h"
+
+// A model of the TREX socket registers, for TREXInterruptController and
+// trex socket services built with TREX_REG_MODEL.
+//
+// Per socket: rCfg0, rCfg1, rIntEnable and the timing registers hold
+// what is written; rInputs is the card's pins (card detect and battery
+// lines low active); rEvents latches the changes of the pins and the
+// card's I/O IRQ, and a write clears the bits written as 0; rIntFlag
+// says that an enabled event is latched. A write to rReset latches a
+// card detect event if a card is in, as the driver expects.
+//
+// The model checks what the driver must not do: read rEvents of a socket
+// on the I/O interface with attribute memory switched on, which is what
+// TREXInterruptController switches it off around.
+//
+// Every access costs accessNanoseconds of virtual time and is counted in
+// the current phase, so a harness can tell who touched the chip.
+//
+// An access through a socket's memory window takes what rMemTiming says,
+// in the 40 ns cycles socket services counts in, on top of that. It is
+// counted as wrong if it is meant for the other space than rCfg0's mAttr
+// selects.
+
+enum {
+	kTREXModelSockets = kNumSockets,
+	kTREXModelRegisters = sockOffStep,
+	kTREXModelCycleNanoseconds = 40		// trex_cycle_time
+};
+
+enum TREXModelPhase {
+	kTREXPhaseSetup,		// socket services and drivers outside interrupts
+	kTREXPhaseController,		// TREXInterruptController::handleInterrupt
+	kTREXPhaseBottom,		// trex_interrupt_bottom, at interrupt time
+	kTREXPhaseTop,			// trex_interrupt_top, on the workloop
+	kTREXPhases
+};
+
+struct TREXModelCounters {
+	UInt32 reads[kTREXPhases];
+	UInt32 writes[kTREXPhases];
+	UInt32 attrEventReads;		// rEvents read with attribute memory on, in I/O mode
+	UInt32 strayAccesses;		// outside the sockets' registers
+	UInt32 memTimingWrites;		// rMemTiming
+	UInt32 windowAccesses;
+	UInt32 wrongSpaceAccesses;	// window accesses to the space not selected
+};
+
+class TREXModel {
+public:
+	// Where the harness says the registers are, as the device tree would
+	enum { kBase = 0x50F1C000 };
+
+	TREXModel(UInt32 accessNanoseconds);
+	~TREXModel();
+
+	UInt8 read(volatile UInt8 *reg);
+	void write(volatile UInt8 *reg, UInt8 value);
+
+	// Power-on state, no cards
+	void reset();
+
+	// No cards and nothing latched, but what the driver set stays set, as
+	// it would on the chip: its copy of the timing must still be right
+	void unplug();
+
+	// What the card does
+	void insert(int socket);
+	void remove(int socket);
+	void raise(int socket, UInt8 events);	// latches them, as a pin change would
+
+	// One access through the socket's memory window, returns its nanoseconds
+	UInt32 windowAccess(int socket, bool attribute);
+	UInt32 memoryCycles(int socket);	// what rMemTiming says
+
+	bool cardPresent(int socket) { return card[socket]; }
+	UInt8 latched(int socket) { return regs[socket][rEvents]; }
+	UInt8 enabled(int socket) { return regs[socket][rIntEnable]; }
+	UInt8 cfg0(int socket) { return regs[socket][rCfg0]; }
+	bool interruptLine();
+	UInt32 accessTime() { return accessNanoseconds; }
+
+	TREXModelPhase phase;
+	TREXModelCounters counters;
+
+	void resetCounters() { memset(&counters, 0, sizeof(counters)); }
+
+private:
+	UInt8 regs[kTREXModelSockets][kTREXModelRegisters];
+	bool card[kTREXModelSockets];
+	UInt32 accessNanoseconds;
+
+	bool decode(volatile UInt8 *reg, int *socket, int *which);
+	void setPins(int socket);
+};
+
+// The bridge with its interrupt controller, and trex socket services, on
+// the model, set up as the machine does it (TREXHarness.cpp). The harness
+// stands in for the rest: IOPCCardBridge's controller on each socket's
+// status change vector (it calls trex_interrupt_bottom at interrupt time
+// and trex_interrupt_top on the workloop when that says so), Card
+// Services' callback, and a card driver on the card IRQ vector.
+
+class IOPCIDevice;
+class IOInterruptController;
+class HostInterruptNub;
+class TREXPseudoPCIBridge;
+
+struct TREXHarnessSocket {
+	int index;
+	IOPCIDevice *nub;			// the socket's PCI nub
+	TREXSocketEvents *events;		// what the controller latched for it
+
+	// from IOPCCardAddCSCInterruptHandlers
+	unsigned int (*top)(unsigned int);
+	unsigned int (*bottom)(unsigned int);
+
+	bool topPending;			// the workloop has to run
+	bool driver;				// the card IRQ vector is registered
+	UInt32 caused;				// causeInterrupt on the card IRQ vector
+
+	// since the last interrupt
+	unsigned int csc;			// what Card Services got
+	UInt32 irqCalls;			// card IRQ handler calls
+};
+
+class TREXModelHarness {
+public:
+	// Where the sockets' memory windows are, as the device tree would say
+	enum { kWindowBase = 0x90000000, kWindowLength = 0x04000000 };
+
+	static void start(TREXModel *model);
+
+	// Empty sockets on the memory interface, nothing latched, no drivers
+	static void reset();
+
+	// Socket services' entry, as Card Services calls it
+	static int service(unsigned int socket, unsigned int cmd, void *arg);
+
+	// A card driver registers and enables the card IRQ vector
+	static bool addDriver(int socket);
+
+	// The TREX interrupt comes, then the workloop runs
+	static void interrupt();
+
+	// The controller's SpuriousInterrupts, from the registry
+	static UInt32 spuriousInterrupts();
+
+	static TREXHarnessSocket sockets[kTREXModelSockets];
+	static TREXPseudoPCIBridge *bridge;
+	static IOInterruptController *controller;
+	static HostInterruptNub *platformNub;
+};
+
+#endif
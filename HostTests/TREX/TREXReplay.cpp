@@ -0,0 +1,398 @@
+#include "TREXModel.h"
+#include "TREXPseudoPCIBridge.h"
+
+#include <IOKit/pccard/config.h>
+#include <IOKit/pccard/k_compat.h>
+#include <IOKit/pccard/cs_types.h>
+#include <IOKit/pccard/ss.h>
+#include <IOKit/pccard/cs.h>
+
+// Replays register traces through the TREX interrupt path as it runs on
+// the PowerBook: TREXPseudoPCIBridge and its TREXInterruptController, and
+// trex socket services, built with TREX_REG_MODEL against TREXModel, with
+// TREXModelHarness standing in for the rest.
+//
+//	trexreplay [--check] [--access ns] [--stats] [--verbose] trace...
+//
+// A trace is one command a line, # starts a comment:
+//
+//	insert S | remove S		a card goes in or out of socket S
+//	memcard S | iocard S		socket services puts the socket on the
+//					memory or the I/O interface, powered
+//	attr S on|off			attribute memory switched on or off, as
+//					while the CIS is read
+//	driver S			a card driver registers and enables the
+//					socket's card IRQ vector
+//	raise S EVENT...		the card latches events in rEvents: CD
+//					RDYBSY IRQ BVD STSCHG WP ACCESSERR INSERT
+//	cause S csc|irq			causeInterrupt on one of the socket's vectors
+//	interrupt			the TREX interrupt comes, then the workloop runs
+//	expect S csc SS_EVENT...|none	what Card Services got in that interrupt:
+//					DETECT READY BATDEAD BATWARN STSCHG
+//	expect S irq N			card IRQ handler calls in that interrupt
+//	expect S latched EVENT...|none	what is left in rEvents
+//	expect accesses N		register accesses of the controller in it
+//	expect spurious N		interrupts no socket asked for, in the trace
+//
+// Every interrupt is also checked for what must hold whatever the trace:
+// socket services does not touch the chip at interrupt time, no enabled
+// event is left latched, rCfg0 is as it was, rEvents is not read with
+// attribute memory on, and the card IRQ vector is called only for a
+// socket whose card asked, or when it was caused.
+//
+// --check fails if anything did not hold.
+
+enum { kSockets = kTREXModelSockets };
+
+static TREXModel *gModel;
+static TREXHarnessSocket *gSockets = TREXModelHarness::sockets;
+
+static const char *gTrace;
+static int gLine;
+static int gFailures;
+static UInt32 gSpuriousBase;
+
+static void fail(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static void fail(const char *format, ...)
+{
+	va_list args;
+
+	printf("  %s:%d: ", gTrace, gLine);
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+	gFailures++;
+}
+
+// The trace commands:
+// -------------------
+
+struct Name {
+	const char *name;
+	u_int value;
+};
+
+static const Name gEventNames[] = {
+	{ "CD", mCD }, { "RDYBSY", mRDYBSY }, { "IRQ", mIRQ }, { "BVD", mBVD },
+	{ "STSCHG", mSTSCHG }, { "WP", mWP }, { "ACCESSERR", mAccessErr }, { "INSERT", mInsert },
+	{ 0, 0 }
+};
+
+static const Name gSSNames[] = {
+	{ "DETECT", SS_DETECT }, { "READY", SS_READY }, { "BATDEAD", SS_BATDEAD },
+	{ "BATWARN", SS_BATWARN }, { "STSCHG", SS_STSCHG },
+	{ 0, 0 }
+};
+
+static bool parseNames(char **words, int count, const Name *names, u_int *value)
+{
+	int i, n;
+
+	*value = 0;
+	if ((count == 1) && (strcmp(words[0], "none") == 0))
+		return true;
+
+	for (i = 0; i < count; i++) {
+		for (n = 0; names[n].name != 0; n++)
+			if (strcmp(words[i], names[n].name) == 0)
+				break;
+		if (names[n].name == 0)
+			return false;
+		*value |= names[n].value;
+	}
+	return count > 0;
+}
+
+static void printNames(const Name *names, u_int value, char *text, size_t size)
+{
+	int n;
+
+	text[0] = 0;
+	for (n = 0; names[n].name != 0; n++)
+		if (value & names[n].value) {
+			if (text[0])
+				strncat(text, " ", size - strlen(text) - 1);
+			strncat(text, names[n].name, size - strlen(text) - 1);
+			value &= ~names[n].value;
+		}
+	if (text[0] == 0)
+		snprintf(text, size, "none");
+}
+
+struct TraceResult {
+	UInt32 interrupts;
+	UInt64 controllerAccesses;
+	UInt32 maxControllerAccesses;
+	UInt64 topAccesses;
+	UInt64 controllerNanoseconds;
+	UInt32 lastControllerAccesses;
+};
+
+static void interrupt(TraceResult *result)
+{
+	UInt8 cfg0[kSockets], asked[kSockets];
+	TREXModelCounters before = gModel->counters;
+	UInt64 start;
+	UInt32 accesses;
+	int i;
+
+	for (i = 0; i < kSockets; i++) {
+		TREXHarnessSocket *s = &gSockets[i];
+
+		cfg0[i] = gModel->cfg0(i);
+		asked[i] = (cfg0[i] & mSetForIO) && (gModel->latched(i) & gModel->enabled(i) & mIRQ);
+		s->csc = 0;
+		s->irqCalls = 0;
+	}
+
+	start = hostNow();
+	TREXModelHarness::interrupt();
+
+	accesses = (gModel->counters.reads[kTREXPhaseController] - before.reads[kTREXPhaseController]) +
+		   (gModel->counters.writes[kTREXPhaseController] - before.writes[kTREXPhaseController]);
+	result->controllerNanoseconds += (UInt64) accesses * gModel->accessTime();
+	result->interrupts++;
+	result->controllerAccesses += accesses;
+	result->lastControllerAccesses = accesses;
+	if (accesses > result->maxControllerAccesses)
+		result->maxControllerAccesses = accesses;
+	result->topAccesses += (gModel->counters.reads[kTREXPhaseTop] - before.reads[kTREXPhaseTop]) +
+			       (gModel->counters.writes[kTREXPhaseTop] - before.writes[kTREXPhaseTop]);
+
+	// What must hold whatever the trace
+	if ((gModel->counters.reads[kTREXPhaseBottom] != before.reads[kTREXPhaseBottom]) ||
+	    (gModel->counters.writes[kTREXPhaseBottom] != before.writes[kTREXPhaseBottom]))
+		fail("trex_interrupt_bottom touched the chip");
+	if (gModel->counters.attrEventReads != before.attrEventReads)
+		fail("rEvents read with attribute memory on");
+	if (gModel->counters.strayAccesses != before.strayAccesses)
+		fail("access outside the socket registers");
+
+	for (i = 0; i < kSockets; i++) {
+		TREXHarnessSocket *s = &gSockets[i];
+
+		if (gModel->latched(i) & gModel->enabled(i))
+			fail("socket %d: enabled events %02x still latched", i, gModel->latched(i) & gModel->enabled(i));
+		if (gModel->cfg0(i) != cfg0[i])
+			fail("socket %d: rCfg0 %02x, was %02x", i, gModel->cfg0(i), cfg0[i]);
+		if (s->events->cscEvents)
+			fail("socket %d: status changes %02x left for socket services", i, s->events->cscEvents);
+		if (s->irqCalls && !asked[i] && !s->caused)
+			fail("socket %d: card IRQ handler called, the card did not ask", i);
+		if (s->driver && asked[i] && !s->irqCalls)
+			fail("socket %d: the card asked, its IRQ handler was not called", i);
+		s->caused = 0;
+	}
+}
+
+static bool socketNumber(const char *word, int *socket)
+{
+	char *end;
+
+	*socket = word ? strtol(word, &end, 10) : -1;
+	return word && (*end == 0) && (*socket >= 0) && (*socket < kSockets);
+}
+
+static void setInterface(int i, bool io)
+{
+	socket_state_t state;
+
+	memset(&state, 0, sizeof(state));
+	state.flags = SS_OUTPUT_ENA | (io ? SS_IOCARD : 0);
+	state.Vcc = 50;
+	if (TREXModelHarness::service(i, SS_SetSocket, &state) != 0)
+		fail("SS_SetSocket failed");
+}
+
+static void command(char **words, int count, TraceResult *result)
+{
+	const char *verb = words[0];
+	int socket;
+	u_int value;
+	char text[80];
+
+	if (strcmp(verb, "interrupt") == 0) {
+		interrupt(result);
+		return;
+	}
+
+	if (strcmp(verb, "expect") == 0) {
+		if ((count == 3) && (strcmp(words[1], "accesses") == 0)) {
+			if (result->lastControllerAccesses != strtoul(words[2], 0, 10))
+				fail("%u controller accesses, expected %s", result->lastControllerAccesses, words[2]);
+			return;
+		}
+		if ((count == 3) && (strcmp(words[1], "spurious") == 0)) {
+			if (TREXModelHarness::spuriousInterrupts() - gSpuriousBase != strtoul(words[2], 0, 10))
+				fail("%u spurious interrupts, expected %s", TREXModelHarness::spuriousInterrupts() - gSpuriousBase, words[2]);
+			return;
+		}
+		if ((count < 4) || !socketNumber(words[1], &socket)) {
+			fail("bad expect");
+			return;
+		}
+		if (strcmp(words[2], "csc") == 0) {
+			if (!parseNames(&words[3], count - 3, gSSNames, &value))
+				fail("bad status change names");
+			else if (gSockets[socket].csc != value) {
+				printNames(gSSNames, gSockets[socket].csc, text, sizeof(text));
+				fail("socket %d: Card Services got %s", socket, text);
+			}
+		} else if (strcmp(words[2], "irq") == 0) {
+			if (gSockets[socket].irqCalls != strtoul(words[3], 0, 10))
+				fail("socket %d: %u card IRQ calls, expected %s", socket, gSockets[socket].irqCalls, words[3]);
+		} else if (strcmp(words[2], "latched") == 0) {
+			if (!parseNames(&words[3], count - 3, gEventNames, &value))
+				fail("bad event names");
+			else if (gModel->latched(socket) != value) {
+				printNames(gEventNames, gModel->latched(socket), text, sizeof(text));
+				fail("socket %d: %s latched", socket, text);
+			}
+		} else
+			fail("bad expect");
+		return;
+	}
+
+	if ((count < 2) || !socketNumber(words[1], &socket)) {
+		fail("bad command");
+		return;
+	}
+
+	if ((strcmp(verb, "insert") == 0) && (count == 2))
+		gModel->insert(socket);
+	else if ((strcmp(verb, "remove") == 0) && (count == 2))
+		gModel->remove(socket);
+	else if ((strcmp(verb, "memcard") == 0) && (count == 2))
+		setInterface(socket, false);
+	else if ((strcmp(verb, "iocard") == 0) && (count == 2))
+		setInterface(socket, true);
+	else if ((strcmp(verb, "attr") == 0) && (count == 3)) {
+		volatile UInt8 *cfg0 = (volatile UInt8 *) (uintptr_t) (TREXModel::kBase + socket * sockOffStep + rCfg0);
+		UInt8 reg = TREXModelRead(cfg0);
+
+		TREXModelWrite(cfg0, (strcmp(words[2], "on") == 0) ? (reg | mAttr) : (reg & ~mAttr));
+	} else if ((strcmp(verb, "driver") == 0) && (count == 2)) {
+		if (!TREXModelHarness::addDriver(socket))
+			fail("could not register the card IRQ vector");
+	} else if ((strcmp(verb, "raise") == 0) && (count >= 3)) {
+		if (!parseNames(&words[2], count - 2, gEventNames, &value))
+			fail("bad event names");
+		gModel->raise(socket, value);
+	} else if ((strcmp(verb, "cause") == 0) && (count == 3)) {
+		bool irq = strcmp(words[2], "irq") == 0;
+
+		TREXModelHarness::controller->causeInterrupt(gSockets[socket].nub, 2 * socket + (irq ? 1 : 0));
+		if (irq)
+			gSockets[socket].caused++;
+		if (TREXModelHarness::platformNub->sources[0].caused == 0)
+			fail("causeInterrupt did not reach the TREX interrupt");
+	} else
+		fail("bad command");
+}
+
+static void replay(const char *path, TraceResult *result)
+{
+	FILE *file = fopen(path, "r");
+	char line[256];
+
+	gTrace = path;
+	gLine = 0;
+	memset(result, 0, sizeof(*result));
+
+	if (file == 0) {
+		fail("can not open it");
+		return;
+	}
+
+	TREXModelHarness::reset();
+	gSpuriousBase = TREXModelHarness::spuriousInterrupts();
+
+	while (fgets(line, sizeof(line), file) != 0) {
+		char *words[16], *p, *hash;
+		int count = 0;
+
+		gLine++;
+		if ((hash = strchr(line, '#')) != 0)
+			*hash = 0;
+		for (p = strtok(line, " \t\r\n"); (p != 0) && (count < 16); p = strtok(0, " \t\r\n"))
+			words[count++] = p;
+		if (count != 0)
+			command(words, count, result);
+	}
+
+	fclose(file);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: trexreplay [--check] [--access ns] [--stats] [--verbose] trace...\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	UInt32 accessNanoseconds = 240;
+	bool check = false, showStatistics = false;
+	int i, traces = 0;
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (strcmp(arg, "--check") == 0) check = true;
+		else if (strcmp(arg, "--stats") == 0) showStatistics = true;
+		else if (strcmp(arg, "--verbose") == 0) hostVerbose = 1;
+		else if (strcmp(arg, "--access") == 0) {
+			if (++i == argc)
+				usage();
+			accessNanoseconds = strtoul(argv[i], 0, 0);
+		} else if (arg[0] == '-')
+			usage();
+		else
+			traces++;
+	}
+
+	if (traces == 0)
+		usage();
+
+	gModel = new TREXModel(accessNanoseconds);
+	TREXModelHarness::start(gModel);
+
+	printf("TREX access %u ns\n", accessNanoseconds);
+	printf("%-24s %5s %8s %8s %8s %8s %7s\n", "trace", "ints", "acc/int", "max", "us/int", "top/int", "fail");
+
+	for (i = 1; i < argc; i++) {
+		TraceResult result;
+		int failures = gFailures;
+		const char *name;
+
+		if (argv[i][0] == '-') {
+			if (strcmp(argv[i], "--access") == 0)
+				i++;
+			continue;
+		}
+
+		replay(argv[i], &result);
+
+		name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+		printf("%-24s %5u %8.1f %8u %8.2f %8.1f %7d\n", name, result.interrupts,
+		       result.interrupts ? (double) result.controllerAccesses / result.interrupts : 0.0,
+		       result.maxControllerAccesses,
+		       result.interrupts ? (double) result.controllerNanoseconds / result.interrupts / 1000.0 : 0.0,
+		       result.interrupts ? (double) result.topAccesses / result.interrupts : 0.0,
+		       gFailures - failures);
+
+		if (showStatistics) {
+			OSSerialize *s = OSSerialize::withCapacity(256);
+
+			printf("  InterruptStatistics: %s\n", hostSerializeProperty(TREXModelHarness::bridge, "InterruptStatistics", s));
+			s->release();
+		}
+	}
+
+	if (check)
+		printf("%s\n", gFailures ? "FAIL" : "PASS");
+
+	return (check && gFailures) ? 1 : 0;
+}
@@ -0,0 +1,173 @@
+#include "WhitneyModel.h"
+
+#include "Whitney.h"
+
+WhitneyHarnessVector WhitneyModelHarness::vectors[kWhitneyModelVectors];
+UInt64 WhitneyModelHarness::handlerNanoseconds;
+UInt8 WhitneyModelHarness::order[kMaxOrder];
+UInt32 WhitneyModelHarness::orderCount;
+Whitney *WhitneyModelHarness::whitney;
+M2InterruptController *WhitneyModelHarness::controller;
+HostInterruptNub *WhitneyModelHarness::platformNub;
+
+static WhitneyModel *gModel;
+
+// A driver on a vector, at interrupt time: it serves what its source
+//  asked for, or what causeInterrupt asked for, and takes its time
+static void vectorHandler(void *target, void *refCon, void *nub, int source)
+{
+	WhitneyHarnessVector *v = (WhitneyHarnessVector *) target;
+	UInt64 latency;
+
+	v->calls++;
+	if (gModel->servable(source)) {
+		latency = hostNow() - gModel->serve(source, v->stuck);
+		v->latencies++;
+		v->latencySum += latency;
+		if (latency > v->latencyMax)
+			v->latencyMax = latency;
+	} else if (v->caused)
+		v->caused--;
+	else
+		v->unasked++;
+
+	if (WhitneyModelHarness::orderCount < WhitneyModelHarness::kMaxOrder)
+		WhitneyModelHarness::order[WhitneyModelHarness::orderCount++] = source;
+
+	hostAdvance(v->costNanoseconds);
+	WhitneyModelHarness::handlerNanoseconds += v->costNanoseconds;
+	gModel->update();
+}
+
+// Setting up, as the machine does it:
+// ------------------------------------
+
+static void startWhitney()
+{
+	Whitney *whitney = new Whitney;
+
+	whitney->init();
+	whitney->attach(WhitneyModelHarness::platformNub);
+	if (!whitney->start(WhitneyModelHarness::platformNub))
+		panic("Whitney::start failed");
+
+	WhitneyModelHarness::whitney = whitney;
+	WhitneyModelHarness::controller = OSDynamicCast(M2InterruptController,
+		getPlatform()->lookUpInterruptController(gIODTDefaultInterruptController));
+	if (WhitneyModelHarness::controller == 0)
+		panic("no %s", gIODTDefaultInterruptController->getCStringNoCopy());
+}
+
+void WhitneyModelHarness::start(WhitneyModel *model)
+{
+	OSArray *memory;
+	IODeviceMemory *registers;
+
+	gModel = model;
+
+	// The device tree nub of Whitney, with its registers
+	platformNub = new HostInterruptNub;
+	platformNub->init();
+	platformNub->setName("pbx-whitney");
+	memory = OSArray::withCapacity(1);
+	registers = IODeviceMemory::withRange(WhitneyModel::kBase, WhitneyModel::kLength);
+	memory->setObject(registers);
+	registers->release();
+	platformNub->setDeviceMemory(memory);
+	memory->release();
+
+	startWhitney();
+}
+
+void WhitneyModelHarness::reset()
+{
+	int i;
+
+	// The old one is stopped and left, as nothing frees an interrupt
+	//  controller; its storm timer must not fire on the new one's model
+	for (i = 0; i < kWhitneyModelVectors; i++)
+		if (vectors[i].driver)
+			controller->unregisterInterrupt(platformNub, i);
+	if (controller->stormTimer)
+		controller->stormTimer->cancelTimeout();
+	platformNub->disableInterrupt(0);
+	platformNub->unregisterInterrupt(0);
+	whitney->stop(platformNub);
+	whitney->detach(platformNub);
+
+	memset(vectors, 0, sizeof(vectors));
+	handlerNanoseconds = 0;
+	orderCount = 0;
+
+	gModel->reset();
+	startWhitney();
+	gModel->resetCounters();
+}
+
+bool WhitneyModelHarness::addDriver(int vector, UInt32 costNanoseconds)
+{
+	WhitneyHarnessVector *v = &vectors[vector];
+
+	v->costNanoseconds = costNanoseconds;
+	if (v->driver)
+		return true;
+	if ((controller->registerInterrupt(platformNub, vector, v, vectorHandler, 0) != kIOReturnSuccess) ||
+	    (controller->enableInterrupt(platformNub, vector) != kIOReturnSuccess))
+		return false;
+	v->driver = true;
+	return true;
+}
+
+bool WhitneyModelHarness::cause(int vector)
+{
+	if (!vectors[vector].driver)
+		return false;
+	vectors[vector].caused++;
+	controller->causeInterrupt(platformNub, vector);
+	return platformNub->sources[0].caused != 0;
+}
+
+bool WhitneyModelHarness::setEnabled(int vector, bool enable)
+{
+	WhitneyHarnessVector *v = &vectors[vector];
+
+	if (!v->driver)
+		return false;
+	v->disabled = !enable;
+	if (enable)
+		return controller->enableInterrupt(platformNub, vector) == kIOReturnSuccess;
+	return controller->disableInterrupt(platformNub, vector) == kIOReturnSuccess;
+}
+
+// Running:
+// --------
+
+UInt32 WhitneyModelHarness::deliver()
+{
+	UInt32 before = 0, after = 0;
+	int i;
+
+	for (i = 0; i < kWhitneyModelVectors; i++)
+		before += vectors[i].calls;
+
+	// at interrupt time
+	if (!platformNub->deliver(0))
+		panic("the Whitney interrupt is not enabled");
+
+	for (i = 0; i < kWhitneyModelVectors; i++)
+		after += vectors[i].calls;
+	return after - before;
+}
+
+bool WhitneyModelHarness::interruptPending()
+{
+	return gModel->interruptLine() || (platformNub->sources[0].caused != 0);
+}
+
+bool WhitneyModelHarness::enabled(int vector)
+{
+	if ((WhitneyModel::source(vector) == kWhitneySourceVIA1) && !(gModel->enables(0) & (1 << (vector & 7))))
+		return false;
+	return vectors[vector].driver && !vectors[vector].disabled &&
+	       !(controller->stormedMask & (1 << vector));
+}
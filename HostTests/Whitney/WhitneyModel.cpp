@@ -0,0 +1,355 @@
+#include "WhitneyModel.h"
+
+// The WHITNEY_IC_MODEL hooks go to the one model there is
+
+static WhitneyModel *gModel = 0;
+
+extern "C" UInt32 WhitneyModelRead(volatile void *reg, int size)
+{
+	if (gModel == 0)
+		panic("Whitney register read without a model");
+	return gModel->read(reg, size);
+}
+
+extern "C" void WhitneyModelWrite(volatile void *reg, int size, UInt32 value)
+{
+	if (gModel == 0)
+		panic("Whitney register write without a model");
+	gModel->write(reg, size, value);
+}
+
+extern "C" UInt32 WhitneyModelTimebase(void)
+{
+	AbsoluteTime now;
+
+	clock_get_uptime(&now);
+	return (UInt32) now;
+}
+
+// Where things are, as Whitney.cpp has them
+enum {
+	kICR = 0x2A000,
+	kVIA2 = 0x2000,
+	kVIARegisterStep = 0x200,
+	rPCR = 0x1800 / kVIARegisterStep,
+	rIFR = 0x1A00 / kVIARegisterStep,
+	rIER = 0x1C00 / kVIARegisterStep,
+	rANH = 0x1E00 / kVIARegisterStep,
+
+	kSlotFlag = 0x02,			// VIA2's
+	kSoundVector = 20,
+	kICRLineMask = 0x000000F8,		// levels 3 to 7
+	kSlotMask = 0xFF000000,
+	kLevelMask = kICRLineMask | kSlotMask | (1 << kSoundVector)
+};
+
+WhitneyModel::WhitneyModel(UInt32 newICRAccessNanoseconds, UInt32 newVIAAccessNanoseconds)
+{
+	if (gModel != 0)
+		panic("only one Whitney model at a time");
+	gModel = this;
+
+	icrAccessNanoseconds = newICRAccessNanoseconds;
+	viaAccessNanoseconds = newVIAAccessNanoseconds;
+	reset();
+}
+
+WhitneyModel::~WhitneyModel()
+{
+	gModel = 0;
+}
+
+void WhitneyModel::reset()
+{
+	memset(regs, 0, sizeof(regs));
+	memset(ifr, 0, sizeof(ifr));
+	memset(ier, 0, sizeof(ier));
+	lines = 0;
+	memset(requests, 0, sizeof(requests));
+	memset(period, 0, sizeof(period));
+	memset(next, 0, sizeof(next));
+	resetCounters();
+}
+
+WhitneyModelSource WhitneyModel::source(int vector)
+{
+	if ((vector < 0) || (vector >= kWhitneyModelVectors))
+		return kWhitneySourceNone;
+
+	switch (vector >> 3) {
+		case 0:
+			return (kICRLineMask & (1 << vector)) ? kWhitneySourceICR : kWhitneySourceNone;
+		case 1:
+			return ((vector & 7) != 7) ? kWhitneySourceVIA1 : kWhitneySourceNone;
+		case 2:
+			return (((vector & 7) != 7) && ((1 << (vector & 7)) != kSlotFlag)) ? kWhitneySourceVIA2 : kWhitneySourceNone;
+		default:
+			return kWhitneySourceSlot;
+	}
+}
+
+bool WhitneyModel::level(int vector)
+{
+	return (kLevelMask & (1 << vector)) != 0;
+}
+
+// Registers:
+// ----------
+
+bool WhitneyModel::decode(volatile void *reg, int size, int *via, int *which)
+{
+	uintptr_t offset = (uintptr_t) reg - kBase;
+
+	if (offset == kICR) {
+		*via = -1;
+		*which = 0;
+		if (size != 4) {
+			counters.strayAccesses++;
+			return false;
+		}
+		return true;
+	}
+
+	if ((offset >= 2 * kVIA2) || (offset % kVIARegisterStep) || (size != 1)) {
+		counters.strayAccesses++;
+		return false;
+	}
+
+	*via = offset / kVIA2;
+	*which = (offset % kVIA2) / kVIARegisterStep;
+	return true;
+}
+
+// The latched flags and the level lines behind them
+UInt8 WhitneyModel::flags(int via)
+{
+	UInt8 value = ifr[via];
+
+	if (via == 1) {
+		if (lines & kSlotMask)
+			value |= kSlotFlag;
+		if (lines & (1 << kSoundVector))
+			value |= 1 << (kSoundVector & 7);
+	}
+	return value;
+}
+
+UInt8 WhitneyModel::pendingLevel()
+{
+	UInt32 levels = lines & kICRLineMask;
+	int level;
+
+	if (flags(0) & ier[0] & 0x7F)
+		levels |= 1 << 1;
+	if (flags(1) & ier[1] & 0x7F)
+		levels |= 1 << 2;
+
+	for (level = 7; level > 0; level--)
+		if (levels & (1 << level))
+			return level;
+	return 0;
+}
+
+// The controller clears flags: the requests behind them are taken
+void WhitneyModel::clearFlags(int via, UInt8 bits)
+{
+	int bit, vector;
+
+	bits &= ifr[via];
+	ifr[via] &= ~bits;
+
+	for (bit = 0; bit < 7; bit++) {
+		vector = (via ? 16 : 8) + bit;
+		if (!(bits & (1 << bit)) || level(vector) || !requests[vector].queued)
+			continue;
+		requests[vector].queued = false;
+		requests[vector].taken = true;
+		requests[vector].takenAt = requests[vector].queuedAt;
+	}
+}
+
+UInt32 WhitneyModel::read(volatile void *reg, int size)
+{
+	int via, which;
+
+	if (!decode(reg, size, &via, &which)) {
+		hostAdvance(viaAccessNanoseconds);
+		update();
+		return (size == 4) ? 0xFFFFFFFF : 0xFF;
+	}
+
+	if (via < 0) {
+		hostAdvance(icrAccessNanoseconds);
+		update();
+		counters.icrReads++;
+		return pendingLevel();
+	}
+
+	hostAdvance(viaAccessNanoseconds);
+	update();
+	counters.viaReads++;
+	switch (which) {
+		case rIFR:
+			return flags(via) | ((flags(via) & ier[via] & 0x7F) ? 0x80 : 0);
+
+		case rIER:
+			return ier[via] | 0x80;
+
+		case rANH:
+			if (via == 1)
+				return (UInt8) ~(lines >> 24);
+			return regs[via][which];
+
+		default:
+			return regs[via][which];
+	}
+}
+
+void WhitneyModel::write(volatile void *reg, int size, UInt32 value)
+{
+	int via, which;
+
+	if (!decode(reg, size, &via, &which)) {
+		hostAdvance(viaAccessNanoseconds);
+		update();
+		return;
+	}
+
+	if (via < 0) {
+		hostAdvance(icrAccessNanoseconds);
+		update();
+		counters.icrWrites++;
+		if (value & 0x80)
+			counters.acks++;
+		return;
+	}
+
+	hostAdvance(viaAccessNanoseconds);
+	update();
+	counters.viaWrites++;
+	switch (which) {
+		case rIFR:
+			clearFlags(via, value & 0x7F);
+			break;
+
+		case rIER:
+			if (value & 0x80)
+				ier[via] |= value & 0x7F;
+			else
+				ier[via] &= ~value & 0x7F;
+			break;
+
+		default:
+			regs[via][which] = (UInt8) value;
+			break;
+	}
+}
+
+// Sources:
+// --------
+
+void WhitneyModel::raiseAt(int vector, UInt64 when)
+{
+	Request *request = &requests[vector];
+	WhitneyModelSource where = source(vector);
+
+	if (where == kWhitneySourceNone)
+		return;
+
+	counters.raised[vector]++;
+	if (request->queued)
+		counters.merged[vector]++;
+	else {
+		request->queued = true;
+		request->queuedAt = when;
+	}
+
+	if (level(vector))
+		lines |= 1 << vector;
+	else
+		ifr[(where == kWhitneySourceVIA1) ? 0 : 1] |= 1 << (vector & 7);
+}
+
+void WhitneyModel::raise(int vector)
+{
+	raiseAt(vector, hostNow());
+}
+
+void WhitneyModel::every(int vector, UInt64 periodNanoseconds)
+{
+	period[vector] = periodNanoseconds;
+	next[vector] = hostNow() + periodNanoseconds;
+}
+
+void WhitneyModel::stop(int vector)
+{
+	period[vector] = 0;
+}
+
+void WhitneyModel::update()
+{
+	UInt64 now = hostNow();
+	int vector;
+
+	for (vector = 0; vector < kWhitneyModelVectors; vector++)
+		while (period[vector] && (next[vector] <= now)) {
+			raiseAt(vector, next[vector]);
+			next[vector] += period[vector];
+		}
+}
+
+UInt64 WhitneyModel::nextEvent()
+{
+	UInt64 earliest = 0;
+	int vector;
+
+	for (vector = 0; vector < kWhitneyModelVectors; vector++)
+		if (period[vector] && (!earliest || (next[vector] < earliest)))
+			earliest = next[vector];
+	return earliest;
+}
+
+bool WhitneyModel::requested(int vector)
+{
+	return requests[vector].queued || requests[vector].taken;
+}
+
+UInt64 WhitneyModel::requestedAt(int vector)
+{
+	Request *request = &requests[vector];
+
+	return request->taken ? request->takenAt : request->queuedAt;
+}
+
+bool WhitneyModel::servable(int vector)
+{
+	return requests[vector].taken || (level(vector) && requests[vector].queued);
+}
+
+UInt64 WhitneyModel::serve(int vector, bool stuck)
+{
+	Request *request = &requests[vector];
+	UInt64 raisedAt;
+
+	if (request->taken) {
+		request->taken = false;
+		return request->takenAt;
+	}
+
+	raisedAt = request->queuedAt;
+	if (level(vector)) {
+		if (stuck)
+			request->queuedAt = hostNow();	// and asks again at once
+		else {
+			request->queued = false;
+			lines &= ~(1 << vector);
+		}
+	}
+	return raisedAt;
+}
+
+void WhitneyModel::loseEnables()
+{
+	ier[0] = 0;
+	ier[1] = 0;
+}
@@ -0,0 +1,188 @@
+#ifndef _WHITNEY_MODEL_H
+#define _WHITNEY_MODEL_H
+
+#include "HostKernel.h"
+
+// A model of Whitney's interrupt registers and the sources behind them,
+// for M2InterruptController built with WHITNEY_IC_MODEL.
+//
+// The ICR: a read gives the highest 68K level pending in bits 0-2, 0 for
+// none, and a write with 0x80 acknowledges. Level 1 is VIA1 and level 2
+// VIA2 with an enabled flag set; levels 3 to 7 are lines of their own,
+// the SCC on 4 and the NMI on 7. Nothing masks a level.
+//
+// The VIAs: IFR bit 7 says an enabled flag is set and writing 1s clears
+// flags; an IER write sets (bit 7 set) or clears the bits given and reads
+// back with bit 7 set; PCR and the rest hold what is written. VIA2's A
+// port without handshake (ANH) reads the slot lines, low active, and its
+// slot flag (bit 1) is set while any of them is low, as the driver
+// treats it.
+//
+// A source raises a request on its vector. An edge source, every VIA flag
+// but sound's, latches its flag; a second raise before the controller has
+// cleared the flag is merged into the first. A level source, the ICR
+// lines, VIA2 sound and the slot lines, holds its line until the handler
+// serves it, and a stuck one holds it after that too. A request is
+// "taken" when the controller clears its flag, and served when the
+// harness sees its handler run: the time from the raise to that is the
+// latency the harness reports.
+//
+// Every access costs icrAccessNanoseconds or viaAccessNanoseconds of
+// virtual time, and the periodic sources raise as time goes by, checked
+// at every access: a request that comes while handleInterrupt runs is
+// seen by it as it would be on the machine.
+//
+// The timebase is the low word of clock_get_uptime: a tool that replays
+// on it sets hostTimebaseHz to the PowerBook's.
+
+enum {
+	kWhitneyModelVectors = 32,
+	kWhitneyModelTimebaseHz = 33333333 / 4	// M2PE's bus speed over 4
+};
+
+enum WhitneyModelSource {
+	kWhitneySourceNone,			// a cascade or nothing
+	kWhitneySourceICR,
+	kWhitneySourceVIA1,
+	kWhitneySourceVIA2,
+	kWhitneySourceSlot
+};
+
+struct WhitneyModelCounters {
+	UInt32 icrReads;
+	UInt32 icrWrites;
+	UInt32 viaReads;
+	UInt32 viaWrites;
+	UInt32 acks;				// ICR writes with 0x80
+	UInt32 strayAccesses;			// no register there, or the wrong size
+	UInt32 raised[kWhitneyModelVectors];
+	UInt32 merged[kWhitneyModelVectors];	// raised again before taken
+};
+
+class WhitneyModel {
+public:
+	// Where the harness says the registers are, as the device tree would
+	enum { kBase = 0x50F00000, kLength = 0x30000 };
+
+	WhitneyModel(UInt32 icrAccessNanoseconds, UInt32 viaAccessNanoseconds);
+	~WhitneyModel();
+
+	UInt32 read(volatile void *reg, int size);
+	void write(volatile void *reg, int size, UInt32 value);
+
+	// Power-on state, every source quiet
+	void reset();
+
+	// What the sources do
+	static WhitneyModelSource source(int vector);
+	static bool level(int vector);
+	void raise(int vector);
+	void every(int vector, UInt64 periodNanoseconds);	// from now on
+	void stop(int vector);
+	void update();				// raises the periodic requests due
+
+	// A request raised and not served yet, on the chip or taken off it
+	bool requested(int vector);
+	UInt64 requestedAt(int vector);
+	// One the handler serves when it runs: taken, or a level line up
+	bool servable(int vector);
+	// The handler ran: returns when the request it served was raised
+	UInt64 serve(int vector, bool stuck);
+
+	// The VIAs lose their enables, as they do in sleep
+	void loseEnables();
+
+	bool interruptLine() { return pendingLevel() != 0; }
+	UInt64 nextEvent();			// of the periodic sources, 0 for none
+	UInt8 enables(int via) { return ier[via]; }
+	UInt32 accessTime(bool icr) { return icr ? icrAccessNanoseconds : viaAccessNanoseconds; }
+
+	WhitneyModelCounters counters;
+
+	void resetCounters() { memset(&counters, 0, sizeof(counters)); }
+
+private:
+	enum { kVIARegisters = 16 };
+
+	struct Request {
+		bool queued;			// raised, the flag or line is up
+		bool taken;			// its flag cleared by the controller
+		UInt64 queuedAt;
+		UInt64 takenAt;
+	};
+
+	UInt32 icrAccessNanoseconds;
+	UInt32 viaAccessNanoseconds;
+
+	UInt8 regs[2][kVIARegisters];
+	UInt8 ifr[2];				// latched flags
+	UInt8 ier[2];
+	UInt32 lines;				// level sources holding their line, by vector
+	Request requests[kWhitneyModelVectors];
+	UInt64 period[kWhitneyModelVectors];
+	UInt64 next[kWhitneyModelVectors];
+
+	void raiseAt(int vector, UInt64 when);
+	UInt8 flags(int via);
+	UInt8 pendingLevel();
+	void clearFlags(int via, UInt8 bits);
+	bool decode(volatile void *reg, int size, int *via, int *which);
+};
+
+// Whitney with its M2InterruptController on the model, started as the
+// machine starts it (WhitneyHarness.cpp), and drivers on its vectors whose
+// handlers take costNanoseconds and serve their source's request.
+
+class Whitney;
+class M2InterruptController;
+class HostInterruptNub;
+
+struct WhitneyHarnessVector {
+	bool driver;				// registered and enabled by the harness
+	bool stuck;				// its level source holds the line anyway
+	bool disabled;				// disableInterrupt, not enabled since
+	UInt32 costNanoseconds;			// of the handler
+	UInt32 caused;				// causeInterrupt calls not served yet
+
+	// since the reset
+	UInt32 calls;
+	UInt32 unasked;				// calls with nothing requested or caused
+	UInt32 latencies;			// calls that served a request
+	UInt64 latencySum;			// nanoseconds
+	UInt64 latencyMax;
+};
+
+class WhitneyModelHarness {
+public:
+	enum { kMaxOrder = 64 };
+
+	static void start(WhitneyModel *model);
+
+	// A fresh Whitney on the model in its power-on state, no drivers
+	static void reset();
+
+	static bool addDriver(int vector, UInt32 costNanoseconds);
+	static bool cause(int vector);
+	// The driver's disableInterrupt and enableInterrupt
+	static bool setEnabled(int vector, bool enable);
+
+	// handleInterrupt once, returns the handler calls it made
+	static UInt32 deliver();
+	// There is an interrupt to take: the ICR, or a causeInterrupt
+	static bool interruptPending();
+	// Enabled: registered by the harness, not disabled, not storm masked,
+	//  and on VIA1 not turned off by the PMU driver either
+	static bool enabled(int vector);
+
+	static WhitneyHarnessVector vectors[kWhitneyModelVectors];
+	static UInt64 handlerNanoseconds;	// since the reset
+	static UInt8 order[kMaxOrder];		// the calls, in order, since clearOrder
+	static UInt32 orderCount;
+	static void clearOrder() { orderCount = 0; }
+
+	static Whitney *whitney;
+	static M2InterruptController *controller;
+	static HostInterruptNub *platformNub;
+};
+
+#endif
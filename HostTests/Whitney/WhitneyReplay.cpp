@@ -0,0 +1,547 @@
+#include "WhitneyModel.h"
+
+#include "Whitney.h"
+
+// Replays interrupt traces through M2InterruptController as it runs on
+// the PowerBook: Whitney and its controller built with WHITNEY_IC_MODEL
+// against WhitneyModel, with WhitneyModelHarness standing in for the
+// drivers on the vectors.
+//
+//	whitneyreplay [--check] [--icr-access ns] [--via-access ns] [--stats] [--verbose] trace...
+//
+// A trace is one command a line, # starts a comment. V is a vector,
+// by number or name: scc nmi onesecond tick pmusr pmu timer2 timer1
+// scsidrq scsi sound floppy pcmcia display baboon expansion.
+//
+//	driver V [US]			a driver registers and enables V, its
+//					handler takes US microseconds (0)
+//	raise V...			the sources raise a request now
+//	every V US			V's source raises one every US
+//					microseconds from now on
+//	stop V				and no more
+//	stuck V on|off			V's level source holds its line after
+//					the handler has served it
+//	cause V				the driver calls causeInterrupt
+//	disable V | enable V		the driver calls disableInterrupt or
+//					enableInterrupt
+//	budget N			the controller's dispatch budget
+//	priority V P			V's dispatch priority, 0 to 7
+//	stats off|counts|times		"InterruptStatisticsLevel", through
+//					Whitney::setProperties
+//	enables SET CLEAR		the PMU driver's kWhitneyUpdateVIA1Enables,
+//					the VIA1 bits in hex
+//	sleep				the VIAs lose their enables, then M2CPU's
+//					kWhitneyRestoreEnables on wake
+//	run MS				the machine runs MS milliseconds, taking
+//					every interrupt as it comes
+//
+// and what must have happened since the trace started:
+//
+//	expect V calls N [M]		handler calls, N to M
+//	expect V latency US		no request waited longer than US
+//					microseconds for its handler
+//	expect V deferred N [M]		calls put off for lack of budget, or
+//					found behind a repeated ICR level
+//	expect V merged N [M]		requests raised again before the
+//					first was taken
+//	expect V storms N [M]		times storm masked
+//	expect V masked yes|no		storm masked now
+//	expect ints N [M]		interrupts taken
+//	expect empty N [M]		interrupts that called no handler
+//	expect order V...		the first handler calls of the last run
+//
+// Every interrupt is also checked for what must hold whatever the trace:
+// the controller touches no register that is not there, its shadows of
+// the VIA enables are what the VIAs have, and no handler is called that
+// was not asked for. At the end of a run with nothing left to take, no
+// request on an enabled vector may be left unserved.
+//
+// The report has a line for each trace: the interrupts, the handler
+// calls, the ICR and VIA accesses an interrupt made, the time in the
+// controller an interrupt took (without the handlers), the share of the
+// time spent in interrupts, the ones that called nothing, and the
+// failures. Below it, each vector with a driver: its calls, the merged
+// requests, the mean and the longest time from a request to its
+// handler, the deferrals and the storms.
+//
+// --check fails if anything did not hold.
+
+enum { kVectors = kWhitneyModelVectors };
+
+static WhitneyModel *gModel;
+static WhitneyHarnessVector *gVectors = WhitneyModelHarness::vectors;
+
+static const char *gTrace;
+static int gLine;
+static int gFailures;
+
+static void fail(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static void fail(const char *format, ...)
+{
+	va_list args;
+
+	printf("  %s:%d: ", gTrace, gLine);
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+	gFailures++;
+}
+
+// The trace commands:
+// -------------------
+
+struct Name {
+	const char *name;
+	int value;
+};
+
+static const Name gVectorNames[] = {
+	{ "scc", 4 }, { "nmi", 7 },
+	{ "onesecond", 8 }, { "tick", 9 }, { "pmusr", 10 }, { "pmu", 12 }, { "timer2", 13 }, { "timer1", 14 },
+	{ "scsidrq", 16 }, { "scsi", 19 }, { "sound", 20 }, { "floppy", 21 },
+	{ "pcmcia", 24 }, { "display", 25 }, { "baboon", 27 }, { "expansion", 29 },
+	{ 0, 0 }
+};
+
+static bool vectorNumber(const char *word, int *vector)
+{
+	char *end;
+	int n;
+
+	for (n = 0; gVectorNames[n].name != 0; n++)
+		if (strcmp(word, gVectorNames[n].name) == 0) {
+			*vector = gVectorNames[n].value;
+			return true;
+		}
+
+	*vector = strtol(word, &end, 10);
+	return (*end == 0) && (WhitneyModel::source(*vector) != kWhitneySourceNone);
+}
+
+static const char *vectorName(int vector)
+{
+	static char number[8];
+	int n;
+
+	for (n = 0; gVectorNames[n].name != 0; n++)
+		if (gVectorNames[n].value == vector)
+			return gVectorNames[n].name;
+	snprintf(number, sizeof(number), "%d", vector);
+	return number;
+}
+
+struct TraceResult {
+	UInt64 start;
+	UInt32 interrupts;
+	UInt32 calls;
+	UInt32 empty;
+	UInt64 icrAccesses;
+	UInt64 viaAccesses;
+	UInt64 interruptNanoseconds;		// in handleInterrupt, handlers included
+	UInt64 controllerNanoseconds;		// the same without the handlers
+};
+
+static void interrupt(TraceResult *result)
+{
+	WhitneyModelCounters before = gModel->counters;
+	M2InterruptController *controller = WhitneyModelHarness::controller;
+	UInt32 unasked[kVectors], calls;
+	UInt64 start = hostNow(), handlers = WhitneyModelHarness::handlerNanoseconds, elapsed;
+	int i;
+
+	for (i = 0; i < kVectors; i++)
+		unasked[i] = gVectors[i].unasked;
+
+	calls = WhitneyModelHarness::deliver();
+
+	elapsed = hostNow() - start;
+	result->interrupts++;
+	result->calls += calls;
+	if (calls == 0)
+		result->empty++;
+	result->icrAccesses += (gModel->counters.icrReads - before.icrReads) + (gModel->counters.icrWrites - before.icrWrites);
+	result->viaAccesses += (gModel->counters.viaReads - before.viaReads) + (gModel->counters.viaWrites - before.viaWrites);
+	result->interruptNanoseconds += elapsed;
+	result->controllerNanoseconds += elapsed - (WhitneyModelHarness::handlerNanoseconds - handlers);
+
+	// What must hold whatever the trace
+	if (gModel->counters.strayAccesses != before.strayAccesses)
+		fail("access outside the Whitney registers");
+	if (controller->cached_via1_ier != gModel->enables(0))
+		fail("VIA1 enables %02x, the shadow says %02x", gModel->enables(0), controller->cached_via1_ier);
+	if (controller->cached_via2_ier != gModel->enables(1))
+		fail("VIA2 enables %02x, the shadow says %02x", gModel->enables(1), controller->cached_via2_ier);
+	for (i = 0; i < kVectors; i++)
+		if (gVectors[i].unasked != unasked[i])
+			fail("%s: handler called, nothing asked", vectorName(i));
+}
+
+// Takes the interrupts as they come until the time is up, moving time
+//  on to the next source or timer when there is nothing to take
+static void run(UInt64 nanoseconds, TraceResult *result)
+{
+	UInt64 end = hostNow() + nanoseconds, next, timer;
+	int i;
+
+	WhitneyModelHarness::clearOrder();
+
+	while (true) {
+		gModel->update();
+		hostRunThreadCalls();
+
+		if (WhitneyModelHarness::interruptPending()) {
+			if (hostNow() >= end)
+				return;
+			interrupt(result);
+			continue;
+		}
+
+		next = gModel->nextEvent();
+		timer = hostNextThreadCall();
+		if (timer && (!next || (timer < next)))
+			next = timer;
+		if (!next || (next > end))
+			next = end;
+		if (next <= hostNow())
+			break;
+		hostAdvance(next - hostNow());
+	}
+
+	// nothing to take, so nothing may be waiting
+	for (i = 0; i < kVectors; i++)
+		if (WhitneyModelHarness::enabled(i) && gModel->requested(i))
+			fail("%s: request raised %.1f us ago never served", vectorName(i),
+			     (hostNow() - gModel->requestedAt(i)) / 1000.0);
+}
+
+static bool countRange(char **words, int count, UInt32 *low, UInt32 *high)
+{
+	char *end;
+
+	if ((count < 1) || (count > 2))
+		return false;
+	*low = strtoul(words[0], &end, 10);
+	if (*end != 0)
+		return false;
+	*high = *low;
+	if (count == 2) {
+		*high = strtoul(words[1], &end, 10);
+		if ((*end != 0) || (*high < *low))
+			return false;
+	}
+	return true;
+}
+
+static void expectCount(const char *what, UInt32 value, char **words, int count)
+{
+	UInt32 low, high;
+
+	if (!countRange(words, count, &low, &high))
+		fail("bad expect");
+	else if ((value < low) || (value > high)) {
+		if (low == high)
+			fail("%s %u, expected %u", what, value, low);
+		else
+			fail("%s %u, expected %u to %u", what, value, low, high);
+	}
+}
+
+static void setStatisticsLevel(UInt32 level)
+{
+	OSDictionary *dict = OSDictionary::withCapacity(1);
+	OSNumber *number = OSNumber::withNumber(level, 32);
+
+	dict->setObject("InterruptStatisticsLevel", number);
+	number->release();
+	if (WhitneyModelHarness::whitney->setProperties(dict) != kIOReturnSuccess)
+		fail("setProperties failed");
+	dict->release();
+}
+
+static void expect(char **words, int count, TraceResult *result)
+{
+	M2InterruptController *controller = WhitneyModelHarness::controller;
+	char what[40];
+	int vector, i;
+
+	if ((count >= 2) && (strcmp(words[1], "ints") == 0)) {
+		expectCount("interrupts", result->interrupts, &words[2], count - 2);
+		return;
+	}
+	if ((count >= 2) && (strcmp(words[1], "empty") == 0)) {
+		expectCount("empty interrupts", result->empty, &words[2], count - 2);
+		return;
+	}
+	if ((count >= 3) && (strcmp(words[1], "order") == 0)) {
+		for (i = 2; i < count; i++) {
+			if (!vectorNumber(words[i], &vector)) {
+				fail("bad vector %s", words[i]);
+				return;
+			}
+			if (i - 2 >= (int) WhitneyModelHarness::orderCount) {
+				fail("call %d: none, expected %s", i - 1, words[i]);
+				return;
+			}
+			if (WhitneyModelHarness::order[i - 2] != vector) {
+				fail("call %d: %s, expected %s", i - 1, vectorName(WhitneyModelHarness::order[i - 2]), words[i]);
+				return;
+			}
+		}
+		return;
+	}
+
+	if ((count < 4) || !vectorNumber(words[1], &vector)) {
+		fail("bad expect");
+		return;
+	}
+
+	if (strcmp(words[2], "calls") == 0) {
+		snprintf(what, sizeof(what), "%s: calls", vectorName(vector));
+		expectCount(what, gVectors[vector].calls, &words[3], count - 3);
+	} else if (strcmp(words[2], "deferred") == 0) {
+		snprintf(what, sizeof(what), "%s: deferred", vectorName(vector));
+		expectCount(what, controller->starveCounts[vector], &words[3], count - 3);
+	} else if (strcmp(words[2], "merged") == 0) {
+		snprintf(what, sizeof(what), "%s: merged", vectorName(vector));
+		expectCount(what, gModel->counters.merged[vector], &words[3], count - 3);
+	} else if (strcmp(words[2], "storms") == 0) {
+		snprintf(what, sizeof(what), "%s: storms", vectorName(vector));
+		expectCount(what, controller->storms[vector].storms, &words[3], count - 3);
+	} else if ((strcmp(words[2], "latency") == 0) && (count == 4)) {
+		if (gVectors[vector].latencyMax > strtod(words[3], 0) * 1000.0)
+			fail("%s: a request waited %.1f us, expected %s at most", vectorName(vector),
+			     gVectors[vector].latencyMax / 1000.0, words[3]);
+	} else if ((strcmp(words[2], "masked") == 0) && (count == 4)) {
+		bool masked = (controller->stormedMask & (1 << vector)) != 0;
+
+		if (masked != (strcmp(words[3], "yes") == 0))
+			fail("%s: %s", vectorName(vector), masked ? "storm masked" : "not storm masked");
+	} else
+		fail("bad expect");
+}
+
+static void command(char **words, int count, TraceResult *result)
+{
+	const char *verb = words[0];
+	M2InterruptController *controller = WhitneyModelHarness::controller;
+	UInt32 mismatches;
+	int vector, i;
+
+	if (strcmp(verb, "expect") == 0) {
+		expect(words, count, result);
+		return;
+	}
+
+	if ((strcmp(verb, "run") == 0) && (count == 2)) {
+		run((UInt64) (strtod(words[1], 0) * 1000000.0), result);
+		return;
+	}
+
+	if ((strcmp(verb, "budget") == 0) && (count == 2)) {
+		controller->setDispatchBudget(strtoul(words[1], 0, 10));
+		return;
+	}
+
+	if ((strcmp(verb, "stats") == 0) && (count == 2)) {
+		if (strcmp(words[1], "off") == 0)
+			setStatisticsLevel(kStatsOff);
+		else if (strcmp(words[1], "counts") == 0)
+			setStatisticsLevel(kStatsCounts);
+		else if (strcmp(words[1], "times") == 0)
+			setStatisticsLevel(kStatsTimes);
+		else
+			fail("bad statistics level");
+		return;
+	}
+
+	if ((strcmp(verb, "enables") == 0) && (count == 3)) {
+		if (WhitneyModelHarness::whitney->IOService::callPlatformFunction(kWhitneyUpdateVIA1Enables, false,
+				(void *) strtoul(words[1], 0, 16), (void *) strtoul(words[2], 0, 16), 0, 0) != kIOReturnSuccess)
+			fail("kWhitneyUpdateVIA1Enables failed");
+		else if (controller->cached_via1_ier != gModel->enables(0))
+			fail("VIA1 enables %02x, the shadow says %02x", gModel->enables(0), controller->cached_via1_ier);
+		return;
+	}
+
+	if ((strcmp(verb, "sleep") == 0) && (count == 1)) {
+		mismatches = controller->enableSnapshot.mismatches;
+		gModel->loseEnables();
+		if (WhitneyModelHarness::whitney->IOService::callPlatformFunction(kWhitneyRestoreEnables, false,
+				0, 0, 0, 0) != kIOReturnSuccess)
+			fail("kWhitneyRestoreEnables failed");
+		if (controller->enableSnapshot.mismatches != mismatches)
+			fail("the enables did not read back as written");
+		if ((controller->cached_via1_ier != gModel->enables(0)) || (controller->cached_via2_ier != gModel->enables(1)))
+			fail("VIA enables %02x %02x after wake, the shadows say %02x %02x", gModel->enables(0),
+			     gModel->enables(1), controller->cached_via1_ier, controller->cached_via2_ier);
+		return;
+	}
+
+	if ((count < 2) || !vectorNumber(words[1], &vector)) {
+		fail("bad command");
+		return;
+	}
+
+	if ((strcmp(verb, "driver") == 0) && ((count == 2) || (count == 3))) {
+		if (!WhitneyModelHarness::addDriver(vector, (count == 3) ? (UInt32) (strtod(words[2], 0) * 1000.0) : 0))
+			fail("could not register %s", vectorName(vector));
+	} else if (strcmp(verb, "raise") == 0) {
+		for (i = 1; i < count; i++) {
+			if (!vectorNumber(words[i], &vector)) {
+				fail("bad vector %s", words[i]);
+				return;
+			}
+			gModel->raise(vector);
+		}
+	} else if ((strcmp(verb, "every") == 0) && (count == 3))
+		gModel->every(vector, (UInt64) (strtod(words[2], 0) * 1000.0));
+	else if ((strcmp(verb, "stop") == 0) && (count == 2))
+		gModel->stop(vector);
+	else if ((strcmp(verb, "stuck") == 0) && (count == 3)) {
+		if (!WhitneyModel::level(vector))
+			fail("%s is not a level source", vectorName(vector));
+		gVectors[vector].stuck = strcmp(words[2], "on") == 0;
+	} else if ((strcmp(verb, "cause") == 0) && (count == 2)) {
+		if (!WhitneyModelHarness::cause(vector))
+			fail("causeInterrupt did not reach the Whitney interrupt");
+	} else if ((strcmp(verb, "disable") == 0) && (count == 2)) {
+		if (!WhitneyModelHarness::setEnabled(vector, false))
+			fail("could not disable %s", vectorName(vector));
+	} else if ((strcmp(verb, "enable") == 0) && (count == 2)) {
+		if (!WhitneyModelHarness::setEnabled(vector, true))
+			fail("could not enable %s", vectorName(vector));
+	} else if ((strcmp(verb, "priority") == 0) && (count == 3))
+		controller->setVectorPriority(vector, strtoul(words[2], 0, 10));
+	else
+		fail("bad command");
+}
+
+static void replay(const char *path, TraceResult *result, bool statistics)
+{
+	FILE *file = fopen(path, "r");
+	char line[256];
+
+	gTrace = path;
+	gLine = 0;
+	memset(result, 0, sizeof(*result));
+
+	if (file == 0) {
+		fail("can not open it");
+		return;
+	}
+
+	WhitneyModelHarness::reset();
+	if (statistics)
+		setStatisticsLevel(kStatsTimes);
+	result->start = hostNow();
+
+	while (fgets(line, sizeof(line), file) != 0) {
+		char *words[16], *p, *hash;
+		int count = 0;
+
+		gLine++;
+		if ((hash = strchr(line, '#')) != 0)
+			*hash = 0;
+		for (p = strtok(line, " \t\r\n"); (p != 0) && (count < 16); p = strtok(0, " \t\r\n"))
+			words[count++] = p;
+		if (count != 0)
+			command(words, count, result);
+	}
+
+	fclose(file);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: whitneyreplay [--check] [--icr-access ns] [--via-access ns] [--stats] [--verbose] trace...\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	UInt32 icrNanoseconds = 240, viaNanoseconds = 1277;
+	bool check = false, showStatistics = false;
+	int i, traces = 0;
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (strcmp(arg, "--check") == 0) check = true;
+		else if (strcmp(arg, "--stats") == 0) showStatistics = true;
+		else if (strcmp(arg, "--verbose") == 0) hostVerbose = 1;
+		else if ((strcmp(arg, "--icr-access") == 0) || (strcmp(arg, "--via-access") == 0)) {
+			if (++i == argc)
+				usage();
+			if (strcmp(arg, "--icr-access") == 0)
+				icrNanoseconds = strtoul(argv[i], 0, 0);
+			else
+				viaNanoseconds = strtoul(argv[i], 0, 0);
+		} else if (arg[0] == '-')
+			usage();
+		else
+			traces++;
+	}
+
+	if (traces == 0)
+		usage();
+
+	// the storm backoff is kept in timebase ticks, 32 bits of them
+	hostTimebaseHz = kWhitneyModelTimebaseHz;
+
+	gModel = new WhitneyModel(icrNanoseconds, viaNanoseconds);
+	WhitneyModelHarness::start(gModel);
+
+	printf("Whitney ICR access %u ns, VIA access %u ns, timebase %u Hz\n", icrNanoseconds, viaNanoseconds, hostTimebaseHz);
+	printf("%-24s %6s %7s %7s %7s %7s %6s %6s %5s\n", "trace", "ints", "calls", "icr/int", "via/int", "us/int", "busy%", "empty", "fail");
+
+	for (i = 1; i < argc; i++) {
+		TraceResult result;
+		int failures = gFailures, vector;
+		const char *name;
+		UInt64 elapsed;
+
+		if (argv[i][0] == '-') {
+			if ((strcmp(argv[i], "--icr-access") == 0) || (strcmp(argv[i], "--via-access") == 0))
+				i++;
+			continue;
+		}
+
+		replay(argv[i], &result, showStatistics);
+
+		elapsed = hostNow() - result.start;
+		name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+		printf("%-24s %6u %7u %7.1f %7.1f %7.2f %6.1f %6u %5d\n", name, result.interrupts, result.calls,
+		       result.interrupts ? (double) result.icrAccesses / result.interrupts : 0.0,
+		       result.interrupts ? (double) result.viaAccesses / result.interrupts : 0.0,
+		       result.interrupts ? (double) result.controllerNanoseconds / result.interrupts / 1000.0 : 0.0,
+		       elapsed ? 100.0 * result.interruptNanoseconds / elapsed : 0.0,
+		       result.empty, gFailures - failures);
+
+		// and what each vector got
+		for (vector = 0; vector < kVectors; vector++) {
+			WhitneyHarnessVector *v = &gVectors[vector];
+
+			if (!v->driver)
+				continue;
+			printf("  %-10s calls %6u  merged %5u  latency %8.1f us mean %8.1f us max  deferred %5u  storms %u\n",
+			       vectorName(vector), v->calls, gModel->counters.merged[vector],
+			       v->latencies ? (double) v->latencySum / v->latencies / 1000.0 : 0.0,
+			       v->latencyMax / 1000.0, WhitneyModelHarness::controller->starveCounts[vector],
+			       WhitneyModelHarness::controller->storms[vector].storms);
+		}
+
+		if (showStatistics) {
+			OSSerialize *s = OSSerialize::withCapacity(256);
+
+			printf("  InterruptStatistics: %s\n", hostSerializeProperty(WhitneyModelHarness::whitney, "InterruptStatistics", s));
+			s->release();
+		}
+	}
+
+	if (check)
+		printf("%s\n", gFailures ? "FAIL" : "PASS");
+
+	return (check && gFailures) ? 1 : 0;
+}
@@ -0,0 +1,207 @@
+#ifndef _HOST_KERNEL_H
+#define _HOST_KERNEL_H
+
+// Just enough of the kernel, libkern and IOKit for the drivers' own
+// sources to build and run in a Linux process, against the models of the
+// hardware in this directory.
+//
+// Time is virtual: it moves only when the code under test delays or
+// sleeps, or a model charges it for a register access. Runs are
+// repeatable and every duration they report is modelled time on the
+// PowerBook, not time on the host.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+typedef uint8_t		UInt8;
+typedef int8_t		SInt8;
+typedef uint16_t	UInt16;
+typedef int16_t		SInt16;
+typedef uint32_t	UInt32;
+typedef int32_t		SInt32;
+typedef uint64_t	UInt64;
+typedef int64_t		SInt64;
+
+typedef unsigned char	Boolean;
+typedef UInt32		IOByteCount;
+typedef UInt32		IOOptionBits;
+typedef UInt32		IOItemCount;
+typedef int		IOReturn;
+typedef int		kern_return_t;
+typedef unsigned long	IOPMPowerFlags;
+typedef int		IOInterruptState;
+typedef UInt32		IOPhysicalAddress;
+typedef UInt32		IOPhysicalLength;
+typedef uintptr_t	IOVirtualAddress;
+typedef unsigned int	natural_t;
+typedef int		boolean_t;
+
+// Virtual time in ticks of hostTimebaseHz, nanoseconds unless a tool
+// says otherwise
+typedef UInt64		AbsoluteTime;
+
+#define kIOReturnSuccess	0
+#define kIOReturnError		((IOReturn) 0xe00002bc)
+#define kIOReturnNoMemory	((IOReturn) 0xe00002bd)
+#define kIOReturnBadArgument	((IOReturn) 0xe00002c2)
+#define kIOReturnUnsupported	((IOReturn) 0xe00002c7)
+#define kIOReturnNoInterrupt	((IOReturn) 0xe00002e9)
+#define kIOReturnTimeout	((IOReturn) 0xe00002d6)
+#define kIOReturnNoResources	((IOReturn) 0xe00002be)
+#define kIOReturnNotReady	((IOReturn) 0xe00002d8)
+
+enum {
+	kNanosecondScale	= 1,
+	kMicrosecondScale	= 1000,
+	kMillisecondScale	= 1000 * 1000,
+	kSecondScale		= 1000 * 1000 * 1000
+};
+
+#define KERN_SUCCESS			0
+#define KERN_OPERATION_TIMED_OUT	49
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Virtual time
+void clock_get_uptime(AbsoluteTime *result);
+void clock_interval_to_deadline(UInt32 interval, UInt32 scaleFactor, AbsoluteTime *result);
+void clock_interval_to_absolutetime_interval(UInt32 interval, UInt32 scaleFactor, AbsoluteTime *result);
+void absolutetime_to_nanoseconds(AbsoluteTime abstime, UInt64 *result);
+void nanoseconds_to_absolutetime(UInt64 nanoseconds, AbsoluteTime *result);
+
+#define ADD_ABSOLUTETIME(t1, t2)	(*(t1) += *(t2))
+#define SUB_ABSOLUTETIME(t1, t2)	(*(t1) -= *(t2))
+#define CMP_ABSOLUTETIME(t1, t2)	((*(t1) > *(t2)) ? 1 : ((*(t1) < *(t2)) ? -1 : 0))
+#define AbsoluteTime_to_scalar(x)	(*(UInt64 *)(x))
+
+void IODelay(UInt32 microseconds);
+void IOSleep(UInt32 milliseconds);
+void delay_for_interval(natural_t interval, natural_t scaleFactor);
+
+// Interrupts: nothing interrupts the host thread, this only keeps the state
+boolean_t ml_set_interrupts_enabled(boolean_t enable);
+
+// Logging, quiet unless hostVerbose is set
+void IOLog(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void kprintf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void panic(const char *format, ...) __attribute__((format(printf, 1, 2), noreturn));
+
+// Memory
+void *IOMalloc(IOByteCount size);
+void IOFree(void *address, IOByteCount size);
+void *kern_os_malloc(size_t size);
+void kern_os_free(void *address);
+
+// Locks: there is one thread, so they only check that they are balanced
+typedef struct HostLock { int held; } IOLock, IOSimpleLock;
+typedef IOLock *IOLockRef;
+
+IOLock *IOLockAlloc(void);
+void IOLockFree(IOLock *lock);
+void IOLockLock(IOLock *lock);
+void IOLockUnlock(IOLock *lock);
+#define IOLockInit(lock)
+
+IOSimpleLock *IOSimpleLockAlloc(void);
+void IOSimpleLockFree(IOSimpleLock *lock);
+void IOSimpleLockLock(IOSimpleLock *lock);
+void IOSimpleLockUnlock(IOSimpleLock *lock);
+IOInterruptState IOSimpleLockLockDisableInterrupt(IOSimpleLock *lock);
+void IOSimpleLockUnlockEnableInterrupt(IOSimpleLock *lock, IOInterruptState state);
+#define IOSimpleLockInit(lock)
+
+// Semaphores. A wait with nothing to signal it runs the wait hook (the
+// model delivering its interrupts) until it is signalled, and gives up
+// when the hook has nothing left to do.
+typedef struct semaphore { int count; } semaphore;
+typedef semaphore *semaphore_t;
+typedef void *task_t;
+#define SYNC_POLICY_FIFO	0
+
+task_t current_task(void);
+kern_return_t semaphore_create(task_t task, semaphore_t *semaphore, int policy, int value);
+kern_return_t semaphore_destroy(task_t task, semaphore_t semaphore);
+kern_return_t semaphore_wait(semaphore_t semaphore);
+kern_return_t semaphore_signal(semaphore_t semaphore);
+
+// Thread calls, run by hostRunThreadCalls when their deadline has come
+typedef struct HostThreadCall *thread_call_t;
+typedef void *thread_call_param_t;
+typedef void (*thread_call_func_t)(thread_call_param_t param0, thread_call_param_t param1);
+
+thread_call_t thread_call_allocate(thread_call_func_t func, thread_call_param_t param0);
+int thread_call_free(thread_call_t call);
+int thread_call_enter(thread_call_t call);
+int thread_call_enter1(thread_call_t call, thread_call_param_t param1);
+int thread_call_enter_delayed(thread_call_t call, AbsoluteTime deadline);
+int thread_call_cancel(thread_call_t call);
+
+// Atomics, trivially atomic with one thread
+Boolean OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, UInt32 *address);
+SInt32 OSAddAtomic(SInt32 amount, SInt32 *address);
+SInt32 OSIncrementAtomic(SInt32 *address);
+SInt32 OSDecrementAtomic(SInt32 *address);
+UInt8 OSBitAndAtomic8(UInt32 mask, UInt8 *address);
+UInt8 OSBitOrAtomic8(UInt32 mask, UInt8 *address);
+
+static inline void eieio(void) { }
+#define OSSynchronizeIO()
+
+// Byte order, of the host
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define OSSwapLittleToHostInt16(x)	__builtin_bswap16(x)
+#define OSSwapLittleToHostInt32(x)	__builtin_bswap32(x)
+#define OSSwapBigToHostInt16(x)		((UInt16) (x))
+#define OSSwapBigToHostInt32(x)		((UInt32) (x))
+#else
+#define OSSwapLittleToHostInt16(x)	((UInt16) (x))
+#define OSSwapLittleToHostInt32(x)	((UInt32) (x))
+#define OSSwapBigToHostInt16(x)		__builtin_bswap16(x)
+#define OSSwapBigToHostInt32(x)		__builtin_bswap32(x)
+#endif
+#define OSSwapHostToLittleInt16(x)	OSSwapLittleToHostInt16(x)
+#define OSSwapHostToLittleInt32(x)	OSSwapLittleToHostInt32(x)
+#define OSSwapHostToBigInt16(x)		OSSwapBigToHostInt16(x)
+#define OSSwapHostToBigInt32(x)		OSSwapBigToHostInt32(x)
+
+static inline unsigned int min(unsigned int a, unsigned int b) { return (a < b) ? a : b; }
+static inline unsigned int max(unsigned int a, unsigned int b) { return (a > b) ? a : b; }
+
+// Host side only:
+//  the current virtual time, in nanoseconds, and a way to move it
+UInt64 hostNow(void);
+//  AbsoluteTime ticks a second, 1000000000 unless a tool sets it before
+//  anything runs: a driver that takes the timebase for AbsoluteTime, as
+//  it is on the PowerBook, needs the PowerBook's rate
+extern UInt32 hostTimebaseHz;
+void hostAdvance(UInt64 nanoseconds);
+//  where a blocked semaphore_wait goes, false when nothing can happen
+typedef int (*HostWaitHook)(void *ref);
+void hostSetWaitHook(HostWaitHook hook, void *ref);
+//  runs the thread calls that are due, returns how many ran
+int hostRunThreadCalls(void);
+//  the earliest deadline of a pending thread call in nanoseconds, 0 if none
+UInt64 hostNextThreadCall(void);
+//  IOLog and kprintf go to stderr when set
+extern int hostVerbose;
+//  counts the IOSleep calls, the polled paths should not make any
+extern UInt32 hostSleeps;
+//  the kern_os_malloc blocks not freed yet, and all there were
+extern UInt32 hostAllocations, hostAllocationsMade;
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+#include "HostObjects.h"
+#endif
+
+#endif
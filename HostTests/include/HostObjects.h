@@ -0,0 +1,500 @@
+#ifndef _HOST_OBJECTS_H
+#define _HOST_OBJECTS_H
+
+// The libkern containers and the parts of IOService the drivers use.
+//  Properties are kept, serializers run when the property is serialized
+//  (hostSerializeProperty), interrupts registered on a HostInterruptNub
+//  are delivered by the models through HostInterruptNub::deliver.
+//
+//  Device memory has no mapping of its own: a map's virtual address is
+//  the physical address, which the models decode, since every register
+//  access of a driver built for them goes through the model.
+
+class OSObject;
+class OSSerialize;
+class IOService;
+class IOInterruptEventSource;
+class IOWorkLoop;
+class IOCommandGate;
+class IOTimerEventSource;
+class IOUserClient;
+class IOMemoryMap;
+class IODeviceMemory;
+class IOInterruptController;
+
+class OSMetaClass {
+public:
+	const char *className;
+	const OSMetaClass * const *superClassLink;
+
+	OSMetaClass(const char *name, const OSMetaClass * const *superLink)
+		: className(name), superClassLink(superLink) { }
+
+	const char *getClassName() const { return className; }
+	const OSMetaClass *getSuperClass() const { return superClassLink ? *superClassLink : 0; }
+};
+
+#define OSTypeID(type)		(type::metaClass)
+#define OSDynamicCast(type, inst) \
+	((type *) OSObject::safeMetaCast((const OSObject *) (inst), OSTypeID(type)))
+
+#define OSDeclareDefaultStructors(className) \
+public: \
+	static const OSMetaClass * const metaClass; \
+	virtual const OSMetaClass *getMetaClass() const; \
+	className(); \
+protected: \
+	virtual ~className();
+
+#define OSDeclareAbstractStructors(className)	OSDeclareDefaultStructors(className)
+
+#define OSDefineMetaClassAndStructors(className, superClassName) \
+	static const OSMetaClass className##HostMetaClass(#className, &superClassName::metaClass); \
+	const OSMetaClass * const className::metaClass = &className##HostMetaClass; \
+	const OSMetaClass *className::getMetaClass() const { return metaClass; } \
+	className::className() { } \
+	className::~className() { }
+
+#define OSDefineMetaClassAndAbstractStructors(className, superClassName) \
+	OSDefineMetaClassAndStructors(className, superClassName)
+
+#define OSMetaClassDeclareReservedUnused(className, index)
+#define OSMetaClassDefineReservedUnused(className, index)
+
+class OSObject {
+	int retainCount;
+
+public:
+	static const OSMetaClass * const metaClass;
+	virtual const OSMetaClass *getMetaClass() const;
+
+	OSObject() : retainCount(1) { }
+
+	// Zeroed, as the kernel's are
+	static void *operator new(size_t size);
+	static void operator delete(void *mem, size_t size);
+
+	void retain() const;
+	void release() const;
+	int getRetainCount() const { return retainCount; }
+
+	virtual bool init() { return true; }
+	virtual void free();
+	virtual bool serialize(OSSerialize *s) const;
+
+	bool isEqualTo(const OSObject *other) const { return this == other; }
+	const OSObject *metaCast(const char *className) const;
+	static const OSObject *safeMetaCast(const OSObject *object, const OSMetaClass *toType);
+
+protected:
+	virtual ~OSObject() { }
+};
+
+class OSSerialize : public OSObject {
+	OSDeclareDefaultStructors(OSSerialize)
+
+	char *buffer;
+	unsigned int length;
+	unsigned int capacity;
+
+public:
+	static OSSerialize *withCapacity(unsigned int capacity);
+	bool addString(const char *string);
+	bool addFormat(const char *format, ...) __attribute__((format(printf, 2, 3)));
+	const char *text() const { return buffer ? buffer : ""; }
+	virtual void free();
+};
+
+class OSSymbol : public OSObject {
+	OSDeclareDefaultStructors(OSSymbol)
+
+	char *string;
+
+public:
+	static const OSSymbol *withCString(const char *cString);
+	static const OSSymbol *withCStringNoCopy(const char *cString) { return withCString(cString); }
+	const char *getCStringNoCopy() const { return string; }
+	bool isEqualTo(const char *cString) const { return strcmp(string, cString) == 0; }
+	bool isEqualTo(const OSSymbol *symbol) const { return symbol && (strcmp(string, symbol->string) == 0); }
+	virtual bool serialize(OSSerialize *s) const;
+	virtual void free();
+};
+
+typedef OSSymbol OSString;
+
+class OSNumber : public OSObject {
+	OSDeclareDefaultStructors(OSNumber)
+
+	unsigned long long value;
+	unsigned int size;
+
+public:
+	static OSNumber *withNumber(unsigned long long value, unsigned int numberOfBits);
+	unsigned int numberOfBits() const { return size; }
+	unsigned long long unsigned64BitValue() const { return value; }
+	unsigned int unsigned32BitValue() const { return (unsigned int) value; }
+	unsigned short unsigned16BitValue() const { return (unsigned short) value; }
+	unsigned char unsigned8BitValue() const { return (unsigned char) value; }
+	void setValue(unsigned long long newValue) { value = newValue; }
+	virtual bool serialize(OSSerialize *s) const;
+};
+
+class OSBoolean : public OSObject {
+	OSDeclareDefaultStructors(OSBoolean)
+
+	bool value;
+
+public:
+	static OSBoolean *withBoolean(bool value);
+	static OSBoolean *hostMake(bool value);
+	bool isTrue() const { return value; }
+	bool isFalse() const { return !value; }
+	virtual bool serialize(OSSerialize *s) const;
+};
+
+extern OSBoolean *kOSBooleanTrue;
+extern OSBoolean *kOSBooleanFalse;
+
+class OSData : public OSObject {
+	OSDeclareDefaultStructors(OSData)
+
+	void *data;
+	unsigned int length;
+
+public:
+	static OSData *withBytes(const void *bytes, unsigned int numBytes);
+	const void *getBytesNoCopy() const { return data; }
+	unsigned int getLength() const { return length; }
+	unsigned int getCapacity() const { return length; }
+	virtual bool serialize(OSSerialize *s) const;
+	virtual void free();
+};
+
+class OSArray : public OSObject {
+	OSDeclareDefaultStructors(OSArray)
+
+	OSObject **array;
+	unsigned int count;
+	unsigned int capacity;
+
+public:
+	static OSArray *withCapacity(unsigned int capacity);
+	bool setObject(const OSObject *object);
+	bool setObject(unsigned int index, const OSObject *object);
+	OSObject *getObject(unsigned int index) const { return (index < count) ? array[index] : 0; }
+	unsigned int getCount() const { return count; }
+	virtual bool serialize(OSSerialize *s) const;
+	virtual void free();
+};
+
+class OSDictionary : public OSObject {
+	OSDeclareDefaultStructors(OSDictionary)
+
+	const OSSymbol **keys;
+	OSObject **values;
+	unsigned int count;
+	unsigned int capacity;
+
+public:
+	static OSDictionary *withCapacity(unsigned int capacity);
+	bool setObject(const char *key, const OSObject *object);
+	bool setObject(const OSSymbol *key, const OSObject *object) { return setObject(key->getCStringNoCopy(), object); }
+	OSObject *getObject(const char *key) const;
+	OSObject *getObject(const OSSymbol *key) const { return getObject(key->getCStringNoCopy()); }
+	void removeObject(const char *key);
+	unsigned int getCount() const { return count; }
+	virtual bool serialize(OSSerialize *s) const;
+	virtual void free();
+};
+
+class OSCollectionIterator : public OSObject {
+	OSDeclareDefaultStructors(OSCollectionIterator)
+
+	OSArray *array;
+	unsigned int index;
+
+public:
+	static OSCollectionIterator *withCollection(const OSArray *array);
+	OSObject *getNextObject();
+	virtual void free();
+};
+
+class OSSerializer : public OSObject {
+	OSDeclareDefaultStructors(OSSerializer)
+
+public:
+	typedef bool (*OSSerializerCallback)(void *target, void *ref, OSSerialize *s);
+
+private:
+	void *target;
+	void *ref;
+	OSSerializerCallback callback;
+
+public:
+	static OSSerializer *forTarget(void *target, OSSerializerCallback callback, void *ref = 0);
+	virtual bool serialize(OSSerialize *s) const;
+};
+
+typedef void (*IOInterruptAction)(OSObject *target, void *refCon, IOService *nub, int source);
+
+class IOMemoryMap : public OSObject {
+	OSDeclareDefaultStructors(IOMemoryMap)
+
+	IOPhysicalAddress address;
+	IOByteCount length;
+
+public:
+	static IOMemoryMap *withRange(IOPhysicalAddress address, IOByteCount length);
+	IOVirtualAddress getVirtualAddress() { return (IOVirtualAddress) address; }
+	IOPhysicalAddress getPhysicalAddress() { return address; }
+	IOByteCount getLength() { return length; }
+};
+
+class IODeviceMemory : public OSObject {
+	OSDeclareDefaultStructors(IODeviceMemory)
+
+	IOPhysicalAddress address;
+	IOByteCount length;
+	IOOptionBits tag;
+
+public:
+	static IODeviceMemory *withRange(IOPhysicalAddress address, IOByteCount length);
+	IOPhysicalAddress getPhysicalAddress() { return address; }
+	IOByteCount getLength() { return length; }
+	void setTag(IOOptionBits newTag) { tag = newTag; }
+	IOOptionBits getTag() { return tag; }
+	IOMemoryMap *map(IOOptionBits options = 0) { return IOMemoryMap::withRange(address, length); }
+};
+
+// Only the device tree plane, and only the parent link
+typedef struct IORegistryPlane { const char *name; } IORegistryPlane;
+extern const IORegistryPlane *gIODTPlane;
+extern const OSSymbol *gIODTDefaultInterruptController;
+
+extern const OSSymbol *gIOInterruptControllersKey;
+extern const OSSymbol *gIOInterruptSpecifiersKey;
+
+class IORegistryEntry : public OSObject {
+	OSDeclareDefaultStructors(IORegistryEntry)
+
+	OSDictionary *properties;
+	const OSSymbol *name;
+	IORegistryEntry *parent;
+
+public:
+	virtual bool init(OSDictionary *dictionary = 0);
+	// the properties and name of a device tree entry
+	virtual bool init(IORegistryEntry *from, const IORegistryPlane *plane);
+	virtual void free();
+
+	virtual const char *getName(const IORegistryPlane *plane = 0) const;
+	virtual void setName(const char *newName, const IORegistryPlane *plane = 0);
+	virtual bool compareName(OSString *name, OSString **matched = 0) const;
+
+	virtual bool attachToParent(IORegistryEntry *newParent, const IORegistryPlane *plane);
+	virtual void detachFromParent(IORegistryEntry *oldParent, const IORegistryPlane *plane);
+	void detachAll(const IORegistryPlane *plane);
+	IORegistryEntry *getParentEntry(const IORegistryPlane *plane) const { return parent; }
+
+	OSObject *getProperty(const char *key) const;
+	OSObject *getProperty(const OSSymbol *key) const { return getProperty(key->getCStringNoCopy()); }
+	bool setProperty(const char *key, OSObject *object);
+	bool setProperty(const OSSymbol *key, OSObject *object) { return setProperty(key->getCStringNoCopy(), object); }
+	bool setProperty(const char *key, bool value);
+	bool setProperty(const char *key, unsigned long long value, unsigned int numberOfBits);
+	bool setProperty(const char *key, const char *value);
+	void removeProperty(const char *key);
+	OSDictionary *getPropertyTable() const { return properties; }
+};
+
+class IOService : public IORegistryEntry {
+	OSDeclareDefaultStructors(IOService)
+
+	IOService *provider;
+
+public:
+	virtual bool attach(IOService *provider);
+	virtual void detach(IOService *provider);
+	IOService *getProvider() const { return provider; }
+
+	virtual bool start(IOService *provider);
+	virtual void stop(IOService *provider);
+	virtual void registerService(IOOptionBits options = 0) { }
+	virtual IOReturn setProperties(OSObject *properties) { return kIOReturnUnsupported; }
+	virtual IOService *matchLocation(IOService *client) { return this; }
+	virtual IOReturn getResources(void) { return kIOReturnSuccess; }
+
+	// the "IODeviceMemory" property, an array of IODeviceMemory
+	OSArray *getDeviceMemory() const;
+	void setDeviceMemory(OSArray *array);
+	IODeviceMemory *getDeviceMemoryWithIndex(unsigned int index) const;
+	IOMemoryMap *mapDeviceMemoryWithIndex(unsigned int index, IOOptionBits options = 0);
+
+	virtual IOReturn callPlatformFunction(const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	virtual IOReturn callPlatformFunction(const char *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+
+	virtual IOReturn registerInterrupt(int source, OSObject *target, IOInterruptAction handler, void *refCon = 0);
+	virtual IOReturn unregisterInterrupt(int source);
+	virtual IOReturn enableInterrupt(int source);
+	virtual IOReturn disableInterrupt(int source);
+	virtual IOReturn causeInterrupt(int source);
+
+	const char *stringFromReturn(IOReturn rtn);
+};
+
+// The provider the models hand to the drivers as their interrupt source
+class HostInterruptNub : public IOService {
+	OSDeclareDefaultStructors(HostInterruptNub)
+
+public:
+	enum { kHostMaxSources = 32 };
+
+	struct Source {
+		OSObject *target;
+		IOInterruptAction handler;
+		void *refCon;
+		bool enabled;
+		UInt32 deliveries;
+		UInt32 caused;		// causeInterrupt calls not delivered yet
+	} sources[kHostMaxSources];
+
+	virtual IOReturn registerInterrupt(int source, OSObject *target, IOInterruptAction handler, void *refCon = 0);
+	virtual IOReturn unregisterInterrupt(int source);
+	virtual IOReturn enableInterrupt(int source);
+	virtual IOReturn disableInterrupt(int source);
+	// only counted: the model decides when the interrupt comes
+	virtual IOReturn causeInterrupt(int source);
+
+	// Calls the handler of source if it is registered and enabled
+	bool deliver(int source);
+};
+
+// IOInterruptController as in IOKit, except that a nub's source is the
+//  vector number: there are no interrupt specifiers to look up.
+typedef void (*IOInterruptHandler)(void *target, void *refCon, void *nub, int source);
+
+struct IOInterruptVector {
+	volatile char interruptActive;
+	volatile char interruptDisabledSoft;
+	volatile char interruptDisabledHard;
+	volatile char interruptRegistered;
+	IOLock *interruptLock;
+	IOService *nub;
+	long source;
+	void *target;
+	IOInterruptHandler handler;
+	void *refCon;
+};
+
+#define kIOInterruptTypeEdge	0
+#define kIOInterruptTypeLevel	1
+
+class IOInterruptController : public IOService {
+	OSDeclareAbstractStructors(IOInterruptController)
+
+protected:
+	IOInterruptVector *vectors;
+	IOSimpleLock *controllerLock;
+
+public:
+	virtual IOReturn registerInterrupt(IOService *nub, int source, void *target,
+		IOInterruptHandler handler, void *refCon);
+	virtual IOReturn unregisterInterrupt(IOService *nub, int source);
+	virtual IOReturn getInterruptType(IOService *nub, int source, int *interruptType);
+	virtual IOReturn enableInterrupt(IOService *nub, int source);
+	virtual IOReturn disableInterrupt(IOService *nub, int source);
+	virtual IOReturn causeInterrupt(IOService *nub, int source);
+
+	virtual IOInterruptAction getInterruptHandlerAddress(void) = 0;
+	virtual IOReturn handleInterrupt(void *refCon, IOService *nub, int source) = 0;
+
+	virtual bool vectorCanBeShared(long vectorNumber, IOInterruptVector *vector);
+	virtual void initVector(long vectorNumber, IOInterruptVector *vector);
+	virtual int getVectorType(long vectorNumber, IOInterruptVector *vector);
+	virtual void disableVectorHard(long vectorNumber, IOInterruptVector *vector);
+	virtual void enableVector(long vectorNumber, IOInterruptVector *vector);
+	virtual void causeVector(long vectorNumber, IOInterruptVector *vector);
+};
+
+// The device tree below a nub. The host has none: nothing is found to
+//  publish and nothing is resolved.
+enum {
+	kIODTRecursive	= 0x00000001,
+	kIODTExclusive	= 0x00000002
+};
+
+OSCollectionIterator *IODTFindMatchingEntries(IORegistryEntry *from, IOOptionBits options, const char *keys);
+bool IODTCompareNubName(const IORegistryEntry *regEntry, OSString *name, OSString **matched);
+OSArray *IODTResolveAddressing(IORegistryEntry *regEntry, const char *addressPropertyName, IODeviceMemory *parent);
+
+// A work loop, its event sources and their timers. There is one thread:
+//  a timer is a thread call, run by hostRunThreadCalls when it is due.
+class IOEventSource : public OSObject {
+	OSDeclareAbstractStructors(IOEventSource)
+
+protected:
+	OSObject *owner;
+	IOWorkLoop *workLoop;
+
+public:
+	virtual bool init(OSObject *owner);
+	void setWorkLoop(IOWorkLoop *newWorkLoop) { workLoop = newWorkLoop; }
+	IOWorkLoop *getWorkLoop() const { return workLoop; }
+};
+
+class IOWorkLoop : public OSObject {
+	OSDeclareDefaultStructors(IOWorkLoop)
+
+public:
+	static IOWorkLoop *workLoop();
+	virtual IOReturn addEventSource(IOEventSource *newEvent);
+	virtual IOReturn removeEventSource(IOEventSource *toRemove);
+};
+
+class IOTimerEventSource : public IOEventSource {
+	OSDeclareDefaultStructors(IOTimerEventSource)
+
+public:
+	typedef void (*Action)(OSObject *owner, IOTimerEventSource *sender);
+
+private:
+	Action action;
+	thread_call_t call;
+
+	static void timeout(thread_call_param_t me, thread_call_param_t unused);
+
+public:
+	static IOTimerEventSource *timerEventSource(OSObject *owner, Action action = 0);
+	virtual void free();
+
+	IOReturn setTimeoutTicks(UInt32 ticks);		// of 10 ms
+	IOReturn setTimeoutMS(UInt32 ms);
+	IOReturn setTimeoutUS(UInt32 us);
+	IOReturn setTimeout(UInt32 interval, UInt32 scaleFactor);
+	void cancelTimeout();
+};
+
+// Keeps the interrupt controllers by name, for the harnesses to find
+class IOPlatformExpert : public IOService {
+	OSDeclareDefaultStructors(IOPlatformExpert)
+
+	enum { kHostMaxControllers = 8 };
+
+	const OSSymbol *names[kHostMaxControllers];
+	IOInterruptController *controllers[kHostMaxControllers];
+
+public:
+	virtual IOReturn registerInterruptController(const OSSymbol *name, IOInterruptController *controller);
+	virtual IOInterruptController *lookUpInterruptController(const OSSymbol *name);
+	IOInterruptController *lookUpInterruptController(const char *name);
+	virtual void setCPUInterruptProperties(IOService *service) { }
+};
+
+IOPlatformExpert *getPlatform(void);
+
+// Serializes a property as the registry would, for the reports
+const char *hostSerializeProperty(IOService *service, const char *key, OSSerialize *s);
+
+#endif
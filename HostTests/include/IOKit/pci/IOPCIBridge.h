@@ -0,0 +1,51 @@
+#ifndef _HOST_IOPCIBRIDGE_H
+#define _HOST_IOPCIBRIDGE_H
+
+#include "../../HostKernel.h"
+
+// Enough of IOPCIBridge for a bridge driver to build and start. There is
+// no bus to probe: the harness creates the nubs it needs.
+
+union IOPCIAddressSpace {
+	UInt32 bits;
+	struct {
+		unsigned int registerNum:8;
+		unsigned int functionNum:3;
+		unsigned int deviceNum:5;
+		unsigned int busNum:8;
+		unsigned int space:2;
+		unsigned int resv:3;
+		unsigned int t:1;
+		unsigned int prefetch:1;
+		unsigned int reloc:1;
+	} s;
+};
+
+class IOPCIBridge : public IOService {
+	OSDeclareAbstractStructors(IOPCIBridge)
+
+protected:
+	virtual UInt8 firstBusNum(void) = 0;
+	virtual UInt8 lastBusNum(void) = 0;
+
+	bool addBridgeMemoryRange(IOPhysicalAddress start, IOPhysicalLength length, bool host) { return true; }
+	bool addBridgeIORange(IOByteCount start, IOByteCount length) { return true; }
+
+public:
+	virtual bool start(IOService *provider) { return IOService::start(provider) && configure(provider); }
+	virtual bool configure(IOService *provider) { return true; }
+
+	virtual IODeviceMemory *ioDeviceMemory(void) = 0;
+	virtual IOReturn getNubResources(IOService *service) { return kIOReturnSuccess; }
+
+	virtual UInt32 configRead32(IOPCIAddressSpace space, UInt8 offset) = 0;
+	virtual void configWrite32(IOPCIAddressSpace space, UInt8 offset, UInt32 data) = 0;
+	virtual UInt16 configRead16(IOPCIAddressSpace space, UInt8 offset) = 0;
+	virtual void configWrite16(IOPCIAddressSpace space, UInt8 offset, UInt16 data) = 0;
+	virtual UInt8 configRead8(IOPCIAddressSpace space, UInt8 offset) = 0;
+	virtual void configWrite8(IOPCIAddressSpace space, UInt8 offset, UInt8 data) = 0;
+
+	virtual IOPCIAddressSpace getBridgeSpace(void) = 0;
+};
+
+#endif
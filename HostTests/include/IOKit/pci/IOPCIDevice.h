@@ -0,0 +1,26 @@
+#ifndef _HOST_IOPCIDEVICE_H
+#define _HOST_IOPCIDEVICE_H
+
+#include "IOPCIBridge.h"
+
+enum {
+	kIOPCIConfigVendorID		= 0x00,
+	kIOPCIConfigDeviceID		= 0x02,
+	kIOPCIConfigCommand		= 0x04,
+	kIOPCIConfigStatus		= 0x06,
+	kIOPCIConfigRevisionID		= 0x08,
+	kIOPCIConfigClassCode		= 0x09,
+	kIOPCIConfigCacheLineSize	= 0x0C,
+	kIOPCIConfigLatencyTimer	= 0x0D,
+	kIOPCIConfigHeaderType		= 0x0E,
+	kIOPCIConfigBaseAddress0	= 0x10
+};
+
+class IOPCIDevice : public IOService {
+	OSDeclareDefaultStructors(IOPCIDevice)
+
+public:
+	IOPCIAddressSpace space;
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef _HOST_APPLEMACIODEVICE_H
+#define _HOST_APPLEMACIODEVICE_H
+
+#include "../../HostKernel.h"
+
+// A nub below a Mac I/O controller, without the device tree to resolve
+class AppleMacIODevice : public IOService {
+	OSDeclareDefaultStructors(AppleMacIODevice)
+
+public:
+	virtual bool compareName(OSString *name, OSString **matched = 0) const;
+	virtual IOService *matchLocation(IOService *client);
+	virtual IOReturn getResources(void);
+};
+
+#endif
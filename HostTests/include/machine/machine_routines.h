@@ -0,0 +1,4 @@
+// Included inside extern "C" by some drivers
+extern "C++" {
+#include "../HostKernel.h"
+}
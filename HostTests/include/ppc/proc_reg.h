@@ -0,0 +1,24 @@
+#ifndef _HOST_PPC_PROC_REG_H
+#define _HOST_PPC_PROC_REG_H
+
+#include "../HostKernel.h"
+
+// What the drivers use of the processor: one thread has nothing to order,
+//  and the timebase is AbsoluteTime's low word, as it is on the PowerBook
+#define sync()		__asm__ volatile("" : : : "memory")
+#define isync()		__asm__ volatile("" : : : "memory")
+
+static inline unsigned int cntlzw(unsigned int num)
+{
+	return num ? __builtin_clz(num) : 32;
+}
+
+static inline unsigned int mftb(void)
+{
+	AbsoluteTime now;
+
+	clock_get_uptime(&now);
+	return (unsigned int) now;
+}
+
+#endif
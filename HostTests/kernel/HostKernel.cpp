@@ -0,0 +1,415 @@
+#include "HostKernel.h"
+
+// The kernel side of the host build: virtual time, logging, locks,
+// semaphores and thread calls.
+
+int hostVerbose = 0;
+UInt32 hostSleeps = 0;
+UInt32 hostAllocations = 0;
+UInt32 hostAllocationsMade = 0;
+UInt32 hostTimebaseHz = 1000000000;
+
+static UInt64 gNow = 0;
+
+static HostWaitHook gWaitHook = 0;
+static void *gWaitHookRef = 0;
+
+// Time:
+// -----
+
+UInt64 hostNow(void)
+{
+	return gNow;
+}
+
+void hostAdvance(UInt64 nanoseconds)
+{
+	gNow += nanoseconds;
+}
+
+// Ticks in whole nanoseconds, rounded down, and back, rounded up: a
+//  deadline turned into nanoseconds is due at those nanoseconds
+static UInt64 toAbsolute(UInt64 nanoseconds)
+{
+	if (hostTimebaseHz == kSecondScale)
+		return nanoseconds;
+	return (UInt64) (((unsigned __int128) nanoseconds * hostTimebaseHz) / kSecondScale);
+}
+
+static UInt64 toNanoseconds(UInt64 ticks)
+{
+	if (hostTimebaseHz == kSecondScale)
+		return ticks;
+	return (UInt64) (((unsigned __int128) ticks * kSecondScale + hostTimebaseHz - 1) / hostTimebaseHz);
+}
+
+void clock_get_uptime(AbsoluteTime *result)
+{
+	*result = toAbsolute(gNow);
+}
+
+void clock_interval_to_deadline(UInt32 interval, UInt32 scaleFactor, AbsoluteTime *result)
+{
+	*result = toAbsolute(gNow) + toAbsolute((UInt64) interval * scaleFactor);
+}
+
+void clock_interval_to_absolutetime_interval(UInt32 interval, UInt32 scaleFactor, AbsoluteTime *result)
+{
+	*result = toAbsolute((UInt64) interval * scaleFactor);
+}
+
+void absolutetime_to_nanoseconds(AbsoluteTime abstime, UInt64 *result)
+{
+	*result = toNanoseconds(abstime);
+}
+
+void nanoseconds_to_absolutetime(UInt64 nanoseconds, AbsoluteTime *result)
+{
+	*result = toAbsolute(nanoseconds);
+}
+
+void IODelay(UInt32 microseconds)
+{
+	gNow += (UInt64) microseconds * 1000;
+}
+
+void IOSleep(UInt32 milliseconds)
+{
+	hostSleeps++;
+	gNow += (UInt64) milliseconds * 1000000;
+}
+
+void delay_for_interval(natural_t interval, natural_t scaleFactor)
+{
+	gNow += (UInt64) interval * scaleFactor;
+}
+
+static boolean_t gInterruptsEnabled = true;
+
+boolean_t ml_set_interrupts_enabled(boolean_t enable)
+{
+	boolean_t old = gInterruptsEnabled;
+
+	gInterruptsEnabled = enable;
+	return old;
+}
+
+// Logging:
+// --------
+
+void IOLog(const char *format, ...)
+{
+	va_list args;
+
+	if (!hostVerbose)
+		return;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+void kprintf(const char *format, ...)
+{
+	va_list args;
+
+	if (!hostVerbose)
+		return;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+void panic(const char *format, ...)
+{
+	va_list args;
+
+	fprintf(stderr, "panic: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	abort();
+}
+
+// Memory:
+// -------
+
+void *IOMalloc(IOByteCount size)
+{
+	return calloc(1, size);
+}
+
+void IOFree(void *address, IOByteCount size)
+{
+	free(address);
+}
+
+void *kern_os_malloc(size_t size)
+{
+	void *address = calloc(1, size);
+
+	if (address) {
+		hostAllocations++;
+		hostAllocationsMade++;
+	}
+	return address;
+}
+
+void kern_os_free(void *address)
+{
+	if (address)
+		hostAllocations--;
+	free(address);
+}
+
+// Locks:
+// ------
+
+IOLock *IOLockAlloc(void)
+{
+	return (IOLock *) calloc(1, sizeof(IOLock));
+}
+
+void IOLockFree(IOLock *lock)
+{
+	if (lock->held)
+		panic("IOLockFree of a held lock");
+	free(lock);
+}
+
+void IOLockLock(IOLock *lock)
+{
+	if (lock->held)
+		panic("IOLockLock would deadlock");
+	lock->held = 1;
+}
+
+void IOLockUnlock(IOLock *lock)
+{
+	if (!lock->held)
+		panic("IOLockUnlock of a free lock");
+	lock->held = 0;
+}
+
+IOSimpleLock *IOSimpleLockAlloc(void)
+{
+	return IOLockAlloc();
+}
+
+void IOSimpleLockFree(IOSimpleLock *lock)
+{
+	IOLockFree(lock);
+}
+
+void IOSimpleLockLock(IOSimpleLock *lock)
+{
+	IOLockLock(lock);
+}
+
+void IOSimpleLockUnlock(IOSimpleLock *lock)
+{
+	IOLockUnlock(lock);
+}
+
+IOInterruptState IOSimpleLockLockDisableInterrupt(IOSimpleLock *lock)
+{
+	IOLockLock(lock);
+	return 0;
+}
+
+void IOSimpleLockUnlockEnableInterrupt(IOSimpleLock *lock, IOInterruptState state)
+{
+	IOLockUnlock(lock);
+}
+
+// Semaphores:
+// -----------
+
+task_t current_task(void)
+{
+	return 0;
+}
+
+void hostSetWaitHook(HostWaitHook hook, void *ref)
+{
+	gWaitHook = hook;
+	gWaitHookRef = ref;
+}
+
+kern_return_t semaphore_create(task_t task, semaphore_t *semaphore, int policy, int value)
+{
+	*semaphore = (semaphore_t) calloc(1, sizeof(struct semaphore));
+	(*semaphore)->count = value;
+	return KERN_SUCCESS;
+}
+
+kern_return_t semaphore_destroy(task_t task, semaphore_t semaphore)
+{
+	free(semaphore);
+	return KERN_SUCCESS;
+}
+
+kern_return_t semaphore_wait(semaphore_t semaphore)
+{
+	while (semaphore->count == 0)
+		if ((gWaitHook == 0) || !gWaitHook(gWaitHookRef))
+			return KERN_OPERATION_TIMED_OUT;
+
+	semaphore->count--;
+	return KERN_SUCCESS;
+}
+
+kern_return_t semaphore_signal(semaphore_t semaphore)
+{
+	semaphore->count++;
+	return KERN_SUCCESS;
+}
+
+// Thread calls:
+// -------------
+
+struct HostThreadCall {
+	thread_call_func_t func;
+	thread_call_param_t param0;
+	thread_call_param_t param1;
+	UInt64 deadline;
+	bool pending;
+	HostThreadCall *next;
+};
+
+static HostThreadCall *gThreadCalls = 0;
+
+thread_call_t thread_call_allocate(thread_call_func_t func, thread_call_param_t param0)
+{
+	HostThreadCall *call = (HostThreadCall *) calloc(1, sizeof(HostThreadCall));
+
+	call->func = func;
+	call->param0 = param0;
+	call->next = gThreadCalls;
+	gThreadCalls = call;
+
+	return call;
+}
+
+int thread_call_free(thread_call_t call)
+{
+	HostThreadCall **link;
+
+	for (link = &gThreadCalls; *link != 0; link = &(*link)->next)
+		if (*link == call) {
+			*link = call->next;
+			free(call);
+			return 1;
+		}
+
+	return 0;
+}
+
+int thread_call_enter_delayed(thread_call_t call, AbsoluteTime deadline)
+{
+	int wasPending = call->pending;
+
+	call->deadline = deadline;
+	call->pending = true;
+
+	return wasPending;
+}
+
+int thread_call_enter(thread_call_t call)
+{
+	return thread_call_enter_delayed(call, toAbsolute(gNow));
+}
+
+int thread_call_enter1(thread_call_t call, thread_call_param_t param1)
+{
+	call->param1 = param1;
+	return thread_call_enter(call);
+}
+
+int thread_call_cancel(thread_call_t call)
+{
+	int wasPending = call->pending;
+
+	call->pending = false;
+
+	return wasPending;
+}
+
+int hostRunThreadCalls(void)
+{
+	HostThreadCall *call;
+	int ran = 0;
+	bool again;
+
+	// A call can queue or free calls, so start over after each one
+	do {
+		again = false;
+		for (call = gThreadCalls; call != 0; call = call->next)
+			if (call->pending && (call->deadline <= toAbsolute(gNow))) {
+				call->pending = false;
+				call->func(call->param0, call->param1);
+				ran++;
+				again = true;
+				break;
+			}
+	} while (again);
+
+	return ran;
+}
+
+UInt64 hostNextThreadCall(void)
+{
+	HostThreadCall *call;
+	UInt64 next = 0;
+
+	for (call = gThreadCalls; call != 0; call = call->next)
+		if (call->pending && ((next == 0) || (toNanoseconds(call->deadline) < next)))
+			next = toNanoseconds(call->deadline);
+
+	return next;
+}
+
+// Atomics:
+// --------
+
+Boolean OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, UInt32 *address)
+{
+	if (*address != oldValue)
+		return false;
+	*address = newValue;
+	return true;
+}
+
+SInt32 OSAddAtomic(SInt32 amount, SInt32 *address)
+{
+	SInt32 old = *address;
+
+	*address = old + amount;
+	return old;
+}
+
+SInt32 OSIncrementAtomic(SInt32 *address)
+{
+	return OSAddAtomic(1, address);
+}
+
+SInt32 OSDecrementAtomic(SInt32 *address)
+{
+	return OSAddAtomic(-1, address);
+}
+
+UInt8 OSBitAndAtomic8(UInt32 mask, UInt8 *address)
+{
+	UInt8 old = *address;
+
+	*address = old & mask;
+	return old;
+}
+
+UInt8 OSBitOrAtomic8(UInt32 mask, UInt8 *address)
+{
+	UInt8 old = *address;
+
+	*address = old | mask;
+	return old;
+}
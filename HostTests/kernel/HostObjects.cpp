@@ -0,0 +1,1049 @@
+#include "HostKernel.h"
+#include "IOKit/pci/IOPCIDevice.h"
+#include "IOKit/platform/AppleMacIODevice.h"
+
+// libkern containers and IOService for the host build.
+
+// OSObject:
+// ---------
+
+static const OSMetaClass gOSObjectMetaClass("OSObject", 0);
+const OSMetaClass * const OSObject::metaClass = &gOSObjectMetaClass;
+
+const OSMetaClass *OSObject::getMetaClass() const
+{
+	return metaClass;
+}
+
+void *OSObject::operator new(size_t size)
+{
+	void *mem = calloc(1, size);
+
+	if (mem == 0)
+		abort();
+	return mem;
+}
+
+void OSObject::operator delete(void *mem, size_t size)
+{
+	::free(mem);
+}
+
+void OSObject::retain() const
+{
+	((OSObject *) this)->retainCount++;
+}
+
+void OSObject::release() const
+{
+	if (--((OSObject *) this)->retainCount == 0)
+		((OSObject *) this)->free();
+}
+
+void OSObject::free()
+{
+	delete this;
+}
+
+bool OSObject::serialize(OSSerialize *s) const
+{
+	return s->addFormat("<%s>", getMetaClass()->getClassName());
+}
+
+const OSObject *OSObject::metaCast(const char *className) const
+{
+	const OSMetaClass *meta;
+
+	for (meta = getMetaClass(); meta != 0; meta = meta->getSuperClass())
+		if (strcmp(meta->getClassName(), className) == 0)
+			return this;
+
+	return 0;
+}
+
+const OSObject *OSObject::safeMetaCast(const OSObject *object, const OSMetaClass *toType)
+{
+	const OSMetaClass *meta;
+
+	if (object == 0)
+		return 0;
+
+	for (meta = object->getMetaClass(); meta != 0; meta = meta->getSuperClass())
+		if (meta == toType)
+			return object;
+
+	return 0;
+}
+
+// OSSerialize:
+// ------------
+
+OSDefineMetaClassAndStructors(OSSerialize, OSObject)
+
+OSSerialize *OSSerialize::withCapacity(unsigned int capacity)
+{
+	OSSerialize *s = new OSSerialize;
+
+	s->capacity = capacity ? capacity : 256;
+	s->buffer = (char *) calloc(1, s->capacity);
+	return s;
+}
+
+bool OSSerialize::addString(const char *string)
+{
+	unsigned int add = strlen(string);
+
+	if (length + add + 1 > capacity) {
+		while (length + add + 1 > capacity)
+			capacity *= 2;
+		buffer = (char *) realloc(buffer, capacity);
+	}
+	memcpy(buffer + length, string, add + 1);
+	length += add;
+
+	return true;
+}
+
+bool OSSerialize::addFormat(const char *format, ...)
+{
+	char text[256];
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+
+	return addString(text);
+}
+
+void OSSerialize::free()
+{
+	::free(buffer);
+	OSObject::free();
+}
+
+// OSSymbol:
+// ---------
+
+OSDefineMetaClassAndStructors(OSSymbol, OSObject)
+
+const OSSymbol *OSSymbol::withCString(const char *cString)
+{
+	OSSymbol *symbol = new OSSymbol;
+
+	symbol->string = strdup(cString);
+	return symbol;
+}
+
+bool OSSymbol::serialize(OSSerialize *s) const
+{
+	return s->addFormat("\"%s\"", string);
+}
+
+void OSSymbol::free()
+{
+	::free(string);
+	OSObject::free();
+}
+
+// OSNumber:
+// ---------
+
+OSDefineMetaClassAndStructors(OSNumber, OSObject)
+
+OSNumber *OSNumber::withNumber(unsigned long long value, unsigned int numberOfBits)
+{
+	OSNumber *number = new OSNumber;
+
+	number->size = numberOfBits;
+	number->value = (numberOfBits < 64) ? (value & ((1ULL << numberOfBits) - 1)) : value;
+	return number;
+}
+
+bool OSNumber::serialize(OSSerialize *s) const
+{
+	return s->addFormat("%llu", value);
+}
+
+// OSBoolean:
+// ----------
+
+OSDefineMetaClassAndStructors(OSBoolean, OSObject)
+
+OSBoolean *OSBoolean::withBoolean(bool value)
+{
+	return value ? kOSBooleanTrue : kOSBooleanFalse;
+}
+
+bool OSBoolean::serialize(OSSerialize *s) const
+{
+	return s->addString(value ? "Yes" : "No");
+}
+
+OSBoolean *OSBoolean::hostMake(bool value)
+{
+	OSBoolean *boolean = new OSBoolean;
+
+	boolean->value = value;
+	return boolean;
+}
+
+OSBoolean *kOSBooleanTrue = OSBoolean::hostMake(true);
+OSBoolean *kOSBooleanFalse = OSBoolean::hostMake(false);
+
+// OSData:
+// -------
+
+OSDefineMetaClassAndStructors(OSData, OSObject)
+
+OSData *OSData::withBytes(const void *bytes, unsigned int numBytes)
+{
+	OSData *d = new OSData;
+
+	d->data = malloc(numBytes ? numBytes : 1);
+	memcpy(d->data, bytes, numBytes);
+	d->length = numBytes;
+	return d;
+}
+
+bool OSData::serialize(OSSerialize *s) const
+{
+	unsigned int i;
+
+	s->addString("<");
+	for (i = 0; i < length; i++)
+		s->addFormat("%02x", ((UInt8 *) data)[i]);
+	return s->addString(">");
+}
+
+void OSData::free()
+{
+	::free(data);
+	OSObject::free();
+}
+
+// OSArray:
+// --------
+
+OSDefineMetaClassAndStructors(OSArray, OSObject)
+
+OSArray *OSArray::withCapacity(unsigned int capacity)
+{
+	OSArray *a = new OSArray;
+
+	a->capacity = capacity ? capacity : 1;
+	a->array = (OSObject **) calloc(a->capacity, sizeof(OSObject *));
+	return a;
+}
+
+bool OSArray::setObject(const OSObject *object)
+{
+	if (object == 0)
+		return false;
+	if (count == capacity) {
+		capacity *= 2;
+		array = (OSObject **) realloc(array, capacity * sizeof(OSObject *));
+	}
+	object->retain();
+	array[count++] = (OSObject *) object;
+	return true;
+}
+
+bool OSArray::setObject(unsigned int index, const OSObject *object)
+{
+	if ((object == 0) || (index > count))
+		return false;
+	if (count == capacity) {
+		capacity *= 2;
+		array = (OSObject **) realloc(array, capacity * sizeof(OSObject *));
+	}
+	object->retain();
+	memmove(&array[index + 1], &array[index], (count - index) * sizeof(OSObject *));
+	array[index] = (OSObject *) object;
+	count++;
+	return true;
+}
+
+bool OSArray::serialize(OSSerialize *s) const
+{
+	unsigned int i;
+
+	s->addString("(");
+	for (i = 0; i < count; i++) {
+		if (i)
+			s->addString(",");
+		array[i]->serialize(s);
+	}
+	return s->addString(")");
+}
+
+void OSArray::free()
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		array[i]->release();
+	::free(array);
+	OSObject::free();
+}
+
+// OSDictionary:
+// -------------
+
+OSDefineMetaClassAndStructors(OSDictionary, OSObject)
+
+OSDictionary *OSDictionary::withCapacity(unsigned int capacity)
+{
+	OSDictionary *d = new OSDictionary;
+
+	d->capacity = capacity ? capacity : 1;
+	d->keys = (const OSSymbol **) calloc(d->capacity, sizeof(OSSymbol *));
+	d->values = (OSObject **) calloc(d->capacity, sizeof(OSObject *));
+	return d;
+}
+
+bool OSDictionary::setObject(const char *key, const OSObject *object)
+{
+	unsigned int i;
+
+	if (object == 0)
+		return false;
+	object->retain();
+
+	for (i = 0; i < count; i++)
+		if (keys[i]->isEqualTo(key)) {
+			values[i]->release();
+			values[i] = (OSObject *) object;
+			return true;
+		}
+
+	if (count == capacity) {
+		capacity *= 2;
+		keys = (const OSSymbol **) realloc(keys, capacity * sizeof(OSSymbol *));
+		values = (OSObject **) realloc(values, capacity * sizeof(OSObject *));
+	}
+	keys[count] = OSSymbol::withCString(key);
+	values[count++] = (OSObject *) object;
+
+	return true;
+}
+
+OSObject *OSDictionary::getObject(const char *key) const
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		if (keys[i]->isEqualTo(key))
+			return values[i];
+
+	return 0;
+}
+
+void OSDictionary::removeObject(const char *key)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		if (keys[i]->isEqualTo(key)) {
+			keys[i]->release();
+			values[i]->release();
+			count--;
+			memmove(&keys[i], &keys[i + 1], (count - i) * sizeof(OSSymbol *));
+			memmove(&values[i], &values[i + 1], (count - i) * sizeof(OSObject *));
+			return;
+		}
+}
+
+bool OSDictionary::serialize(OSSerialize *s) const
+{
+	unsigned int i;
+
+	s->addString("{");
+	for (i = 0; i < count; i++) {
+		if (i)
+			s->addString(", ");
+		s->addFormat("\"%s\"=", keys[i]->getCStringNoCopy());
+		values[i]->serialize(s);
+	}
+	return s->addString("}");
+}
+
+void OSDictionary::free()
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		keys[i]->release();
+		values[i]->release();
+	}
+	::free(keys);
+	::free(values);
+	OSObject::free();
+}
+
+// OSCollectionIterator:
+// ---------------------
+
+OSDefineMetaClassAndStructors(OSCollectionIterator, OSObject)
+
+OSCollectionIterator *OSCollectionIterator::withCollection(const OSArray *array)
+{
+	OSCollectionIterator *iterator = new OSCollectionIterator;
+
+	array->retain();
+	iterator->array = (OSArray *) array;
+	return iterator;
+}
+
+OSObject *OSCollectionIterator::getNextObject()
+{
+	return array->getObject(index++);
+}
+
+void OSCollectionIterator::free()
+{
+	array->release();
+	OSObject::free();
+}
+
+// OSSerializer:
+// -------------
+
+OSDefineMetaClassAndStructors(OSSerializer, OSObject)
+
+OSSerializer *OSSerializer::forTarget(void *target, OSSerializerCallback callback, void *ref)
+{
+	OSSerializer *serializer = new OSSerializer;
+
+	serializer->target = target;
+	serializer->callback = callback;
+	serializer->ref = ref;
+	return serializer;
+}
+
+bool OSSerializer::serialize(OSSerialize *s) const
+{
+	return callback(target, ref, s);
+}
+
+// IOMemoryMap and IODeviceMemory:
+// -------------------------------
+
+OSDefineMetaClassAndStructors(IOMemoryMap, OSObject)
+
+IOMemoryMap *IOMemoryMap::withRange(IOPhysicalAddress address, IOByteCount length)
+{
+	IOMemoryMap *map = new IOMemoryMap;
+
+	map->address = address;
+	map->length = length;
+	return map;
+}
+
+OSDefineMetaClassAndStructors(IODeviceMemory, OSObject)
+
+IODeviceMemory *IODeviceMemory::withRange(IOPhysicalAddress address, IOByteCount length)
+{
+	IODeviceMemory *memory = new IODeviceMemory;
+
+	memory->address = address;
+	memory->length = length;
+	return memory;
+}
+
+// IORegistryEntry:
+// ----------------
+
+static const IORegistryPlane gHostDTPlane = { "IODeviceTree" };
+const IORegistryPlane *gIODTPlane = &gHostDTPlane;
+
+const OSSymbol *gIOInterruptControllersKey = OSSymbol::withCString("IOInterruptControllers");
+const OSSymbol *gIOInterruptSpecifiersKey = OSSymbol::withCString("IOInterruptSpecifiers");
+const OSSymbol *gIODTDefaultInterruptController = OSSymbol::withCString("IOPrimaryInterruptController");
+
+OSDefineMetaClassAndStructors(IORegistryEntry, OSObject)
+
+bool IORegistryEntry::init(OSDictionary *dictionary)
+{
+	if (properties != 0)
+		return true;
+	if (dictionary != 0) {
+		dictionary->retain();
+		properties = dictionary;
+	} else
+		properties = OSDictionary::withCapacity(8);
+	return true;
+}
+
+bool IORegistryEntry::init(IORegistryEntry *from, const IORegistryPlane *plane)
+{
+	if (from->properties != 0) {
+		from->properties->retain();
+		properties = from->properties;
+	} else
+		init();
+	if (from->name != 0)
+		setName(from->name->getCStringNoCopy());
+	parent = from->parent;
+	return true;
+}
+
+void IORegistryEntry::free()
+{
+	if (properties != 0)
+		properties->release();
+	if (name != 0)
+		name->release();
+	OSObject::free();
+}
+
+const char *IORegistryEntry::getName(const IORegistryPlane *plane) const
+{
+	return name ? name->getCStringNoCopy() : getMetaClass()->getClassName();
+}
+
+void IORegistryEntry::setName(const char *newName, const IORegistryPlane *plane)
+{
+	if (name != 0)
+		name->release();
+	name = OSSymbol::withCString(newName);
+}
+
+bool IORegistryEntry::compareName(OSString *name, OSString **matched) const
+{
+	if ((name == 0) || !name->isEqualTo(getName()))
+		return false;
+	if (matched != 0) {
+		name->retain();
+		*matched = name;
+	}
+	return true;
+}
+
+bool IORegistryEntry::attachToParent(IORegistryEntry *newParent, const IORegistryPlane *plane)
+{
+	parent = newParent;
+	return true;
+}
+
+void IORegistryEntry::detachFromParent(IORegistryEntry *oldParent, const IORegistryPlane *plane)
+{
+	if (parent == oldParent)
+		parent = 0;
+}
+
+void IORegistryEntry::detachAll(const IORegistryPlane *plane)
+{
+	parent = 0;
+}
+
+OSObject *IORegistryEntry::getProperty(const char *key) const
+{
+	return properties ? properties->getObject(key) : 0;
+}
+
+bool IORegistryEntry::setProperty(const char *key, OSObject *object)
+{
+	if (properties == 0)
+		init();
+	return properties->setObject(key, object);
+}
+
+bool IORegistryEntry::setProperty(const char *key, bool value)
+{
+	return setProperty(key, (OSObject *) (value ? kOSBooleanTrue : kOSBooleanFalse));
+}
+
+bool IORegistryEntry::setProperty(const char *key, unsigned long long value, unsigned int numberOfBits)
+{
+	OSNumber *number = OSNumber::withNumber(value, numberOfBits);
+	bool ok = setProperty(key, number);
+
+	number->release();
+	return ok;
+}
+
+bool IORegistryEntry::setProperty(const char *key, const char *value)
+{
+	const OSSymbol *string = OSSymbol::withCString(value);
+	bool ok = setProperty(key, (OSObject *) string);
+
+	string->release();
+	return ok;
+}
+
+void IORegistryEntry::removeProperty(const char *key)
+{
+	if (properties != 0)
+		properties->removeObject(key);
+}
+
+// IOService:
+// ----------
+
+OSDefineMetaClassAndStructors(IOService, IORegistryEntry)
+
+bool IOService::attach(IOService *newProvider)
+{
+	provider = newProvider;
+	return true;
+}
+
+void IOService::detach(IOService *oldProvider)
+{
+	if (provider == oldProvider)
+		provider = 0;
+}
+
+bool IOService::start(IOService *newProvider)
+{
+	init();
+	return true;
+}
+
+void IOService::stop(IOService *oldProvider)
+{
+}
+
+OSArray *IOService::getDeviceMemory() const
+{
+	return OSDynamicCast(OSArray, getProperty("IODeviceMemory"));
+}
+
+void IOService::setDeviceMemory(OSArray *array)
+{
+	setProperty("IODeviceMemory", array);
+}
+
+IODeviceMemory *IOService::getDeviceMemoryWithIndex(unsigned int index) const
+{
+	OSArray *array = getDeviceMemory();
+
+	return array ? OSDynamicCast(IODeviceMemory, array->getObject(index)) : 0;
+}
+
+IOMemoryMap *IOService::mapDeviceMemoryWithIndex(unsigned int index, IOOptionBits options)
+{
+	IODeviceMemory *memory = getDeviceMemoryWithIndex(index);
+
+	return memory ? memory->map(options) : 0;
+}
+
+IOReturn IOService::callPlatformFunction(const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	if (provider != 0)
+		return provider->callPlatformFunction(functionName, waitForFunction, param1, param2, param3, param4);
+	return kIOReturnUnsupported;
+}
+
+IOReturn IOService::callPlatformFunction(const char *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	const OSSymbol *symbol = OSSymbol::withCString(functionName);
+	IOReturn result = callPlatformFunction(symbol, waitForFunction, param1, param2, param3, param4);
+
+	symbol->release();
+	return result;
+}
+
+IOReturn IOService::registerInterrupt(int source, OSObject *target, IOInterruptAction handler, void *refCon)
+{
+	return kIOReturnNoInterrupt;
+}
+
+IOReturn IOService::unregisterInterrupt(int source)
+{
+	return kIOReturnNoInterrupt;
+}
+
+IOReturn IOService::enableInterrupt(int source)
+{
+	return kIOReturnNoInterrupt;
+}
+
+IOReturn IOService::disableInterrupt(int source)
+{
+	return kIOReturnNoInterrupt;
+}
+
+IOReturn IOService::causeInterrupt(int source)
+{
+	return kIOReturnNoInterrupt;
+}
+
+const char *IOService::stringFromReturn(IOReturn rtn)
+{
+	static char text[32];
+
+	snprintf(text, sizeof(text), "0x%08x", (unsigned int) rtn);
+	return text;
+}
+
+const char *hostSerializeProperty(IOService *service, const char *key, OSSerialize *s)
+{
+	OSObject *property = service->getProperty(key);
+
+	if ((property == 0) || !property->serialize(s))
+		return 0;
+	return s->text();
+}
+
+// HostInterruptNub:
+// -----------------
+
+OSDefineMetaClassAndStructors(HostInterruptNub, IOService)
+
+IOReturn HostInterruptNub::registerInterrupt(int source, OSObject *target, IOInterruptAction handler, void *refCon)
+{
+	if ((source < 0) || (source >= kHostMaxSources) || (sources[source].handler != 0))
+		return kIOReturnNoInterrupt;
+
+	sources[source].target = target;
+	sources[source].handler = handler;
+	sources[source].refCon = refCon;
+	sources[source].enabled = false;
+	return kIOReturnSuccess;
+}
+
+IOReturn HostInterruptNub::unregisterInterrupt(int source)
+{
+	if ((source < 0) || (source >= kHostMaxSources))
+		return kIOReturnNoInterrupt;
+
+	memset(&sources[source], 0, sizeof(sources[source]));
+	return kIOReturnSuccess;
+}
+
+IOReturn HostInterruptNub::enableInterrupt(int source)
+{
+	if ((source < 0) || (source >= kHostMaxSources) || (sources[source].handler == 0))
+		return kIOReturnNoInterrupt;
+
+	sources[source].enabled = true;
+	return kIOReturnSuccess;
+}
+
+IOReturn HostInterruptNub::disableInterrupt(int source)
+{
+	if ((source < 0) || (source >= kHostMaxSources) || (sources[source].handler == 0))
+		return kIOReturnNoInterrupt;
+
+	sources[source].enabled = false;
+	return kIOReturnSuccess;
+}
+
+IOReturn HostInterruptNub::causeInterrupt(int source)
+{
+	if ((source < 0) || (source >= kHostMaxSources))
+		return kIOReturnNoInterrupt;
+
+	sources[source].caused++;
+	return kIOReturnSuccess;
+}
+
+bool HostInterruptNub::deliver(int source)
+{
+	Source *s;
+
+	if ((source < 0) || (source >= kHostMaxSources))
+		return false;
+
+	s = &sources[source];
+	if ((s->handler == 0) || !s->enabled)
+		return false;
+
+	s->deliveries++;
+	s->caused = 0;
+	s->handler(s->target, s->refCon, this, source);
+	return true;
+}
+
+// IOInterruptController:
+// ----------------------
+
+OSDefineMetaClassAndAbstractStructors(IOInterruptController, IOService)
+
+IOReturn IOInterruptController::registerInterrupt(IOService *nub, int source, void *target,
+	IOInterruptHandler handler, void *refCon)
+{
+	IOInterruptVector *vector = &vectors[source];
+
+	if (vector->interruptRegistered)
+		return kIOReturnNoResources;
+
+	vector->nub = nub;
+	vector->source = source;
+	vector->target = target;
+	vector->handler = handler;
+	vector->refCon = refCon;
+
+	// disabled until enableInterrupt, as in IOKit
+	vector->interruptDisabledSoft = 1;
+	vector->interruptDisabledHard = 1;
+	vector->interruptRegistered = 1;
+	initVector(source, vector);
+	return kIOReturnSuccess;
+}
+
+IOReturn IOInterruptController::unregisterInterrupt(IOService *nub, int source)
+{
+	IOInterruptVector *vector = &vectors[source];
+
+	if (!vector->interruptRegistered)
+		return kIOReturnSuccess;
+
+	vector->interruptDisabledSoft = 1;
+	if (!vector->interruptDisabledHard) {
+		vector->interruptDisabledHard = 1;
+		disableVectorHard(source, vector);
+	}
+	vector->interruptRegistered = 0;
+	vector->nub = 0;
+	vector->target = 0;
+	vector->handler = 0;
+	vector->refCon = 0;
+	return kIOReturnSuccess;
+}
+
+IOReturn IOInterruptController::getInterruptType(IOService *nub, int source, int *interruptType)
+{
+	*interruptType = getVectorType(source, &vectors[source]);
+	return kIOReturnSuccess;
+}
+
+IOReturn IOInterruptController::enableInterrupt(IOService *nub, int source)
+{
+	IOInterruptVector *vector = &vectors[source];
+
+	if (vector->interruptDisabledSoft) {
+		vector->interruptDisabledSoft = 0;
+		if (vector->interruptDisabledHard) {
+			vector->interruptDisabledHard = 0;
+			enableVector(source, vector);
+		}
+	}
+	return kIOReturnSuccess;
+}
+
+IOReturn IOInterruptController::disableInterrupt(IOService *nub, int source)
+{
+	IOInterruptVector *vector = &vectors[source];
+
+	vector->interruptDisabledSoft = 1;
+	if (!vectorCanBeShared(source, vector)) {
+		vector->interruptDisabledHard = 1;
+		disableVectorHard(source, vector);
+	}
+	return kIOReturnSuccess;
+}
+
+IOReturn IOInterruptController::causeInterrupt(IOService *nub, int source)
+{
+	causeVector(source, &vectors[source]);
+	return kIOReturnSuccess;
+}
+
+bool IOInterruptController::vectorCanBeShared(long vectorNumber, IOInterruptVector *vector)
+{
+	return false;
+}
+
+void IOInterruptController::initVector(long vectorNumber, IOInterruptVector *vector)
+{
+}
+
+int IOInterruptController::getVectorType(long vectorNumber, IOInterruptVector *vector)
+{
+	return kIOInterruptTypeEdge;
+}
+
+void IOInterruptController::disableVectorHard(long vectorNumber, IOInterruptVector *vector)
+{
+}
+
+void IOInterruptController::enableVector(long vectorNumber, IOInterruptVector *vector)
+{
+}
+
+void IOInterruptController::causeVector(long vectorNumber, IOInterruptVector *vector)
+{
+}
+
+// IOPCIBridge, IOPCIDevice:
+// --------------------------
+
+OSDefineMetaClassAndAbstractStructors(IOPCIBridge, IOService)
+OSDefineMetaClassAndStructors(IOPCIDevice, IOService)
+
+// AppleMacIODevice:
+// -----------------
+
+OSDefineMetaClassAndStructors(AppleMacIODevice, IOService)
+
+bool AppleMacIODevice::compareName(OSString *name, OSString **matched) const
+{
+	return IODTCompareNubName(this, name, matched) || IORegistryEntry::compareName(name, matched);
+}
+
+IOService *AppleMacIODevice::matchLocation(IOService *client)
+{
+	return this;
+}
+
+IOReturn AppleMacIODevice::getResources(void)
+{
+	return kIOReturnSuccess;
+}
+
+// The device tree:
+// ----------------
+
+OSCollectionIterator *IODTFindMatchingEntries(IORegistryEntry *from, IOOptionBits options, const char *keys)
+{
+	return 0;
+}
+
+bool IODTCompareNubName(const IORegistryEntry *regEntry, OSString *name, OSString **matched)
+{
+	return false;
+}
+
+OSArray *IODTResolveAddressing(IORegistryEntry *regEntry, const char *addressPropertyName, IODeviceMemory *parent)
+{
+	return 0;
+}
+
+// IOEventSource, IOWorkLoop, IOTimerEventSource:
+// ----------------------------------------------
+
+OSDefineMetaClassAndAbstractStructors(IOEventSource, OSObject)
+
+bool IOEventSource::init(OSObject *newOwner)
+{
+	owner = newOwner;
+	return true;
+}
+
+OSDefineMetaClassAndStructors(IOWorkLoop, OSObject)
+
+IOWorkLoop *IOWorkLoop::workLoop()
+{
+	return new IOWorkLoop;
+}
+
+IOReturn IOWorkLoop::addEventSource(IOEventSource *newEvent)
+{
+	newEvent->retain();
+	newEvent->setWorkLoop(this);
+	return kIOReturnSuccess;
+}
+
+IOReturn IOWorkLoop::removeEventSource(IOEventSource *toRemove)
+{
+	if (toRemove->getWorkLoop() != this)
+		return kIOReturnBadArgument;
+	toRemove->setWorkLoop(0);
+	toRemove->release();
+	return kIOReturnSuccess;
+}
+
+OSDefineMetaClassAndStructors(IOTimerEventSource, IOEventSource)
+
+IOTimerEventSource *IOTimerEventSource::timerEventSource(OSObject *owner, Action action)
+{
+	IOTimerEventSource *timer = new IOTimerEventSource;
+
+	timer->init(owner);
+	timer->action = action;
+	timer->call = thread_call_allocate(&IOTimerEventSource::timeout, (thread_call_param_t) timer);
+	return timer;
+}
+
+void IOTimerEventSource::free()
+{
+	thread_call_free(call);
+	OSObject::free();
+}
+
+void IOTimerEventSource::timeout(thread_call_param_t me, thread_call_param_t unused)
+{
+	IOTimerEventSource *timer = (IOTimerEventSource *) me;
+
+	if (timer->action != 0)
+		timer->action(timer->owner, timer);
+}
+
+IOReturn IOTimerEventSource::setTimeout(UInt32 interval, UInt32 scaleFactor)
+{
+	AbsoluteTime deadline;
+
+	clock_interval_to_deadline(interval, scaleFactor, &deadline);
+	thread_call_enter_delayed(call, deadline);
+	return kIOReturnSuccess;
+}
+
+IOReturn IOTimerEventSource::setTimeoutTicks(UInt32 ticks)
+{
+	return setTimeout(ticks, kSecondScale / 100);
+}
+
+IOReturn IOTimerEventSource::setTimeoutMS(UInt32 ms)
+{
+	return setTimeout(ms, kMillisecondScale);
+}
+
+IOReturn IOTimerEventSource::setTimeoutUS(UInt32 us)
+{
+	return setTimeout(us, kMicrosecondScale);
+}
+
+void IOTimerEventSource::cancelTimeout()
+{
+	thread_call_cancel(call);
+}
+
+// IOPlatformExpert:
+// -----------------
+
+OSDefineMetaClassAndStructors(IOPlatformExpert, IOService)
+
+IOReturn IOPlatformExpert::registerInterruptController(const OSSymbol *name, IOInterruptController *controller)
+{
+	int i;
+
+	for (i = 0; i < kHostMaxControllers; i++)
+		if ((names[i] == 0) || names[i]->isEqualTo(name)) {
+			if (names[i] == 0)
+				names[i] = OSSymbol::withCString(name->getCStringNoCopy());
+			controllers[i] = controller;
+			return kIOReturnSuccess;
+		}
+
+	return kIOReturnNoResources;
+}
+
+IOInterruptController *IOPlatformExpert::lookUpInterruptController(const OSSymbol *name)
+{
+	return lookUpInterruptController(name->getCStringNoCopy());
+}
+
+IOInterruptController *IOPlatformExpert::lookUpInterruptController(const char *name)
+{
+	int i;
+
+	for (i = 0; i < kHostMaxControllers; i++)
+		if ((names[i] != 0) && names[i]->isEqualTo(name))
+			return controllers[i];
+
+	return 0;
+}
+
+IOPlatformExpert *getPlatform(void)
+{
+	static IOPlatformExpert *platform = 0;
+
+	if (platform == 0)
+		platform = new IOPlatformExpert;
+	return platform;
+}
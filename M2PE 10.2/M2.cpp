@@ -1 +1 @@
-extern "C" {#include <machine/machine_routines.h>}#include <IOKit/pwr_mgt/RootDomain.h>#include <IOKit/IODeviceTreeSupport.h>#include <IOKit/IORangeAllocator.h>#include <IOKit/nvram/IONVRAMController.h>#include "../OpenPMU/OpenPMU.h"#include "M2.h"#define VERBOSE 1#define ALLOW_SLEEP 0#if VERBOSE    #define VerboseIOLog(x...) IOLog(x)#else    #define VerboseIOLog(x...) {}#endif#define super ApplePlatformExpertOSDefineMetaClassAndStructors(M2PE, ApplePlatformExpert);bool M2PE::start(IOService *provider){	IOReturn superRet;        	setBootROMType(kBootROMTypeOldWorld);	setChipSetType(kChipSetTypeM2);	_pePMFeatures =	kPMHasWakeupTimerMask |					kPMHasProcessorCyclingMask |					kPMHasSCSIDiskModeMask |					kPMCanGetBatteryTimeMask |					kPMHasStartupTimerMask |					kPMHasChargeNotificationMask |					kPMHasSleepMask;	_pePrivPMFeatures = kStdPowerBookPrivPMFeatures;	_peNumBatteriesSupported = 1;		superRet = super::start(provider);        	return superRet;}void M2PE::registerNVRAMController(IONVRAMController *nvram){	UInt32 timeToGMT = 0;	IOReturn err;		enum {kXPRAMTimeToGMTOffset = 0xEC};	super::registerNVRAMController(nvram);	err = readXPRAM(kXPRAMTimeToGMTOffset, (UInt8 *) &timeToGMT, sizeof(timeToGMT));		VerboseIOLog("M2PE: readXPRAM returned %x, timeToGMT = %x\n", err, (unsigned int) timeToGMT);}	IOReturn M2PE::callPlatformFunction(const OSSymbol *functionName,					  bool waitForFunction,					  void *param1, void *param2,					  void *param3, void *param4){	VerboseIOLog("M2PE::callPlatformFunction entered, functionName = %s\n", functionName->getCStringNoCopy());        	if (functionName->isEqualTo("GetDefaultBusSpeeds")) {		getDefaultBusSpeeds((long *) param1, (unsigned long **) param2);		return kIOReturnSuccess;	}  	return super::callPlatformFunction(functionName, waitForFunction,				     param1, param2, param3, param4);                                     	VerboseIOLog("M2PE::callPlatformFunction exited\n");}static unsigned long m2Speed[] = {33333333, 1};void M2PE::getDefaultBusSpeeds(long *numSpeeds, unsigned long **speedList){	if (!numSpeeds || !speedList)		return;	    *numSpeeds = 1;    *speedList = m2Speed;}void M2PE::PMInstantiatePowerDomains (void){	root = new IOPMrootDomain;	root->init();	root->attach(this);	root->start(this);	root->youAreRoot();#if ALLOW_SLEEP   	root->setSleepSupported(kRootDomainSleepSupported);#else	root->setSleepSupported(kRootDomainSleepNotSupported);#endif}void M2PE::PMRegisterDevice(IOService *theNub, IOService *theDevice){	mach_timespec_t t;	IOService *baboon;			//    VerboseIOLog("M2PE::PMRegisterDevice entered; theNub is %s, theDevice is %s\n", theNub->getName(), theDevice->getName());    // Checks if the nub handles power states, if it does not gets its parent and so    // up until we reach the root, or we do not find anything:    while ((theNub != NULL) && ( theNub->addPowerChild(theDevice) != IOPMNoErr )) {		// Attempt to attach services descending from the ATA nodes to the Baboon driver		if (!strcmp(theNub->getName(), "ata")) {			t.tv_sec = 60;			t.tv_nsec = 0;			baboon = waitForService(serviceMatching("Baboon"), &t);			if (baboon) {				theNub = baboon;				continue;			}		}				theNub = theNub->getProvider();	}    if ( theNub == NULL ) {        root->addPowerChild ( theDevice );        return;    }}#if 1void M2PE::PMLog(const char * who,unsigned long event,unsigned long param1, unsigned long param2){//    if( gIOKitDebug & kIOLogPower) {//        kprintf("%s %02d %08x %08x\n",who,event,param1,param2);        IOLog("%s %02d %08x %08x\n",who,event,param1,param2);//    }}#endif
\ No newline at end of file
+extern "C" {#include <machine/machine_routines.h>#include <pexpert/pexpert.h>}#include <ppc/proc_reg.h>#include <IOKit/pwr_mgt/RootDomain.h>#include <IOKit/IODeviceTreeSupport.h>#include <IOKit/IORangeAllocator.h>#include <IOKit/nvram/IONVRAMController.h>#include "../OpenPMU/OpenPMU.h"#include "M2.h"#define VERBOSE 1#define ALLOW_SLEEP 0#if VERBOSE    #define VerboseIOLog(x...) IOLog(x)#else    #define VerboseIOLog(x...) {}#endif// How long devices below the ATA nodes wait for Baboon before they join//  the power tree further up#define kBaboonWaitSeconds 60// M2VIA calibrates the clocks against the VIA timer at every boot, as//  nothing on a 1400 keeps a cache of them across a restart: XPRAM has no//  byte documented as free, and OpenPMUXPRAMController only writes the//  XPRAM partition back to the PMU.  Once the PMU's RTC is up the//  timebase is timed over kClockRTCSeconds of it, off the boot path, and//  the speeds follow it if the VIA calibration was off.#define kClockRTCSeconds 8#define kClockRTCPollMS 2		// each poll is a PMU transaction too#define kClockTolerance 512		// within 1/512 is the same speed#define super ApplePlatformExpertOSDefineMetaClassAndStructors(M2PE, ApplePlatformExpert);bool M2PE::start(IOService *provider){	IOReturn superRet;        	setBootROMType(kBootROMTypeOldWorld);	setChipSetType(kChipSetTypeM2);	_pePMFeatures =	kPMHasWakeupTimerMask |					kPMHasProcessorCyclingMask |					kPMHasSCSIDiskModeMask |					kPMCanGetBatteryTimeMask |					kPMHasStartupTimerMask |					kPMHasChargeNotificationMask |					kPMHasSleepMask;	_pePrivPMFeatures = kStdPowerBookPrivPMFeatures;	_peNumBatteriesSupported = 1;		superRet = super::start(provider);	// The clock check waits for the PMU's RTC	clockCheck = thread_call_allocate((thread_call_func_t) &M2PE::checkClockSpeeds, (thread_call_param_t) this);	if (clockCheck)		rtcNotifier = addNotification(gIOPublishNotification, resourceMatching("IORTC"),			(IOServiceNotificationHandler) &M2PE::rtcPublished, this, 0);        	return superRet;}void M2PE::registerNVRAMController(IONVRAMController *nvram){	UInt32 timeToGMT = 0;	IOReturn err;		enum {kXPRAMTimeToGMTOffset = 0xEC};	super::registerNVRAMController(nvram);	err = readXPRAM(kXPRAMTimeToGMTOffset, (UInt8 *) &timeToGMT, sizeof(timeToGMT));		VerboseIOLog("M2PE: readXPRAM returned %x, timeToGMT = %x\n", err, (unsigned int) timeToGMT);}	IOReturn M2PE::callPlatformFunction(const OSSymbol *functionName,					  bool waitForFunction,					  void *param1, void *param2,					  void *param3, void *param4){	VerboseIOLog("M2PE::callPlatformFunction entered, functionName = %s\n", functionName->getCStringNoCopy());        	if (functionName->isEqualTo("GetDefaultBusSpeeds")) {		getDefaultBusSpeeds((long *) param1, (unsigned long **) param2);		return kIOReturnSuccess;	}  	return super::callPlatformFunction(functionName, waitForFunction,				     param1, param2, param3, param4);                                     	VerboseIOLog("M2PE::callPlatformFunction exited\n");}static unsigned long m2Speed[] = {33333333, 1};void M2PE::getDefaultBusSpeeds(long *numSpeeds, unsigned long **speedList){	if (!numSpeeds || !speedList)		return;	    *numSpeeds = 1;    *speedList = m2Speed;}static bool sameSpeed(UInt32 a, UInt32 b){	UInt32 difference = (a > b) ? a - b : b - a;	return difference <= (a / kClockTolerance);}// Sets the speeds the way PE_Determine_Clock_Speeds does (the timebase//  runs at a quarter of the bus) and tells the clock codestatic void setClockSpeeds(UInt32 busHz, UInt32 cpuHz){	gPEClockFrequencyInfo.bus_clock_rate_hz = busHz;	gPEClockFrequencyInfo.cpu_clock_rate_hz = cpuHz;	gPEClockFrequencyInfo.dec_clock_rate_hz = busHz / 4;	gPEClockFrequencyInfo.bus_clock_rate_num = busHz;	gPEClockFrequencyInfo.bus_clock_rate_den = 1;	gPEClockFrequencyInfo.bus_to_cpu_rate_num = (2 * cpuHz + busHz / 2) / busHz;	gPEClockFrequencyInfo.bus_to_cpu_rate_den = 2;	gPEClockFrequencyInfo.bus_to_dec_rate_num = 1;	gPEClockFrequencyInfo.bus_to_dec_rate_den = 4;	PE_call_timebase_callback();}// Waits for the RTC to turn over to the next second, which it returns in//  secs with the timebase just before the read that saw it; false if the//  RTC cannot be read or did not turn over within two secondsstatic bool waitForRTCSecond(long *secs, UInt32 *timebase){	long first, now;	UInt32 before, polls;	if (!PE_read_write_time_of_day || PE_read_write_time_of_day(kPEReadTOD, &first))		return false;	for (polls = 0; polls < 2000 / kClockRTCPollMS; polls++) {		IOSleep(kClockRTCPollMS);		before = mftb();		if (PE_read_write_time_of_day(kPEReadTOD, &now))			return false;		if (now != first) {			*secs = now;			*timebase = before;			return true;		}	}	return false;}// Published as the PMU's RTC comes upbool M2PE::rtcPublished(void *target, void * /* ref */, IOService * /* newService */){	M2PE *me = (M2PE *) target;	if (me->clockCheck)		thread_call_enter(me->clockCheck);	return true;}// Times the timebase over kClockRTCSeconds of the PMU's RTC.  An edge is//  found to kClockRTCPollMS and a PMU transaction, so both together are//  well inside kClockTolerance over that span.void M2PE::checkClockSpeeds(thread_call_param_t me, thread_call_param_t /* unused */){	M2PE *self = (M2PE *) me;	long startSecs, endSecs;	UInt32 start, end, timebaseHz, busHz, cpuHz;	if (self->rtcNotifier) {		self->rtcNotifier->remove();		self->rtcNotifier = 0;	}	if (!waitForRTCSecond(&startSecs, &start))		return;	IOSleep(kClockRTCSeconds * 1000 - 500);		// half a second before the edge	if (!waitForRTCSecond(&endSecs, &end) || (endSecs - startSecs != kClockRTCSeconds)) {		IOLog("M2PE: RTC did not keep time, clock speeds not checked\n");		return;	}	timebaseHz = (end - start) / kClockRTCSeconds;	self->setProperty("RTCTimebaseFrequency", timebaseHz, 32);	if (sameSpeed(gPEClockFrequencyInfo.dec_clock_rate_hz, timebaseHz)) {		VerboseIOLog("M2PE: timebase %lu Hz checked against the RTC\n", (unsigned long) timebaseHz);		return;	}	busHz = timebaseHz * 4;	cpuHz = (UInt32) (((UInt64) gPEClockFrequencyInfo.cpu_clock_rate_hz * busHz)		/ gPEClockFrequencyInfo.bus_clock_rate_hz);	IOLog("M2PE: timebase is %lu Hz by the RTC, not %lu Hz, bus set to %lu Hz\n",		(unsigned long) timebaseHz, gPEClockFrequencyInfo.dec_clock_rate_hz, (unsigned long) busHz);	setClockSpeeds(busHz, cpuHz);}void M2PE::PMInstantiatePowerDomains (void){	IONotifier *notifier;	root = new IOPMrootDomain;	root->init();	root->attach(this);	root->start(this);	root->youAreRoot();#if ALLOW_SLEEP   	root->setSleepSupported(kRootDomainSleepSupported);#else	root->setSleepSupported(kRootDomainSleepNotSupported);#endif	// Devices below the ATA nodes belong under Baboon, which may not have	//  started yet: they wait in a queue until it publishes	baboonLock = IOLockAlloc();	baboonDevices = OSArray::withCapacity(4);	baboonNubs = OSArray::withCapacity(4);	baboonTimes = OSData::withCapacity(4 * sizeof(AbsoluteTime));	baboonTimeout = thread_call_allocate((thread_call_func_t) &M2PE::baboonWaitExpired, (thread_call_param_t) this);	notifier = addNotification(gIOPublishNotification, serviceMatching("Baboon"),		(IOServiceNotificationHandler) &M2PE::baboonPublished, this, 0);	if (!baboonLock || !baboonDevices || !baboonNubs || !baboonTimes || !baboonTimeout || !notifier) {		IOLog("M2PE: cannot defer devices for Baboon\n");		baboonGaveUp = true;	}	// Baboon may have published from inside addNotification(), before	//  there was a notifier for it to remove	if (notifier && baboonLock) {		IOLockLock(baboonLock);		if (!baboonParent) {			baboonNotifier = notifier;			notifier = 0;		}		IOLockUnlock(baboonLock);	}	if (notifier)		notifier->remove();}void M2PE::PMRegisterDevice(IOService *theNub, IOService *theDevice){	//    VerboseIOLog("M2PE::PMRegisterDevice entered; theNub is %s, theDevice is %s\n", theNub->getName(), theDevice->getName());	attachPowerChild(theNub, theDevice);}static AbsoluteTime deadlineAfter(UInt32 interval, UInt32 scale){	AbsoluteTime deadline;	clock_interval_to_deadline(interval, scale, &deadline);	return deadline;}void M2PE::attachPowerChild(IOService *theNub, IOService *theDevice){	IOService *baboon;	AbsoluteTime now;	bool first;    // Checks if the nub handles power states, if it does not gets its parent and so    // up until we reach the root, or we do not find anything:    while ((theNub != NULL) && ( theNub->addPowerChild(theDevice) != IOPMNoErr )) {		// Attempt to attach services descending from the ATA nodes to the Baboon driver		if (!strcmp(theNub->getName(), "ata") && baboonLock) {			IOLockLock(baboonLock);			baboon = baboonParent;			if (!baboon && !baboonGaveUp) {				// Not there yet: baboonPublished() finishes the job				clock_get_uptime(&now);				first = (baboonDevices->getCount() == 0);				baboonDevices->setObject(theDevice);				baboonNubs->setObject(theNub);				baboonTimes->appendBytes(&now, sizeof(now));				IOLockUnlock(baboonLock);				if (first)					thread_call_enter_delayed(baboonTimeout, deadlineAfter(kBaboonWaitSeconds, kSecondScale));				VerboseIOLog("M2PE: %s waits for Baboon\n", theDevice->getName());				return;			}			IOLockUnlock(baboonLock);						if (baboon) {				theNub = baboon;				continue;			}		}				theNub = theNub->getProvider();	}    if ( theNub == NULL ) {        root->addPowerChild ( theDevice );        return;    }}// Attaches the devices that waited for Baboon, under baboon or, when it//  did not show up in time, further up from their ATA nodes.  Logs how//  long each one waited: registration used to block for that long.//  The first Baboon to publish is kept and the notifier removed; a//  timeout leaves the notifier in place, so a late Baboon still gets the//  devices that register after it.void M2PE::releaseBaboonDevices(IOService *baboon){	OSArray *devices, *nubs;	OSData *times;	IONotifier *notifier = 0;	IOService *device;	AbsoluteTime now, waited;	UInt64 nanoseconds;	UInt32 index, waitedMS, longestMS = 0;	if (!baboonLock)		return;			// nothing was deferred	IOLockLock(baboonLock);	if (baboon) {		if (baboonParent) {			IOLockUnlock(baboonLock);			return;			// another Baboon, the first one is kept		}		baboon->retain();		baboonParent = baboon;		// takes precedence over baboonGaveUp		notifier = baboonNotifier;		baboonNotifier = 0;	} else		baboonGaveUp = true;	devices = baboonDevices;	nubs = baboonNubs;	times = baboonTimes;	baboonDevices = OSArray::withCapacity(1);	baboonNubs = OSArray::withCapacity(1);	baboonTimes = OSData::withCapacity(sizeof(AbsoluteTime));	if (!baboonDevices || !baboonNubs || !baboonTimes)		baboonGaveUp = true;		// attachPowerChild() must not queue any more	IOLockUnlock(baboonLock);	if (notifier)		notifier->remove();	thread_call_cancel(baboonTimeout);	if (!devices || !nubs || !times)		return;			// already released, or nothing was ever queued	clock_get_uptime(&now);	for (index = 0; (device = (IOService *) devices->getObject(index)); index++) {		waited = now;		SUB_ABSOLUTETIME(&waited, &((AbsoluteTime *) times->getBytesNoCopy())[index]);		absolutetime_to_nanoseconds(waited, &nanoseconds);		waitedMS = (UInt32) (nanoseconds / 1000000);		if (waitedMS > longestMS)			longestMS = waitedMS;		IOLog("M2PE: %s waited %lu ms for Baboon\n", device->getName(), (unsigned long) waitedMS);		if (baboon)			attachPowerChild(baboon, device);		else			attachPowerChild(((IOService *) nubs->getObject(index))->getProvider(), device);	}	if (index)		IOLog("M2PE: %lu devices deferred for Baboon, the longest for %lu ms\n",			(unsigned long) index, (unsigned long) longestMS);	devices->release();	nubs->release();	times->release();}bool M2PE::baboonPublished(void *target, void * /* ref */, IOService *newService){	((M2PE *) target)->releaseBaboonDevices(newService);	return true;}void M2PE::baboonWaitExpired(thread_call_param_t me, thread_call_param_t /* unused */){	IOLog("M2PE: Baboon did not show up in %d seconds\n", kBaboonWaitSeconds);	((M2PE *) me)->releaseBaboonDevices(NULL);}#if 1void M2PE::PMLog(const char * who,unsigned long event,unsigned long param1, unsigned long param2){//    if( gIOKitDebug & kIOLogPower) {//        kprintf("%s %02d %08x %08x\n",who,event,param1,param2);        IOLog("%s %02d %08x %08x\n",who,event,param1,param2);//    }}#endif
\ No newline at end of file
@@ -3,6 +3,10 @@
 
 #include <IOKit/platform/ApplePlatformExpert.h>
 
+extern "C" {
+#include <kern/thread_call.h>
+}
+
 enum {kChipSetTypeM2 = 47};		// arbitrary, does not conflict with established chipsets.
 
 class M2PE : public ApplePlatformExpert
@@ -11,8 +15,30 @@ class M2PE : public ApplePlatformExpert
   
 private:
 	void getDefaultBusSpeeds(long *numSpeeds, unsigned long **speedList);
+
+	// The clock speeds checked against the PMU's RTC, once it is up
+	thread_call_t clockCheck;
+	IONotifier *rtcNotifier;
+
+	static bool rtcPublished(void *target, void *ref, IOService *newService);
+	static void checkClockSpeeds(thread_call_param_t me, thread_call_param_t unused);
 	void PMInstantiatePowerDomains(void);
 	void PMRegisterDevice(IOService *theNub, IOService *theDevice);
+
+	// Devices below the ATA nodes, waiting for Baboon to publish
+	IOLock *baboonLock;
+	OSArray *baboonDevices;
+	OSArray *baboonNubs;		// their ATA nodes
+	OSData *baboonTimes;		// when they registered, AbsoluteTime
+	IOService *baboonParent;	// Baboon, once it published
+	bool baboonGaveUp;		// it did not, attach further up
+	IONotifier *baboonNotifier;
+	thread_call_t baboonTimeout;
+
+	void attachPowerChild(IOService *theNub, IOService *theDevice);
+	void releaseBaboonDevices(IOService *baboon);
+	static bool baboonPublished(void *target, void *ref, IOService *newService);
+	static void baboonWaitExpired(thread_call_param_t me, thread_call_param_t unused);
     
 public:
 	bool start(IOService *provider);
@@ -0,0 +1,143 @@
+#ifndef _M2_REGISTER_SNAPSHOT_H
+#define _M2_REGISTER_SNAPSHOT_H
+
+#include <IOKit/IOTypes.h>
+#include <IOKit/IOLib.h>
+#include <ppc/proc_reg.h>
+
+// Register snapshots for sleep and wake.  A driver describes the registers
+//  it has to carry across sleep in a table and keeps one UInt32 per entry
+//  for the values; M2CPU (the VIAs), ECSC (the LCD controller) and Whitney
+//  (the VIA interrupt enables) each have one.
+//
+// Entries are restored in table order.  The registers are mapped guarded
+//  and cache-inhibited, so the writes reach the device in that order
+//  without a fence after each: there is one fence where the group number
+//  changes, for entries that have to see the writes before them (one that
+//  reads the register again, say), and a sync at the end.
+
+// Entry flags
+#define kSnapNoVerify		0x01	// reads back something else (IFR, port inputs)
+#define kSnapRewrite		0x02	// not saved: restore writes back what it reads then
+
+struct M2SnapshotEntry {
+	UInt32 offset;			// from the snapshot base
+	UInt8 width;			// 1, 2 or 4 bytes
+	UInt8 group;			// ascending through the table
+	UInt8 flags;
+	UInt32 setBits;			// or'ed in on restore, 0x80 for a VIA IER
+	UInt32 verifyMask;		// bits that read back as written
+};
+
+struct M2Snapshot {
+	volatile UInt8 *base;
+	// Accessors to use instead of the registers, NULL for none
+	UInt32 (*read)(volatile UInt8 *address, UInt8 width);
+	void (*write)(volatile UInt8 *address, UInt8 width, UInt32 value);
+	const M2SnapshotEntry *entries;
+	UInt32 count;
+	UInt32 *values;			// count of them
+	UInt32 mismatches;		// found by m2SnapshotVerify, all told
+	UInt32 lastMismatch;		// offset of the last one
+};
+
+static inline UInt32 m2SnapshotRead(volatile UInt8 *address, UInt8 width)
+{
+	switch (width) {
+		case 2: return *(volatile UInt16 *) address;
+		case 4: return *(volatile UInt32 *) address;
+	}
+	return *address;
+}
+
+static inline void m2SnapshotWrite(volatile UInt8 *address, UInt8 width, UInt32 value)
+{
+	switch (width) {
+		case 2: *(volatile UInt16 *) address = (UInt16) value; break;
+		case 4: *(volatile UInt32 *) address = value; break;
+		default: *address = (UInt8) value; break;
+	}
+}
+
+static inline UInt32 m2SnapshotGet(M2Snapshot *snapshot, volatile UInt8 *address, UInt8 width)
+{
+	return snapshot->read ? snapshot->read(address, width) : m2SnapshotRead(address, width);
+}
+
+static inline void m2SnapshotPut(M2Snapshot *snapshot, volatile UInt8 *address, UInt8 width, UInt32 value)
+{
+	if (snapshot->write)
+		snapshot->write(address, width, value);
+	else
+		m2SnapshotWrite(address, width, value);
+}
+
+static inline void m2SnapshotInit(M2Snapshot *snapshot, volatile UInt8 *base,
+	const M2SnapshotEntry *entries, UInt32 count, UInt32 *values)
+{
+	snapshot->base = base;
+	snapshot->read = 0;
+	snapshot->write = 0;
+	snapshot->entries = entries;
+	snapshot->count = count;
+	snapshot->values = values;
+	snapshot->mismatches = 0;
+	snapshot->lastMismatch = 0;
+}
+
+static inline void m2SnapshotSave(M2Snapshot *snapshot)
+{
+	const M2SnapshotEntry *entry = snapshot->entries;
+	UInt32 i;
+
+	for (i = 0; i < snapshot->count; i++, entry++)
+		if (!(entry->flags & kSnapRewrite))
+			snapshot->values[i] = m2SnapshotGet(snapshot, snapshot->base + entry->offset, entry->width);
+	OSSynchronizeIO();
+}
+
+static inline void m2SnapshotRestore(M2Snapshot *snapshot)
+{
+	const M2SnapshotEntry *entry = snapshot->entries;
+	volatile UInt8 *address;
+	UInt32 i;
+
+	for (i = 0; i < snapshot->count; i++, entry++) {
+		if (i && (entry->group != entry[-1].group))
+			OSSynchronizeIO();
+		address = snapshot->base + entry->offset;
+		if (entry->flags & kSnapRewrite)
+			m2SnapshotPut(snapshot, address, entry->width, m2SnapshotGet(snapshot, address, entry->width));
+		else
+			m2SnapshotPut(snapshot, address, entry->width, snapshot->values[i] | entry->setBits);
+	}
+	sync();
+}
+
+// Reads the registers back after a restore, returns how many differ.
+//  A register restored twice is checked against its last entry only.
+static inline UInt32 m2SnapshotVerify(M2Snapshot *snapshot)
+{
+	const M2SnapshotEntry *entry = snapshot->entries;
+	UInt32 i, j, found = 0;
+
+	for (i = 0; i < snapshot->count; i++, entry++) {
+		if (entry->flags & (kSnapNoVerify | kSnapRewrite))
+			continue;
+		for (j = i + 1; j < snapshot->count; j++)
+			if (snapshot->entries[j].offset == entry->offset)
+				break;
+		if (j < snapshot->count)
+			continue;
+		if ((m2SnapshotGet(snapshot, snapshot->base + entry->offset, entry->width) ^ (snapshot->values[i] | entry->setBits))
+		    & entry->verifyMask) {
+			found++;
+			snapshot->lastMismatch = entry->offset;
+		}
+	}
+	snapshot->mismatches += found;
+
+	return found;
+}
+
+#endif
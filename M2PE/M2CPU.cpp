@@ -3,6 +3,7 @@
 
 extern "C" {
 	#include <ppc/proc_reg.h>
+	#include <machine/machine_routines.h>
 }
 
 #include "M2CPU.h"
@@ -16,6 +17,58 @@ extern "C" {
     #define VerboseIOLog(x...) {}
 #endif
 
+// L2CR is SPR 1017
+#ifndef mtl2cr
+#define mtl2cr(reg) __asm__ volatile("sync\n\tmtspr 1017, %0\n\tsync\n\tisync" : : "r" (reg))
+#endif
+
+// The L2 DLL needs 640 L2 clocks to lock after the L2 clock changes
+#define kL2DLLLockMicroseconds 20
+
+// Where flushL2 walks, in the kernel's V=R mapping of physical memory
+#define kL2FlushBase 0x00100000
+
+// Idle: the kernel naps when nothing is runnable if "NapEnabled" lets it,
+//  which it does not unless the personality or a client says so.  A probe
+//  every kIdleProbeSeconds measures how late a thread call fires: the wake
+//  from nap is in it, but so is the scheduling of the thread call, so it
+//  is an upper bound on the wake and not the interrupt latency itself.
+//  Above "IdleLatencyLimit" nap goes off, to be tried again after
+//  kNapRetryProbes probes, doubling up to kNapRetryMaxProbes while it keeps
+//  failing.  idleLock serializes the probe, setProperties and the
+//  statistics.
+#define kIdleProbeSeconds 5
+#define kNapRetryProbes 12
+#define kNapRetryMaxProbes 720
+
+// VIA registers carried across sleep, VIA1 at 0 and VIA2 at 0x2000.  The
+//  port outputs go before the directions so no pin glitches.  The
+//  interrupt enables are Whitney's: it rebuilds them from its copy
+//  (kWhitneyRestoreEnables) and viaEnableEntries is only for when it cannot.
+#define kVIABase 0x50F00000
+#define kWhitneyRestoreEnables "WhitneyRestoreEnables"
+
+static const M2SnapshotEntry viaEntries[] = {
+	{ 0x0000, 1, 0, kSnapNoVerify, 0, 0xFF },	// VIA1 ORB
+	{ 0x0400, 1, 0, 0, 0, 0xFF },			// DDRB
+	{ 0x1E00, 1, 0, kSnapNoVerify, 0, 0xFF },	// ORA, no handshake
+	{ 0x0600, 1, 0, 0, 0, 0xFF },			// DDRA
+	{ 0x1600, 1, 0, 0, 0, 0xFF },			// ACR
+	{ 0x1800, 1, 0, 0, 0, 0xFF },			// PCR
+	{ 0x2000, 1, 0, kSnapNoVerify, 0, 0xFF },	// VIA2 ORB
+	{ 0x2400, 1, 0, 0, 0, 0xFF },			// DDRB
+	{ 0x3E00, 1, 0, kSnapNoVerify, 0, 0xFF },	// ORA, no handshake
+	{ 0x2600, 1, 0, 0, 0, 0xFF },			// DDRA
+	{ 0x3600, 1, 0, 0, 0, 0xFF },			// ACR
+	{ 0x3800, 1, 0, 0, 0, 0xFF },			// PCR
+	{ 0x1200, 1, 1, kSnapRewrite, 0, 0 }		// VIA1 T2 high, from ROM: restarts timer 2
+};
+
+static const M2SnapshotEntry viaEnableEntries[] = {
+	{ 0x1C00, 1, 0, 0, 0x80, 0x7F },		// VIA1 IER, bit 7 set to enable
+	{ 0x3C00, 1, 0, 0, 0x80, 0x7F }			// VIA2 IER
+};
+
 #define super IOCPU
 
 OSDefineMetaClassAndStructors(M2CPU, IOCPU);
@@ -46,18 +99,25 @@ bool M2CPU::start(IOService *provider)
 
     cpuIC->registerCPUInterruptController();
 
+    m2SnapshotInit(&viaSnapshot, (volatile UInt8 *) kVIABase, viaEntries,
+                   sizeof(viaEntries) / sizeof(viaEntries[0]), viaValues);
+    m2SnapshotInit(&viaEnableSnapshot, (volatile UInt8 *) kVIABase, viaEnableEntries,
+                   sizeof(viaEnableEntries) / sizeof(viaEnableEntries[0]), viaEnableValues);
+    restoreEnablesSymbol = OSSymbol::withCStringNoCopy(kWhitneyRestoreEnables);
+
     processor_info.cpu_id = (cpu_id_t) this;
     processor_info.boot_cpu = true;
     processor_info.start_paddr = 0x100;			// Wakes to reset vector
     processorKind = mfpvr() >> 16;
     
     // Retrieve L2CR for processors which are known to have L2: namely 750, 750*X
-    if ((processorKind == 8) || ((processorKind & ~0x0002) == 0x7000))
-	processor_info.l2cr_value = mfl2cr() & 0x7FFFFFFF;	// cache-disabled value (see GossamerCPU)
-    else
+    if ((processorKind == 8) || ((processorKind & ~0x0002) == 0x7000)) {
+	setupL2(provider);
+	processor_info.l2cr_value = l2crValue ? l2crValue : (mfl2cr() & 0x7FFFFFFF);	// cache-disabled value (see GossamerCPU)
+    } else
 	processor_info.l2cr_value = 0;
         
-    processor_info.supports_nap = false;
+    processor_info.supports_nap = true;		// the 603e and 750 both nap
     processor_info.time_base_enable = 0;
 
     // Register this CPU with mach.
@@ -67,6 +127,8 @@ bool M2CPU::start(IOService *provider)
 
     setCPUState(kIOCPUStateUninitalized);
 
+    setupIdle();
+
     processor_start(machProcessor);
 
     registerService();
@@ -85,6 +147,9 @@ void M2CPU::ipiHandler(void *refCon, void *nub, int source)
 // boot = false: we are waking from sleep
 void M2CPU::initCPU(bool boot)
 {
+    // The L2 lost its configuration and contents if we slept
+    enableL2();
+
     if (boot)
         cpuIC->enableCPUInterrupt(this);
     else {
@@ -97,8 +162,14 @@ void M2CPU::initCPU(bool boot)
         // Restore time base after wake (since CPU's TBR was set to zero during sleep)
         restoreTB();
         
-        // Restore VIA1/2 state
-        saveRestoreVIA(false);
+        // Restore VIA1/2 state, then the interrupt enables from Whitney's copy
+        m2SnapshotRestore(&viaSnapshot);
+        m2SnapshotVerify(&viaSnapshot);
+        if (!whitney || !restoreEnablesSymbol
+         || (whitney->callPlatformFunction(restoreEnablesSymbol, false, 0, 0, 0, 0) != kIOReturnSuccess)) {
+            m2SnapshotRestore(&viaEnableSnapshot);
+            m2SnapshotVerify(&viaEnableSnapshot);
+        }
 
 #if 0        
         // Make some noise via Singer
@@ -114,6 +185,9 @@ extern UInt32 ResetHandler;
 // flushes the cash for a word at the given address.
 #define cFlush(addr) __asm__ volatile("dcbf	0, %0" : : "r" (addr))
 
+// loads a word at the given address, into the caches.
+#define cTouch(addr) do { unsigned int w; __asm__ volatile("lwz	%0, 0(%1)" : "=r" (w) : "b" (addr)); } while (0)
+
 extern "C" {
     extern void cacheInit(void);
     extern void cacheDisable(void);
@@ -128,11 +202,15 @@ void M2CPU::quiesceCPU(void)
         pmu->callPlatformFunction("sleepNow", false, 0, 0, 0, 0);
     
     // Save VIA1/2 state
-    saveRestoreVIA(true);
+    m2SnapshotSave(&viaSnapshot);
+    m2SnapshotSave(&viaEnableSnapshot);
 
     // Save time base before sleep since CPU's TBR will be set to zero at wake.
     saveTB();
 
+    // The L2 loses power: write back what only it holds, and turn it off
+    flushL2();
+
     // Raise the 68k interrupt level to 7 (at the ICR)
     *((volatile UInt32 *) 0x50F2A000) = 0x38;
     
@@ -163,10 +241,323 @@ void M2CPU::haltCPU(void)
 	
 	// Find PMU now -- should not do this in quiesceCPU, which runs in interrupt context.
 	pmu = waitForService(serviceMatching("ApplePMU"), &timeout);
+	whitney = waitForService(serviceMatching("Whitney"), &timeout);
 
 	processor_exit(machProcessor); 
 }
 
+// Reads an L2 setting from our properties (the personality can set them)
+//  or from the provider's
+static bool getL2Setting(IOService *cpu, IOService *provider, const char *key, unsigned int *value)
+{
+	OSObject *object = cpu->getProperty(key);
+	OSNumber *number;
+	OSBoolean *boolean;
+
+	if (!object)
+		object = provider->getProperty(key);
+	if ((number = OSDynamicCast(OSNumber, object)))
+		*value = number->unsigned32BitValue();
+	else if ((boolean = OSDynamicCast(OSBoolean, object)))
+		*value = boolean->isTrue() ? 1 : 0;
+	else
+		return false;
+
+	return true;
+}
+
+// Works out the L2 configuration from L2CR as the firmware left it and
+//  the overrides, and publishes it as "L2Cache"
+void M2CPU::setupL2(IOService *provider)
+{
+	struct M2L2Settings settings;
+	unsigned int firmwareL2CR = mfl2cr(), enable = 1;
+	OSDictionary *dict;
+	OSNumber *number;
+
+	m2L2ClearSettings(&settings);
+	getL2Setting(this, provider, "L2Size", &settings.sizeKB);
+	getL2Setting(this, provider, "L2ClockRatioX2", &settings.clockHalves);
+	getL2Setting(this, provider, "L2RAMType", &settings.ramType);
+	getL2Setting(this, provider, "L2OutputHold", &settings.outputHold);
+	getL2Setting(this, provider, "L2WriteThrough", &settings.writeThrough);
+	getL2Setting(this, provider, "L2Parity", &settings.parity);
+	getL2Setting(this, provider, "L2Enable", &enable);
+
+	if (firmwareL2CR & kL2CREnable) {
+		// Changing it now would need a flush first; keep what is there
+		l2crValue = m2L2ComputeL2CR(firmwareL2CR, &settings);
+		if (l2crValue != (firmwareL2CR & ~(kL2CREnable | kL2CRInvalidate | kL2CRInvalidating)))
+			IOLog("M2CPU: L2 already on, L2CR 0x%08x kept\n", firmwareL2CR);
+		l2crValue = firmwareL2CR & ~(kL2CREnable | kL2CRInvalidate | kL2CRInvalidating);
+		l2Enabled = true;
+	} else if (enable) {
+		l2crValue = m2L2ComputeL2CR(firmwareL2CR, &settings);
+		if (!l2crValue)
+			IOLog("M2CPU: L2 size or speed unknown (L2CR 0x%08x), L2 stays off\n", firmwareL2CR);
+	} else
+		l2crValue = 0;
+
+	VerboseIOLog("M2CPU: L2CR firmware 0x%08x, ours 0x%08x\n", firmwareL2CR, l2crValue);
+
+	dict = OSDictionary::withCapacity(4);
+	if (!dict)
+		return;
+	if ((number = OSNumber::withNumber(l2crValue, 32))) {
+		dict->setObject("L2CR", number);
+		number->release();
+	}
+	if ((number = OSNumber::withNumber(m2L2SizeKB(l2crValue), 32))) {
+		dict->setObject("Size", number);
+		number->release();
+	}
+	if ((number = OSNumber::withNumber(m2L2ClockHalves(l2crValue), 32))) {
+		dict->setObject("ClockRatioX2", number);
+		number->release();
+	}
+	dict->setObject("WriteThrough", (l2crValue & kL2CRWriteThrough) ? kOSBooleanTrue : kOSBooleanFalse);
+	dict->setObject("Enabled", l2crValue ? kOSBooleanTrue : kOSBooleanFalse);
+	setProperty("L2Cache", dict);
+	dict->release();
+}
+
+// Global invalidate, then enable, with interrupts off since nothing may
+//  touch memory through the L2 in between
+void M2CPU::enableL2(void)
+{
+	boolean_t interruptState;
+
+	if (!l2crValue || l2Enabled || (mfl2cr() & kL2CREnable))
+		return;
+
+	interruptState = ml_set_interrupts_enabled(false);
+
+	mtl2cr(l2crValue);				// configured but off, lets the DLL lock
+	IODelay(kL2DLLLockMicroseconds);
+	mtl2cr(l2crValue | kL2CRInvalidate);
+	while (mfl2cr() & kL2CRInvalidating)
+		;
+	mtl2cr(l2crValue);
+	mtl2cr(l2crValue | kL2CREnable);
+	l2Enabled = true;
+
+	(void) ml_set_interrupts_enabled(interruptState);
+}
+
+// Writes back and invalidates the L2, then turns it off.  The 750 has no
+//  hardware flush, so this is the sequence of its user's manual ("L2
+//  Cache Flushing"): with interrupts off, load twice the L2's size of
+//  memory, which casts out every modified line, then dcbf the same lines.
+//  A write-through L2 holds nothing memory lacks and is only turned off.
+void M2CPU::flushL2(void)
+{
+	unsigned int bytes = m2L2FlushBytes(l2crValue), offset;
+	boolean_t interruptState;
+
+	if (!l2Enabled)
+		return;
+
+	interruptState = ml_set_interrupts_enabled(false);
+
+	if (!(l2crValue & kL2CRWriteThrough)) {
+		for (offset = 0; offset < bytes; offset += kL2LineBytes)
+			cTouch(kL2FlushBase + offset);
+		for (offset = 0; offset < bytes; offset += kL2LineBytes)
+			cFlush(kL2FlushBase + offset);
+		__asm__ volatile("sync");
+	}
+	mtl2cr(l2crValue);				// L2E off
+	l2Enabled = false;
+
+	(void) ml_set_interrupts_enabled(interruptState);
+}
+
+void M2CPU::setupIdle(void)
+{
+	OSBoolean *napEnabled = OSDynamicCast(OSBoolean, getProperty("NapEnabled"));
+	OSNumber *limit = OSDynamicCast(OSNumber, getProperty("IdleLatencyLimit"));
+	OSSerializer *serializer;
+
+	idleLock = IOLockAlloc();
+	if (!idleLock) {
+		(void) ml_enable_nap(getCPUNumber(), false);	// no policy, no nap
+		return;
+	}
+
+	napWanted = napEnabled ? napEnabled->isTrue() : false;
+	idleLatencyLimit = limit ? limit->unsigned32BitValue() : 0;
+	napRetryProbes = kNapRetryProbes;
+	IOLockLock(idleLock);
+	setNap(napWanted);
+	IOLockUnlock(idleLock);
+
+	serializer = OSSerializer::forTarget((void *) this, &M2CPU::serializeIdleStatistics);
+	if (serializer) {
+		setProperty("IdleStatistics", serializer);
+		serializer->release();
+	}
+
+	idleProbe = thread_call_allocate((thread_call_func_t) &M2CPU::idleProbeFired, (thread_call_param_t) this);
+	if (idleProbe)
+		armIdleProbe();
+}
+
+// With idleLock held
+void M2CPU::setNap(bool nap)
+{
+	napOn = nap;
+	(void) ml_enable_nap(getCPUNumber(), nap);
+}
+
+void M2CPU::armIdleProbe(void)
+{
+	clock_interval_to_deadline(kIdleProbeSeconds, kSecondScale, &idleProbeDeadline);
+	thread_call_enter_delayed(idleProbe, idleProbeDeadline);
+}
+
+// Accounts for how late the probe came and applies the latency limit
+void M2CPU::idleProbeFired(thread_call_param_t me, thread_call_param_t /* unused */)
+{
+	M2CPU *self = (M2CPU *) me;
+	AbsoluteTime now;
+	UInt64 nanoseconds;
+	UInt32 latency, bucket;
+
+	clock_get_uptime(&now);
+	SUB_ABSOLUTETIME(&now, &self->idleProbeDeadline);
+	absolutetime_to_nanoseconds(now, &nanoseconds);
+	latency = (UInt32) (nanoseconds / 1000);
+
+	IOLockLock(self->idleLock);
+	for (bucket = 0; (bucket < kIdleHistBuckets - 1) && (latency >> (2 * bucket + 2)); bucket++)
+		;
+	if (self->napOn) {
+		self->napProbes++;
+		self->napLatencyHist[bucket]++;
+		if (latency > self->maxNapLatency)
+			self->maxNapLatency = latency;
+	} else {
+		self->spinProbes++;
+		self->spinLatencyHist[bucket]++;
+	}
+
+	if (self->napOn && self->idleLatencyLimit && (latency > self->idleLatencyLimit)) {
+		self->setNap(false);		// back off
+		self->napBackoffs++;
+		self->probesUntilNap = self->napRetryProbes;
+		if (self->napRetryProbes < kNapRetryMaxProbes)
+			self->napRetryProbes *= 2;
+	} else if (!self->napOn && self->napWanted
+	 && (!self->probesUntilNap || !--self->probesUntilNap))
+		self->setNap(true);
+	else if (self->napOn && (self->napRetryProbes > kNapRetryProbes))
+		self->napRetryProbes--;		// settles back while nap keeps up
+	IOLockUnlock(self->idleLock);
+
+	self->armIdleProbe();
+}
+
+// "NapEnabled" and "IdleLatencyLimit" (microseconds, 0 for none) at run
+//  time: a client that needs a quick interrupt response, audio playback
+//  for one, sets the limit while it runs
+IOReturn M2CPU::setProperties(OSObject *properties)
+{
+	OSDictionary *dict = OSDynamicCast(OSDictionary, properties);
+	OSBoolean *napEnabled;
+	OSNumber *limit;
+	IOReturn result = kIOReturnUnsupported;
+
+	if (!dict)
+		return kIOReturnBadArgument;
+	if (!idleLock)
+		return kIOReturnUnsupported;
+
+	limit = OSDynamicCast(OSNumber, dict->getObject("IdleLatencyLimit"));
+	napEnabled = OSDynamicCast(OSBoolean, dict->getObject("NapEnabled"));
+
+	IOLockLock(idleLock);
+	if (limit) {
+		idleLatencyLimit = limit->unsigned32BitValue();
+		napRetryProbes = kNapRetryProbes;
+		probesUntilNap = 0;
+		result = kIOReturnSuccess;
+	}
+	if (napEnabled) {
+		napWanted = napEnabled->isTrue();
+		result = kIOReturnSuccess;
+	}
+	if (result == kIOReturnSuccess)
+		setNap(napWanted);		// nap gets measured again under the new limit
+	IOLockUnlock(idleLock);
+
+	// outside idleLock: the registry may be serializing IdleStatistics,
+	//  which takes it
+	if (limit)
+		setProperty("IdleLatencyLimit", limit);
+	if (napEnabled)
+		setProperty("NapEnabled", napEnabled);
+
+	return result;
+}
+
+static void setIdleNumber(OSDictionary *dict, const char *key, UInt32 value)
+{
+	OSNumber *number = OSNumber::withNumber(value, 32);
+
+	if (number) {
+		dict->setObject(key, number);
+		number->release();
+	}
+}
+
+static void setIdleHistogram(OSDictionary *dict, const char *key, const UInt32 *hist)
+{
+	OSArray *array = OSArray::withCapacity(kIdleHistBuckets);
+	UInt32 i;
+
+	if (!array)
+		return;
+	for (i = 0; i < kIdleHistBuckets; i++) {
+		OSNumber *number = OSNumber::withNumber(hist[i], 32);
+		if (number) {
+			array->setObject(number);
+			number->release();
+		}
+	}
+	dict->setObject(key, array);
+	array->release();
+}
+
+// Publishes the idle state and the probe latencies (microseconds, bucket
+//  n holding 4^n to 4^(n+1)-1) when someone reads "IdleStatistics"
+bool M2CPU::serializeIdleStatistics(void *target, void * /* ref */, OSSerialize *s)
+{
+	M2CPU *self = (M2CPU *) target;
+	OSDictionary *dict = OSDictionary::withCapacity(8);
+	bool ok;
+
+	if (!dict)
+		return false;
+
+	if (self->idleLock)
+		IOLockLock(self->idleLock);
+	dict->setObject("Napping", self->napOn ? kOSBooleanTrue : kOSBooleanFalse);
+	setIdleNumber(dict, "LatencyLimit", self->idleLatencyLimit);
+	setIdleNumber(dict, "NapBackoffs", self->napBackoffs);
+	setIdleNumber(dict, "NapProbes", self->napProbes);
+	setIdleNumber(dict, "SpinProbes", self->spinProbes);
+	setIdleNumber(dict, "MaxNapLatency", self->maxNapLatency);
+	setIdleNumber(dict, "WakeRestoreMismatches", self->viaSnapshot.mismatches + self->viaEnableSnapshot.mismatches);
+	setIdleHistogram(dict, "NapLatencyHistogram", self->napLatencyHist);
+	setIdleHistogram(dict, "SpinLatencyHistogram", self->spinLatencyHist);
+	if (self->idleLock)
+		IOLockUnlock(self->idleLock);
+
+	ok = dict->serialize(s);
+	dict->release();
+	return ok;
+}
+
 void M2CPU::saveTB(void)
 {
 	unsigned long tbHigh2;
@@ -185,57 +576,6 @@ void M2CPU::restoreTB(void)
 	mttb(savedTBLow);
 }
 
-void M2CPU::saveRestoreVIA(bool save)
-{
-    volatile UInt8 *viaAddr = (volatile UInt8 *) 0x50F00000;
-    
-    if (save) {
-        // Save VIA1
-        viaSave[0] = viaAddr[0x0000];
-        viaSave[1] = viaAddr[0x0400];
-        viaSave[2] = viaAddr[0x1E00];
-        viaSave[3] = viaAddr[0x0600];
-        viaSave[4] = viaAddr[0x1C00] | 0x80;		// set 'enable' bit
-        viaSave[5] = viaAddr[0x1600];
-        viaSave[6] = viaAddr[0x1800];
-
-        // Save VIA2
-        viaAddr += 0x2000;
-        viaSave[7] = viaAddr[0x0000];
-        viaSave[8] = viaAddr[0x0400];
-        viaSave[9] = viaAddr[0x1E00];
-        viaSave[10] = viaAddr[0x0600];
-        viaSave[11] = viaAddr[0x1C00] | 0x80;		// set 'enable' bit
-        viaSave[12] = viaAddr[0x1600];
-        viaSave[13] = viaAddr[0x1800];        
-    } else {
-        // Restore VIA1
-        viaAddr[0x0000] = viaSave[0]; OSSynchronizeIO();
-        viaAddr[0x0400] = viaSave[1]; OSSynchronizeIO();
-        viaAddr[0x1E00] = viaSave[2]; OSSynchronizeIO();
-        viaAddr[0x0600] = viaSave[3]; OSSynchronizeIO();
-        viaAddr[0x1C00] = viaSave[4]; OSSynchronizeIO();
-        viaAddr[0x1600] = viaSave[5]; OSSynchronizeIO();
-        viaAddr[0x1800] = viaSave[6]; OSSynchronizeIO();
-        
-        // from ROM; starts one of the timers running, perhaps?
-        viaAddr[0x1200] = viaAddr[0x1200]; OSSynchronizeIO();
-        
-        // clear VIA1 interrupts
-//        viaAddr[0x1A00] = viaAddr[0x1A00];
-        
-        // Restore VIA2
-        viaAddr += 0x2000;
-        viaAddr[0x0000] = viaSave[7]; OSSynchronizeIO();
-        viaAddr[0x0400] = viaSave[8]; OSSynchronizeIO();
-        viaAddr[0x1E00] = viaSave[9]; OSSynchronizeIO();
-        viaAddr[0x0600] = viaSave[10]; OSSynchronizeIO();
-        viaAddr[0x1C00] = viaSave[11]; OSSynchronizeIO();
-        viaAddr[0x1600] = viaSave[12]; OSSynchronizeIO();
-        viaAddr[0x1800] = viaSave[13]; OSSynchronizeIO();
-    }
-}
-
 #if 0
 void M2CPU::singerNote(void)
 {
@@ -5,6 +5,15 @@
 #include <IOKit/IODeviceTreeSupport.h>
 #include <IOKit/IOPlatformExpert.h>
 
+#include "M2L2CR.h"
+#include "M2RegisterSnapshot.h"
+
+extern "C" {
+#include <kern/thread_call.h>
+}
+
+#define kIdleHistBuckets 8		// wake latency, bucket n: 4^n to 4^(n+1)-1 microseconds
+
 class M2CPU : public IOCPU
 {
 	OSDeclareDefaultStructors(M2CPU)
@@ -15,17 +24,46 @@ public:
 	const OSSymbol *getCPUName(void);
 	kern_return_t startCPU(vm_offset_t start_paddr, vm_offset_t arg_paddr);
 	void haltCPU(void);
+	IOReturn setProperties(OSObject *properties);
         
 protected:
 	IOService *pmu;
 	IOCPUInterruptController *cpuIC;
 	unsigned long savedTBLow, savedTBHigh;		// saved timebase for sleep
-	UInt8 viaSave[2 * 7];				// saved VIA registers for sleep
+	IOService *whitney;
+	const OSSymbol *restoreEnablesSymbol;
+	M2Snapshot viaSnapshot;				// VIA registers for sleep
+	UInt32 viaValues[13];
+	M2Snapshot viaEnableSnapshot;			// their enables, if Whitney cannot
+	UInt32 viaEnableValues[2];
+	unsigned int l2crValue;				// L2 configuration without L2E, 0 for no L2
+	bool l2Enabled;
+
+	// Idle policy, see M2CPU::idleProbeFired
+	IOLock *idleLock;				// for all of the below
+	bool napWanted;					// "NapEnabled", off by default
+	bool napOn;					// what the kernel does now
+	UInt32 idleLatencyLimit;			// microseconds, 0 for none
+	UInt32 napRetryProbes;				// backoff before nap is tried again
+	UInt32 probesUntilNap;
+	thread_call_t idleProbe;
+	AbsoluteTime idleProbeDeadline;
+	UInt32 napProbes, spinProbes, napBackoffs;
+	UInt32 maxNapLatency;
+	UInt32 napLatencyHist[kIdleHistBuckets];
+	UInt32 spinLatencyHist[kIdleHistBuckets];
         
 	void ipiHandler(void *refCon, void *nub, int source);
+	void setupL2(IOService *provider);
+	void enableL2(void);
+	void flushL2(void);
+	void setupIdle(void);
+	void setNap(bool nap);
+	void armIdleProbe(void);
+	static void idleProbeFired(thread_call_param_t me, thread_call_param_t unused);
+	static bool serializeIdleStatistics(void *target, void *ref, OSSerialize *s);
 	void saveTB(void);
         void restoreTB(void);
-        void saveRestoreVIA(bool save);
 };
 
 #endif
\ No newline at end of file
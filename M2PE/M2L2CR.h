@@ -0,0 +1,143 @@
+#ifndef _M2_L2CR_H
+#define _M2_L2CR_H
+
+// L2CR arithmetic for the 750 class processors on the G3 upgrade cards.
+//  Nothing here touches the processor, so it builds anywhere.
+
+// L2CR fields
+#define kL2CREnable		0x80000000	// L2E
+#define kL2CRParity		0x40000000	// L2PE
+#define kL2CRSizeMask		0x30000000	// L2SIZ
+#define kL2CRSizeShift		28
+#define kL2CRClockMask		0x0E000000	// L2CLK
+#define kL2CRClockShift		25
+#define kL2CRRAMTypeMask	0x01800000	// L2RAM
+#define kL2CRRAMTypeShift	23
+#define kL2CRDataOnly		0x00400000	// L2DO
+#define kL2CRInvalidate		0x00200000	// L2I
+#define kL2CRWriteThrough	0x00080000	// L2WT
+#define kL2CROutputHoldMask	0x00030000	// L2OH
+#define kL2CROutputHoldShift	16
+#define kL2CRInvalidating	0x00000001	// L2IP
+
+// Settings that override what the firmware left in L2CR, kL2Unset for none
+#define kL2Unset		0xFFFFFFFF
+
+struct M2L2Settings {
+	unsigned int sizeKB;		// 256, 512 or 1024
+	unsigned int clockHalves;	// processor clocks per L2 clock, times 2: 2, 3, 4, 5 or 6
+	unsigned int ramType;		// 0 flow-through, 2 pipelined burst, 3 late write
+	unsigned int outputHold;	// 0 to 3
+	unsigned int writeThrough;	// 1 write-through, 0 copy-back
+	unsigned int parity;
+};
+
+static inline void m2L2ClearSettings(struct M2L2Settings *settings)
+{
+	settings->sizeKB = kL2Unset;
+	settings->clockHalves = kL2Unset;
+	settings->ramType = kL2Unset;
+	settings->outputHold = kL2Unset;
+	settings->writeThrough = kL2Unset;
+	settings->parity = kL2Unset;
+}
+
+// L2 size in KB, 0 if L2CR does not say
+static inline unsigned int m2L2SizeKB(unsigned int l2cr)
+{
+	switch ((l2cr & kL2CRSizeMask) >> kL2CRSizeShift) {
+		case 1: return 256;
+		case 2: return 512;
+		case 3: return 1024;
+	}
+	return 0;
+}
+
+static inline unsigned int m2L2SizeField(unsigned int sizeKB)
+{
+	switch (sizeKB) {
+		case 256: return 1;
+		case 512: return 2;
+		case 1024: return 3;
+	}
+	return 0;
+}
+
+// Processor clocks per L2 clock times 2, 0 if the L2 clock is off
+static inline unsigned int m2L2ClockHalves(unsigned int l2cr)
+{
+	switch ((l2cr & kL2CRClockMask) >> kL2CRClockShift) {
+		case 1: return 2;
+		case 2: return 3;
+		case 4: return 4;
+		case 5: return 5;
+		case 6: return 6;
+	}
+	return 0;
+}
+
+static inline unsigned int m2L2ClockField(unsigned int clockHalves)
+{
+	switch (clockHalves) {
+		case 2: return 1;
+		case 3: return 2;
+		case 4: return 4;
+		case 5: return 5;
+		case 6: return 6;
+	}
+	return 0;
+}
+
+// The L2CR to run with: the firmware's value with the overrides applied,
+//  without L2E, L2I and L2IP.  0 when the size or the clock is unknown
+//  or an override is out of range, and the L2 has to stay off.
+static inline unsigned int m2L2ComputeL2CR(unsigned int firmwareL2CR, const struct M2L2Settings *settings)
+{
+	unsigned int l2cr = firmwareL2CR & ~(kL2CREnable | kL2CRInvalidate | kL2CRInvalidating);
+	unsigned int field;
+
+	if (settings->sizeKB != kL2Unset) {
+		if (!(field = m2L2SizeField(settings->sizeKB)))
+			return 0;
+		l2cr = (l2cr & ~kL2CRSizeMask) | (field << kL2CRSizeShift);
+	}
+	if (settings->clockHalves != kL2Unset) {
+		if (!(field = m2L2ClockField(settings->clockHalves)))
+			return 0;
+		l2cr = (l2cr & ~kL2CRClockMask) | (field << kL2CRClockShift);
+	}
+	if (settings->ramType != kL2Unset) {
+		if ((settings->ramType > 3) || (settings->ramType == 1))
+			return 0;
+		l2cr = (l2cr & ~kL2CRRAMTypeMask) | (settings->ramType << kL2CRRAMTypeShift);
+	}
+	if (settings->outputHold != kL2Unset) {
+		if (settings->outputHold > 3)
+			return 0;
+		l2cr = (l2cr & ~kL2CROutputHoldMask) | (settings->outputHold << kL2CROutputHoldShift);
+	}
+	if (settings->writeThrough != kL2Unset)
+		l2cr = settings->writeThrough ? (l2cr | kL2CRWriteThrough) : (l2cr & ~kL2CRWriteThrough);
+	if (settings->parity != kL2Unset)
+		l2cr = settings->parity ? (l2cr | kL2CRParity) : (l2cr & ~kL2CRParity);
+
+	if (!m2L2SizeKB(l2cr) || !m2L2ClockHalves(l2cr))
+		return 0;
+
+	return l2cr;
+}
+
+// The 750 has no operation that flushes the L2: loading twice its size
+//  of memory displaces every line it holds, and a dcbf of each line of
+//  that memory then takes them out of both caches.  The bytes to walk,
+//  for the largest L2 if L2CR does not say the size.
+#define kL2LineBytes		32
+
+static inline unsigned int m2L2FlushBytes(unsigned int l2cr)
+{
+	unsigned int sizeKB = m2L2SizeKB(l2cr);
+
+	return 2 * 1024 * (sizeKB ? sizeKB : 1024);
+}
+
+#endif
@@ -27,6 +27,7 @@
 #include "OpenPMUPwrController.h"
 #include "OpenPMUXPRAMController.h"
 #include <IOKit/pwr_mgt/RootDomain.h>
+#include <libkern/OSAtomic.h>
 
 #include "OpenPMUUserClient.h"
 
@@ -134,6 +135,46 @@ OpenPMUInterface::start(IOService *nub)
     // Creates the mutex lock to protect the clients list:
     clientMutexLock = NULL;
     clientMutexLock = IOLockAlloc();
+
+    // The clients table starts empty:
+    bzero(clientTables, sizeof(clientTables));
+    activeClientTable = &clientTables[0];
+
+    // And the events for the clients need their pool:
+    if (!allocateEventPool())
+        return false;
+
+    OSSerializer *eventSerializer = OSSerializer::forTarget(this, &serializeEventStatistics);
+    if (eventSerializer != NULL) {
+        setProperty("PMUEventStatistics", eventSerializer);
+        eventSerializer->release();
+    }
+
+    // The ADB autopoll packets have their own ring and delivery thread:
+    adbRingHead = adbRingTail = 0;
+    adbDeliveryPending = 0;
+    adbPacketsQueued = adbDeliveries = adbLargestBatch = 0;
+    adbRingOverruns = adbOversizePackets = 0;
+    adbDeliveryLock = IOLockAlloc();
+    adbDeliveryThread = thread_call_allocate((thread_call_func_t)adbDeliveryCaller, (thread_call_param_t)this);
+    if ((adbDeliveryLock == NULL) || (adbDeliveryThread == NULL)) {
+#if VERBOSE
+        IOLog("OpenPMUInterface::start can not allocate the ADB delivery thread call\n");
+#endif
+        return false;
+    }
+
+    // The devices are powered up on wake from this one:
+    wakeBatch.length = 0;
+    wakeBatchBusy = false;
+    wakeBatchLock = IOLockAlloc();
+    wakeBatchThread = thread_call_allocate((thread_call_func_t)wakeBatchCaller, (thread_call_param_t)this);
+    if ((wakeBatchLock == NULL) || (wakeBatchThread == NULL)) {
+#if VERBOSE
+        IOLog("OpenPMUInterface::start can not allocate the wake thread call\n");
+#endif
+        return false;
+    }
     
     // creates the syncer lock:
     syncLock = NULL;
@@ -343,20 +384,47 @@ OpenPMUInterface::freeAllResources(void)
         theHWInterface = NULL;
     }
 
-    // Releases the mutex lock used to protect the clients lists:
-    if (clientMutexLock != NULL) {
-        IOLockFree (clientMutexLock);
-        clientMutexLock = NULL;
-    }
-    
     // Releases the syncer lock:
     if (syncLock != NULL) {
         IOLockFree (syncLock);
         syncLock = NULL;
     }
 
+    // No more interrupts, so no more events for the clients:
+    freeEventPool();
+
+    if (adbDeliveryThread != NULL) {
+        thread_call_cancel(adbDeliveryThread);
+        thread_call_free(adbDeliveryThread);
+        adbDeliveryThread = NULL;
+    }
+
+    if (adbDeliveryLock != NULL) {
+        IOLockFree(adbDeliveryLock);
+        adbDeliveryLock = NULL;
+    }
+
+    if (wakeBatchThread != NULL) {
+        thread_call_cancel(wakeBatchThread);
+        thread_call_free(wakeBatchThread);
+        wakeBatchThread = NULL;
+    }
+
+    if (wakeBatchLock != NULL) {
+        IOLockFree(wakeBatchLock);
+        wakeBatchLock = NULL;
+    }
+
     // The last thing to release are the clients:
-    return (clearPMUClientList());
+    bool clientsCleared = clearPMUClientList();
+
+    // Releases the mutex lock used to protect the clients lists:
+    if (clientMutexLock != NULL) {
+        IOLockFree (clientMutexLock);
+        clientMutexLock = NULL;
+    }
+
+    return clientsCleared;
 }
 
 // De-Syncers: they make up for the lack of thread_func_call()
@@ -423,6 +491,42 @@ OpenPMUInterface::CallAndFreeThread(ThreadParametersPtr params)
 // Client handling methods:
 // ------------------------
 
+// --------------------------------------------------------------------------
+//
+// Method: publishPMUClientTable
+//
+// Purpose:
+//         builds the per-bit index of the given table (which must be the
+//         spare one) and makes it the active table. Then it waits for the
+//         readers of the old table to leave, so when we return nobody is
+//         looking at the old clients anymore. Must be called with the
+//         clientMutexLock held.
+void
+OpenPMUInterface::publishPMUClientTable(PMUClientTablePtr newTable)
+{
+    PMUClientTablePtr oldTable = activeClientTable;
+    UInt32 bit, i;
+
+    for (bit = 0; bit < kPMUInterruptBits; bit++) {
+        newTable->clientsForBit[bit] = 0;
+
+        for (i = 0; i < newTable->numberOfClients; i++) {
+            if (newTable->clients[i].interruptMask & (1 << bit))
+                newTable->clientIndex[bit][newTable->clientsForBit[bit]++] = i;
+        }
+    }
+
+    // The table must be complete before anyone can see it:
+    OSCompareAndSwap((UInt32)oldTable, (UInt32)newTable, (UInt32*)&activeClientTable);
+
+    // Wait for the readers that are still in the old table. They are
+    // client callbacks, so this is going to be short:
+    // (NOTE: as with the old mutex, a client must not register or
+    // de-register from inside its own callback).
+    while (oldTable->readers != 0)
+        IOSleep(1);
+}
+
 // --------------------------------------------------------------------------
 //
 // Method: addPMUClient
@@ -438,22 +542,30 @@ OpenPMUInterface::addPMUClient(UInt8 interruptMask, OpenPMUClient function, IOSe
     
     if (clientMutexLock != NULL)
         IOLockLock(clientMutexLock);
-    
-    PMUClientPtr newClient = (PMUClientPtr)IOMalloc(sizeof(PMUClient));
 
-    if (newClient != NULL) {
-        // Just creates a new link and atteches to the top of the list (there
+    PMUClientTablePtr oldTable = activeClientTable;
+    PMUClientTablePtr newTable = (oldTable == &clientTables[0]) ? &clientTables[1] : &clientTables[0];
+
+    if (oldTable->numberOfClients < kMaxPMUClients) {
+        // Copies the current clients and adds the new one at the end (there
         // is no order in the list so we can attach it anywhere).
-        newClient->nextClient = listHead;
-        newClient->interruptMask = interruptMask;
-        newClient->client = caller;
-        newClient->callBackFunction = function;
+        bcopy(oldTable->clients, newTable->clients, oldTable->numberOfClients * sizeof(PMUClient));
+        newTable->numberOfClients = oldTable->numberOfClients;
+
+        newTable->clients[newTable->numberOfClients].interruptMask = interruptMask;
+        newTable->clients[newTable->numberOfClients].client = caller;
+        newTable->clients[newTable->numberOfClients].callBackFunction = function;
+        newTable->numberOfClients++;
 
-        listHead = newClient;
+        publishPMUClientTable(newTable);
 
-        // The only possible problem was the lack of memory.
+        // The only possible problem was the lack of room.
         result = true;
     }
+#ifdef VERBOSE_LOGS_ON_PMU_INT
+    else
+        IOLog("OpenPMUInterface::addPMUClient, too many clients\n");
+#endif // VERBOSE_LOGS_ON_PMU_INT
 
     if (clientMutexLock != NULL)
          IOLockUnlock(clientMutexLock);
@@ -470,52 +582,33 @@ OpenPMUInterface::addPMUClient(UInt8 interruptMask, OpenPMUClient function, IOSe
 bool
 OpenPMUInterface::removePMUClient(IOService * caller, UInt8 interruptMask)
 {
+    bool result = false;
+
     if (clientMutexLock != NULL)
         IOLockLock(clientMutexLock);
 
-    PMUClientPtr tmp, tmpPrev = NULL;
-
-    for (tmp = listHead; tmp != NULL; tmp = tmp->nextClient) {
-        if ((tmp->client == caller) && (tmp->interruptMask == interruptMask)) {
-
-            // detaches the link from the list:
-            if (tmp == listHead) {
-                listHead = tmp->nextClient;
-            }
-            else if (tmpPrev !=NULL) {
-                tmpPrev->nextClient = tmp->nextClient;
-            }
-            else {
-                // If it is not the head of the list tmpPrev should be differnt
-                // than 0, so perhaps an assertion would be more proper here.
-                // for now let's just log an error and report a faliture:
-#ifdef VERBOSE_LOGS_ON_PMU_INT
-                IOLog("OpenPMUInterface:removePMUClient, unlinked client\n");
-#endif // VERBOSE_LOGS_ON_PMU_INT
-
-                return false;
-            }
+    PMUClientTablePtr oldTable = activeClientTable;
+    PMUClientTablePtr newTable = (oldTable == &clientTables[0]) ? &clientTables[1] : &clientTables[0];
+    UInt32 i;
 
-            // And since we are here it means that the client is unlinked and found
-            // so we can remove it and report a success.
-            IOFree(tmp, sizeof(PMUClient));
-
-            if (clientMutexLock != NULL)
-                 IOLockUnlock(clientMutexLock);
-            
-            return true;
-        }
-        else {
-            tmpPrev = tmp;
-        }
+    // Copies all the clients but the one we are removing:
+    newTable->numberOfClients = 0;
+    for (i = 0; i < oldTable->numberOfClients; i++) {
+        if ((!result) && (oldTable->clients[i].client == caller) && (oldTable->clients[i].interruptMask == interruptMask))
+            result = true;
+        else
+            newTable->clients[newTable->numberOfClients++] = oldTable->clients[i];
     }
 
+    // If we did not find the client with the given object there
+    // is nothing to publish:
+    if (result)
+        publishPMUClientTable(newTable);
+
     if (clientMutexLock != NULL)
          IOLockUnlock(clientMutexLock);
     
-    // If we are here it measn we did not find the client with the
-    // given object.
-    return false;
+    return result;
 }
 
 // --------------------------------------------------------------------------
@@ -534,12 +627,20 @@ OpenPMUInterface::clearPMUClientList()
 
     bool success = true;
 
-    while (listHead != NULL) {
+    // If start failed before the table was set up there
+    // is nothing to clear:
+    if (activeClientTable == NULL)
+        return success;
+
+    while (activeClientTable->numberOfClients != 0) {
         // I could just remove all from here. But doing a call
         // to the removePMUClient allows me to change the structure
         // of the list (if one day I'll wish to do so) and to test
         // the removePMUClient function.
-        success &= removePMUClient(listHead->client, listHead->interruptMask);
+        if (!removePMUClient(activeClientTable->clients[0].client, activeClientTable->clients[0].interruptMask)) {
+            success = false;
+            break;
+        }
     }
 
     return success;
@@ -550,23 +651,51 @@ OpenPMUInterface::clearPMUClientList()
 // Method: callPMUClient
 //
 // Purpose:
-//         calls a client in the list with the data from the current interrupt:
+//         calls the clients in the table with the data from the current
+//         interrupt. This does not take any lock: it just tells the table
+//         that there is one more reader, so the writers will not reuse it
+//         until we are done.
 bool
 OpenPMUInterface::callPMUClient(UInt8 interruptMask, UInt32 length, UInt8 * buffer)
-{    bool success = false;
+{
+    bool success = false;
+    PMUClientTablePtr table;
+    UInt32 alreadyCalled = 0;
+    UInt32 bit, i;
 
-    if (clientMutexLock != NULL)
-        IOLockLock(clientMutexLock);
+    if (activeClientTable == NULL)
+        return success;
+
+    // Enter the active table. If a writer switched the table while we
+    // were entering, leave and try again with the new one:
+    for (;;) {
+        table = activeClientTable;
+        OSIncrementAtomic((SInt32*)&table->readers);
+
+        if (table == activeClientTable)
+            break;
+
+        OSDecrementAtomic((SInt32*)&table->readers);
+    }
 
     // Finds the client matching the given interrupt mask and
     // calls them with the given buffer. NOTE: the clients are
     // not allowed to modify the buffer. If they need to make
     // changes they are supposed to make a copy of it.
-    PMUClientPtr tmp;
+    // A client registered for more than one of the bits that
+    // are set is called only once, as it always was.
+    for (bit = 0; bit < kPMUInterruptBits; bit++) {
+        if ((interruptMask & (1 << bit)) == 0)
+            continue;
+
+        for (i = 0; i < table->clientsForBit[bit]; i++) {
+            UInt8 index = table->clientIndex[bit][i];
+            PMUClientPtr tmp = &table->clients[index];
+
+            if (alreadyCalled & (1 << index))
+                continue;
+            alreadyCalled |= (1 << index);
 
-    for (tmp = listHead; tmp != NULL; tmp = tmp->nextClient) {
-        if ((tmp->interruptMask & interruptMask) != 0) {
-            
 #ifdef VERBOSE_LOGS_ON_PMU_INT
             IOLog("OpenPMUInterface::callPMUClient(0x%02x, %d, 0x%08lx) on %s->0x%08lx(0x%08lx...)\n", interruptMask, length, buffer, tmp->client->getName(), tmp->callBackFunction, tmp->client);
 #endif // VERBOSE_LOGS_ON_PMU_INT
@@ -579,12 +708,203 @@ OpenPMUInterface::callPMUClient(UInt8 interruptMask, UInt32 length, UInt8 * buff
         }
     }
 
-    if (clientMutexLock != NULL)
-         IOLockUnlock(clientMutexLock);
+    OSDecrementAtomic((SInt32*)&table->readers);
 
     return (success);
 }
 
+// Event pool:
+// -----------
+
+// --------------------------------------------------------------------------
+//
+// Method: allocateEventPool
+//
+// Purpose:
+//         sets up the pool of parameter blocks used to bring the interrupt
+//         data to the clients. Each block gets its thread call now, so that
+//         the interrupt path does not need to allocate anything.
+bool
+OpenPMUInterface::allocateEventPool()
+{
+    UInt32 i;
+
+    eventPoolFreeMask = 0;
+    eventPoolMisses = 0;
+
+    for (i = 0; i < kPMUEventPoolSize; i++) {
+        eventPool[i].myThis = this;
+        eventPool[i].fromPool = true;
+        eventPool[i].workThread = thread_call_allocate((thread_call_func_t)eventPoolCaller, (thread_call_param_t)&eventPool[i]);
+
+        if (eventPool[i].workThread == NULL) {
+#if VERBOSE
+            IOLog("OpenPMUInterface::allocateEventPool can not allocate the thread calls\n");
+#endif
+            return false;
+        }
+
+        eventPoolFreeMask |= (1 << i);
+    }
+
+    return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: freeEventPool
+//
+// Purpose:
+//         releases the thread calls of the pool.
+void
+OpenPMUInterface::freeEventPool()
+{
+    UInt32 i;
+
+    // Nobody can take a block from now on:
+    eventPoolFreeMask = 0;
+
+    for (i = 0; i < kPMUEventPoolSize; i++) {
+        if (eventPool[i].workThread != NULL) {
+            thread_call_cancel(eventPool[i].workThread);
+            thread_call_free(eventPool[i].workThread);
+            eventPool[i].workThread = NULL;
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: getEventBlock
+//
+// Purpose:
+//         gets a free block from the pool. If the pool is empty (it takes
+//         quite slow clients for this to happen) it allocates one.
+OpenPMUInterface::OutputCallParametersPtr
+OpenPMUInterface::getEventBlock()
+{
+    UInt32 freeMask, i;
+
+    for (;;) {
+        freeMask = eventPoolFreeMask;
+        if (freeMask == 0)
+            break;
+
+        for (i = 0; (freeMask & (1 << i)) == 0; i++)
+            ;
+
+        if (OSCompareAndSwap(freeMask, freeMask & ~(1 << i), (UInt32*)&eventPoolFreeMask))
+            return &eventPool[i];
+    }
+
+    eventPoolMisses++;
+
+    OutputCallParametersPtr event = (OutputCallParametersPtr)IOMalloc(sizeof(OutputCallParameters));
+    if (event != NULL) {
+        event->myThis = this;
+        event->fromPool = false;
+        event->workThread = NULL;
+    }
+
+    return event;
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: postEventBlock
+//
+// Purpose:
+//         sends a filled block to the clients, on a separate thread so we
+//         free the workloop.
+void
+OpenPMUInterface::postEventBlock(OutputCallParametersPtr event)
+{
+    if (event == NULL)
+        return;
+
+    if (event->fromPool)
+        thread_call_enter(event->workThread);
+    else
+        CallFuncDesync(clientNotifyData, event);
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: releaseEventBlock
+//
+// Purpose:
+//         gives back the block to the pool (or to the heap if it did not
+//         come from the pool).
+void
+OpenPMUInterface::releaseEventBlock(OutputCallParametersPtr event)
+{
+    if (event->fromPool) {
+        UInt32 bit = 1 << (event - eventPool);
+        UInt32 freeMask;
+
+        do {
+            freeMask = eventPoolFreeMask;
+        } while (!OSCompareAndSwap(freeMask, freeMask | bit, (UInt32*)&eventPoolFreeMask));
+    }
+    else
+        IOFree(event, sizeof(OutputCallParameters));
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: serializeEventStatistics
+//
+// Purpose:
+//         builds the "PMUEventStatistics" property when someone reads it:
+//         the event pool and the ADB ring.
+/* static */ bool
+OpenPMUInterface::serializeEventStatistics(void *target, void *ref, OSSerialize *s)
+{
+    OpenPMUInterface *pmu = OSDynamicCast(OpenPMUInterface, (OSObject*)target);
+    if (pmu == NULL)
+        return false;
+
+    OSDictionary *dict = OSDictionary::withCapacity(7);
+    bool ok = false;
+
+    if (dict != NULL) {
+        OSNumber *num;
+
+#define ADD_STAT(key, value) \
+        if ((num = OSNumber::withNumber((unsigned long long)(value), 32)) != NULL) { \
+            dict->setObject(key, num); \
+            num->release(); \
+        }
+
+        ADD_STAT("EventPoolSize", kPMUEventPoolSize);
+        ADD_STAT("EventPoolMisses", pmu->eventPoolMisses);
+        ADD_STAT("ADBPacketsQueued", pmu->adbPacketsQueued);
+        ADD_STAT("ADBDeliveries", pmu->adbDeliveries);
+        ADD_STAT("ADBLargestBatch", pmu->adbLargestBatch);
+        ADD_STAT("ADBRingOverruns", pmu->adbRingOverruns);
+        ADD_STAT("ADBOversizePackets", pmu->adbOversizePackets);
+
+#undef ADD_STAT
+
+        ok = dict->serialize(s);
+        dict->release();
+    }
+
+    return ok;
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: eventPoolCaller
+//
+// Purpose:
+//         thread call entry for the blocks in the pool.
+/* static */ void
+OpenPMUInterface::eventPoolCaller(thread_call_param_t castMeToOutputCallParametersPtr, thread_call_param_t)
+{
+    clientNotifyData(castMeToOutputCallParametersPtr, NULL);
+}
+
 // Desyncers structures and methods:
 // ---------------------------------
 
@@ -616,8 +936,9 @@ OpenPMUInterface::enqueueData(void *castMeToInputCallParametersPtr, void *n)
             // Now we can open the gate to the next command:
             // except for the kPMUpMgrADB they are considered
             // completed only when we get their interrupt.
-            // the only exception is 
-            if ((ip->theRequest.pmCommand != kPMUpMgrADB) || (ip->theRequest.pmSBuffer[1] = 0x86))
+            // the only exception is the autopoll setup (0x86),
+            // which has no reply: autopoll never holds the gate.
+            if ((ip->theRequest.pmCommand != kPMUpMgrADB) || (ip->theRequest.pmSBuffer[1] == 0x86))
 #endif // ADB_COMMANDS_HOLD_ALL                
                 pmuDriver->setPMUDriverBusy(false, ip->theRequest.pmCommand);
         }
@@ -651,11 +972,16 @@ OpenPMUInterface::clientNotifyData(void *castMeToOutputCallParametersPtr, void *
                 IOLog("OpenPMUInterface::clientNotifyData nobody registed for 0x%02x\n", op->interruptType);
 #endif // VERBOSE_LOGS_ON_PMU_INT
             }
-        }
 
-        // At this point the parametes are no more necessary, so I can free the memory
-        // they allocated:
-        IOFree(op, sizeof(OutputCallParameters));
+            // At this point the parametes are no more necessary, so the block
+            // can go back where it came from:
+            pmuDriver->releaseEventBlock(op);
+        }
+        else if (!op->fromPool) {
+            // The driver is gone, but a block from the heap is still ours
+            // to free (the pool went away with the driver):
+            IOFree(op, sizeof(OutputCallParameters));
+        }
     }
 }
 
@@ -727,10 +1053,11 @@ void
 OpenPMUInterface::pmuInterruptDispatcher(UInt8 *buffer, UInt32 bufLen)
 {
 #ifdef ADB_COMMANDS_HOLD_ALL
-    // if it is the conclusion of a kPMUpMgrADB we can re-open the gate:
+    // if it is the conclusion of a kPMUpMgrADB we can re-open the gate
+    // (autopoll data is not the reply we are waiting for):
     if ((lockingCommand == kPMUpMgrADB) &&
-        (interruptBlock.pmRBuffer[0] & kPMUADBint)
-        && (!(interruptBlock.pmRBuffer[0] & kPMUautopoll)))
+        (buffer[0] & kPMUADBint)
+        && (!(buffer[0] & kPMUautopoll)))
         setPMUDriverBusy(false, kPMUpMgrADB);
 
     // The only reason we may wish to hold this is if we have an oustanfing ADB
@@ -755,20 +1082,146 @@ OpenPMUInterface::pmuInterruptDispatcher(UInt8 *buffer, UInt32 bufLen)
             checkPowerEnvironmentEvents();
         }
 
+    // Autopoll data (keyboard and trackpad) takes the fast path, whatever
+    // the state of the gate:
+    if ((buffer[0] & kPMUADBint) && (buffer[0] & kPMUautopoll) &&
+        queueADBAutopollPacket(buffer, bufLen))
+        return;
+
     // Now we can let the right client handle this interrupt:
-    // Allocates a transfer block:
-    OutputCallParametersPtr outputData= (OutputCallParametersPtr)IOMalloc(sizeof(OutputCallParameters));
+    // Gets a transfer block:
+    OutputCallParametersPtr outputData = getEventBlock();
+    if (outputData == NULL)
+        return;
 
     // Makes a copy of the data we care to transfer above:
-    outputData->myThis = this;
     outputData->interruptType = buffer[0];
     outputData->dataLength = bufLen - 1;
     bcopy(buffer + 1, outputData->buffer, bufLen - 1);
 
     // and (asyncronously, so we free the workloop) we call the clients interested.
-    // we do not need to dispose the memory allocated above,  clientNotifyData will
+    // we do not need to give back the block,  clientNotifyData will
     // do it for us.
-    CallFuncDesync(clientNotifyData, outputData);
+    postEventBlock(outputData);
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: queueADBAutopollPacket
+//
+// Purpose:
+//	puts an autopoll packet in the ADB ring and makes sure that a delivery
+//      is on its way. Returns false only if there is no ring to use, and
+//      the packet must go through the normal path. A packet that does not
+//      fit (too long, or the ring is full) is delivered here, after the
+//      packets in the ring: sending it the normal way would let it
+//      overtake them.
+bool
+OpenPMUInterface::queueADBAutopollPacket(UInt8 *buffer, UInt32 bufLen)
+{
+    UInt32 head = adbRingHead;
+
+    if ((bufLen < 1) || (adbDeliveryThread == NULL) || (adbDeliveryLock == NULL))
+        return false;
+
+    if (((bufLen - 1) > kADBPacketMaxLength) || ((head - adbRingTail) >= kADBRingSize)) {
+        if ((bufLen - 1) > kADBPacketMaxLength)
+            adbOversizePackets++;
+        else
+            adbRingOverruns++;
+
+        // Waits for a delivery in progress, takes what it left and
+        // then this one:
+        IOLockLock(adbDeliveryLock);
+        drainADBRing();
+        callPMUClient(buffer[0], bufLen - 1, buffer + 1);
+        IOLockUnlock(adbDeliveryLock);
+        return true;
+    }
+
+    ADBPacket *packet = &adbRing[head & (kADBRingSize - 1)];
+    packet->interruptType = buffer[0];
+    packet->dataLength = bufLen - 1;
+    bcopy(buffer + 1, packet->data, bufLen - 1);
+
+    // The packet must be in place before the consumer can see it:
+    eieio();
+    adbRingHead = head + 1;
+    adbPacketsQueued++;
+
+    // If there is not a delivery already queued, queue one:
+    if (OSCompareAndSwap(0, 1, (UInt32*)&adbDeliveryPending))
+        thread_call_enter(adbDeliveryThread);
+
+    return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: adbDeliveryCaller
+//
+// Purpose:
+//	thread call entry for the ADB deliveries.
+/* static */ void
+OpenPMUInterface::adbDeliveryCaller(thread_call_param_t castMeToOpenPMUInterface, thread_call_param_t)
+{
+    OpenPMUInterface *pmuDriver = OSDynamicCast(OpenPMUInterface, (OSObject*)castMeToOpenPMUInterface);
+
+    if (pmuDriver != NULL)
+        pmuDriver->deliverADBPackets();
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: deliverADBPackets
+//
+// Purpose:
+//	hands all the packets in the ADB ring to the clients, in order.
+void
+OpenPMUInterface::deliverADBPackets()
+{
+    UInt32 batch;
+
+    // Clear the flag before to look at the ring: a packet queued from
+    // now on will queue a new delivery, the ones already there are ours.
+    OSCompareAndSwap(1, 0, (UInt32*)&adbDeliveryPending);
+
+    IOLockLock(adbDeliveryLock);
+    batch = drainADBRing();
+    IOLockUnlock(adbDeliveryLock);
+
+    adbDeliveries++;
+    if (batch > adbLargestBatch)
+        adbLargestBatch = batch;
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: drainADBRing
+//
+// Purpose:
+//	delivers the packets in the ADB ring, in order. The caller holds
+//      adbDeliveryLock.
+UInt32
+OpenPMUInterface::drainADBRing()
+{
+    UInt32 batch = 0;
+
+    while (adbRingTail != adbRingHead) {
+        ADBPacket *packet = &adbRing[adbRingTail & (kADBRingSize - 1)];
+
+        if (!callPMUClient(packet->interruptType, packet->dataLength, packet->data)) {
+#ifdef VERBOSE_LOGS_ON_PMU_INT
+            IOLog("OpenPMUInterface::deliverADBPackets nobody registed for 0x%02x\n", packet->interruptType);
+#endif // VERBOSE_LOGS_ON_PMU_INT
+        }
+
+        // Only now the producer can reuse the slot:
+        adbRingTail++;
+        batch++;
+    }
+
+    return batch;
 }
 
 // --------------------------------------------------------------------------
@@ -798,8 +1251,10 @@ OpenPMUInterface::checkPowerEnvironmentEvents(void)
 #endif // VERBOSE_LOGS_ON_PMU_INT
 
         // Now we can let the right client handle this interrupt:
-        // Allocates a transfer block:
-        OutputCallParametersPtr outputData= (OutputCallParametersPtr)IOMalloc(sizeof(OutputCallParameters));
+        // Gets a transfer block:
+        OutputCallParametersPtr outputData = getEventBlock();
+        if (outputData == NULL)
+            return;
 
         // Makes a copy of the data we care to transfer above
         // NOTES: 1] since the whole buffer is meaningful here
@@ -811,15 +1266,14 @@ OpenPMUInterface::checkPowerEnvironmentEvents(void)
         //           that the result is always 1 byte, but hopefully
         //           this will keep the driver compatible with future
         //           versions of the pmu.
-        outputData->myThis = this;
         outputData->interruptType = kPMUenvironmentInt;
         outputData->dataLength = environmentBlock.pmRLength;
         bcopy(environmentBlock.pmRBuffer, outputData->buffer, environmentBlock.pmRLength);
 
         // and (asyncronously, so we free the workloop) we call the clients interested.
-        // we do not need to dispose the memory allocated above,  clientNotifyData will
+        // we do not need to give back the block,  clientNotifyData will
         // do it for us.
-        CallFuncDesync(clientNotifyData, outputData);
+        postEventBlock(outputData);
     }
 }
 
@@ -894,6 +1348,43 @@ OpenPMUInterface::pmuCommandGateReFlash(OSObject *object, void *castMeToFirmware
     return  kIOReturnSuccess;
 }
 
+// --------------------------------------------------------------------------
+//
+// Method: pmuCommandGateBatch
+//
+// Purpose:
+//          sends all the commands of a power batch while holding the gate
+//          once. A failed command does not stop the others, the devices are
+//          independent.
+/* static */ IOReturn
+OpenPMUInterface::pmuCommandGateBatch(OSObject *object, void *castMeToPowerBatch, void *arg1, void *arg2, void *arg3r)
+{
+    OpenPMUInterface *pmu = OSDynamicCast(OpenPMUInterface, object);
+    PMUPowerBatch *batch = (PMUPowerBatch*)castMeToPowerBatch;
+    IOReturn retVal = kIOReturnSuccess;
+    PMUrequest theRequest;
+    UInt32 i;
+
+    if ((pmu == NULL) || (batch == NULL))
+        return kIOReturnError;
+
+    for (i = 0; i < batch->length; i++) {
+        theRequest.pmCommand = batch->commands[i].command;
+        theRequest.pmSLength = batch->commands[i].sLength;
+        bcopy(batch->commands[i].sBuffer, theRequest.pmSBuffer, theRequest.pmSLength);
+        theRequest.pmRLength = 0;
+
+        if (!pmu->pmuTansferRequestToVIA(&theRequest)) {
+#ifdef VERBOSE_LOGS_ON_PMU_INT
+            IOLog("OpenPMUInterface::pmuCommandGateBatch command 0x%02x failed\n", theRequest.pmCommand);
+#endif // VERBOSE_LOGS_ON_PMU_INT
+            retVal = kIOReturnError;
+        }
+    }
+
+    return retVal;
+}
+
 // --------------------------------------------------------------------------
 //
 // Method: pmuTansferRequestToVIA
@@ -1220,7 +1711,19 @@ void
 OpenPMUInterface::preSleepSequence()
 {
 	IOService *platProv;
-	
+    PMUPowerBatch sleepBatch;
+    AbsoluteTime startTime;
+
+    clock_get_uptime(&startTime);
+    sleepBatch.length = 0;
+
+    // If the devices are still to be powered up from the last wake
+    // there is no point in doing it now; if they are being powered up
+    // the power down must come after:
+    if ((wakeBatchThread != NULL) && thread_call_cancel(wakeBatchThread))
+        wakeBatchDone();
+    waitForWakePowerUp();
+
     // Powers off the LCD
     // We need this only for PwerbookG31999 that in this moment does not have
     // a brightness driver:
@@ -1232,21 +1735,19 @@ OpenPMUInterface::preSleepSequence()
             || IODTMatchNubWithKeys(platProv, "'AAPL,1400'")
     #endif    
     )
-        setLCDPower(false);
+        addLCDPower(&sleepBatch, false);
 
     // Powers off the HD
-    setHDPower(false);
+    addHDPower(&sleepBatch, false);
 
     // Powers off the media bay
-    setMediaBayPower(false);
+    addMediaBayPower(&sleepBatch, false);
 
     // Powers off the IR
-    setIRPower(false);
+    addIRPower(&sleepBatch, false);
 
     if (!isOldHardware) {
         UInt8 outBuffer[3];
-        UInt8 inBuffer[2];
-        IOByteCount iLen = sizeof(inBuffer);
         
         // Defines the power up events for this machine, by as first
         // clearing the current settings ...
@@ -1254,7 +1755,7 @@ OpenPMUInterface::preSleepSequence()
         outBuffer[1] = 0xFF;
         outBuffer[2] = 0xFF;
 
-        sendMiscCommand (kPMUpowerUpEvents, (IOByteCount)3, outBuffer, &iLen, inBuffer);
+        addPowerCommand(&sleepBatch, kPMUpowerUpEvents, 3, outBuffer);
 
         //... and after defining the new set of events:
         outBuffer[0] = kPMUsetWakeUpEvents;
@@ -1265,9 +1766,13 @@ OpenPMUInterface::preSleepSequence()
         else
             outBuffer[2] = kPMUwakeUpOnKey | kPMUwakeUpOnLidOpen;
 
-        iLen = sizeof(inBuffer);
-        sendMiscCommand (kPMUpowerUpEvents, (IOByteCount)3, outBuffer, &iLen, inBuffer);
+        addPowerCommand(&sleepBatch, kPMUpowerUpEvents, 3, outBuffer);
     }
+
+    // and all the above in one go:
+    runPowerBatch(&sleepBatch);
+
+    publishTransitionTime("PMUSleepPowerDownMicroseconds", startTime);
 }
 
 // --------------------------------------------------------------------------
@@ -1275,11 +1780,19 @@ OpenPMUInterface::preSleepSequence()
 // Method: wakeUP
 //
 // Purpose:
-//        sets the machine in awake mode.
+//        sets the machine in awake mode. The devices are powered up
+//        asynchronously, this returns as soon as the PMU knows that the
+//        system is up. What needs them (Baboon for the HD and the media
+//        bay) calls waitForWakePowerUp first.
 void
 OpenPMUInterface::wakeUp()
 {
 	IOService *platProv;
+
+    // The batch of an earlier wake must be out before this one is built:
+    waitForWakePowerUp();
+
+    clock_get_uptime(&wakeStartTime);
     
     // Allow use of interrupt-based interface again
     theHWInterface->trustTheKernel(true);
@@ -1293,6 +1806,8 @@ OpenPMUInterface::wakeUp()
     // Informs the pmu that the system is up:
     saySystemReady();
 
+    wakeBatch.length = 0;
+
     // Powers on the LCD
     // We need this only for PwerbookG31999 that in this moment does not have
     // a brightness driver:
@@ -1303,19 +1818,185 @@ OpenPMUInterface::wakeUp()
             || IODTMatchNubWithKeys(platProv, "'AAPL,1400'")
     #endif    
     )
-        setLCDPower(true);
+        addLCDPower(&wakeBatch, true);
 
     // Powers on the HD
-    setHDPower(true);
+    addHDPower(&wakeBatch, true);
 
     // Powers on the media bay
-    setMediaBayPower(true);
+    addMediaBayPower(&wakeBatch, true);
 
 // PC: not using IR
 #if 0
     // Powers on the IR
-    setIRPower(true);
+    addIRPower(&wakeBatch, true);
 #endif
+
+    // The power up goes on its own, if we can:
+    IOLockLock(wakeBatchLock);
+    wakeBatchBusy = true;
+    IOLockUnlock(wakeBatchLock);
+    if ((wakeBatch.length != 0) && (wakeBatchThread != NULL))
+        thread_call_enter(wakeBatchThread);
+    else
+        wakeBatchCaller((thread_call_param_t)this, NULL);
+
+    publishTransitionTime("PMUWakeReturnMicroseconds", wakeStartTime);
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: wakeBatchCaller
+//
+// Purpose:
+//        powers up the devices after a wake.
+/* static */ void
+OpenPMUInterface::wakeBatchCaller(thread_call_param_t castMeToOpenPMUInterface, thread_call_param_t)
+{
+    OpenPMUInterface *pmu = OSDynamicCast(OpenPMUInterface, (OSObject*)castMeToOpenPMUInterface);
+
+    if (pmu != NULL) {
+        pmu->runPowerBatch(&pmu->wakeBatch);
+        pmu->publishTransitionTime("PMUWakePowerUpMicroseconds", pmu->wakeStartTime);
+        pmu->wakeBatchDone();
+    }
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: wakeBatchDone
+//
+// Purpose:
+//        the wake batch is sent, or will not be: lets the waiters go.
+void
+OpenPMUInterface::wakeBatchDone()
+{
+    IOLockLock(wakeBatchLock);
+    wakeBatchBusy = false;
+    IOLockWakeup(wakeBatchLock, &wakeBatchBusy, false);
+    IOLockUnlock(wakeBatchLock);
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: waitForWakePowerUp
+//
+// Purpose:
+//        returns once the devices are powered up after the last wake.
+void
+OpenPMUInterface::waitForWakePowerUp()
+{
+    if (wakeBatchLock == NULL)
+        return;
+
+    IOLockLock(wakeBatchLock);
+    while (wakeBatchBusy)
+        IOLockSleep(wakeBatchLock, &wakeBatchBusy, THREAD_UNINT);
+    IOLockUnlock(wakeBatchLock);
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: runPowerBatch
+//
+// Purpose:
+//        sends all the commands in the batch, holding the driver and the
+//        command gate only once for all of them.
+bool
+OpenPMUInterface::runPowerBatch(PMUPowerBatch *batch)
+{
+    bool success;
+
+    if (batch->length == 0)
+        return true;
+
+    // From now on the driver is officialy busy:
+    setPMUDriverBusy(true, batch->commands[0].command);
+
+    success = (commandGate->runAction(pmuCommandGateBatch, batch) == kIOReturnSuccess);
+
+    // And the next command can go:
+    setPMUDriverBusy(false, batch->commands[0].command);
+
+    return success;
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: addPowerCommand
+//
+// Purpose:
+//        appends a command to a power batch.
+void
+OpenPMUInterface::addPowerCommand(PMUPowerBatch *batch, UInt8 command, UInt8 sLength, UInt8 *sBuffer)
+{
+    PMUPowerCommand *theCommand;
+
+    assert(sLength <= kPMUPowerCommandMaxData);
+
+    if (batch->length >= kPMUMaxPowerBatch) {
+#ifdef VERBOSE_LOGS_ON_PMU_INT
+        IOLog("OpenPMUInterface::addPowerCommand batch full, 0x%02x dropped\n", command);
+#endif // VERBOSE_LOGS_ON_PMU_INT
+        return;
+    }
+
+    theCommand = &batch->commands[batch->length++];
+    theCommand->command = command;
+    theCommand->sLength = sLength;
+    bcopy(sBuffer, theCommand->sBuffer, sLength);
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: addPowerControl
+//
+// Purpose:
+//        appends a power control command (kPMUpowerCntl or kPMUpower1Cntl).
+//        The most left bit of the argument sets the mode on or off, the
+//        others select the devices: so if the batch already switches
+//        devices of this plane in the same direction we just add ours to it.
+void
+OpenPMUInterface::addPowerControl(PMUPowerBatch *batch, UInt8 command, UInt8 devices, bool on)
+{
+    UInt8 mode = (on ? 0x80 : 0x00);
+    UInt8 argument;
+    UInt32 i;
+
+    for (i = 0; i < batch->length; i++) {
+        PMUPowerCommand *theCommand = &batch->commands[i];
+
+        if ((theCommand->command == command) && ((theCommand->sBuffer[0] & 0x80) == mode)) {
+            theCommand->sBuffer[0] |= devices;
+            return;
+        }
+    }
+
+    argument = mode | devices;
+    addPowerCommand(batch, command, 1, &argument);
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: publishTransitionTime
+//
+// Purpose:
+//        publishes (and logs) how long a transition took since startTime.
+void
+OpenPMUInterface::publishTransitionTime(const char *key, AbsoluteTime startTime)
+{
+    AbsoluteTime now;
+    UInt64 nanoseconds;
+
+    clock_get_uptime(&now);
+    SUB_ABSOLUTETIME(&now, &startTime);
+    absolutetime_to_nanoseconds(now, &nanoseconds);
+
+    setProperty(key, (unsigned long long)(nanoseconds / 1000), 32);
+
+#ifdef VERBOSE_LOGS_ON_PMU
+    IOLog("OpenPMUInterface %s = %ld\n", key, (UInt32)(nanoseconds / 1000));
+#endif // VERBOSE_LOGS_ON_PMU
 }
 
 // --------------------------------------------------------------------------
@@ -1496,32 +2177,87 @@ OpenPMUInterface::clearInterrupts()
 // Method: setLCDPower
 //
 // Purpose:
-//        Turns the display on and off:
+//        Turns the display on and off
 void
 OpenPMUInterface::setLCDPower(bool on)
 {
-    if (isOldHardware) {
-        UInt8 iBuffer[256];
-        IOByteCount iLen = sizeof(iBuffer);
+    PMUPowerBatch batch;
+
+    batch.length = 0;
+    addLCDPower(&batch, on);
+    runPowerBatch(&batch);
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: setHDPower
+//
+// Purpose:
+//        Turns the HD on and off
+void
+OpenPMUInterface::setHDPower(bool on)
+{
+    PMUPowerBatch batch;
+
+    batch.length = 0;
+    addHDPower(&batch, on);
+    runPowerBatch(&batch);
+}
 
+// --------------------------------------------------------------------------
+//
+// Method: setMediaBayPower
+//
+// Purpose:
+//        turns power on and off to the media bay
+void
+OpenPMUInterface::setMediaBayPower(bool on)
+{
+    PMUPowerBatch batch;
+
+    batch.length = 0;
+    addMediaBayPower(&batch, on);
+    runPowerBatch(&batch);
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: setIRPower
+//
+// Purpose:
+//          turns power on and off to the IR emitter
+void
+OpenPMUInterface::setIRPower(bool on)
+{
+    PMUPowerBatch batch;
+
+    batch.length = 0;
+    addIRPower(&batch, on);
+    runPowerBatch(&batch);
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: addLCDPower
+//
+// Purpose:
+//        adds to the batch the commands to turn the display on and off
+void
+OpenPMUInterface::addLCDPower(PMUPowerBatch *batch, bool on)
+{
+    if (isOldHardware) {
         // the brighness (values find by the try and error method)
         // 14 = max. 127 = min.
         UInt8 bBuffer = (on ? 14 : 127);
-        iLen = sizeof(iBuffer);
-        sendMiscCommand (kPMUSetBrightness, (IOByteCount)1, &bBuffer, &iLen, iBuffer);     
+        addPowerCommand(batch, kPMUSetBrightness, 1, &bBuffer);
        
         // the contrast (values find by the try and error method)
         // 127 = max. 0 = min.
         UInt8 cBuffer = (on ? 127 : 0);
-        iLen = sizeof(iBuffer);
-        sendMiscCommand (kPMUSetContrast, (IOByteCount)1, &cBuffer, &iLen, iBuffer);
+        addPowerCommand(batch, kPMUSetContrast, 1, &cBuffer);
 
-        // the most left bit sets the mode on or off
         // 0x01 is the bit that controls the screen.
-        UInt8 sBuffer = (on ? 0x80 : 0x00) | 0x01;
-        iLen = sizeof(iBuffer);
-        sendMiscCommand (kPMUpower1Cntl, (IOByteCount)1, &sBuffer, &iLen, iBuffer);
-
+        addPowerControl(batch, kPMUpower1Cntl, 0x01, on);
     }
     else {
         // Do not do anything, we do not have anything to do on new pmus
@@ -1531,21 +2267,16 @@ OpenPMUInterface::setLCDPower(bool on)
 
 // --------------------------------------------------------------------------
 //
-// Method: setHDPower
+// Method: addHDPower
 //
 // Purpose:
-//        Turns the HD on and off
+//        adds to the batch the command to turn the HD on and off
 void
-OpenPMUInterface::setHDPower(bool on)
+OpenPMUInterface::addHDPower(PMUPowerBatch *batch, bool on)
 {
     if (isOldHardware) {
-        UInt8 iBuffer[256];
-        IOByteCount iLen = sizeof(iBuffer);
-        
-        // the most left bit sets the mode on or off
         // 0x04 is teh bit that controls the HD.
-        UInt8 bBuffer = (on ? 0x80 : 0x00) | 0x04;
-        sendMiscCommand (kPMUpowerCntl, (IOByteCount)1, &bBuffer, &iLen, iBuffer);
+        addPowerControl(batch, kPMUpowerCntl, 0x04, on);
     }
     else {
         // Do not do anything, we do not have anything to do on new pmus.
@@ -1554,21 +2285,16 @@ OpenPMUInterface::setHDPower(bool on)
 
 // --------------------------------------------------------------------------
 //
-// Method: setMediaBayPower
+// Method: addMediaBayPower
 //
 // Purpose:
-//        turns power on and off to the media bay
+//        adds to the batch the command to turn the media bay on and off
 void
-OpenPMUInterface::setMediaBayPower(bool on)
+OpenPMUInterface::addMediaBayPower(PMUPowerBatch *batch, bool on)
 {
     if (isOldHardware) {
-        UInt8 iBuffer[256];
-        IOByteCount iLen = sizeof(iBuffer);
-
-        // the most left bit sets the mode on or off
         // 0x08 is the bit that controls the media bay.
-        UInt8 bBuffer = (on ? 0x80 : 0x00) | 0x08;
-        sendMiscCommand (kPMUpower1Cntl, (IOByteCount)1, &bBuffer, &iLen, iBuffer);
+        addPowerControl(batch, kPMUpower1Cntl, 0x08, on);
     }
     else {
         // Do not do anything, we do not have anything to do on new pmus.
@@ -1579,21 +2305,16 @@ OpenPMUInterface::setMediaBayPower(bool on)
 
 // --------------------------------------------------------------------------
 //
-// Method: setIRPower
+// Method: addIRPower
 //
 // Purpose:
-//          turns power on and off to the IR emitter
+//          adds to the batch the command to turn the IR emitter on and off
 void
-OpenPMUInterface::setIRPower(bool on)
+OpenPMUInterface::addIRPower(PMUPowerBatch *batch, bool on)
 {
     if (isOldHardware) {
-        UInt8 iBuffer[256];
-        IOByteCount iLen = sizeof(iBuffer);
-
-        // the most left bit sets the mode on or off
-        // 0x08 is the bit that controls the IR.
-        UInt8 bBuffer = (on ? 0x80 : 0x00) | 0x04;
-        sendMiscCommand (kPMUpower1Cntl, (IOByteCount)1, &bBuffer, &iLen, iBuffer);
+        // 0x04 is the bit that controls the IR.
+        addPowerControl(batch, kPMUpower1Cntl, 0x04, on);
     }
     else {
         // Do not do anything, we do not have anything to do on new pmus.
@@ -1757,6 +2478,10 @@ OpenPMUInterface::callPlatformFunction( const OSSymbol *functionName,
         *((UInt8 *) param1) = readMBHWID();
 		return kIOReturnSuccess;
     }
+    else if (functionName->isEqualTo(kWaitForWakePowerUp)) {
+        waitForWakePowerUp();
+        return kIOReturnSuccess;
+    }
 
     // If we are here it means we failed to find the correct call
     // so we pass the parametes to the function above:
@@ -90,6 +90,20 @@ OpenViaInterface::start(IOService *provider)
                 Verbose_IOLog("OpenViaInterface::start() interruptSource is %s\n", interruptSource->getName());
 #endif
 
+        // On M2 the interrupt controller owns the VIA1 enables. Find it
+        // now, since at interrupt time we can not walk the registry:
+        enablesOwner = NULL;
+        if (isM2) {
+            for (IOService *owner = interruptSource; owner != NULL; owner = owner->getProvider()) {
+                if (owner->metaCast("Whitney") != NULL) {
+                    updateEnablesSymbol = OSSymbol::withCStringNoCopy(kWhitneyUpdateVIA1Enables);
+                    if (updateEnablesSymbol != NULL)
+                        enablesOwner = owner;
+                    break;
+                }
+            }
+        }
+
         // Sets all the pointers to NULL, since the real
         // resource allocation is in hwInit()
         mutex = NULL;
@@ -100,6 +114,18 @@ OpenViaInterface::start(IOService *provider)
         // kernel resources:
         trustTheKernel(true);
 
+        // Clear the timing of the transfers and make it visible in the registry:
+        bzero(&transferStatistics, sizeof(transferStatistics));
+
+        OSNumber *spinTime = OSDynamicCast(OSNumber, getProperty("PMUAckSpinMicroseconds"));
+        ackSpinMicroseconds = (spinTime != NULL) ? spinTime->unsigned32BitValue() : kPMUAckSpinMicroseconds;
+
+        OSSerializer *statisticsSerializer = OSSerializer::forTarget(this, &serializeTransferStatistics);
+        if (statisticsSerializer != NULL) {
+            setProperty("PMUTransferStatistics", statisticsSerializer);
+            statisticsSerializer->release();
+        }
+
         // Init the hardware to NULL, just so we know it is in
         // a clean state.
         hwRelease();
@@ -138,6 +164,11 @@ OpenViaInterface::free(void)
     // Not much to do after all:
     hwRelease();
 
+    if (updateEnablesSymbol != NULL) {
+        updateEnablesSymbol->release();
+        updateEnablesSymbol = NULL;
+    }
+
     // And the super:
     super::free();
 }
@@ -393,6 +424,7 @@ OpenViaInterface::processPMURequest(PMUrequestPtr plugInMessage)
     int howManyBytes, currentByte;
     char myByte;
     bool success = true;
+    AbsoluteTime startTime;
 
     // If there is not a message to transmit we do not send anything.
     // However I believe that this is NOT a transmission error and
@@ -439,6 +471,8 @@ OpenViaInterface::processPMURequest(PMUrequestPtr plugInMessage)
     // (but let the primary interrupt handlers run):
     if (preemptionMutex) IOSimpleLockLock (preemptionMutex);
 
+    clock_get_uptime(&startTime);
+
     // This is in case we jump at the end becuase of an error:
     plugInMessage->pmRLength = 0;
 
@@ -595,7 +629,10 @@ exitFromPolledTransmitter:
 
     // however things went we can others taks be rescheduled:
     if (preemptionMutex) IOSimpleLockUnlock (preemptionMutex);
-	
+
+    // still under the lock, so the statistics are consistent:
+    recordTransfer(plugInMessage->pmCommand, startTime, success);
+
     // End of the critical section area:
     releaseVIALock();
 
@@ -612,6 +649,128 @@ exitFromPolledTransmitter:
     return true;
 }
 
+// --------------------------------------------------------------------------
+//
+// Function: histogramBucket
+//
+// Purpose:
+//    the bucket of the timing histograms for a duration is the number of
+//    significant bits of the duration in microseconds.
+static inline UInt32
+histogramBucket(UInt32 microseconds)
+{
+    UInt32 bucket;
+
+    for (bucket = 0; (microseconds != 0) && (bucket < kPMUTransferHistogramBuckets - 1); bucket++)
+        microseconds >>= 1;
+
+    return bucket;
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: recordTransfer
+//
+// Purpose:
+//    accounts for a transfer started at startTime and just completed. The
+//    caller holds the VIA lock, so nobody else is touching the statistics.
+void
+OpenViaInterface::recordTransfer(UInt32 command, AbsoluteTime startTime, bool success)
+{
+    AbsoluteTime endTime;
+    UInt64 nanoseconds;
+    UInt32 microseconds;
+
+    clock_get_uptime(&endTime);
+    SUB_ABSOLUTETIME(&endTime, &startTime);
+    absolutetime_to_nanoseconds(endTime, &nanoseconds);
+    microseconds = (UInt32)(nanoseconds / 1000);
+
+    transferStatistics.transfers++;
+    if (!success)
+        transferStatistics.failures++;
+
+    transferStatistics.totalMicroseconds += microseconds;
+    if (microseconds > transferStatistics.maxMicroseconds) {
+        transferStatistics.maxMicroseconds = microseconds;
+        transferStatistics.maxCommand = command;
+    }
+
+    transferStatistics.histogram[histogramBucket(microseconds)]++;
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: serializeTransferStatistics
+//
+// Purpose:
+//    builds the "PMUTransferStatistics" property when someone reads it.
+//    Values are copied without the lock, so they may be a transfer apart.
+/* static */ bool
+OpenViaInterface::serializeTransferStatistics(void *target, void *ref, OSSerialize *s)
+{
+    OpenViaInterface *via = OSDynamicCast(OpenViaInterface, (OSObject*)target);
+    if (via == NULL)
+        return false;
+
+    PMUTransferStatistics stats = via->transferStatistics;
+    OSDictionary *dict = OSDictionary::withCapacity(13);
+    OSArray *histogram = OSArray::withCapacity(kPMUTransferHistogramBuckets);
+    OSArray *ackHistogram = OSArray::withCapacity(kPMUTransferHistogramBuckets);
+    bool ok = false;
+
+    if ((dict != NULL) && (histogram != NULL) && (ackHistogram != NULL)) {
+        OSNumber *num;
+        UInt32 i;
+
+#define ADD_STAT(key, value, bits) \
+        if ((num = OSNumber::withNumber((unsigned long long)(value), bits)) != NULL) { \
+            dict->setObject(key, num); \
+            num->release(); \
+        }
+
+        ADD_STAT("Transfers", stats.transfers, 32);
+        ADD_STAT("Failures", stats.failures, 32);
+        ADD_STAT("TotalMicroseconds", stats.totalMicroseconds, 64);
+        ADD_STAT("AverageMicroseconds", (stats.transfers != 0) ? (stats.totalMicroseconds / stats.transfers) : 0, 32);
+        ADD_STAT("MaxMicroseconds", stats.maxMicroseconds, 32);
+        ADD_STAT("MaxCommand", stats.maxCommand, 8);
+        ADD_STAT("AckWaits", stats.ackWaits, 32);
+        ADD_STAT("AckTimeouts", stats.ackTimeouts, 32);
+        ADD_STAT("AckSleeps", stats.ackSleeps, 32);
+        ADD_STAT("AckSpinMicroseconds", via->ackSpinMicroseconds, 32);
+
+#undef ADD_STAT
+
+        for (i = 0; i < kPMUTransferHistogramBuckets; i++) {
+            if ((num = OSNumber::withNumber(stats.histogram[i], 32)) != NULL) {
+                histogram->setObject(num);
+                num->release();
+            }
+        }
+        dict->setObject("Histogram", histogram);
+
+        for (i = 0; i < kPMUTransferHistogramBuckets; i++) {
+            if ((num = OSNumber::withNumber(stats.ackHistogram[i], 32)) != NULL) {
+                ackHistogram->setObject(num);
+                num->release();
+            }
+        }
+        dict->setObject("AckHistogram", ackHistogram);
+
+        ok = dict->serialize(s);
+    }
+
+    if (ackHistogram != NULL)
+        ackHistogram->release();
+    if (histogram != NULL)
+        histogram->release();
+    if (dict != NULL)
+        dict->release();
+
+    return ok;
+}
+
 // --------------------------------------------------------------------------
 //
 // Method: sendByte
@@ -624,19 +783,15 @@ OpenViaInterface::sendByte(char byte)
 {
     bool success = false;
 
-    *VIA1_auxillaryControl |= 0x1C;		        // set shift register to output
-    eieio();
+    viaSetBits(VIA1_auxillaryControl, 0x1C);		        // set shift register to output
 
-    *VIA1_shift = byte;		                    // give it the byte (this clears any pending SR interrupt)
-    eieio();
+    viaWrite(VIA1_shift, byte);		                    // give it the byte (this clears any pending SR interrupt)
 
     // *VIA1_interruptEnable = 0x84;	        // enable SR interrupt
-    *VIA2_dataB &= ~PMreq;			            // assert /REQ
-    eieio();
+    viaClearBits(VIA2_dataB, PMreq);			            // assert /REQ
 
     if (waitForAck(false, 32)) {                // Wait for ack low (false)
-        *VIA2_dataB |= PMreq;			        // deassert /REQ
-        eieio();
+        viaSetBits(VIA2_dataB, PMreq);			        // deassert /REQ
 
         if (waitForAck(true, 32))               // Wait for ack hi (true)
             success = true;
@@ -650,11 +805,9 @@ OpenViaInterface::sendByte(char byte)
         kprintf("OpenViaInterface::sendByte [3] waitForAck(false, 32) failed\n");
 #endif // VERBOSE_LOGS_ON_VIA
 
-    *VIA2_dataB |= PMreq;			   // deassert /REQ
-    eieio();
+    viaSetBits(VIA2_dataB, PMreq);			   // deassert /REQ
 
-    *VIA1_auxillaryControl |= 0x1C;		// set shift register to output
-    eieio();
+    viaSetBits(VIA1_auxillaryControl, 0x1C);		// set shift register to output
 
     return (success);
 }
@@ -670,26 +823,20 @@ bool OpenViaInterface::readByte(char *byte)
 {
     bool success = false;
 
-    *VIA1_auxillaryControl |= 0x0C;             // set shift register to input
-    eieio();
+    viaSetBits(VIA1_auxillaryControl, 0x0C);             // set shift register to input
 
-    *VIA1_auxillaryControl &= ~0x10;            // set shift register to use external clock
-    eieio();
+    viaClearBits(VIA1_auxillaryControl, 0x10);            // set shift register to use external clock
 
-    *byte = *VIA1_shift;                        // get the byte (this clears any pending SR interrupt)
-    eieio();
+    *byte = viaRead(VIA1_shift);                        // get the byte (this clears any pending SR interrupt)
     //    kprintf("OpenViaInterface::readByte read  [1] 0x%02x\n", *byte);
 
-    *VIA2_dataB &= ~PMreq;		                // assert /REQ
-    eieio();
+    viaClearBits(VIA2_dataB, PMreq);		                // assert /REQ
 
     if (waitForAck(false, 32)) {                // Wait for ack low (false)
-        *VIA2_dataB |= PMreq;			        // deassert /REQ
-        eieio();
+        viaSetBits(VIA2_dataB, PMreq);			        // deassert /REQ
 
         if (waitForAck(true, 32)) {              // Wait for ack hi (true)
-            *byte = *VIA1_shift;                 // get the byte (this time for real)
-            eieio();
+            *byte = viaRead(VIA1_shift);                 // get the byte (this time for real)
             //            kprintf("OpenViaInterface::readByte read  [2] 0x%02x\n", *byte);
             success = true;
         }
@@ -703,11 +850,9 @@ bool OpenViaInterface::readByte(char *byte)
         kprintf("OpenViaInterface::readByte [5] waitForAck(false, 32) failed\n");
 #endif // VERBOSE_LOGS_ON_VIA
 
-    *VIA2_dataB |= PMreq;			    // deassert /REQ
-    eieio();
+    viaSetBits(VIA2_dataB, PMreq);			    // deassert /REQ
 
-    *VIA1_auxillaryControl |= 0x1C;		// set shift register to output
-    eieio();
+    viaSetBits(VIA1_auxillaryControl, 0x1C);		// set shift register to output
 
     return (success);
 }
@@ -720,28 +865,80 @@ bool OpenViaInterface::readByte(char *byte)
 //       Waits for tha ack bit to match the given state:
 //       wait for ack hi - > waitForAck(true, time)
 //       wait for ack lo - > waitForAck(false, time)
-bool OpenViaInterface::waitForAck(bool mode, UInt32 milliseconds)
+//       it spins for ackSpinMicroseconds and after that, if mayBlock, it
+//       sleeps a millisecond between the checks. Callers holding the
+//       preemption lock or running at interrupt time must not set mayBlock.
+bool OpenViaInterface::waitForAck(bool mode, UInt32 milliseconds, bool mayBlock)
 {
-    AbsoluteTime        currentTime, endTime;
-    
+    AbsoluteTime        startTime, currentTime, spinTime, endTime;
+    UInt64              nanoseconds;
+    bool                acked = false, slept = false;
+
+    clock_get_uptime(&startTime);
     clock_interval_to_deadline(milliseconds, 1000000, &endTime);
+    clock_interval_to_deadline(ackSpinMicroseconds, 1000, &spinTime);
 
     do {
-        UInt8 viaNow = *VIA2_dataB;
-        eieio();
-
-        if (((viaNow & PMack) != 0) && (mode)) {           // we are waiting for ack hi and ..
-            return ( true );				   // ack is high, return
-        }
+        UInt8 viaNow = viaRead(VIA2_dataB);
 
-        if (((viaNow & PMack) == 0) && (!mode)) {          // we are waiting for ack low and ..
-            return ( true );				   // ack is low, return
+        if ((((viaNow & PMack) != 0) && (mode)) ||         // we are waiting for ack hi and ack is high
+            (((viaNow & PMack) == 0) && (!mode))) {        // we are waiting for ack low and ack is low
+            acked = true;
+            break;
         }
 
         clock_get_uptime(&currentTime);
+
+        // Almost all the acks come while we spin. If this one is late
+        // and the caller can sleep give the cpu to someone else between
+        // the checks, instead than burning it for up to the whole timeout:
+        if (mayBlock && (CMP_ABSOLUTETIME(&currentTime, &spinTime) > 0)) {
+            IOSleep(1);
+            slept = true;
+            clock_get_uptime(&currentTime);
+        }
     } while ( CMP_ABSOLUTETIME(&endTime, &currentTime) > 0 );
 
-    return (false);
+    // Keep track of how long the ack took, so the spin time can be tuned:
+    clock_get_uptime(&currentTime);
+    SUB_ABSOLUTETIME(&currentTime, &startTime);
+    absolutetime_to_nanoseconds(currentTime, &nanoseconds);
+
+    transferStatistics.ackWaits++;
+    if (slept)
+        transferStatistics.ackSleeps++;
+    if (acked)
+        transferStatistics.ackHistogram[histogramBucket((UInt32)(nanoseconds / 1000))]++;
+    else
+        transferStatistics.ackTimeouts++;
+
+    return (acked);
+}
+
+// --------------------------------------------------------------------------
+//
+// Method: updateVIA1Enables
+//
+// Purpose:
+//	Sets and clears bits in the VIA1 interrupt enable register. The
+//	register takes a write with bit 7 set to enable the bits given and
+//	with bit 7 clear to disable them, so each change is a single write.
+//	If the interrupt controller owns the register it does the writes
+//	and keeps its copy of the enables up to date. It is not ready
+//	before it started, and then we write the register ourselves: it
+//	clears all the enables once it is.
+void
+OpenViaInterface::updateVIA1Enables(UInt8 setBits, UInt8 clearBits)
+{
+    if ((enablesOwner != NULL) &&
+        (enablesOwner->callPlatformFunction(updateEnablesSymbol, false, (void*)(UInt32)setBits,
+                                            (void*)(UInt32)clearBits, NULL, NULL) == kIOReturnSuccess))
+        return;
+
+    if (clearBits != 0)
+        viaWrite(VIA1_interruptEnable, clearBits);
+    if (setBits != 0)
+        viaWrite(VIA1_interruptEnable, setBits | 0x80);
 }
 
 // --------------------------------------------------------------------------
@@ -753,8 +950,7 @@ bool OpenViaInterface::waitForAck(bool mode, UInt32 milliseconds)
 void
 OpenViaInterface::disableSRInterrupt ( void )
 {
-	*VIA1_interruptEnable = 1<<ifSR;
-	eieio();
+	updateVIA1Enables(0, 1<<ifSR);
 }
 
 // --------------------------------------------------------------------------
@@ -766,8 +962,7 @@ OpenViaInterface::disableSRInterrupt ( void )
 void
 OpenViaInterface::enableSRInterrupt ( void )
 {
-        *VIA1_interruptEnable = (1<<ifSR) | 0x80;
-        eieio();
+        updateVIA1Enables(1<<ifSR, 0);
 }
 
 // --------------------------------------------------------------------------
@@ -780,8 +975,7 @@ void
 OpenViaInterface::disablePMUInterrupt ( void )
 {
         takeVIALock();
-        *VIA1_interruptEnable = 1<<ifCB1;
-        eieio();
+        updateVIA1Enables(0, 1<<ifCB1);
         releaseVIALock();
 }
 
@@ -795,8 +989,7 @@ void
 OpenViaInterface::enablePMUInterrupt ( void )
 {
         takeVIALock();
-        *VIA1_interruptEnable = (1<<ifCB1) | 0x80;
-        eieio();
+        updateVIA1Enables(1<<ifCB1, 0);
         releaseVIALock();
 }
 
@@ -810,8 +1003,7 @@ void
 OpenViaInterface::acknowledgePMUInterrupt ( void )
 {
     takeVIALock();
-    *VIA1_interruptFlag = 1<<ifCB1;
-    eieio();
+    viaWrite(VIA1_interruptFlag, 1<<ifCB1);
     releaseVIALock();
 }
 
@@ -827,8 +1019,7 @@ OpenViaInterface::pmuInteruptPending(void)
     bool interruptisPending;
     
     takeVIALock();
-    interruptisPending = (*VIA1_interruptFlag & 0x10);
-    eieio();
+    interruptisPending = (viaRead(VIA1_interruptFlag) & 0x10);
     releaseVIALock();
 
     return true;
@@ -843,7 +1034,7 @@ OpenViaInterface::pmuInteruptPending(void)
 bool
 OpenViaInterface::srInteruptPending(void)
 {
-    return (*VIA1_interruptFlag & 0x04);
+    return (viaRead(VIA1_interruptFlag) & 0x04);
 }
 
 inline int OpenViaInterface::getSRInterruptNumber()
@@ -1043,7 +1234,8 @@ OpenIntrrViaInterface::sendToPMU(PMUrequestPtr theRequest)
 
     // Waits until the PMU is actually ready
 	//  ******** NOTE: in nbpmac-linux, this is not done for M2 PMUs
-    if (!waitForAck(true, 32)) {
+    // (we are in a thread and hold only the VIA mutex, so we can sleep)
+    if (!waitForAck(true, 32, true)) {
 #ifdef VERBOSE_LOGS_ON_VIA_INTR
         kprintf("OpenIntrrViaInterface::sendToPMU(0x%02x) waitForAck(true, 32) fails\n", transferState.currentTransfer->pmCommand);
 #endif // VERBOSE_LOGS_ON_VIA_INTR
@@ -1108,9 +1300,7 @@ OpenIntrrViaInterface::actUponState()
     if (transferState.currentInterruptState == kInterfaceIdle) {
         // BEGIN addition 12/17/08
         // read shift reg to clear SR int
-        UInt8 lostRead = *VIA1_shift;
-        lostRead++;			// Just in case the compiler starts getting ideas...
-        eieio();
+        viaRead(VIA1_shift);
         // END addition
         return;
     }
@@ -1147,8 +1337,7 @@ OpenIntrrViaInterface::actUponState()
 
             // Completes the previous send (the command byte)
             // deassert /REQ
-            *VIA2_dataB |= PMreq;
-            eieio();
+            viaSetBits(VIA2_dataB, PMreq);
 
             // Intialize the counter of sent bytes:
             transferState.numberOfTransferedBytes = 0;
@@ -1177,8 +1366,7 @@ OpenIntrrViaInterface::actUponState()
             // reading data)...
 
             // ... complete the previous write:
-            *VIA2_dataB |= PMreq;
-            eieio();
+            viaSetBits(VIA2_dataB, PMreq);
 
             // Waits to be sure that the pmu is ready again.
             if (!waitForAck(true, 32)) {
@@ -1212,8 +1400,7 @@ OpenIntrrViaInterface::actUponState()
         case kSwitchToRead:
             // We sent everything there was to send so we complete the last write:
             // by de-asserting the req:
-            *VIA2_dataB |= PMreq;
-            eieio();
+            viaSetBits(VIA2_dataB, PMreq);
 
             // Waits to be sure that the pmu is ready again.
             if (!waitForAck(true, 32)) {
@@ -1261,17 +1448,13 @@ OpenIntrrViaInterface::actUponState()
             // idle it means that we have to set the conditions to begin to read:
             if (transferState.currentInterruptState != kInterfaceIdle) {
                 // switch the shift register in read (input) mode:
-                *VIA1_auxillaryControl &= 0xEF;
-                eieio();
+                viaClearBits(VIA1_auxillaryControl, 0x10);
 
                 // read shift reg to clear SR int
-                UInt8 lostRead = *VIA1_shift;
-                lostRead++;			// Just in case the compiler starts getting ideas...
-                eieio();
+                viaRead(VIA1_shift);
 
                 // assert /REQ to begin the read
-                *VIA2_dataB &= ~PMreq;
-                eieio();
+                viaClearBits(VIA2_dataB, PMreq);
             }
             break;
 
@@ -1302,8 +1485,7 @@ OpenIntrrViaInterface::actUponState()
                 }
 
                 // Assert /REQ to continue to the read (or begin to read the data)
-                *VIA2_dataB &= ~PMreq;
-                eieio();
+                viaClearBits(VIA2_dataB, PMreq);
             }
             break;
 
@@ -1328,8 +1510,7 @@ OpenIntrrViaInterface::actUponState()
                 }
 
                 // Assert /REQ to continue to the read the data.
-                *VIA2_dataB &= ~PMreq;
-                eieio();
+                viaClearBits(VIA2_dataB, PMreq);
             }
             else {
                 // We read everything there was to read and we go back idle.
@@ -1370,16 +1551,13 @@ void
 OpenIntrrViaInterface::sendIntrByte(char byte)
 {
     // set shift register to output
-    *VIA1_auxillaryControl |= 0x1C;
-    eieio();
+    viaSetBits(VIA1_auxillaryControl, 0x1C);
 
     // give it the byte (this clears any pending SR interrupt)
-    *VIA1_shift = byte;
-    eieio();
+    viaWrite(VIA1_shift, byte);
 
     // assert /REQ so that the pmu knows that ther is abyte available.
-    *VIA2_dataB &= ~PMreq;
-    eieio();
+    viaClearBits(VIA2_dataB, PMreq);
 
 #ifdef VERBOSE_LOGS_ON_VIA_INTR
     kprintf("OpenIntrrViaInterface::sendIntrByte sends for 0x%02x\n", (UInt8)byte);
@@ -1396,13 +1574,11 @@ char
 OpenIntrrViaInterface::readIntrByte()
 {
     // read the data byte
-    UInt8 byte = *VIA1_shift;
-    eieio();
+    UInt8 byte = viaRead(VIA1_shift);
 
     // deassert /REQ line to let the pmu
     // know that we read the byte
-    *VIA2_dataB |= PMreq;
-    eieio();
+    viaSetBits(VIA2_dataB, PMreq);
 
 #ifdef VERBOSE_LOGS_ON_VIA_INTR
     kprintf("OpenIntrrViaInterface::readIntrByte returns for 0x%02x\n", (UInt8)byte);
@@ -1479,8 +1655,13 @@ OpenIntrrViaInterface::processPMURequest(PMUrequestPtr plugInMessage)
         kprintf("OpenIntrrViaInterface::processPMURequest starts for 0x%02x\n", plugInMessage->pmCommand);
 #endif // VERBOSE_LOGS_ON_VIA_INTR
 
+        AbsoluteTime startTime;
+        clock_get_uptime(&startTime);
+
         bool success = sendToPMU(plugInMessage);
 
+        recordTransfer(plugInMessage->pmCommand, startTime, success);
+
         // End of the critical section area:
         releaseVIALock();
 
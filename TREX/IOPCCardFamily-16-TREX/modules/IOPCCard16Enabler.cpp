@@ -199,13 +199,163 @@ while ((last_ret=CardServices(last_fn=(fn),args))!=0) goto cs_failed
 #define CFG_CHECK(fn, args...) \
 if (CardServices(fn, args) != 0) goto next_entry
 
+// the configuration that last worked for each card is kept on the
+// bridge, keyed by card identity, so it outlives the card's nub.  Each
+// entry's LastUsed orders them, the lowest goes when the cache is full.
+#define kConfigurationCacheKey	"Card Configuration Cache"
+#define kMaxCachedCards		16
+#define kCardKeyLength		128
+
+//MACOSXXX including bsd/sys/systm.h causes too much pain
+__BEGIN_DECLS
+int snprintf __P((char *, size_t, const char *, ...));
+__END_DECLS
+
+// builds "manfid:vers_1:checksum" for the card, the checksum covers
+// every tuple of the common CIS chain
+static bool
+getCardKey(IOPCCard16Device * device, client_handle_t handle, char * key)
+{
+    tuple_t tuple;
+    u_char buf[255];
+    UInt16 sum = 0;
+    int len, tuples;
+    
+    OSNumber * manf = OSDynamicCast(OSNumber, device->getProperty(kIOPCCardVendorIDMatchKey));
+    OSNumber * card = OSDynamicCast(OSNumber, device->getProperty(kIOPCCardDeviceIDMatchKey));
+    OSArray * vers1 = OSDynamicCast(OSArray, device->getProperty(kIOPCCardVersionOneMatchKey));
+    if (!manf && !vers1) return false;
+
+    tuple.DesiredTuple = RETURN_FIRST_TUPLE;
+    tuple.Attributes = TUPLE_RETURN_COMMON;
+    tuple.TupleData = buf;
+    tuple.TupleDataMax = sizeof(buf);
+    tuple.TupleOffset = 0;
+    if (CardServices(GetFirstTuple, handle, &tuple) != 0) return false;
+    for (tuples = 0; tuples < 256; tuples++) {
+	if (CardServices(GetTupleData, handle, &tuple) != 0) return false;
+	sum = ((sum << 1) | (sum >> 15)) + tuple.TupleCode;
+	for (int i=0; i < tuple.TupleDataLen; i++) {
+	    sum = ((sum << 1) | (sum >> 15)) + buf[i];
+	}
+	if (CardServices(GetNextTuple, handle, &tuple) != 0) break;
+    }
+
+    len = snprintf(key, kCardKeyLength, "%lx,%lx:",
+		   manf ? (long)manf->unsigned32BitValue() : -1L,
+		   card ? (long)card->unsigned32BitValue() : -1L);
+    for (unsigned i=0; vers1 && (i < vers1->getCount()); i++) {
+	OSSymbol * str = OSDynamicCast(OSSymbol, vers1->getObject(i));
+	if (!str || (len >= kCardKeyLength - 6)) break;
+	len += snprintf(key + len, kCardKeyLength - 6 - len, "%s/", str->getCStringNoCopy());
+    }
+    if (len > kCardKeyLength - 6) len = kCardKeyLength - 6;
+    snprintf(key + len, kCardKeyLength - len, ":%04x", sum);
+
+    return true;
+}
+
+static bool
+lookupCachedConfiguration(IOService * bridge, const char * key,
+			  UInt32 * index, UInt32 * base1, UInt32 * base2)
+{
+    OSDictionary * cache = OSDynamicCast(OSDictionary, bridge->getProperty(kConfigurationCacheKey));
+    if (!cache) return false;
+
+    OSDictionary * entry = OSDynamicCast(OSDictionary, cache->getObject(key));
+    if (!entry) return false;
+
+    OSNumber * number = OSDynamicCast(OSNumber, entry->getObject("ConfigIndex"));
+    if (!number) return false;
+    *index = number->unsigned32BitValue();
+
+    number = OSDynamicCast(OSNumber, entry->getObject("IOBase1"));
+    *base1 = number ? number->unsigned32BitValue() : 0;
+    number = OSDynamicCast(OSNumber, entry->getObject("IOBase2"));
+    *base2 = number ? number->unsigned32BitValue() : 0;
+
+    return true;
+}
+
+static void
+recordConfiguration(IOService * bridge, const char * key,
+		    UInt32 index, UInt32 base1, UInt32 base2)
+{
+    OSDictionary * cache = OSDynamicCast(OSDictionary, bridge->getProperty(kConfigurationCacheKey));
+    OSDictionary * newCache;
+    OSDictionary * entry;
+    OSNumber * number;
+    const OSSymbol * oldest = 0;
+    UInt32 lastUsed = 0, oldestUsed = 0;
+
+    // the property is replaced rather than changed in place, other
+    // sockets and ioreg may be looking at the old one
+    if (cache) {
+	OSCollectionIterator * iter = OSCollectionIterator::withCollection(cache);
+	const OSSymbol * cardKey;
+
+	if (iter) {
+	    while ((cardKey = OSDynamicCast(OSSymbol, iter->getNextObject()))) {
+		UInt32 used = 0;
+
+		entry = OSDynamicCast(OSDictionary, cache->getObject(cardKey));
+		number = entry ? OSDynamicCast(OSNumber, entry->getObject("LastUsed")) : 0;
+		if (number) used = number->unsigned32BitValue();
+		if (used > lastUsed) lastUsed = used;
+		if (!oldest || (used < oldestUsed)) {
+		    oldest = cardKey;
+		    oldestUsed = used;
+		}
+	    }
+	    iter->release();
+	}
+	newCache = OSDictionary::withDictionary(cache, cache->getCount() + 1);
+    } else
+	newCache = OSDictionary::withCapacity(4);
+    if (!newCache) return;
+
+    // full: the card used longest ago makes room
+    if (!newCache->getObject(key) && (newCache->getCount() >= kMaxCachedCards) && oldest)
+	newCache->removeObject(oldest);
+
+    entry = OSDictionary::withCapacity(4);
+    if (!entry) {
+	newCache->release();
+	return;
+    }
+    if ((number = OSNumber::withNumber(index, 32))) {
+	entry->setObject("ConfigIndex", number);
+	number->release();
+    }
+    if ((number = OSNumber::withNumber(base1, 32))) {
+	entry->setObject("IOBase1", number);
+	number->release();
+    }
+    if ((number = OSNumber::withNumber(base2, 32))) {
+	entry->setObject("IOBase2", number);
+	number->release();
+    }
+    if ((number = OSNumber::withNumber(lastUsed + 1, 32))) {
+	entry->setObject("LastUsed", number);
+	number->release();
+    }
+
+    newCache->setObject(key, entry);
+    bridge->setProperty(kConfigurationCacheKey, newCache);
+    entry->release();
+    newCache->release();
+}
+
 
 bool
 IOPCCard16Enabler::configure(UInt32 index = 0)
 {
     bool success;
     IODeviceMemory::InitElement rangeList[CISTPL_MEM_MAX_WIN + CISTPL_IO_MAX_WIN];
-    IOPCCardBridge * bridge;
+    IOPCCardBridge * bridge = (IOPCCardBridge *)device->getProvider();
+    char key[kCardKeyLength];
+    bool haveKey = false;
+    UInt32 cachedIndex = 0, cachedBase1 = 0, cachedBase2 = 0;
 
     DEBUG(0, "IOPCCard16Enabler::configure(0x%x)\n", index);
 
@@ -223,22 +373,52 @@ IOPCCard16Enabler::configure(UInt32 index = 0)
     if (index) {
 	success = tryConfiguration(index);
     } else {
-	sortConfigurations();
+	// a card seen before gets what worked for it last time, same
+	// index and, where the CIS lets the ports float, same io ports;
+	// only that attempt working saves the scan below
+	success = false;
+	haveKey = getCardKey(device, handle, key);
+	if (haveKey && lookupCachedConfiguration(bridge, key, &cachedIndex, &cachedBase1, &cachedBase2)) {
+	    cistpl_cftable_entry_t *cfg = 0;
+	    for (UInt32 i=0; i < tableEntryCount; i++) {
+		if (configTable[i]->index == cachedIndex) {
+		    cfg = configTable[i];
+		    break;
+		}
+	    }
+	    if (cfg) {
+		cistpl_io_t saved = cfg->io;
+		if ((cfg->io.nwin > 0) && !cfg->io.win[0].base) cfg->io.win[0].base = cachedBase1;
+		if ((cfg->io.nwin > 1) && !cfg->io.win[1].base) cfg->io.win[1].base = cachedBase2;
+		success = tryConfiguration(cachedIndex);
+		cfg->io = saved;
+		DEBUG(1, "IOPCCard16Enabler::configure cached index 0x%x for \"%s\" %s\n",
+		      cachedIndex, key, success ? "worked" : "failed");
+	    }
+	}
+
+	if (!success) {
+	    sortConfigurations();
 
-	for (UInt32 i=0; i < tableEntryCount; i++) {
-	    success = tryConfiguration(configTable[i]->index);
-	    if (success) break;
+	    for (UInt32 i=0; i < tableEntryCount; i++) {
+		success = tryConfiguration(configTable[i]->index);
+		if (success) break;
+	    }
 	}
     }
     if (!success) goto exit;
     
     // go for it
-    bridge = (IOPCCardBridge *)device->getProvider();
     success = bridge->configureSocket((IOService *)device, &configuration) == 0;
     if (!success) goto exit;
 
     state &= ~DEV_CONFIG_PENDING;
 
+    // recorded even when it is what the cache had, so the card's
+    // LastUsed keeps it from being the one evicted
+    if (haveKey)
+	recordConfiguration(bridge, key, configuration.ConfigIndex, io.BasePort1, io.BasePort2);
+
     /* Finally, report what we've done */
     printk(KERN_INFO "IOPCCard16Enabler::configure using index 0x%02x: Vcc %d.%d",
 	   configuration.ConfigIndex, configuration.Vcc/10, configuration.Vcc%10);
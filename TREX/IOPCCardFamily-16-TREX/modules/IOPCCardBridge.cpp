@@ -1445,10 +1445,12 @@ IOPCCardBridge::setBridgePowerState(unsigned long powerState,
 				    IOService * whatDevice)
 {
     int ret;
+    IOReturn result = IOPMAckImplied;
 
     DEBUG(1, "IOPCCardBridge::setBridgePowerState state=%d\n", powerState);
 
-    // for all sockets on this bridge do
+    // for all sockets on this bridge do, every socket is started
+    // before returning so their resets and CIS checks overlap
     for (unsigned i=0; i < sockets; i++) {
 	socket_info_t *s = &socket_table[i];
 	if (s->bridge != this) continue;
@@ -1458,7 +1460,7 @@ IOPCCardBridge::setBridgePowerState(unsigned long powerState,
 #else
 	if ((powerState == kIOPCIDeviceOnState) || (powerState == 1)) {
 #endif
-	    if (!(s->state & SOCKET_SUSPEND)) return IOPMAckImplied;
+	    if (!(s->state & SOCKET_SUSPEND)) continue;
 	    s->state &= ~SOCKET_SUSPEND;
 
 	    bridgeDevice->enableInterrupt(0);
@@ -1470,14 +1472,14 @@ IOPCCardBridge::setBridgePowerState(unsigned long powerState,
 		// return the max time to power up in usec
 		// CS can take over to 5 seconds to reset a card in
 		// the worse case, add another second for scheduler delays
-		return 6000000;
+		result = 6000000;
 	    }
 #ifdef CHEETAH_STYLE_PM
 	} else {
 #else
 	} else if (powerState == kIOPCIDeviceOffState) {
 #endif
-	    if (s->state & SOCKET_SUSPEND) return IOPMAckImplied;
+	    if (s->state & SOCKET_SUSPEND) continue;
 	    s->state |= SOCKET_SUSPEND;
 	    
 	    if (s->state & SOCKET_CONFIG) {
@@ -1494,7 +1496,7 @@ IOPCCardBridge::setBridgePowerState(unsigned long powerState,
 	    bridgeDevice->disableInterrupt(0);
 	}
     }
-    return IOPMAckImplied;
+    return result;
 }
 
 
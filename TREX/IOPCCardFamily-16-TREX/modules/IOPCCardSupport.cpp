@@ -52,6 +52,66 @@ IOPCCardRemoveCSCInterruptHandlers(IOPCCardBridge *bus, unsigned int socket)
     return !bus->removeCSCInterruptHandler(socket);
 }
 
+#define kEraseStatisticsKey "EraseStatistics"
+
+// one entry per memory region, keyed "socket,space@offset"
+void
+IOPCCardSetEraseStatistics(IOPCCardBridge *bus, unsigned int socket,
+			   int attr, unsigned int offset,
+			   unsigned int erases, unsigned int kbytes,
+			   unsigned long long usecs,
+			   unsigned int pending, unsigned int max_pending)
+{
+    OSDictionary * stats = OSDynamicCast(OSDictionary, bus->getProperty(kEraseStatisticsKey));
+    OSDictionary * newStats;
+    OSDictionary * entry;
+    OSNumber * number;
+    char key[32];
+
+    // replaced rather than changed in place, ioreg may be looking at it
+    if (stats)
+	newStats = OSDictionary::withDictionary(stats, stats->getCount() + 1);
+    else
+	newStats = OSDictionary::withCapacity(2);
+    if (!newStats) return;
+
+    entry = OSDictionary::withCapacity(6);
+    if (!entry) {
+	newStats->release();
+	return;
+    }
+    if ((number = OSNumber::withNumber(erases, 32))) {
+	entry->setObject("Erases", number);
+	number->release();
+    }
+    if ((number = OSNumber::withNumber(kbytes, 32))) {
+	entry->setObject("KBytes", number);
+	number->release();
+    }
+    if ((number = OSNumber::withNumber(usecs, 64))) {
+	entry->setObject("Microseconds", number);
+	number->release();
+    }
+    if ((number = OSNumber::withNumber(usecs ? (kbytes * 1000000ULL) / usecs : 0, 32))) {
+	entry->setObject("KBytesPerSecond", number);
+	number->release();
+    }
+    if ((number = OSNumber::withNumber(pending, 32))) {
+	entry->setObject("Pending", number);
+	number->release();
+    }
+    if ((number = OSNumber::withNumber(max_pending, 32))) {
+	entry->setObject("MaxPending", number);
+	number->release();
+    }
+
+    snprintf(key, sizeof(key), "%u,%s@%x", socket, attr ? "attr" : "common", offset);
+    newStats->setObject(key, entry);
+    bus->setProperty(kEraseStatisticsKey, newStats);
+    entry->release();
+    newStats->release();
+}
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
@@ -154,6 +214,40 @@ IOPCCardWriteLong(void * virt, unsigned int value)
     OSSynchronizeIO();
 }
 
+// Block copies to and from card memory. The windows they are used on
+// are 16 bits wide, so no access is wider than that. Bytes stay in card
+// order, so the halfwords are not swapped; bcopy can't be used since it
+// may touch the (uncached) card memory with cache instructions.
+void
+IOPCCardCopyFromIO(void * dst, void * virt, unsigned int count)
+{
+    volatile UInt8 * src = (volatile UInt8 *)virt;
+    UInt8 * d = (UInt8 *)dst;
+
+    if ((((UInt32)src | (UInt32)d) & 1) == 0) {
+	for ( ; count >= 2; count -= 2, src += 2, d += 2)
+	    *(UInt16 *)d = *(volatile UInt16 *)src;
+    }
+    for ( ; count; count--)
+	*d++ = *src++;
+    OSSynchronizeIO();
+}
+
+void
+IOPCCardCopyToIO(void * virt, void * src, unsigned int count)
+{
+    volatile UInt8 * dst = (volatile UInt8 *)virt;
+    UInt8 * s = (UInt8 *)src;
+
+    if ((((UInt32)dst | (UInt32)s) & 1) == 0) {
+	for ( ; count >= 2; count -= 2, dst += 2, s += 2)
+	    *(volatile UInt16 *)dst = *(UInt16 *)s;
+    }
+    for ( ; count; count--)
+	*dst++ = *s++;
+    OSSynchronizeIO();
+}
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
@@ -223,6 +317,17 @@ IOPCCardDeleteTimer(struct timer_list * timer)
     return (int)thread_call_func_cancel(timerFunnel, (void *)timer, FALSE);
 }
 
+unsigned long long
+IOPCCardUptime(void)
+{
+    AbsoluteTime                    now;
+    UInt64                          nsecs;
+
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now, &nsecs);
+    return nsecs / 1000;
+}
+
 
 
 } /* extern c */
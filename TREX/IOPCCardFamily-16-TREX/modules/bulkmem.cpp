@@ -55,6 +55,7 @@
 #include <IOKit/pccard/cs.h>
 #include <IOKit/pccard/bulkmem.h>
 #include <IOKit/pccard/cistpl.h>
+#include <IOKit/pccard/bus_ops.h>
 #include "cs_internal.h"
 
 // begin TREX modifications
@@ -141,6 +142,51 @@ static void remove_queue(erase_busy_t *entry)
     entry->prev->next = entry->next;
 }
 
+// begin TREX modification
+static void start_erases(eraseq_t *queue);
+
+/* Counts an erase in its region's statistics, which are published
+   in the bridge's EraseStatistics property */
+static void erase_done(erase_busy_t *busy)
+{
+    eraseq_entry_t *erase = busy->erase;
+    memory_handle_t r = erase->Handle;
+    socket_info_t *s = SOCKET(busy->client);
+    u_int usecs;
+
+    usecs = (u_int)(IOPCCardUptime() - busy->started);
+    r->erase_pending--;
+    r->erase_count++;
+    r->erase_kbytes += erase->Size >> 10;
+    r->erase_usecs += usecs;
+    DEBUG(1, "cs: erase at 0x%x, %d bytes, state 0x%x in %d us; region "
+	  "0x%p: %d pending (max %d)\n", erase->Offset, erase->Size,
+	  erase->State, usecs, r, r->erase_pending, r->erase_max_pending);
+    IOPCCardSetEraseStatistics(s->cap.pccard_nub, busy->client->Socket,
+			       r->info.Attributes & REGION_TYPE_AM,
+			       r->info.CardOffset, r->erase_count,
+			       r->erase_kbytes, r->erase_usecs,
+			       r->erase_pending, r->erase_max_pending);
+}
+
+/* Tells the client, and starts what waited for the erase's part.
+   The queue is only looked at again if something waits, since the
+   client may deregister it once the last erase is done. */
+static void erase_complete(erase_busy_t *busy)
+{
+    eraseq_t *queue = busy->queue;
+    int more;
+
+    erase_done(busy);
+    more = queue->held || queue->starting;
+    busy->client->event_callback_args.info = busy->erase;
+    EVENT(busy->client, CS_EVENT_ERASE_COMPLETE, CS_EVENT_PRI_LOW);
+    kfree(busy);
+    if (more)
+	start_erases(queue);
+}
+// end TREX modification
+
 static void retry_erase(erase_busy_t *busy, u_int cause)
 {
     eraseq_entry_t *erase = busy->erase;
@@ -152,6 +198,15 @@ static void retry_erase(erase_busy_t *busy, u_int cause)
     DEBUG(2, "cs: trying erase request 0x%p...\n", busy);
     if (busy->next)
 	remove_queue(busy);
+    // begin TREX modification
+    if (erase->Handle->mtd == NULL) {
+	/* The built-in MTD only reads and writes; it has no erase */
+	DEBUG(2, "  Ret = %d, no MTD\n", CS_UNSUPPORTED_FUNCTION);
+	erase->State = ERASE_FAILED;
+	erase_complete(busy);
+	return;
+    }
+    // end TREX modification
     req.Function = MTD_REQ_ERASE | cause;
     req.TransferLength = erase->Size;
     req.DestCardOffset = erase->Offset + erase->Handle->info.CardOffset;
@@ -193,9 +248,9 @@ static void retry_erase(erase_busy_t *busy, u_int cause)
 	default:
 	    erase->State = ERASE_FAILED; break;
 	}
-	busy->client->event_callback_args.info = erase;
-	EVENT(busy->client, CS_EVENT_ERASE_COMPLETE, CS_EVENT_PRI_LOW);
-	kfree(busy);
+	// begin TREX modification
+	erase_complete(busy);
+	// end TREX modification
 	/* Resubmit anything waiting for a request to finish */
 	wakeup(&mtd->mtd_req);
 	retry_erase_list(&mtd->erase_busy, 0);
@@ -227,7 +282,9 @@ static void handle_erase_timeout(u_long arg)
     retry_erase((erase_busy_t *)arg, MTD_REQ_TIMEOUT);
 }
 
-static void setup_erase_request(client_handle_t handle, eraseq_entry_t *erase)
+// begin TREX modification
+static void setup_erase_request(eraseq_t *queue, eraseq_entry_t *erase)
+// end TREX modification
 {
     erase_busy_t *busy;
     region_info_t *info;
@@ -242,11 +299,25 @@ static void setup_erase_request(client_handle_t handle, eraseq_entry_t *erase)
 	else if ((erase->Offset+erase->Size > info->RegionSize) ||
 		 (erase->Size & (info->BlockSize-1)))
 	    erase->State = ERASE_BAD_SIZE;
+	// begin TREX modification
+	else if (erase->Handle->mtd == NULL)
+	    erase->State = ERASE_FAILED;	/* built-in MTD: can't erase */
+	// end TREX modification
 	else {
-	    erase->State = 1;
 	    busy = kmalloc(sizeof(erase_busy_t), GFP_KERNEL);
+	    // begin TREX modification
+	    if (busy == NULL) {
+		erase->State = ERASE_FAILED;
+		return;
+	    }
+	    busy->started = IOPCCardUptime();
+	    if (++erase->Handle->erase_pending > erase->Handle->erase_max_pending)
+		erase->Handle->erase_max_pending = erase->Handle->erase_pending;
+	    busy->queue = queue;
+	    // end TREX modification
+	    erase->State = 1;
 	    busy->erase = erase;
-	    busy->client = handle;
+	    busy->client = queue->handle;
 #ifndef __MACOSX__
 	    busy->timeout.prev = busy->timeout.next = NULL;
 #endif
@@ -258,6 +329,118 @@ static void setup_erase_request(client_handle_t handle, eraseq_entry_t *erase)
     }
 } /* setup_erase_request */
 
+/*======================================================================
+
+    The built-in MTD.  SRAM and ROM type regions, and the read side of
+    flash, are plain memory to the host.  When no MTD has registered
+    for such a region, OpenMemory gives it a window of its own and
+    reads (and SRAM writes) are copied straight through it instead of
+    going through an MTD request.  The window covers the whole region
+    and never moves: a controller may not let a window move once the
+    card is configured (TREX doesn't), so a region that can't be
+    mapped whole can't be opened.  There is no erase.
+    
+======================================================================*/
+
+// begin TREX modification
+#define DIRECT_READ(r) \
+    (((r)->type >= CISTPL_DTYPE_ROM) && ((r)->type <= CISTPL_DTYPE_DRAM))
+#define DIRECT_WRITE(r) \
+    (((r)->type == CISTPL_DTYPE_SRAM) || ((r)->type == CISTPL_DTYPE_DRAM))
+
+static int setup_direct_window(client_handle_t handle, memory_handle_t r)
+{
+    socket_info_t *s = SOCKET(handle);
+    window_handle_t win;
+    win_req_t req;
+    
+    req.Attributes = WIN_ENABLE | WIN_DATA_WIDTH_16;
+    if (r->info.Attributes & REGION_TYPE_AM)
+	req.Attributes |= WIN_MEMORY_TYPE_AM;
+    req.Base = 0;
+    req.AccessSpeed = r->info.AccessSpeed;
+
+    /* RequestWindow maps card address 0; cover everything up to the
+       end of the region, so the window never has to move */
+    req.Size = (r->info.CardOffset + r->info.RegionSize + s->cap.map_size-1) &
+	~(s->cap.map_size-1);
+    win = (window_handle_t)handle;
+    if (CardServices(RequestWindow, &win, &req, NULL) != CS_SUCCESS) {
+	DEBUG(1, "cs: no %d byte window for region 0x%p\n", req.Size, r);
+	return CS_OUT_OF_RESOURCE;
+    }
+    DEBUG(1, "cs: built-in MTD window 0x%p, %d bytes for region 0x%p\n",
+	  win, req.Size, r);
+    
+    r->direct_win = win;
+    r->direct_owner = handle;
+    r->direct_virt = NULL;
+    return CS_SUCCESS;
+}
+
+/* Also called by free_regions, when the card goes away with handles
+   still open; the window may have gone with its client already */
+void release_direct_window(memory_handle_t r)
+{
+    window_t *win = r->direct_win;
+    socket_info_t *s = win->sock;
+    
+    if (r->direct_virt) {
+	bus_iounmap(s->cap.bus, r->direct_virt);
+	r->direct_virt = NULL;
+    }
+    if ((win->magic == WINDOW_MAGIC) && (win->handle == r->direct_owner))
+	CardServices(ReleaseWindow, win, NULL, NULL);
+    r->direct_win = NULL;
+    r->direct_owner = NULL;
+}
+
+/* Where card address addr is, and how much of the window follows it */
+static u_char *map_direct(memory_handle_t r, u_int addr, u_int *avail)
+{
+    window_t *win = r->direct_win;
+    socket_info_t *s = win->sock;
+    
+    if (addr >= win->ctl.card_start + win->size)
+	return NULL;
+    if (r->direct_virt == NULL) {
+	if (s->cap.features & SS_CAP_STATIC_MAP)
+	    r->direct_virt = bus_ioremap(s->cap.bus, win->ctl.sys_start,
+					 win->size);
+	else
+	    r->direct_virt = bus_ioremap(s->cap.bus, win->base, win->size);
+	if (r->direct_virt == NULL)
+	    return NULL;
+    }
+    *avail = win->ctl.card_start + win->size - addr;
+    return r->direct_virt + (addr - win->ctl.card_start);
+}
+
+static int direct_transfer(memory_handle_t r, u_int addr, u_int count,
+			   caddr_t buf, int write)
+{
+    socket_info_t *s = r->direct_win->sock;
+    u_char *sys;
+    u_int avail;
+
+    while (count) {
+	if (!(s->state & SOCKET_PRESENT))
+	    return CS_NO_CARD;
+	sys = map_direct(r, addr, &avail);
+	if (sys == NULL)
+	    return CS_GENERAL_FAILURE;
+	if (avail > count)
+	    avail = count;
+	if (write)
+	    bus_memcpy_toio(s->cap.bus, sys, buf, avail);
+	else
+	    bus_memcpy_fromio(s->cap.bus, buf, sys, avail);
+	addr += avail; buf += avail; count -= avail;
+    }
+    return CS_SUCCESS;
+}
+// end TREX modification
+
 /*======================================================================
 
     MTD helper functions
@@ -376,6 +559,16 @@ static void setup_regions(client_handle_t handle, int attr,
 	    r->state = 0;
 	    r->dev_info[0] = '\0';
 	    r->mtd = NULL;
+	    // begin TREX modification
+	    r->type = device.dev[i].type;
+	    r->opens = 0;
+	    r->direct_win = NULL;
+	    r->direct_owner = NULL;
+	    r->direct_virt = NULL;
+	    r->erase_pending = r->erase_max_pending = 0;
+	    r->erase_count = r->erase_kbytes = 0;
+	    r->erase_usecs = 0;
+	    // end TREX modification
 	    r->info.Attributes = (attr) ? REGION_TYPE_AM : 0;
 	    r->info.CardOffset = offset;
 	    r->info.RegionSize = device.dev[i].size;
@@ -500,6 +693,10 @@ int register_erase_queue(client_handle_t *handle, eraseq_hdr_t *header)
     queue->handle = *handle;
     queue->count = header->QueueEntryCnt;
     queue->entry = header->QueueEntryArray;
+    // begin TREX modification
+    queue->held = 0;
+    queue->starting = queue->rescan = 0;
+    // end TREX modification
     *handle = (client_handle_t)queue;
     return CS_SUCCESS;
 } /* register_erase_queue */
@@ -511,21 +708,83 @@ int deregister_erase_queue(eraseq_handle_t eraseq)
 	return CS_BAD_HANDLE;
     for (i = 0; i < eraseq->count; i++)
 	if (ERASE_IN_PROGRESS(eraseq->entry[i].State)) break;
-    if (i < eraseq->count)
+    // begin TREX modification
+    /* held entries are still ours to start */
+    if ((i < eraseq->count) || eraseq->held || eraseq->starting)
 	return CS_BUSY;
+    // end TREX modification
     eraseq->eraseq_magic = 0;
     kfree(eraseq);
     return CS_SUCCESS;
 } /* deregister_erase_queue */
 
-int check_erase_queue(eraseq_handle_t eraseq)
+// begin TREX modification
+/* Flash parts erase independently of each other, so each part (the
+   region's PartMultiple, from its DEVICE_GEO tuple, or the whole
+   region) has one erase at a time in the MTD, and the next one of
+   that part starts when it ends.  The parts' erases run side by side
+   while the rest of the queue waits here rather than on the MTD's
+   busy list, so reads and writes to other regions get the MTD
+   between erase steps instead of after the whole queue. */
+static u_int erase_part(eraseq_entry_t *erase)
+{
+    region_t *r = erase->Handle;
+    if (CHECK_REGION(r) || (r->info.PartMultiple <= 1))
+	return 0;
+    return erase->Offset / r->info.PartMultiple;
+}
+
+static int erase_part_busy(eraseq_t *queue, eraseq_entry_t *erase)
 {
+    eraseq_entry_t *e;
+    u_int part = erase_part(erase);
     int i;
+
+    for (i = 0, e = queue->entry; i < queue->count; i++, e++)
+	if (ERASE_IN_PROGRESS(e->State) && (e->Handle == erase->Handle) &&
+	    (erase_part(e) == part))
+	    return 1;
+    return 0;
+}
+
+/* An erase the MTD does at once ends inside setup_erase_request, and
+   comes back here; it only asks for another pass */
+static void start_erases(eraseq_t *queue)
+{
+    eraseq_entry_t *erase;
+    int i, held;
+
+    if (queue->starting) {
+	queue->rescan = 1;
+	return;
+    }
+    queue->starting = 1;
+    do {
+	queue->rescan = 0;
+	held = 0;
+	for (i = 0; i < queue->count; i++) {
+	    erase = &queue->entry[i];
+	    if (erase->State != ERASE_QUEUED)
+		continue;
+	    if (erase_part_busy(queue, erase)) {
+		held++;
+		continue;
+	    }
+	    setup_erase_request(queue, erase);
+	}
+	queue->held = held;
+    } while (queue->rescan);
+    queue->starting = 0;
+}
+// end TREX modification
+
+int check_erase_queue(eraseq_handle_t eraseq)
+{
     if (CHECK_ERASEQ(eraseq))
 	return CS_BAD_HANDLE;
-    for (i = 0; i < eraseq->count; i++)
-	if (eraseq->entry[i].State == ERASE_QUEUED)
-	    setup_erase_request(eraseq->handle, &eraseq->entry[i]);
+    // begin TREX modification
+    start_erases(eraseq);
+    // end TREX modification
     return CS_SUCCESS;
 } /* check_erase_queue */
 
@@ -540,6 +799,9 @@ int open_memory(client_handle_t *handle, open_mem_t *open)
 {
     socket_info_t *s;
     memory_handle_t region;
+    // begin TREX modification
+    int ret;
+    // end TREX modification
     
     if ((handle == NULL) || CHECK_HANDLE(*handle))
 	return CS_BAD_HANDLE;
@@ -561,6 +823,21 @@ int open_memory(client_handle_t *handle, open_mem_t *open)
 	    dprintf("cs: could not find MTD module %s\n", n);
     }
 #endif
+    // begin TREX modification
+    if (region && !region->mtd && DIRECT_READ(region)) {
+	/* No MTD wants it, so the built-in one serves it */
+	if (!region->direct_win) {
+	    ret = setup_direct_window(*handle, region);
+	    if (ret != CS_SUCCESS)
+		return ret;
+	}
+	region->opens++;
+	*handle = (client_handle_t)region;
+	DEBUG(1, "cs: open_memory(0x%p, 0x%x) = 0x%p, built-in MTD\n",
+	      handle, open->Offset, region);
+	return CS_SUCCESS;
+    }
+    // end TREX modification
     if (region && region->mtd) {
 	*handle = (client_handle_t)region;
 	DEBUG(1, "cs: open_memory(0x%p, 0x%x) = 0x%p\n",
@@ -574,7 +851,8 @@ int open_memory(client_handle_t *handle, open_mem_t *open)
 
     Close a memory handle from an earlier call to OpenMemory.
     
-    For the moment, I don't think this needs to do anything.
+    Only the built-in MTD has anything to undo: its window goes away
+    with the last handle.
     
 ======================================================================*/
 
@@ -583,6 +861,10 @@ int close_memory(memory_handle_t handle)
     DEBUG(1, "cs: close_memory(0x%p)\n", handle);
     if (CHECK_REGION(handle))
 	return CS_BAD_HANDLE;
+    // begin TREX modification
+    if (handle->direct_win && handle->opens && (--handle->opens == 0))
+	release_direct_window(handle);
+    // end TREX modification
 #ifdef __BEOS__
     if (handle->dev_info[0] != '\0') {
 	char n[80];
@@ -610,6 +892,15 @@ int read_memory(memory_handle_t handle, mem_op_t *req, caddr_t buf)
     if (req->Offset+req->Count > handle->info.RegionSize)
 	return CS_BAD_SIZE;
     
+    // begin TREX modification
+    if (!handle->mtd && handle->direct_win) {
+	if (!(req->Attributes & MEM_OP_BUFFER_KERNEL))
+	    return CS_BAD_ARGS;
+	return direct_transfer(handle, req->Offset + handle->info.CardOffset,
+			       req->Count, buf, 0);
+    }
+    // end TREX modification
+    
     mtd.SrcCardOffset = req->Offset + handle->info.CardOffset;
     mtd.TransferLength = req->Count;
     mtd.MediaID = handle->MediaID;
@@ -636,6 +927,17 @@ int write_memory(memory_handle_t handle, mem_op_t *req, caddr_t buf)
     if (req->Offset+req->Count > handle->info.RegionSize)
 	return CS_BAD_SIZE;
     
+    // begin TREX modification
+    if (!handle->mtd && handle->direct_win) {
+	if (!DIRECT_WRITE(handle))
+	    return CS_WRITE_PROTECTED;
+	if (!(req->Attributes & MEM_OP_BUFFER_KERNEL))
+	    return CS_BAD_ARGS;
+	return direct_transfer(handle, req->Offset + handle->info.CardOffset,
+			       req->Count, buf, 1);
+    }
+    // end TREX modification
+    
     mtd.DestCardOffset = req->Offset + handle->info.CardOffset;
     mtd.TransferLength = req->Count;
     mtd.MediaID = handle->MediaID;
@@ -653,14 +955,37 @@ int write_memory(memory_handle_t handle, mem_op_t *req, caddr_t buf)
     it.  yes, "copy" is a really bad name in this case.  if the
     hardware doesn't support memory mapping then this code should call
     read_memory to do the "copy".
+
+    With the built-in MTD, the Count bytes at SourceOffset in the
+    region are mapped in its window and their system address is
+    returned in DestOffset; nothing is copied.  The window covers the
+    whole region, so they are always there.
     
 ======================================================================*/
 
 int copy_memory(memory_handle_t handle, copy_op_t *req)
 {
+    u_char *sys;
+    u_int avail;
+    
     if (CHECK_REGION(handle))
 	return CS_BAD_HANDLE;
-    return CS_UNSUPPORTED_FUNCTION;
+    // begin TREX modification
+    if (handle->mtd || !handle->direct_win)
+	return CS_UNSUPPORTED_FUNCTION;
+    if (req->SourceOffset >= handle->info.RegionSize)
+	return CS_BAD_OFFSET;
+    if (req->SourceOffset+req->Count > handle->info.RegionSize)
+	return CS_BAD_SIZE;
+    sys = map_direct(handle, req->SourceOffset + handle->info.CardOffset,
+		     &avail);
+    if (sys == NULL)
+	return CS_GENERAL_FAILURE;
+    if (avail < req->Count)
+	return CS_BAD_SIZE;
+    req->DestOffset = (u_int)sys;
+    return CS_SUCCESS;
+    // end TREX modification
 }
 
 
@@ -111,6 +111,9 @@ INT_MODULE_PARM(cis_width,	0);		/* 16-bit CIS? */
 #define IS_INDIRECT	8
 
 static int setup_cis_mem(socket_info_t *s);
+// begin TREX modification
+static int cis_cached(socket_info_t *s, int attr, u_int addr, u_int len);
+// end TREX modification
 
 static void set_cis_map(socket_info_t *s, pccard_mem_map *mem)
 {
@@ -196,6 +199,9 @@ void write_cis_mem(socket_info_t *s, int attr, u_int addr,
 {
     pccard_mem_map *mem = &s->cis_mem;
     u_char *sys, *buf = ptr;
+    // begin TREX modification
+    u_int addr0 = addr, len0 = len;
+    // end TREX modification
     
     DEBUG(3, "cs: write_cis_mem(%d, %#x, %u)\n", attr, addr, len);
     if (setup_cis_mem(s) != 0) return;
@@ -233,6 +239,8 @@ void write_cis_mem(socket_info_t *s, int attr, u_int addr,
     }
     // begin TREX modification
     cis_read_write_done(s);
+    if (cis_cached(s, attr, addr0, len0))
+	flush_cis_cache(s);
     // end TREX modification
 }
 
@@ -256,7 +264,7 @@ static int cis_readable(u_long base)
     vs->cis_virt = bus_ioremap(vs->cap.bus, base, vs->cap.map_size);
     ret = validate_cis(vs->clients, &info1);
     /* invalidate mapping and CIS cache */
-    bus_iounmap(vs->cap.bus, vs->cis_virt); vs->cis_used = 0;
+    bus_iounmap(vs->cap.bus, vs->cis_virt); flush_cis_cache(vs);
     if ((ret != 0) || (info1.Chains == 0))
 	return 0;
     vs->cis_mem.sys_start = base+vs->cap.map_size;
@@ -264,7 +272,7 @@ static int cis_readable(u_long base)
     vs->cis_virt = bus_ioremap(vs->cap.bus, base+vs->cap.map_size,
 			       vs->cap.map_size);
     ret = validate_cis(vs->clients, &info2);
-    bus_iounmap(vs->cap.bus, vs->cis_virt); vs->cis_used = 0;
+    bus_iounmap(vs->cap.bus, vs->cis_virt); flush_cis_cache(vs);
     return ((ret == 0) && (info1.Chains == info2.Chains));
 }
 
@@ -328,6 +336,224 @@ void release_cis_mem(socket_info_t *s)
     }
 }
 
+// begin TREX modification
+/*======================================================================
+
+    The CIS image.  Walking the CIS used to cost a window remap and
+    a cis_read_write_done() for every tuple header; instead the start
+    of each direct CIS space is read in bursts into s->cis_image, and
+    grown a burst at a time when a read goes past what we have.  So
+    the tuple services run from memory, and the card is only touched
+    once per burst.  A burst follows the chain that starts at 0 as it
+    reads and stops at its end: the configuration registers often come
+    right after it, and reading them is not always harmless.  Indirect
+    spaces, CardBus and anything beyond the chain or MAX_CIS_IMAGE
+    still go through the old per-read cache.
+    
+======================================================================*/
+
+void flush_cis_cache(socket_info_t *s)
+{
+    s->cis_used = 0;
+    s->cis_image_len[0] = s->cis_image_len[1] = 0;
+    s->cis_chain_next[0] = s->cis_chain_next[1] = 0;
+    s->cis_chain_end[0] = s->cis_chain_end[1] = 0;
+    s->cis_nindex = 0;
+}
+
+/* Whether anything we keep of the CIS covers part of a range */
+static int cis_cached(socket_info_t *s, int attr, u_int addr, u_int len)
+{
+    int i;
+    
+    if (!(attr & ~IS_ATTR) && (addr < s->cis_image_len[attr]))
+	return 1;
+    for (i = 0; i < s->cis_used; i++) {
+	if ((s->cis_table[i].attr == attr) &&
+	    (addr < s->cis_table[i].addr+s->cis_table[i].len) &&
+	    (s->cis_table[i].addr < addr+len))
+	    return 1;
+    }
+    return 0;
+}
+
+/* Reads len bytes of a direct CIS space from addr, the direct part of
+   read_cis_mem(), but follows the chain that starts at 0 as the bytes
+   come in and stops after its last one.  Returns how many it read. */
+static u_int read_cis_chain(socket_info_t *s, int attr, u_int addr,
+			    u_int len, u_char *buf)
+{
+    pccard_mem_map *mem = &s->cis_mem;
+    u_char *sys;
+    u_int ofs = addr, stop = addr+len, next = s->cis_chain_next[attr];
+    u_int inc = 1;
+    
+    if (setup_cis_mem(s) != 0)
+	return 0;
+    mem->flags = MAP_ACTIVE | ((cis_width) ? MAP_16BIT : 0);
+    if (attr) { mem->flags |= MAP_ATTRIB; inc++; addr *= 2; }
+    mem->card_start = addr & ~(s->cap.map_size-1);
+    while ((ofs < stop) && !s->cis_chain_end[attr]) {
+	set_cis_map(s, mem);
+	sys = s->cis_virt + (addr & (s->cap.map_size-1));
+	for ( ; ofs < stop; ofs++, buf++, sys += inc) {
+	    if (sys == s->cis_virt+s->cap.map_size) break;
+	    *buf = bus_readb(s->cap.bus, sys);
+	    if (ofs == next) {
+		/* a tuple code */
+		if (*buf == CISTPL_NULL)
+		    next++;
+		else if (*buf == CISTPL_END)
+		    s->cis_chain_end[attr] = ofs+1;
+	    } else if (ofs == next+1) {
+		/* its link */
+		if (*buf == 0xff)
+		    s->cis_chain_end[attr] = ofs+1;
+		else
+		    next += *buf + 2;
+	    }
+	    if (s->cis_chain_end[attr]) {
+		ofs++;
+		break;
+	    }
+	}
+	mem->card_start += s->cap.map_size;
+	addr = 0;
+    }
+    cis_read_write_done(s);
+    s->cis_chain_next[attr] = next;
+    return len - (stop-ofs);
+}
+
+static int read_cis_image(socket_info_t *s, int attr, u_int addr,
+			  u_int len, void *ptr)
+{
+    u_int want, have;
+    
+#ifdef CONFIG_CARDBUS
+    if (s->state & SOCKET_CARDBUS)
+	return -1;
+#endif
+    if ((attr & ~IS_ATTR) || (addr+len > MAX_CIS_IMAGE))
+	return -1;
+    have = s->cis_image_len[attr];
+    if ((addr+len > have) && !s->cis_chain_end[attr]) {
+	want = (addr+len+CIS_IMAGE_BURST-1) & ~(CIS_IMAGE_BURST-1);
+	if (want > MAX_CIS_IMAGE)
+	    want = MAX_CIS_IMAGE;
+	have += read_cis_chain(s, attr, have, want-have,
+			       s->cis_image[attr]+have);
+	s->cis_image_len[attr] = have;
+    }
+    /* Past the end of the chain */
+    if (addr+len > have)
+	return -1;
+    memcpy(ptr, s->cis_image[attr]+addr, len);
+    return 0;
+}
+
+/* Is this one of the tuples get_next_tuple() has to look at? */
+static int is_link_tuple(cisdata_t code)
+{
+    return ((code == CISTPL_LONGLINK_A) || (code == CISTPL_LONGLINK_C) ||
+	    (code == CISTPL_LONGLINK_MFC) || (code == CISTPL_LINKTARGET) ||
+	    (code == CISTPL_INDIRECT) || (code == CISTPL_NO_LINK) ||
+	    (code == CISTPL_END));
+}
+
+/* The tuples that tell cards apart, in the order verify_cis_cache()
+   trusts them: MANFID and CHECKSUM are compared byte for byte, the
+   others through a digest taken when the chain was indexed */
+static int is_ident_tuple(cisdata_t code)
+{
+    return ((code == CISTPL_MANFID) || (code == CISTPL_CHECKSUM));
+}
+
+static int is_digest_tuple(cisdata_t code)
+{
+    return ((code == CISTPL_VERS_1) || (code == CISTPL_CONFIG) ||
+	    (code == CISTPL_FUNCID));
+}
+
+#define CIS_DIGEST_SEED	2166136261U
+
+static u_int cis_digest(u_int h, u_char *p, u_int len)
+{
+    while (len--)
+	h = (h ^ *p++) * 16777619U;
+    return h;
+}
+
+/* Whether an indexed tuple lies entirely within the image */
+static int in_cis_image(socket_info_t *s, cis_index_t *t)
+{
+    return ((t->link != 0xff) &&
+	    (t->ofs + t->link + 2 <= s->cis_image_len[IS_ATTR]));
+}
+
+/* Records the tuples of the primary attribute chain, once per card */
+static void index_cis_chain(socket_info_t *s)
+{
+    u_char link[2];
+    u_int ofs = 0;
+    int i;
+    
+    s->cis_nindex = 0;
+    while ((s->cis_nindex < MAX_CIS_INDEX) && (ofs+2 <= MAX_CIS_IMAGE)) {
+	if (read_cis_image(s, IS_ATTR, ofs, 2, link) != 0)
+	    break;
+	if (link[0] == CISTPL_NULL) {
+	    ofs++; continue;
+	}
+	s->cis_index[s->cis_nindex].ofs = ofs;
+	s->cis_index[s->cis_nindex].code = link[0];
+	s->cis_index[s->cis_nindex].link = link[1];
+	s->cis_nindex++;
+	if ((link[0] == CISTPL_END) || (link[1] == 0xff))
+	    break;
+	ofs += link[1] + 2;
+    }
+    s->cis_digest = CIS_DIGEST_SEED;
+    for (i = 0; i < s->cis_nindex; i++) {
+	cis_index_t *t = &s->cis_index[i];
+	if (is_digest_tuple(t->code) && in_cis_image(s, t))
+	    s->cis_digest = cis_digest(s->cis_digest,
+				       s->cis_image[IS_ATTR]+t->ofs,
+				       t->link+2);
+    }
+}
+
+/* If ofs is a tuple of the primary attribute chain, moves it past the
+   tuples that are neither the one we want nor links, returning how
+   many were skipped (at most limit) */
+static int skip_indexed_tuples(socket_info_t *s, int *ofs, cisdata_t desired,
+			       int limit)
+{
+    int lo, hi, mid, k;
+    
+    if (s->fake_cis)
+	return 0;
+    if (s->cis_nindex == 0)
+	index_cis_chain(s);
+    lo = 0; hi = s->cis_nindex-1;
+    while (lo <= hi) {
+	mid = (lo+hi)/2;
+	if (s->cis_index[mid].ofs == *ofs) break;
+	if (s->cis_index[mid].ofs < *ofs) lo = mid+1; else hi = mid-1;
+    }
+    if (lo > hi)
+	return 0;
+    for (k = mid; (k < s->cis_nindex-1) && (k-mid < limit); k++) {
+	cisdata_t code = s->cis_index[k].code;
+	if ((code == desired) || is_link_tuple(code) ||
+	    (s->cis_index[k].link == 0xff))
+	    break;
+    }
+    *ofs = s->cis_index[k].ofs;
+    return k-mid;
+}
+// end TREX modification
+
 /*======================================================================
 
     This is a wrapper around read_cis_mem, with the same interface,
@@ -349,6 +575,10 @@ static void read_cis_cache(socket_info_t *s, int attr, u_int addr,
 	    memset(ptr, 0xff, len);
 	return;
     }
+    // begin TREX modification
+    if (read_cis_image(s, attr, addr, len, ptr) == 0)
+	return;
+    // end TREX modification
     caddr = s->cis_cache;
     for (i = 0; i < s->cis_used; i++) {
 	if ((s->cis_table[i].addr == addr) &&
@@ -381,13 +611,76 @@ static void read_cis_cache(socket_info_t *s, int attr, u_int addr,
 
     This verifies if the CIS of a card matches what is in the CIS
     cache.
+
+    On resume, that used to mean reading back everything we had ever
+    read, a byte at a time.  Now the identity tuples of the indexed
+    chain go first: a difference there settles it, and if they and
+    the digest of the descriptive tuples both match, the card is the
+    one we had.  Only when a card has too few of these tuples to tell
+    is the whole cache read back.
     
 ======================================================================*/
 
+// begin TREX modification
+/* Reads the indexed tuples picked by match() back from the card.
+   Returns -1 if there are none, 1 if the card differs from the
+   image (or, with digest set, from s->cis_digest), and 0 if not */
+static int verify_indexed_tuples(socket_info_t *s,
+				 int (*match)(cisdata_t), int digest)
+{
+    u_char buf[257];
+    u_int h = CIS_DIGEST_SEED, len;
+    int i, n = 0;
+
+    for (i = 0; i < s->cis_nindex; i++) {
+	cis_index_t *t = &s->cis_index[i];
+	if (!match(t->code) || !in_cis_image(s, t))
+	    continue;
+	len = t->link + 2;
+	read_cis_mem(s, IS_ATTR, t->ofs, len, buf);
+	n++;
+	if (digest)
+	    h = cis_digest(h, buf, len);
+	else if (memcmp(buf, s->cis_image[IS_ATTR]+t->ofs, len) != 0)
+	    return 1;
+    }
+    if (n == 0)
+	return -1;
+    return (digest && (h != s->cis_digest));
+}
+// end TREX modification
+
 int verify_cis_cache(socket_info_t *s)
 {
     char buf[256], *caddr;
     int i;
+    // begin TREX modification
+    u_int space, ofs, len;
+
+    if (!s->fake_cis && (s->cis_nindex > 0)) {
+	i = verify_indexed_tuples(s, is_ident_tuple, 0);
+	if (i > 0)
+	    return 1;
+	if (i == 0) {
+	    i = verify_indexed_tuples(s, is_digest_tuple, 1);
+	    if (i >= 0)
+		return i;
+	}
+	DEBUG(1, "cs: socket %d: CIS identity ambiguous, full compare\n",
+	      s->sock);
+    }
+
+    for (space = 0; space < 2; space++) {
+	for (ofs = 0; ofs < s->cis_image_len[space]; ofs += len) {
+	    len = s->cis_image_len[space]-ofs;
+	    if (len > sizeof(buf))
+		len = sizeof(buf);
+	    read_cis_mem(s, space, ofs, len, buf);
+	    if (memcmp(buf, s->cis_image[space]+ofs, len) != 0)
+		return 1;
+	}
+    }
+    // end TREX modification
     
     caddr = s->cis_cache;
     for (i = 0; i < s->cis_used; i++) {
@@ -553,6 +846,12 @@ int get_next_tuple(client_handle_t handle, tuple_t *tuple)
 	if (link[1] == 0xff) {
 	    link[0] = CISTPL_END;
 	} else {
+	    // begin TREX modification
+	    if ((attr == IS_ATTR) &&
+		(tuple->DesiredTuple != RETURN_FIRST_TUPLE))
+		i += skip_indexed_tuples(s, &ofs, tuple->DesiredTuple,
+					 MAX_TUPLES-1-i);
+	    // end TREX modification
 	    read_cis_cache(s, attr, ofs, 2, link);
 	    if (link[0] == CISTPL_NULL) {
 		ofs++; continue;
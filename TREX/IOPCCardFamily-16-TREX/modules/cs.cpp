@@ -141,6 +141,9 @@ INT_MODULE_PARM(reset_time,	10);		/* usecs */
 INT_MODULE_PARM(unreset_delay,	HZ/10);		/* ticks */
 INT_MODULE_PARM(unreset_check,	HZ/10);		/* ticks */
 INT_MODULE_PARM(unreset_limit,	50);		/* unreset_check's */
+// begin TREX modification
+INT_MODULE_PARM(vcc_settle_min,	HZ/20);		/* ticks, if RDY comes early */
+// end TREX modification
 
 /* Access speed for attribute memory windows */
 INT_MODULE_PARM(cis_speed,	300);		/* ns */
@@ -462,6 +465,10 @@ static void free_regions(memory_handle_t *list)
 	tmp = *list;
 	*list = tmp->info.next;
 	tmp->region_magic = 0;
+	// begin TREX modification
+	if (tmp->direct_win)
+	    release_direct_window(tmp);
+	// end TREX modification
 	kfree(tmp);
     }
 }
@@ -484,7 +491,9 @@ static void shutdown_socket(u_long i)
     init_socket(s);
     s->irq.AssignedIRQ = s->irq.Config = 0;
     s->lock_count = 0;
-    s->cis_used = 0;
+    // begin TREX modification
+    flush_cis_cache(s);
+    // end TREX modification
     if (s->fake_cis) {
 	kfree(s->fake_cis);
 	s->fake_cis = NULL;
@@ -498,6 +507,12 @@ static void shutdown_socket(u_long i)
 	kfree(s->config);
 	s->config = NULL;
     }
+    // begin TREX modification
+    /* Before the unbound clients go: the built-in MTD's windows
+       belong to them */
+    free_regions(&s->a_region);
+    free_regions(&s->c_region);
+    // end TREX modification
     for (c = &s->clients; *c; ) {
 	if ((*c)->state & CLIENT_UNBOUND) {
 	    client_t *d = *c;
@@ -507,8 +522,6 @@ static void shutdown_socket(u_long i)
 	    c = &((*c)->next);
 	}
     }
-    free_regions(&s->a_region);
-    free_regions(&s->c_region);
 } /* shutdown_socket */
 
 static void setup_socket(u_long i)
@@ -546,6 +559,10 @@ static void setup_socket(u_long i)
 #endif
 	}
 	s->ss_entry(s->sock, SS_SetSocket, &s->socket);
+	// begin TREX modification
+	s->bringup = BRINGUP_SETTLING;
+	s->bringup_stamp[BRINGUP_SETTLING] = IOPCCardUptime();
+	// end TREX modification
 	s->setup.function = &reset_socket;
 	mod_timer(&s->setup, jiffies + vcc_settle);
     } else
@@ -571,6 +588,10 @@ static void reset_socket(u_long i)
     udelay((long)reset_time);
     s->socket.flags &= ~SS_RESET;
     s->ss_entry(s->sock, SS_SetSocket, &s->socket);
+    // begin TREX modification
+    s->bringup = BRINGUP_RESETTING;
+    s->bringup_stamp[BRINGUP_RESETTING] = IOPCCardUptime();
+    // end TREX modification
     s->setup_timeout = 0;
     s->setup.function = &unreset_socket;
     mod_timer(&s->setup, jiffies + unreset_delay);
@@ -587,6 +608,18 @@ static void unreset_socket(u_long i)
     s->ss_entry(s->sock, SS_GetStatus, &val);
     if (val & SS_READY) {
 	DEBUG(1, "cs: reset done on socket %ld\n", i);
+	// begin TREX modification
+	s->bringup = BRINGUP_READY;
+	s->bringup_stamp[BRINGUP_READY] = IOPCCardUptime();
+	DEBUG(1, "cs: socket %ld bring-up: detect %lu us, settle %lu us,"
+	      " reset %lu us\n", i,
+	      (u_long)(s->bringup_stamp[BRINGUP_SETTLING] -
+		       s->bringup_stamp[BRINGUP_IDLE]),
+	      (u_long)(s->bringup_stamp[BRINGUP_RESETTING] -
+		       s->bringup_stamp[BRINGUP_SETTLING]),
+	      (u_long)(s->bringup_stamp[BRINGUP_READY] -
+		       s->bringup_stamp[BRINGUP_RESETTING]));
+	// end TREX modification
 	if (s->state & SOCKET_SUSPEND) {
 	    s->state &= ~EVENT_MASK;
 	    if (verify_cis_cache(s) != 0)
@@ -619,12 +652,61 @@ static void unreset_socket(u_long i)
 	    printk(KERN_NOTICE "cs: socket %ld timed out during"
 		   " reset\n", i);
 	    s->state &= ~EVENT_MASK;
+	    // begin TREX modification
+	    s->bringup = BRINGUP_IDLE;
+	    // end TREX modification
 	} else {
 	    mod_timer(&s->setup, jiffies + unreset_check);
 	}
     }
 } /* unreset_socket */
 
+// begin TREX modification
+/*======================================================================
+
+    The timers above are only upper bounds.  When the socket reports
+    a RDY/BSY change while we wait for the card, bringup_ready()
+    checks if the card is ready and if so fires the setup timer now,
+    so cards that are ready early do not pay the worst-case wait.
+    Vcc still gets at least vcc_settle_min.
+    
+======================================================================*/
+
+static u_long bringup_ticks(socket_info_t *s, int phase)
+{
+    return (u_long)((IOPCCardUptime() - s->bringup_stamp[phase]) *
+		    HZ / 1000000);
+}
+
+static void bringup_ready(socket_info_t *s)
+{
+    int val;
+    long elapsed, left = 0;
+
+    if ((s->bringup != BRINGUP_SETTLING) &&
+	(s->bringup != BRINGUP_RESETTING))
+	return;
+    s->ss_entry(s->sock, SS_GetStatus, &val);
+    if (!(val & SS_READY))
+	return;
+    if (s->bringup == BRINGUP_SETTLING) {
+	elapsed = bringup_ticks(s, BRINGUP_SETTLING);
+	left = vcc_settle_min - elapsed;
+	if (left < 0)
+	    left = 0;
+	if (left >= vcc_settle - elapsed)
+	    return;
+    }
+    /* Only if the timer was still pending, or the step would run twice */
+    if (del_timer(&s->setup)) {
+	DEBUG(1, "cs: socket %d ready early, %ld ticks left\n",
+	      s->sock, left);
+	s->setup.expires = jiffies + left;
+	add_timer(&s->setup);
+    }
+}
+// end TREX modification
+
 /*======================================================================
 
     The central event handler.  Send_event() sends an event to all
@@ -671,6 +753,9 @@ static void do_shutdown(socket_info_t *s)
 	DEBUG(0, "cs: flushing pending setup\n");
 	del_timer(&s->setup);
 	s->state &= ~EVENT_MASK;
+	// begin TREX modification
+	s->bringup = BRINGUP_IDLE;
+	// end TREX modification
     }
     mod_timer(&s->shutdown, jiffies + shutdown_delay);
     s->state &= ~SOCKET_PRESENT;
@@ -698,6 +783,10 @@ static void parse_events(void *info, u_int events)
 	    s->state |= SOCKET_SETUP_PENDING;
 	    s->setup.function = &setup_socket;
 	    s->setup_timeout = 0;
+	    // begin TREX modification
+	    s->bringup = BRINGUP_IDLE;
+	    s->bringup_stamp[BRINGUP_IDLE] = IOPCCardUptime();
+	    // end TREX modification
 	    if (s->state & SOCKET_SUSPEND)
 		s->setup.expires = jiffies + resume_delay;
 	    else
@@ -716,6 +805,9 @@ static void parse_events(void *info, u_int events)
 	if (!(s->state & SOCKET_RESET_PENDING))
 	    send_event(s, CS_EVENT_READY_CHANGE, CS_EVENT_PRI_LOW);
 	else DEBUG(1, "cs: ready change during reset\n");
+	// begin TREX modification
+	bringup_ready(s);
+	// end TREX modification
     }
 } /* parse_events */
 
@@ -1965,6 +2057,26 @@ static int cs_request_irq(client_handle_t handle, irq_req_t *req)
 
 ======================================================================*/
 
+// begin TREX modification
+/* The access speed the card's CIS gives for a memory space: the slowest
+   of the devices in its DEVICE (or DEVICE_A) tuple, or 0 if it doesn't
+   say.  Windows whose client doesn't ask for a speed get this one. */
+static u_int cis_device_speed(client_handle_t handle, int attr)
+{
+    cistpl_device_t device;
+    u_int i, speed = 0;
+
+    if (read_tuple(handle, (attr) ? CISTPL_DEVICE_A : CISTPL_DEVICE,
+		   &device) != CS_SUCCESS)
+	return 0;
+    for (i = 0; i < device.ndev; i++)
+	if ((device.dev[i].type != CISTPL_DTYPE_NULL) &&
+	    (device.dev[i].speed > speed))
+	    speed = device.dev[i].speed;
+    return speed;
+}
+// end TREX modification
+
 static int request_window(client_handle_t *handle, win_req_t *req)
 {
     socket_info_t *s;
@@ -2020,6 +2132,10 @@ static int request_window(client_handle_t *handle, win_req_t *req)
     win->ctl.map = w+1;
     win->ctl.flags = 0;
     win->ctl.speed = req->AccessSpeed;
+    // begin TREX modification
+    if (win->ctl.speed == 0)
+	win->ctl.speed = cis_device_speed(*handle, req->Attributes & WIN_MEMORY_TYPE);
+    // end TREX modification
     if (req->Attributes & WIN_MEMORY_TYPE)
 	win->ctl.flags |= MAP_ATTRIB;
     if (req->Attributes & WIN_ENABLE)
@@ -39,6 +39,10 @@ typedef struct erase_busy_t {
     client_handle_t	client;
     struct timer_list	timeout;
     struct erase_busy_t	*prev, *next;
+    // begin TREX modification
+    unsigned long long	started;	/* usecs, for the region's statistics */
+    struct eraseq_t	*queue;		/* to start what waits for its part */
+    // end TREX modification
 } erase_busy_t;
 
 #define ERASEQ_MAGIC	0xFA67
@@ -47,6 +51,11 @@ typedef struct eraseq_t {
     client_handle_t	handle;
     int			count;
     eraseq_entry_t	*entry;
+    // begin TREX modification
+    int			held;		/* entries waiting for their part */
+    u_char		starting;	/* in start_erases */
+    u_char		rescan;		/* an erase ended meanwhile */
+    // end TREX modification
 } eraseq_t;
 
 #define CLIENT_MAGIC 	0x51E6
@@ -115,6 +124,18 @@ typedef struct region_t {
     client_handle_t	mtd;
     u_int		MediaID;
     region_info_t	info;
+    // begin TREX modification
+    u_char		type;		/* CISTPL_DTYPE_*, for the built-in MTD */
+    u_short		opens;		/* OpenMemory calls using direct_win */
+    window_handle_t	direct_win;	/* the built-in MTD's window, or NULL */
+    client_handle_t	direct_owner;	/* who requested it */
+    u_char		*direct_virt;	/* and where it is mapped */
+    u_int		erase_pending;	/* erases started and not yet done */
+    u_int		erase_max_pending;
+    u_int		erase_count;	/* erases done */
+    u_int		erase_kbytes;	/* and how much they erased */
+    unsigned long long	erase_usecs;	/* and how long they took */
+    // end TREX modification
 } region_t;
 
 #define REGION_STALE	0x01
@@ -141,10 +162,36 @@ typedef struct config_t {
 /* Maximum number of memory windows per socket */
 #define MAX_WIN 4
 
+// begin TREX modifications
+/* Socket bring-up phases: what the setup timer is waiting for, and
+   the index of the time each phase started in bringup_stamp[] */
+#define BRINGUP_IDLE		0
+#define BRINGUP_SETTLING	1	/* power applied, Vcc settling */
+#define BRINGUP_RESETTING	2	/* reset released, card busy */
+#define BRINGUP_READY		3	/* card ready */
+#define BRINGUP_PHASES		4	/* BRINGUP_IDLE stamps the detect */
+// end TREX modifications
+
 /* The size of the CIS cache */
 #define MAX_CIS_TABLE	64
 #define MAX_CIS_DATA	512
 
+// begin TREX modifications
+/* The CIS image: the start of the common (0) and attribute (1) CIS
+   spaces, read in bursts of CIS_IMAGE_BURST bytes as far as needed but
+   never past the end of the chain that starts at 0, plus an index of
+   the tuples of the primary attribute chain */
+#define MAX_CIS_IMAGE	2048
+#define CIS_IMAGE_BURST	256
+#define MAX_CIS_INDEX	128
+
+typedef struct cis_index_t {
+    u_short			ofs;
+    u_char			code;
+    u_char			link;
+} cis_index_t;
+// end TREX modifications
+
 typedef struct socket_info_t {
 #ifdef USE_SPIN_LOCKS
     spinlock_t			lock;
@@ -161,6 +208,10 @@ typedef struct socket_info_t {
     client_handle_t		reset_handle;
     struct timer_list		setup, shutdown;
     u_long			setup_timeout;
+// begin TREX modifications
+    u_int			bringup;
+    unsigned long long		bringup_stamp[BRINGUP_PHASES];
+// end TREX modifications
     pccard_mem_map		cis_mem;
     u_char			*cis_virt;
     config_t			*config;
@@ -185,6 +236,15 @@ typedef struct socket_info_t {
 	u_short			attr;
     }				cis_table[MAX_CIS_TABLE];
     char			cis_cache[MAX_CIS_DATA];
+// begin TREX modifications
+    u_int			cis_image_len[2];
+    u_char			cis_image[2][MAX_CIS_IMAGE];
+    u_int			cis_chain_next[2];
+    u_int			cis_chain_end[2];
+    int				cis_nindex;
+    cis_index_t			cis_index[MAX_CIS_INDEX];
+    u_int			cis_digest;
+// end TREX modifications
     u_int			fake_cis_len;
     char			*fake_cis;
 #ifdef HAS_PROC_BUS
@@ -244,6 +304,7 @@ void write_cis_mem(socket_info_t *s, int attr,
 		   u_int addr, u_int len, void *ptr);
 void release_cis_mem(socket_info_t *s);
 int verify_cis_cache(socket_info_t *s);
+void flush_cis_cache(socket_info_t *s);
 void preload_cis_cache(socket_info_t *s);
 int get_first_tuple(client_handle_t handle, tuple_t *tuple);
 int get_next_tuple(client_handle_t handle, tuple_t *tuple);
@@ -255,6 +316,9 @@ int read_tuple(client_handle_t handle, cisdata_t code, void *parse);
 
 /* In bulkmem.c */
 void retry_erase_list(struct erase_busy_t *list, u_int cause);
+// begin TREX modification
+void release_direct_window(memory_handle_t r);
+// end TREX modification
 int get_first_region(client_handle_t handle, region_info_t *rgn);
 int get_next_region(client_handle_t handle, region_info_t *rgn);
 int register_mtd(client_handle_t handle, mtd_reg_t *reg);
@@ -111,6 +111,7 @@ struct timer_list {
 
 extern void IOPCCardAddTimer(struct timer_list * timer);
 extern int IOPCCardDeleteTimer(struct timer_list * timer);
+extern unsigned long long IOPCCardUptime(void);	// in usecs
 
 #define jiffies (0)	// just cheat on the whole jiffies thing :-)
 
@@ -144,10 +145,15 @@ extern u_long IOPCCardReadLong(void *virt);
 extern void IOPCCardWriteByte(void *virt, u_char value);
 extern void IOPCCardWriteLong(void *virt, u_int value);
 
+extern void IOPCCardCopyFromIO(void *dst, void *virt, u_int count);
+extern void IOPCCardCopyToIO(void *virt, void *src, u_int count);
+
 #define readb(a)		IOPCCardReadByte(a)
 #define readl(a)		IOPCCardReadLong(a)
 #define writeb(v, a)		IOPCCardWriteByte(a, v)
 #define writel(v, a)		IOPCCardWriteLong(a, v)
+#define memcpy_fromio(d, s, n)	IOPCCardCopyFromIO(d, s, n)
+#define memcpy_toio(d, s, n)	IOPCCardCopyToIO(d, s, n)
 
 extern void *IOPCCardIORemap(u_long paddr, u_long size);
 extern void IOPCCardIOUnmap(void *vaddr);
@@ -182,6 +188,12 @@ extern int IOPCCardAddCSCInterruptHandlers(IOPCCardBridge *bus, unsigned int soc
 					   const char* name);
 extern int IOPCCardRemoveCSCInterruptHandlers(IOPCCardBridge *bus, unsigned int socket);
 
+extern void IOPCCardSetEraseStatistics(IOPCCardBridge *bus, unsigned int socket,
+				       int attr, unsigned int offset,
+				       unsigned int erases, unsigned int kbytes,
+				       unsigned long long usecs,
+				       unsigned int pending, unsigned int max_pending);
+
 // MACOSXXX - i82365.c and cardbus.c currently use these differently :-)
 // the #defines are in those files for now
 extern int IOPCCardReadConfigByte(IOPCIDevice *bus, int r, u_char *v);
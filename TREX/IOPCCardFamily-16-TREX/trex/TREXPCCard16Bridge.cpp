@@ -1,4 +1,5 @@
 #include <IOKit/pccard/IOPCCard.h>
+#include "TREXRegisters.h"
 #include "trexss.h"
 
 //#define VerboseIOLog(x...) IOLog(x)
@@ -130,10 +131,18 @@ bool TREXPCCard16Bridge::initializeSocketServices(void)
 {
     IOPCIDevice *nub = OSDynamicCast(IOPCIDevice, getProvider());
     IODeviceMemory *winMem;
+    TREXSocketEvents *events = NULL;
     
     if (!nub)
         return false;
     
+    // The events TREXInterruptController takes off our socket
+    if (nub->callPlatformFunction(kTREXGetSocketEvents, false, (void *) nub->space.s.functionNum,
+                                  (void *) &events, 0, 0) != kIOReturnSuccess) {
+        VerboseIOLog("TREX: could not get the socket events\n");
+        return false;
+    }
+    
     socketRegsMap = nub->mapDeviceMemoryWithRegister(trexRegsBaseReg);
     if (!socketRegsMap)
         return false;
@@ -142,7 +151,7 @@ bool TREXPCCard16Bridge::initializeSocketServices(void)
     if (!winMem)
         return false;
     
-    return 0 == init_trex(this, nub, (void *) socketRegsMap->getVirtualAddress(), (void *) winMem->getPhysicalAddress());
+    return 0 == init_trex(this, nub, (void *) socketRegsMap->getVirtualAddress(), (void *) winMem->getPhysicalAddress(), events);
 }
 
 void
@@ -160,7 +169,9 @@ TREXPCCard16Bridge::free(void)
     super::free();
 }
 
-// This replaces super's implementation completely
+// This replaces super's implementation completely. The card's IRQ is this
+//  socket's IRQ vector in TREXInterruptController, which only calls it when
+//  this socket latched mIRQ.
 #if 1
 void
 TREXPCCard16Bridge::addNubInterruptProperties(OSDictionary * propTable)
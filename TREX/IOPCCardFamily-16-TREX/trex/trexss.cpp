@@ -7,6 +7,8 @@
 #include <IOKit/pccard/ss.h>
 #include <IOKit/pccard/cs.h>
 
+#include <libkern/OSAtomic.h>
+
 #include "TREXRegisters.h"
 #include "trexss.h"
 
@@ -45,6 +47,8 @@ typedef struct {
     volatile u_char *regs;
     u_char flags;
     u_char new_events;
+    u_char mem_cycles;		// what rMemTiming is set to now
+    u_char map_cycles[5];	// what each memory map needs, 0 if inactive
     socket_cap_t cap;
     void		(*handler)(void *info, u_int events);
     void		*info;
@@ -52,6 +56,7 @@ typedef struct {
     pccard_io_map imap[2];
     void *mem_win_base;
     void *io_win_base;
+    TREXSocketEvents *events;	// latched by the TREX interrupt controller
 } TREXSocket;
 
 // Values for TREXSocket.flags
@@ -107,12 +112,20 @@ static subfn_t trex_service_table[] = {
 
 inline u_char trex_get(TREXSocket *s, int which)
 {
+#ifdef TREX_REG_MODEL
+    return TREXModelRead(s->regs + which);
+#else
     return (s->regs)[which];
+#endif
 }
 
 inline void trex_set(TREXSocket *s, int which, u_char val)
 {
+#ifdef TREX_REG_MODEL
+    TREXModelWrite(s->regs + which, val);
+#else
     (s->regs)[which] = val;
+#endif
 }
 
 void trex_dump_regs(TREXSocket *s)
@@ -175,16 +188,13 @@ trex_interrupt_bottom(u_int socket_index)
     
     skt = &trex_socket[socket_index];
     
-    // Is this socket interrupting?
-    if (!(trex_get(skt, rIntFlag) & mIntFlag))
+    // The interrupt controller has already read and cleared them in the
+    //  chip, so this is the only place they are: taken in one atomic step,
+    //  as it may add more at interrupt time
+    chgd = OSBitAndAtomic8(0, (UInt8 *) &skt->events->cscEvents);
+    if (!chgd)
         return 0;
     
-    // Read and clear enabled interrupts
-    chgd = trex_get(skt, rEvents) & trex_get(skt, rIntEnable);
-    OSSynchronizeIO();
-    trex_set(skt, rEvents, ~chgd);
-    OSSynchronizeIO();
-    
     if (skt->flags & IS_IO_INTF)
         chgd &= ~mIRQ;		// mIRQ is the same as mRDYBSY -- we don't want to send false
                                 //  RDYBSY events to trex_interrupt_top
@@ -551,7 +561,7 @@ static int trex_set_io_map(TREXSocket *s, struct pccard_io_map *io)
     cycles = 1 + (((slowest + trex_cycle_time - 1) / trex_cycle_time) >> 1);
 
     if (cycles > (mIOSpeedMask + 1)) {
-        s->imap[map].flags = 0;
+        s->imap[io->map].flags = 0;
         DEBUG(1, "trex_set_io_map: speed too slow\n");
         return -EINVAL;
     }
@@ -577,9 +587,21 @@ static int trex_get_mem_map(TREXSocket *s, struct pccard_mem_map *mem)
 }
 
 
+// Writes rMemTiming only when it changes; HostTests/TREX/TREXBench.cpp
+//  measures what the windows get out of it
+static void trex_set_mem_timing(TREXSocket *s, u_char cycles)
+{
+    if (cycles == s->mem_cycles)
+        return;
+    
+    trex_set(s, rMemTiming, mMemTimingHighBits | cycles);
+    OSSynchronizeIO();
+    s->mem_cycles = cycles;
+}
+
 static int trex_set_mem_map(TREXSocket *s, struct pccard_mem_map *mem)
 {
-    u_int len;
+    u_int len, map, cycles;
     u_char this_map = mem->map;
     u_char cfg0;
     
@@ -612,34 +634,46 @@ static int trex_set_mem_map(TREXSocket *s, struct pccard_mem_map *mem)
 //        IOLog("trex_set_mem_map: card_start = %x, sys_start = %x\n", mem->card_start, mem->sys_start);
     }
     
-    trex_set(s, rCfg0, cfg0);
-    OSSynchronizeIO();
-    
-    // Recompute socket-global memory timing
-    u_int map, slowest, cycles;
-
-    s->mmap[this_map] = *mem;
-    
-    // Include map 0 in timing only if reading attribute mem
-    map = !(cfg0 & mAttr);
-    slowest = min_mem_timing;
-    for (; map < 5; map++) {
-        if (s->mmap[map].flags & MAP_ACTIVE) {
-            slowest = max(slowest, s->mmap[map].speed);
+    if ((s_char) this_map != -1) {
+        // Each map remembers the timing its speed needs, so a change to one
+        //  of them doesn't have to convert all the others again
+        cycles = 0;
+        if (mem->flags & MAP_ACTIVE) {
+            cycles = (max(mem->speed, min_mem_timing) + trex_cycle_time - 1) / trex_cycle_time;
+            if (cycles == 0)
+                cycles = 1;
+            if (cycles > (mMemSpeedMask + 1)) {
+                DEBUG(1, "trex_set_mem_map: speed too slow\n");
+                return -EINVAL;
+            }
         }
+        s->mmap[this_map] = *mem;
+        s->map_cycles[this_map] = cycles;
     }
-    
-    cycles = (slowest + trex_cycle_time - 1) / trex_cycle_time;
+
+    // TREX has one memory timing per socket. Map 0 is the CIS window: its
+    //  (slow) timing is only used while attribute memory is on, which is
+    //  while read_cis_mem/write_cis_mem run. The other maps are the
+    //  clients' common memory windows and get the slowest of their own
+    //  timings, so the CIS speed doesn't stay with them after the CIS
+    //  has been read.
+    if (cfg0 & mAttr)
+        cycles = s->map_cycles[0];
+    else
+        for (cycles = 0, map = 1; map < 5; map++)
+            cycles = max(cycles, s->map_cycles[map]);
     if (cycles == 0)
         cycles = 1;
-    if (cycles > (mMemSpeedMask + 1)) {
-        s->mmap[map].flags = 0;
-        DEBUG(1, "trex_set_mem_map: speed too slow\n");
-        return -EINVAL;
-    }
-
     cycles &= mMemSpeedMask;
-    trex_set(s, rMemTiming, mMemTimingHighBits | cycles);
+
+    // Slow down before attribute memory is on, speed up after it is off
+    if (cfg0 & mAttr)
+        trex_set_mem_timing(s, cycles);
+    
+    trex_set(s, rCfg0, cfg0);
+    OSSynchronizeIO();
+    
+    trex_set_mem_timing(s, cycles);
             
     return 0;
 }
@@ -693,7 +727,7 @@ int trex_get_ranges(unsigned int socket_number, unsigned long *range_list, unsig
     return 0;
 }
 
-static void trex_add_socket(IOPCCardBridge *pccard_nub, IOPCIDevice *bridge_nub, volatile u_char *regs, void *mem_base, void *io_base)
+static void trex_add_socket(IOPCCardBridge *pccard_nub, IOPCIDevice *bridge_nub, volatile u_char *regs, void *mem_base, void *io_base, TREXSocketEvents *events)
 {
     TREXSocket *s;
     
@@ -711,6 +745,7 @@ static void trex_add_socket(IOPCCardBridge *pccard_nub, IOPCIDevice *bridge_nub,
     s->flags = CAN_MOVE_MEM_WINDOWS;
     s->mem_win_base = mem_base;
     s->io_win_base = io_base;
+    s->events = events;
     
     trex_set(s, rReset, 0);
     IOSleep(1);
@@ -720,11 +755,13 @@ static void trex_add_socket(IOPCCardBridge *pccard_nub, IOPCIDevice *bridge_nub,
     
     // Default timings for memory and I/O accesses
     trex_set(s, rMemTiming, mMemTimingHighBits | 0x08);
+    s->mem_cycles = 0x08;
+    bzero(s->map_cycles, sizeof(s->map_cycles));
     trex_set(s, rIOTiming, mIOTimingHighBits | 0x05);
 }
 
 int
-init_trex(IOPCCardBridge *pccard_nub, IOPCIDevice *bridge_nub, void *device_regs, void *socket_windows)
+init_trex(IOPCCardBridge *pccard_nub, IOPCIDevice *bridge_nub, void *device_regs, void *socket_windows, TREXSocketEvents *events)
 {
     TREXSocket *s;
     unsigned int starting_socket = trex_sockets;
@@ -745,7 +782,12 @@ init_trex(IOPCCardBridge *pccard_nub, IOPCIDevice *bridge_nub, void *device_regs
     if ((starting_socket + 1) > max_sockets)
         return eTREXNoMoreSockets;
     
-    trex_add_socket(pccard_nub, bridge_nub, (volatile u_char *) device_regs, socket_windows, (u_char *) socket_windows + woIOWin);
+    // The interrupt controller clears the events in the chip before
+    //  trex_interrupt_bottom runs, so without its copy we would lose them
+    if (!events)
+        return eTREXNoSocketEvents;
+    
+    trex_add_socket(pccard_nub, bridge_nub, (volatile u_char *) device_regs, socket_windows, (u_char *) socket_windows + woIOWin, events);
 //    trex_add_socket(pccard_nub, bridge_nub, ((volatile u_char *) device_regs) + sockOffStep, ((u_char *) socket_windows) + woSocket1, ((u_char *) socket_windows) + woSocket1 + woIOWin);
     
     /* Set up interrupt handlers */
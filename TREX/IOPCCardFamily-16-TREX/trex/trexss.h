@@ -9,10 +9,11 @@ extern "C" {
 // Return types from init_trex
 enum {
     eTREXNoMoreSockets = -1,		// No more sockets in socket table
-    eTREXRegisterFailed = -2		// Registration of SS entry points failed
+    eTREXRegisterFailed = -2,		// Registration of SS entry points failed
+    eTREXNoSocketEvents = -3		// No events from the interrupt controller
 };
 
-int init_trex(IOPCCardBridge *pccard_nub, IOPCIDevice *bridge_nub, void *device_regs, void *socket_windows);
+int init_trex(IOPCCardBridge *pccard_nub, IOPCIDevice *bridge_nub, void *device_regs, void *socket_windows, TREXSocketEvents *events);
 int trex_get_ranges(unsigned int socket, unsigned long *range_list, unsigned int *num_ranges);
 
 }
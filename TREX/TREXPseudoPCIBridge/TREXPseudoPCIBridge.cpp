@@ -3,6 +3,7 @@
 #include <IOKit/IODeviceTreeSupport.h>
 #include <IOKit/IOPlatformExpert.h>
 #include <libkern/OSByteOrder.h>
+#include <libkern/OSAtomic.h>
 #include <ppc/proc_reg.h>
 #include <ppc/machine_routines.h>
 
@@ -65,6 +66,7 @@ bool TREXPseudoPCIBridge::start( IOService * provider )
     IOPhysicalAddress trexRegs;
     char uniqueName[50];
     IOInterruptAction intHandler;
+    OSSerializer *stats;
     unsigned int socket;
     unsigned int i;
     unsigned long nubReg[5 * 3] =
@@ -126,6 +128,14 @@ bool TREXPseudoPCIBridge::start( IOService * provider )
     
     getPlatform()->registerInterruptController(icName, trexIC);
     
+    // The card IRQs are dispatched here, not by IOPCCardBridge's controller,
+    //  so this is where to see how they are dispatched
+    stats = OSSerializer::forTarget((void *) trexIC, &TREXInterruptController::serializeStatistics);
+    if (stats) {
+        setProperty("InterruptStatistics", stats);
+        stats->release();
+    }
+    
     provider->enableInterrupt(0);    // Always good to do this
 #endif
 
@@ -312,6 +322,26 @@ void TREXPseudoPCIBridge::free(void)
 }
 
 
+// Socket services asks here for the events our interrupt controller
+//  takes off its socket, so it does not have to read them again.
+IOReturn TREXPseudoPCIBridge::callPlatformFunction( const OSSymbol *functionName,
+                                                    bool waitForFunction,
+                                                    void *param1, void *param2,
+                                                    void *param3, void *param4 )
+{
+    if (functionName->isEqualTo(kTREXGetSocketEvents)) {
+        unsigned long socket = (unsigned long) param1;
+        
+        if (!trexIC || (socket >= kNumSockets) || !param2)
+            return kIOReturnBadArgument;
+        
+        *((TREXSocketEvents **) param2) = trexIC->getSocketEvents(socket);
+        return kIOReturnSuccess;
+    }
+    
+    return super::callPlatformFunction(functionName, waitForFunction, param1, param2, param3, param4);
+}
+
 bool TREXPseudoPCIBridge::configure( IOService * provider )
 {
     bool ok;
@@ -555,6 +585,10 @@ TREXInterruptController::initInterruptController(IOService *provider, IOPhysical
     trexRegs = (volatile UInt8 *) trexRegMap->getVirtualAddress();
     
     registeredEvents = 0;
+    pendingEvents = 0;
+    bzero(socketEvents, sizeof(socketEvents));
+    bzero(vectorCalls, sizeof(vectorCalls));
+    spuriousInterrupts = 0;
   
     // Allocate the memory for the vectors
     vectors = (IOInterruptVector *)IOMalloc(kNumVectors * sizeof(IOInterruptVector));
@@ -610,62 +644,72 @@ TREXInterruptController::handleInterrupt(void */*refCon*/,
 					     IOService */*nub*/,
 					     int /*source*/)
 {
-    unsigned long i, j, vnum;
+    unsigned long i, j, vnum, outEvents;
     IOInterruptVector *vector;
     volatile UInt8 *regs;
-    UInt8 maskedEvents, events, outEvents, cfg0;
-    bool wasAttr[kNumSockets];
-    
-    wasAttr[0] = false;
-    wasAttr[1] = false;
+    UInt8 maskedEvents, cfg0;
+    bool wasAttr, any = false;
         
+    // A socket's IRQ vector is only called when that socket latched mIRQ,
+    //  so a card driver never sees the other socket's interrupts.
     for (i = 0; i < kNumSockets; i++) {        
         regs = getSocketRegs(i);
 
-        // Quit if we don't have any interrupt sources
-        if (!((regs[rIntFlag] & mIntFlag) || outEvents))
-            continue;
+        // Vectors asked for with causeVector()
+        outEvents = (pendingEvents >> (2 * i)) & 3;
+        pendingEvents &= ~(3 << (2 * i));
 
-        // Disable attribute memory if it is enabled. Probably unnecessary
-        //  since we only care about this for I/O IRQs, and they won't occur
-        //  under the memory-only interface.
+        // Each socket's registers are read once per interrupt. Everything
+        //  enabled is cleared in one write; the status changes wait in
+        //  socketEvents for trex_interrupt_bottom (in Socket Services,
+        //  trexss.c) instead of being read from the chip a second time.
+        if (trexRead(regs, rIntFlag) & mIntFlag) {
+            OSSynchronizeIO();
 
-        cfg0 = regs[rCfg0];
-        OSSynchronizeIO();
-        
-        if (cfg0 & mAttr) {
-            wasAttr[i] = true;
-            
-            regs[rCfg0] = cfg0 & ~mAttr;
+            cfg0 = trexRead(regs, rCfg0);
             OSSynchronizeIO();
-        }
-        
-        while (true) {
-            events = regs[rEvents];
+            
+            // Disable attribute memory if it is enabled. We only care about
+            //  this for I/O IRQs, and they won't occur under the memory-only
+            //  interface, so leave it alone there.
+            wasAttr = (cfg0 & mSetForIO) && (cfg0 & mAttr);
+            if (wasAttr) {
+                trexWrite(regs, rCfg0, cfg0 & ~mAttr);
+                OSSynchronizeIO();
+            }
+            
+            maskedEvents = trexRead(regs, rEvents);
             OSSynchronizeIO();
-            maskedEvents = events & regs[rIntEnable];
+            maskedEvents &= trexRead(regs, rIntEnable);
             OSSynchronizeIO();
             
-            // debug
-//            regs[rEvents] = ~maskedEvents;
-
-            // Check for IRQ and clear its interrupt flag
+            if (maskedEvents) {
+                trexWrite(regs, rEvents, ~maskedEvents);
+                OSSynchronizeIO();
+            }
+            
+            if (wasAttr) {
+                trexWrite(regs, rCfg0, cfg0);
+                OSSynchronizeIO();
+            }
+            
+            // Check for IRQ
             if ((cfg0 & mSetForIO) && (maskedEvents & mIRQ)) {
                 outEvents |= 2;
-                
-                regs[rEvents] = ~mIRQ;
-                OSSynchronizeIO();
 
                 maskedEvents &= ~mIRQ;
             }
                         
             // All other interrupts are status change (CSC) and are routed to TREXPCCard16Bridge
-            // Don't clear status change interrupts -- leave them for trex_interrupt_bottom 
-            //  (in Socket Services, trexss.c)
-            if (maskedEvents)
+            if (maskedEvents) {
+                OSBitOrAtomic8(maskedEvents, (UInt8 *) &socketEvents[i].cscEvents);
                 outEvents |= 1;
+            }
         }
 
+        if (outEvents)
+            any = true;
+
         // Call the appropriate vectors
         for (j = 0; j < 2; j++) {
             if (outEvents & (1 << j)) {
@@ -682,6 +726,7 @@ TREXInterruptController::handleInterrupt(void */*refCon*/,
         #endif
                     // Call the handler if it exists.
                     if (vector->interruptRegistered) {
+                        vectorCalls[vnum]++;
                         vector->handler(vector->target, vector->refCon,
                                         vector->nub, vector->source);
                     } else
@@ -689,7 +734,7 @@ TREXInterruptController::handleInterrupt(void */*refCon*/,
                 } else {
                     // Hard disable the source.
                     vector->interruptDisabledHard = 1;
-                    disableVectorHard(i, vector);
+                    disableVectorHard(vnum, vector);
                 }
             
                 vector->interruptActive = 0;
@@ -697,24 +742,51 @@ TREXInterruptController::handleInterrupt(void */*refCon*/,
         }
     }
     
-#if TREX_IC_LOOP_UNTIL_NO_INTS
-    } while (gotInts);
-#endif
-
-    // Restore attribute memory on any sockets where it was disabled.
-    for (i = 0; i < kNumSockets; i++)
-        if (wasAttr[i]) {
-            regs = getSocketRegs(i);
-            
-            cfg0 = regs[rCfg0];
-            OSSynchronizeIO();
-            regs[rCfg0] = cfg0 | mAttr;
-            OSSynchronizeIO();
-        }
+    if (!any)
+        spuriousInterrupts++;
     
     return kIOReturnSuccess;
 }
 
+// Publishes the vector call counts and the interrupts no socket asked for
+bool
+TREXInterruptController::serializeStatistics(void *target, void */*ref*/, OSSerialize *s)
+{
+    TREXInterruptController *ic = OSDynamicCast(TREXInterruptController, (OSObject *) target);
+    OSDictionary *dict;
+    OSNumber *num;
+    char key[16];
+    unsigned long i;
+    bool ok;
+    
+    if (!ic)
+        return false;
+    
+    dict = OSDictionary::withCapacity(kNumVectors + 1);
+    if (!dict)
+        return false;
+    
+    num = OSNumber::withNumber(ic->spuriousInterrupts, 32);
+    if (num) {
+        dict->setObject("SpuriousInterrupts", num);
+        num->release();
+    }
+    
+    // Even vectors are a socket's status changes, odd ones its card IRQ
+    for (i = 0; i < kNumVectors; i++) {
+        num = OSNumber::withNumber(ic->vectorCalls[i], 32);
+        if (!num)
+            continue;
+        sprintf(key, "Socket%ld%s", i >> 1, (i & 1) ? "IRQ" : "CSC");
+        dict->setObject(key, num);
+        num->release();
+    }
+    
+    ok = dict->serialize(s);
+    dict->release();
+    return ok;
+}
+
 
 void
 TREXInterruptController::initVector(long vectorNumber, IOInterruptVector *vector)
@@ -741,7 +813,7 @@ TREXInterruptController::disableVectorHard(long vectorNumber, IOInterruptVector
     boolean_t state;
     
     x = mInsert;
-    if (regs[rCfg0] & mSetForIO)
+    if (trexRead(regs, rCfg0) & mSetForIO)
         x |= mIRQ;
     
     if (vectorNumber & 1)
@@ -751,7 +823,7 @@ TREXInterruptController::disableVectorHard(long vectorNumber, IOInterruptVector
     // Our usual problem: no way to disable the TREX interrupt itself, so we resort
     //  to disabling all interrupts.
     state = ml_set_interrupts_enabled(false);
-    regs[rIntEnable] &= x;
+    trexWrite(regs, rIntEnable, trexRead(regs, rIntEnable) & x);
     ml_set_interrupts_enabled(state);
 }
 
@@ -766,11 +838,11 @@ TREXInterruptController::enableVector(long vectorNumber, IOInterruptVector */*ve
     // Again, we mirror whether the IRQ is enabled in the mInsert bit.
     if (vectorNumber & 1) {
         x = mInsert;
-        if (regs[rCfg0] & mSetForIO)
+        if (trexRead(regs, rCfg0) & mSetForIO)
             x |= mIRQ;
         
         state = ml_set_interrupts_enabled(false);
-        regs[rIntEnable] |= x;
+        trexWrite(regs, rIntEnable, trexRead(regs, rIntEnable) | x);
         ml_set_interrupts_enabled(state);
     }
 }
@@ -26,8 +26,13 @@ public:
     virtual bool configure( IOService * provider );
     virtual void free(void);
     
+    virtual IOReturn callPlatformFunction( const OSSymbol *functionName,
+                                           bool waitForFunction,
+                                           void *param1, void *param2,
+                                           void *param3, void *param4 );
+
     virtual IODeviceMemory *ioDeviceMemory( void );
-    IOReturn TREXPseudoPCIBridge::getNubResources(IOService *service);
+    IOReturn getNubResources(IOService *service);
 
     virtual UInt32 configRead32( IOPCIAddressSpace space, UInt8 offset );
     virtual void configWrite32( IOPCIAddressSpace space,
@@ -57,16 +62,44 @@ protected:
     unsigned long		registeredEvents;
     unsigned long		pendingEvents;
 
+    TREXSocketEvents		socketEvents[kNumSockets];
+
+    // calls to each vector, and interrupts no socket asked for
+    UInt32			vectorCalls[2 * kNumSockets];
+    UInt32			spuriousInterrupts;
+
     struct ExpansionData 	{ };
     ExpansionData *		reserved;
 
     inline volatile UInt8 *	getSocketRegs(unsigned long skt);
 
+    inline UInt8 trexRead(volatile UInt8 *regs, int which)
+    {
+#ifdef TREX_REG_MODEL
+        return TREXModelRead(regs + which);
+#else
+        return regs[which];
+#endif
+    }
+
+    inline void trexWrite(volatile UInt8 *regs, int which, UInt8 value)
+    {
+#ifdef TREX_REG_MODEL
+        TREXModelWrite(regs + which, value);
+#else
+        regs[which] = value;
+#endif
+    }
+
 public:
 
     IOReturn		initInterruptController(IOService *provider, IOPhysicalAddress base);
     void free(void);
   
+    TREXSocketEvents *	getSocketEvents(unsigned long skt) { return &socketEvents[skt]; }
+
+    static bool		serializeStatistics(void *target, void *ref, OSSerialize *s);
+
     IOInterruptAction	getInterruptHandlerAddress(void);
     IOReturn		handleInterrupt(void * refCon, IOService * nub, int source);
   
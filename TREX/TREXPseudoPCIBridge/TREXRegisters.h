@@ -65,6 +65,28 @@
 #define mAllIntsExceptIOIRQ (mAllInts & ~mIRQ)
 #define ioStatusChgMask (mSTSCHG | mAccessErr)
 
+/* Events the interrupt controller has already read and cleared in rEvents,
+		waiting for socket services. It reads each socket once per interrupt,
+		so they can not be read from the chip again: TREXPCCard16Bridge gets
+		a pointer to its socket's entry from TREXPseudoPCIBridge with
+		callPlatformFunction(kTREXGetSocketEvents, false, (void *) socket,
+		(void *) &entryPointer, 0, 0), and socket services needs it. */
+#define kTREXGetSocketEvents "TREXGetSocketEvents"
+
+typedef struct {
+    volatile UInt8 cscEvents;	/* status changes, for trex_interrupt_bottom */
+} TREXSocketEvents;
+
+/* If TREX_REG_MODEL is defined the registers are not touched directly:
+		every access goes to these functions, that a model of the chip
+		has to provide. HostTests/TREX has one. */
+#ifdef TREX_REG_MODEL
+extern "C" {
+UInt8 TREXModelRead(volatile UInt8 *reg);
+void TREXModelWrite(volatile UInt8 *reg, UInt8 value);
+}
+#endif
+
 // rInputs (0x5) defines
 
 /* 0x80 to 0x10 as in rIntEnable and rEvents.  */
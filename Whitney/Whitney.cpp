@@ -60,6 +60,11 @@ enum {
 #define kVectorBaboon 27
 #define kVectorExpansionCard 29
 
+// The ICR levels have no enable in the hardware, only icr_ien, which
+//  readLevelSources applies after the ICR has interrupted; masking one
+//  does not keep its source from interrupting
+#define kICRVectorMask	0x000000FF
+
 
 // Many interrupts are level-triggered, but the ICR interrupts may be edge-triggered
 //  (perhaps the 'mode bit' determines edge/level-triggered behavior for these??)
@@ -71,20 +76,27 @@ enum {
 			(1 << kVectorPCMCIA))
 			// also kVectorDisplay (ECSC)
 
+// Default dispatch priorities, highest first when several sources are
+//  pending at once.  The SCC has a 3 byte FIFO and the PMU shift register
+//  must be answered quickly, so they go ahead of disk and PC Card.
+//  Can be overridden by an "interrupt-priorities" property (one byte per
+//  vector) in the device tree or the driver's personality.
+static const UInt8 defaultPriorities[kNumVectors] = {
+	0, 0, 0, 3, 6, 3, 3, 7,		// ICR: -, VIA1, VIA2, 3, SCC, 5, 6, NMI
+	1, 3, 6, 3, 5, 5, 5, 3,		// VIA1: 1 sec, tick, PMU SR, 3, PMU, timer 2, timer 1, 7
+	4, 0, 3, 4, 4, 4, 3, 3,		// VIA2: SCSI DRQ, slot, 2, SCSI, sound, floppy, 6, 7
+	2, 2, 2, 3, 2, 2, 2, 2		// slot: PC Card, display, 2, Baboon, 4, expansion, 6, 7
+};
+
 #define super IOService
 
 OSDefineMetaClassAndStructors(Whitney, IOService);
 
-#if LOG_INT_COUNTS
-UInt8 whitney_ps_icr;
-UInt16 whitney_ps_xc;
-#endif
-
 bool Whitney::start(IOService *provider)
 {
 	IOInterruptAction handler;
 	IOReturn error;
-	M2InterruptController *interruptController;
+	OSSerializer *statistics;
 
 	Verbose_IOLog("entering Whitney::start()\n");
 	
@@ -108,6 +120,20 @@ bool Whitney::start(IOService *provider)
 	if (error != kIOReturnSuccess)
 		return false;
 	
+	// optional dispatch policy overrides
+	interruptController->setVectorPriorities(OSDynamicCast(OSData, provider->getProperty("interrupt-priorities")));
+	interruptController->setVectorPriorities(OSDynamicCast(OSData, getProperty("interrupt-priorities")));
+	if (OSNumber *budget = OSDynamicCast(OSNumber, getProperty("interrupt-dispatch-budget")))
+		interruptController->setDispatchBudget(budget->unsigned32BitValue());
+	if (OSNumber *level = OSDynamicCast(OSNumber, getProperty("InterruptStatisticsLevel")))
+		interruptController->setStatisticsLevel(level->unsigned32BitValue());
+
+	statistics = OSSerializer::forTarget((void *) interruptController, &M2InterruptController::serializeStatistics);
+	if (statistics) {
+		setProperty("InterruptStatistics", statistics);
+		statistics->release();
+	}
+
 	// set up M2InterruptController to handle interrupts
 	handler = interruptController->getInterruptHandlerAddress();
 	provider->registerInterrupt(0, interruptController, handler, 0);
@@ -197,6 +223,45 @@ bool Whitney::compareNubName(const IOService *nub, OSString *name, OSString **ma
     return(IODTCompareNubName(nub, name, matched) || nub->IORegistryEntry::compareName(name, matched));
 }
 
+// "InterruptStatisticsLevel" switches statistics collection at run time
+IOReturn Whitney::setProperties(OSObject *properties)
+{
+	OSDictionary *dict = OSDynamicCast(OSDictionary, properties);
+	OSNumber *level;
+
+	if (!dict || !interruptController)
+		return kIOReturnBadArgument;
+
+	if ((level = OSDynamicCast(OSNumber, dict->getObject("InterruptStatisticsLevel")))) {
+		interruptController->setStatisticsLevel(level->unsigned32BitValue());
+		setProperty("InterruptStatisticsLevel", level);
+		return kIOReturnSuccess;
+	}
+
+	return kIOReturnUnsupported;
+}
+
+IOReturn Whitney::callPlatformFunction(const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	if (functionName->isEqualTo(kWhitneyUpdateVIA1Enables)) {
+		if (!interruptController
+		 || !interruptController->updateVIA1Enables((UInt8) (unsigned long) param1, (UInt8) (unsigned long) param2))
+			return kIOReturnNotReady;
+
+		return kIOReturnSuccess;
+	}
+
+	if (functionName->isEqualTo(kWhitneyRestoreEnables)) {
+		if (!interruptController || !interruptController->restoreEnables())
+			return kIOReturnNotReady;
+
+		return kIOReturnSuccess;
+	}
+
+	return super::callPlatformFunction(functionName, waitForFunction, param1, param2, param3, param4);
+}
+
 IOReturn Whitney::getNubResources(IOService *nub)
 {
     if (nub->getDeviceMemory())
@@ -270,27 +335,86 @@ IOReturn WhitneyDevice::getResources(void)
 
 OSDefineMetaClassAndStructors(M2InterruptController, IOInterruptController);
 
-#if 1
-inline void M2InterruptController::set_via1_ier_from_cache(void)
+// A VIA IER write with bit 7 set enables the bits given and with bit 7
+//  clear disables them, leaving the others alone.  Call with interrupts off.
+inline void M2InterruptController::update_ier(volatile UInt8 *ier, UInt8 *cache, UInt8 setBits, UInt8 clearBits)
 {
-        *via1_ier = 0x7F;
-        OSSynchronizeIO();
-        *via1_ier = 0x80 | cached_via1_ier;
-        OSSynchronizeIO();
+	clearBits &= *cache & ~setBits;
+	setBits &= ~*cache & 0x7F;
+
+	if (clearBits)
+		writeReg(ier, clearBits);
+	if (setBits)
+		writeReg(ier, 0x80 | setBits);
+	*cache = (*cache | setBits) & ~clearBits;
+}
+
+// The enables after wake: all of them off, then the shadowed ones on
+static const M2SnapshotEntry enableEntries[] = {
+	{ WHITNEY_VIA1 + VIA_IER, 1, 0, kSnapNoVerify, 0, 0 },
+	{ WHITNEY_VIA2 + VIA_IER, 1, 0, kSnapNoVerify, 0, 0 },
+	{ WHITNEY_VIA1 + VIA_IER, 1, 0, 0, 0x80, 0x7F },
+	{ WHITNEY_VIA2 + VIA_IER, 1, 0, 0, 0x80, 0x7F }
+};
+
+#ifdef WHITNEY_IC_MODEL
+static UInt32 modelSnapshotRead(volatile UInt8 *reg, UInt8 width)
+{
+	return WhitneyModelRead(reg, width);
+}
+
+static void modelSnapshotWrite(volatile UInt8 *reg, UInt8 width, UInt32 value)
+{
+	WhitneyModelWrite(reg, width, value);
 }
 #endif
 
-inline void M2InterruptController::set_via2_ier_from_cache(void)
+// For M2CPU, see kWhitneyRestoreEnables.  False until
+//  initInterruptController() has set up the registers.
+bool M2InterruptController::restoreEnables(void)
 {
-        *via2_ier = 0x7F;
-        OSSynchronizeIO();
-        *via2_ier = 0x80 | cached_via2_ier;
-        OSSynchronizeIO();
+	boolean_t interruptState;
+
+	if (!via1_ier)
+		return false;
+
+	interruptState = ml_set_interrupts_enabled(false);
+
+	enableValues[0] = 0x7F;
+	enableValues[1] = 0x7F;
+	enableValues[2] = cached_via1_ier;
+	enableValues[3] = cached_via2_ier;
+	m2SnapshotRestore(&enableSnapshot);
+	m2SnapshotVerify(&enableSnapshot);
+
+	(void) ml_set_interrupts_enabled(interruptState);
+
+	return true;
+}
+
+// For the PMU driver, see kWhitneyUpdateVIA1Enables.  False until
+//  initInterruptController() has set up the registers.
+bool M2InterruptController::updateVIA1Enables(UInt8 setBits, UInt8 clearBits)
+{
+	boolean_t interruptState;
+
+	if (!via1_ier)
+		return false;
+
+	interruptState = ml_set_interrupts_enabled(false);
+
+	setBits &= ~(stormedMask >> 8);		// stormTimerFired() enables those
+	update_ier(via1_ier, &cached_via1_ier, setBits, clearBits);
+
+	(void) ml_set_interrupts_enabled(interruptState);
+
+	return true;
 }
 
 IOReturn M2InterruptController::initInterruptController(IOService *provider, volatile UInt8 *base)
 {
 	int cnt;
+	AbsoluteTime interval;
 	
 	whitneyBase = base;
 	parentNub = provider;
@@ -313,6 +437,18 @@ IOReturn M2InterruptController::initInterruptController(IOService *provider, vol
 		}
 	}
 
+	for (cnt = 0; cnt < kNumVectors; cnt++)
+		setVectorPriority(cnt, defaultPriorities[cnt]);
+	dispatchBudget = kDefaultDispatchBudget;
+
+	clock_interval_to_absolutetime_interval(1, kMillisecondScale, &interval);
+	stormTicksPerMS = (UInt32) AbsoluteTime_to_scalar(&interval);
+	stormTimer = IOTimerEventSource::timerEventSource(this, (IOTimerEventSource::Action) &M2InterruptController::stormTimerFired);
+	if (stormTimer && (getWorkLoop()->addEventSource(stormTimer) != kIOReturnSuccess)) {
+		stormTimer->release();
+		stormTimer = 0;
+	}
+
 	// Setup the accessors for the registers
 	icr = (volatile UInt32 *)(base + WHITNEY_ICR);
 	via1_ier = (volatile UInt8 *)(base + WHITNEY_VIA1 + VIA_IER);
@@ -320,33 +456,26 @@ IOReturn M2InterruptController::initInterruptController(IOService *provider, vol
  	via2_ier = (volatile UInt8 *)(base + WHITNEY_VIA2 + VIA_IER);
 	via2_ifr = (volatile UInt8 *)(base + WHITNEY_VIA2 + VIA_IFR);
 	via2_slot_ifr = (volatile UInt8 *)(base + WHITNEY_VIA2 + VIA2_SLOT_IFR);
+	via1_pcr = (volatile UInt8 *)(base + WHITNEY_VIA1 + VIA_PCR);
+	via2_pcr = (volatile UInt8 *)(base + WHITNEY_VIA2 + VIA_PCR);
+	m2SnapshotInit(&enableSnapshot, base, enableEntries,
+		sizeof(enableEntries) / sizeof(enableEntries[0]), enableValues);
+#ifdef WHITNEY_IC_MODEL
+	enableSnapshot.read = &modelSnapshotRead;
+	enableSnapshot.write = &modelSnapshotWrite;
+#endif
 
 	#if VERBOSE
-	IOLog("M2InterruptController:initInterruptController() current ICR = %x\n", (unsigned int) *icr);
-	OSSynchronizeIO();
+	IOLog("M2InterruptController:initInterruptController() current ICR = %x\n", (unsigned int) readICR());
 	#endif
 
 	// Set up HW now that accessors are initialized
 	clearAllInterrupts();
 	
 	#if VERBOSE
-	IOLog("M2InterruptController:initInterruptController() new ICR = %x\n", (unsigned int) *icr);
-	OSSynchronizeIO();
+	IOLog("M2InterruptController:initInterruptController() new ICR = %x\n", (unsigned int) readICR());
 	#endif
 
-#if LOG_INT_COUNTS
-	dumpTimer = IOTimerEventSource::timerEventSource(this, (IOTimerEventSource::Action) &M2InterruptController::dumpIntCounts);
-	if (!dumpTimer) {
-		Verbose_IOLog("M2IC: could not create dumpTimer");
-	} else {
-		getWorkLoop()->addEventSource(dumpTimer);
-		dumpTimer->enable();
-		if (dumpTimer->setTimeoutMS(1000) != kIOReturnSuccess) {
-			Verbose_IOLog("M2IC: setTimeoutMS failed\n");
-		}
-	}
-#endif
-
 	return kIOReturnSuccess;
 }
 
@@ -361,35 +490,101 @@ IOWorkLoop *M2InterruptController::getWorkLoop(void)
 void M2InterruptController::clearAllInterrupts(void)
 {
 	// Clear out PC registers (AppleVIAInterruptController does this, so we should)
-	*((volatile UInt8 *)(whitneyBase + WHITNEY_VIA1 + VIA_PCR)) = 0x00;
-	*((volatile UInt8 *)(whitneyBase + WHITNEY_VIA2 + VIA_PCR)) = 0x00;
+	writeReg(via1_pcr, 0x00);
+	writeReg(via2_pcr, 0x00);
 	
 	pending_ints = 0;
-	*via1_ier = 0x7F;		// Clear VIA interrupt enables (only ones maskable)
-	*via2_ier = 0x7F;
-	*via1_ifr = 0x7F;		// Clear VIA interrupt flags
-	*via2_ifr = 0x7F;
+	writeReg(via1_ier, 0x7F);	// Clear VIA interrupt enables (only ones maskable)
+	writeReg(via2_ier, 0x7F);
+	writeReg(via1_ifr, 0x7F);	// Clear VIA interrupt flags
+	writeReg(via2_ifr, 0x7F);
 	cached_via1_ier = 0;
 	cached_via2_ier = 0;
 	via2_slot_ien = 0;		// Does not correspond to a register -- keeps track of enabled slot interrupts.
-	OSSynchronizeIO();
-	*icr = 0x80;			// Ack any pending ICR interrupt and reset interrupt mask - do this last just in case the previous lines let any ints through
+	writeICR(0x80);			// Ack any pending ICR interrupt and reset interrupt mask - do this last just in case the previous lines let any ints through
 	icr_ien = 0x6;			// Initially VIA1, VIA2 enabled
 }
 
+void M2InterruptController::setVectorPriority(long vectorNumber, UInt8 priority)
+{
+	int i;
+
+	if ((vectorNumber < 0) || (vectorNumber >= kNumVectors))
+		return;
+	if (priority >= kNumPriorities)
+		priority = kNumPriorities - 1;
+
+	vectorPriority[vectorNumber] = priority;
+	for (i = 0; i < kNumPriorities; i++)
+		priorityMask[i] &= ~(1 << vectorNumber);
+	priorityMask[priority] |= 1 << vectorNumber;
+}
+
+void M2InterruptController::setVectorPriorities(OSData *priorities)
+{
+	const UInt8 *bytes;
+	unsigned int cnt, len;
+
+	if (!priorities)
+		return;
+
+	bytes = (const UInt8 *) priorities->getBytesNoCopy();
+	len = priorities->getLength();
+	if (len > kNumVectors)
+		len = kNumVectors;
+
+	boolean_t interruptState = ml_set_interrupts_enabled(false);
+	for (cnt = 0; cnt < len; cnt++)
+		setVectorPriority(cnt, bytes[cnt]);
+	(void) ml_set_interrupts_enabled(interruptState);
+}
+
+void M2InterruptController::setDispatchBudget(UInt32 budget)
+{
+	dispatchBudget = budget ? budget : 1;
+}
+
 // Must be compiled with -fpermissive
 IOInterruptAction M2InterruptController::getInterruptHandlerAddress(void)
 {
 	return (IOInterruptAction) &M2InterruptController::handleInterrupt;
 }
 
+// Histogram bucket of a timebase interval: n for 4^n to 4^(n+1)-1 ticks
+static inline int histBucket(UInt32 ticks)
+{
+	return ticks ? (31 - cntlzw(ticks)) >> 1 : 0;
+}
+
 void M2InterruptController::callVector(long vectorNumber)
 {
 	IOInterruptVector *vector;
+	M2StormState *storm = &storms[vectorNumber];
+	M2VectorStats *stats = 0;
+	UInt32 start = 0, now;
+
+	// the timebase is only read every kStormCalls calls
+	if (++storm->calls >= kStormCalls) {
+		now = timebase();
+		if ((now - storm->windowStart < kStormWindowMS * stormTicksPerMS) &&
+		    !(kICRVectorMask & (1 << vectorNumber)) && stormTimer)
+			stormDetected(vectorNumber, now);
+		storm->windowStart = now;
+		storm->calls = 0;
+	}
 
-#if LOG_INT_COUNTS
-	intCounts[vectorNumber]++;
-#endif
+	if (statsLevel) {
+		stats = &vectorStats[vectorNumber];
+		stats->calls++;
+		if (statsLevel >= kStatsTimes) {
+			start = timebase();
+			if (stats->lastArrival)
+				stats->arrivalHist[histBucket(start - stats->lastArrival)]++;
+			stats->lastArrival = start;
+			if (start - entryTime > stats->maxLatency)
+				stats->maxLatency = start - entryTime;
+		}
+	}
 
 	vector = &vectors[vectorNumber];
 	
@@ -402,6 +597,8 @@ void M2InterruptController::callVector(long vectorNumber)
 		// Call the handler if it exists.
 		if (vector->interruptRegistered)
 			vector->handler(vector->target, vector->refCon, vector->nub, vector->source);
+		if (start)
+			stats->durationHist[histBucket(timebase() - start)]++;
 	} else {
 		// Hard disable the source. If nothing else, sets our internal masks
                 //  so this vector is not called again.
@@ -412,110 +609,160 @@ void M2InterruptController::callVector(long vectorNumber)
 	vector->interruptActive = 0;
 }
 
+// Reads and clears the sources behind one ICR level, returning them as
+//  a mask of vector numbers
+UInt32 M2InterruptController::readLevelSources(UInt8 level)
+{
+	UInt32 sources;
+	unsigned char ifr, slot_ifr;
+
+	if (level == 2) {
+		ifr = readReg(via2_ifr) & cached_via2_ier;
+		if (ifr)
+			writeReg(via2_ifr, ifr);				// clear pending VIA2 ints
+		sources = (UInt32) (ifr & ~via2_slot_int_mask) << 16;
+		if (ifr & via2_slot_int_mask) {
+			slot_ifr = ~readReg(via2_slot_ifr) & via2_slot_ien;	// slot ints are active low
+			sources |= (UInt32) slot_ifr << 24;
+		}
+		return sources;
+	}
+	
+	if (level == 1) {
+		ifr = readReg(via1_ifr) & cached_via1_ier;
+		if (ifr)
+			writeReg(via1_ifr, ifr);				// clear pending VIA1 ints
+		return (UInt32) ifr << 8;
+	}
+	
+	return (1 << level) & icr_ien;		// no hardware mask, so mask here
+}
+
+// Calls the given vectors, highest priority first.  Once the budget is
+//  spent the rest are left in pending_ints, where the next pass finds them
+//  before it looks at the hardware, so a busy source can delay the others
+//  by at most one pass.
+void M2InterruptController::dispatchVectors(UInt32 vectors, UInt32 *budget)
+{
+	unsigned long vectorNumber;
+	UInt32 level, mask, deferred = 0;
+
+	for (level = kNumPriorities; vectors && level-- > 0; ) {
+		mask = vectors & priorityMask[level];
+		vectors &= ~mask;
+		while (mask) {
+			vectorNumber = 31 - cntlzw(mask);
+			mask &= ~(1 << vectorNumber);
+			if (*budget == 0) {
+				deferred |= 1 << vectorNumber;
+				starveCounts[vectorNumber]++;
+				continue;
+			}
+			(*budget)--;
+			callVector(vectorNumber);
+		}
+	}
+
+	if (deferred) {
+		pending_ints |= deferred;
+		parentNub->causeInterrupt(0);
+	}
+}
+
 IOReturn M2InterruptController::handleInterrupt(void * /*refCon*/, IOService * /*nub*/, int /*source*/)
 {
-	unsigned long vectorNumber, maskedPending;
-	unsigned char x, y, ifr, slot_ifr, orig_v1_ifr;
-//	unsigned long loops = 0;
-//	#define MAX_INT_LOOPS 100
+	UInt32 maskedPending, sources, collected, hidden, budget, passes = 0;
+	unsigned long vectorNumber;
+	unsigned char x, y, via1Enables;
 	
+	budget = dispatchBudget;
+	if (statsLevel) {
+		interrupts++;
+		if (statsLevel >= kStatsTimes)
+			entryTime = timebase();
+	}
+
+	// vectors caused by software or deferred by the last pass go first.
+	//  A VIA1 vector is masked with the IER as it is now and not with
+	//  cached_via1_ier, which misses what the PMU driver writes to it
+	//  itself.
+	via1Enables = cached_via1_ier;
+	if (pending_ints & 0xFF00)
+		via1Enables = readReg(via1_ier) & 0x7F;
 	maskedPending = pending_ints & (icr_ien
-		| ((unsigned long) cached_via1_ier << 8)
+		| ((unsigned long) via1Enables << 8)
 		| ((unsigned long) cached_via2_ier << 16)
 		| ((unsigned long) via2_slot_ien << 24));
-
-	while (maskedPending) {
-		vectorNumber = 31 - cntlzw(maskedPending);
-		maskedPending &= ~(1 << vectorNumber);
-		pending_ints &= ~(1 << vectorNumber);
-		callVector(vectorNumber);
-	} 
-
-	while (true) {
-#if 0
-		if (loops++ == MAX_INT_LOOPS)		// Failsafe mechanism
-			break;
-#endif
-		y = *icr;
-		*icr = y | 0x80;
-		eieio();
-		x = *icr & 7;
-		eieio();
-		
-		if (!y)
-			break;
-		
-		// On NMI at least, sometimes we get x = 0, but y should probably be correct.
-		//  This might also happen for serial interrupts; I've never observed it for
-		//  interrupt levels 1 or 2.
-		if (!x)
-			x = y & 7;
-
-#if LOG_INT_COUNTS
-		totalInts++;
-#endif
-
-		if (x == 2) {
-			ifr = *via2_ifr & cached_via2_ier;
-			eieio();
-			*via2_ifr = ifr;						// clear pending VIA2 ints
-			eieio();
-			if (ifr & via2_slot_int_mask) {
-				ifr &= ~via2_slot_int_mask;
-				slot_ifr = ~(*via2_slot_ifr) & via2_slot_ien;		// slot ints are active low
-				eieio();
-				while (slot_ifr) {
-					vectorNumber = 31 - cntlzw(slot_ifr);
-					slot_ifr &= ~(1 << vectorNumber);
-					callVector(vectorNumber + 24);
-				}
-			}
+	pending_ints &= ~maskedPending;
+	dispatchVectors(maskedPending, &budget);
+
+	while (budget) {
+		// Take every level the ICR reports before calling anything, so the
+		//  priorities decide the order and not the ICR.  A level-triggered
+		//  source reports again until its handler runs, so stop once a level
+		//  brings nothing new; but first read the VIAs' IFRs, or a busy or
+		//  stuck source above them (the SCC, which is never storm masked)
+		//  would keep them out of every pass.
+		collected = 0;
+		while (true) {
+			y = readICR();
+			writeICR(y | 0x80);
+			x = readICR() & 7;
 			
-			while (ifr) {
-				vectorNumber = 31 - cntlzw(ifr);
-				ifr &= ~(1 << vectorNumber);
-				callVector(vectorNumber + 16);
-			}
+			if (!y)
+				break;
 			
-			continue;
+			// On NMI at least, sometimes we get x = 0, but y should probably be correct.
+			//  This might also happen for serial interrupts; I've never observed it for
+			//  interrupt levels 1 or 2.
+			if (!x)
+				x = y & 7;
+
+			passes++;
+
+			sources = readLevelSources(x);
+			if (!(sources & ~collected)) {
+				hidden = 0;				// the levels below x
+				if (x > 2)
+					hidden |= readLevelSources(2);
+				if (x > 1)
+					hidden |= readLevelSources(1);
+				hidden &= ~collected;
+				collected |= hidden;
+				while (hidden) {			// the ICR passed them over
+					vectorNumber = 31 - cntlzw(hidden);
+					hidden &= ~(1 << vectorNumber);
+					starveCounts[vectorNumber]++;
+				}
+				break;
+			}
+			collected |= sources;
+			if (sources & (1 << kVectorPMUSR))
+				break;
 		}
 		
-		if (x == 1) {
-#if 1
-			ifr = *via1_ifr & (~0x80); 		// The PMU driver changes the VIA1 int enables directly
-			eieio();
-			ifr &= *via1_ier;
-#else
-			ifr = *via1_ifr & cached_via1_ier;
-#endif
-			eieio();
-			*via1_ifr = ifr;						// clear pending VIA1 ints
-			eieio();
-			
-			orig_v1_ifr = ifr;
-			while (ifr) {
-				vectorNumber = 31 - cntlzw(ifr);
-				ifr &= ~(1 << vectorNumber);
-				callVector(vectorNumber + 8);
-			}
+		if (!collected)
+			break;
 
-#if 1			
-			if (orig_v1_ifr & 4) {			// Stop processing if we got a PMU SR interrupt
-#if LOG_INT_COUNTS
-				whitney_ps_icr = *icr;
-				if ((*via1_ifr & 4) && (whitney_ps_icr & 0x1))
-					whitney_ps_xc++;	// Count how many times we still have a PMU interrupt going
-#endif
-				break;
+		dispatchVectors(collected, &budget);
+
+		if (collected & (1 << kVectorPMUSR)) {		// Stop processing if we got a PMU SR interrupt
+			if (statsLevel) {
+				y = readICR();
+				if ((readReg(via1_ifr) & 4) && (y & 0x1))
+					pmuStillPending++;	// Count how many times we still have a PMU interrupt going
 			}
-#endif			
-			continue;
+			break;
 		}
-		
-		callVector(x);
 	}
 
-	
+	if (statsLevel) {
+		icrReads += passes;
+		passHist[(passes < kNumPassBuckets) ? passes : kNumPassBuckets - 1]++;
+		if (statsLevel >= kStatsTimes)
+			dispatchHist[histBucket(timebase() - entryTime)]++;
+	}
+
 	return kIOReturnSuccess;
 }
 
@@ -535,23 +782,15 @@ void M2InterruptController::disableVectorHard(long vectorNumber, IOInterruptVect
 	
 	switch (vectorNumber >> 3) {				// Interrupt sources ordered by priority:
 		case 1:		// VIA1
-#if 0
-			cached_via1_ier &= ~(1 << (vectorNumber & 7));
-			set_via1_ier_from_cache();
-#else
-			*via1_ier = 1 << (vectorNumber & 7);
-#endif
+			update_ier(via1_ier, &cached_via1_ier, 0, 1 << (vectorNumber & 7));
 			break;
 		case 3:		// VIA2 slot
 			via2_slot_ien &= ~(1 << (vectorNumber & 7));
-			if (!via2_slot_ien) {
-				cached_via2_ier &= ~via2_slot_int_mask;		// no slot ints enabled -- disable at via2
-				set_via2_ier_from_cache();
-			}
+			if (!via2_slot_ien)		// no slot ints enabled -- disable at via2
+				update_ier(via2_ier, &cached_via2_ier, 0, via2_slot_int_mask);
 			break;
 		case 2:		// VIA2
-			cached_via2_ier &= ~(1 << (vectorNumber & 7));
-			set_via2_ier_from_cache();
+			update_ier(via2_ier, &cached_via2_ier, 0, 1 << (vectorNumber & 7));
 			break;
 		default:	// ICR
 			icr_ien &= ~(1 << vectorNumber);
@@ -568,29 +807,21 @@ void M2InterruptController::enableVector(long vectorNumber, IOInterruptVector *
 
 	if (vectorNumber >= 32)
 		return;
+	if (stormedMask & (1 << vectorNumber))
+		return;			// stormTimerFired() enables it when the backoff is over
 	
 	interruptState = ml_set_interrupts_enabled(false);
 	
 	switch (vectorNumber >> 3) {
 		case 1:		// VIA1
-#if 0
-			cached_via1_ier |= (1 << (vectorNumber & 7));
-			cached_via1_ier &= 0x7F;			// make sure bit 7 is not set
-			set_via1_ier_from_cache();
-#else
-			*via1_ier = 0x80 | (1 << (vectorNumber & 7));
-#endif
+			update_ier(via1_ier, &cached_via1_ier, 1 << (vectorNumber & 7), 0);
 			break;
 		case 3:		// VIA2 slot
 			via2_slot_ien |= (1 << (vectorNumber & 7));
-
-			cached_via2_ier |= via2_slot_int_mask;
-			set_via2_ier_from_cache();
+			update_ier(via2_ier, &cached_via2_ier, via2_slot_int_mask, 0);
 			break;
 		case 2:		// VIA2
-			cached_via2_ier |= (1 << (vectorNumber & 7));
-			cached_via2_ier &= 0x7F;
-			set_via2_ier_from_cache();
+			update_ier(via2_ier, &cached_via2_ier, 1 << (vectorNumber & 7), 0);
 			break;
 		default:	// ICR
 			icr_ien |= (1 << vectorNumber);
@@ -621,106 +852,206 @@ int M2InterruptController::getVectorType(long vectorNumber, IOInterruptVector */
 
 
 
-#if LOG_INT_COUNTS
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-#if 0
-// Routine to write characters directly to console -- never disabled
-extern "C" {
-	extern void vc_putchar(char ch);		/* xnu/osfmk/ppc/POWERMAC/video_console.c */
-	extern void _disable_preemption(void);
-	extern void _enable_preemption(void);
-}
+// Interrupt storms.  A stuck level-triggered source (a PC Card, a media bay
+//  device) would otherwise keep the CPU in handleInterrupt for good; instead
+//  its vector is masked for a while and the rest of the machine carries on.
 
-static void vc_putchar_intf(char ch)
+// Called at interrupt level from callVector()
+void M2InterruptController::stormDetected(long vectorNumber, UInt32 now)
 {
-	vc_putchar(ch);
-	if (ch == '\n')
-		vc_putchar('\r');
+	M2StormState *storm = &storms[vectorNumber];
+
+	// another storm soon after the last one doubles the backoff
+	if (storm->backoffMS && (now - storm->lastStorm < 2 * storm->backoffMS * stormTicksPerMS)) {
+		storm->backoffMS *= 2;
+		if (storm->backoffMS > kStormBackoffMaxMS)
+			storm->backoffMS = kStormBackoffMaxMS;
+	} else {
+		storm->backoffMS = kStormBackoffMinMS;
+	}
+	storm->lastStorm = now;
+	storm->releaseAt = now + storm->backoffMS * stormTicksPerMS;
+	storm->storms++;
+
+	stormedMask |= 1 << vectorNumber;
+	unreportedMask |= 1 << vectorNumber;
+	disableVectorHard(vectorNumber, &vectors[vectorNumber]);
+
+	stormTimer->setTimeoutTicks(1);
 }
 
-// In 10.2, vc_putchar was made static. Use vcputc instead.
-static void vc_putchar_intf_jaguar(char ch)
+// Reports new storms and unmasks the vectors whose backoff is over
+void M2InterruptController::stormTimerFired(IOTimerEventSource * /*sender*/)
 {
-	vcputc(0, 0, ch);
-	if (ch == '\n')
-		vcputc(0, 0, '\r');
+	boolean_t interruptState;
+	IOInterruptVector *vector;
+	UInt32 report, mask, now, next = 0;
+	SInt32 remaining;
+	long vectorNumber;
+
+	interruptState = ml_set_interrupts_enabled(false);
+	
+	report = unreportedMask;
+	unreportedMask = 0;
+	
+	now = timebase();
+	mask = stormedMask;
+	while (mask) {
+		vectorNumber = 31 - cntlzw(mask);
+		mask &= ~(1 << vectorNumber);
+		remaining = (SInt32) (storms[vectorNumber].releaseAt - now);
+		if (remaining <= 0) {
+			stormedMask &= ~(1 << vectorNumber);
+			storms[vectorNumber].calls = 0;
+			vector = &vectors[vectorNumber];
+			if (vector->interruptRegistered && !vector->interruptDisabledSoft)
+				enableVector(vectorNumber, vector);
+		} else if (!next || ((UInt32) remaining < next)) {
+			next = remaining;
+		}
+	}
+	
+	(void) ml_set_interrupts_enabled(interruptState);
+
+	while (report) {
+		vectorNumber = 31 - cntlzw(report);
+		report &= ~(1 << vectorNumber);
+		IOLog("M2InterruptController: interrupt storm on vector %ld, masked for %ld ms (%ld so far)\n",
+		      vectorNumber, storms[vectorNumber].backoffMS, storms[vectorNumber].storms);
+	}
+
+	if (next)
+		stormTimer->setTimeoutMS(next / stormTicksPerMS + 1);
 }
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// Statistics.  Collection costs one test per interrupt and per vector call
+//  when off; the counters are read through the "InterruptStatistics"
+//  property, never printed.
 
-void ICLog(const char *format, ...)
+void M2InterruptController::setStatisticsLevel(UInt32 level)
 {
-#if 0
-	const char *sp = format;
-	char c;
+	M2VectorStats *stats;
+
+	if (level > kStatsTimes)
+		level = kStatsTimes;
+
+	if (level && !vectorStats) {
+		stats = (M2VectorStats *) IOMalloc(kNumVectors * sizeof(M2VectorStats));
+		if (!stats)
+			return;
+		bzero(stats, kNumVectors * sizeof(M2VectorStats));
+		vectorStats = stats;
+		sync();
+	}
 
-	while (true) {
-		c = *sp++;
-		if (!c)
-			break;
-		vc_putchar(c);
+	// starting over from off clears the counters
+	if (level && !statsLevel) {
+		bzero(vectorStats, kNumVectors * sizeof(M2VectorStats));
+		interrupts = icrReads = pmuStillPending = 0;
+		bzero(passHist, sizeof(passHist));
+		bzero(dispatchHist, sizeof(dispatchHist));
+		sync();
 	}
-#endif
-	va_list	listp;
-	boolean_t state;
 
-	state = ml_set_interrupts_enabled(FALSE);	
-//	disable_preemption();
-	
-	va_start(listp, format);
-	_doprnt(format, &listp, vc_putchar_intf, 16);
-	va_end(listp);
-	
-//	enable_preemption();
-	ml_set_interrupts_enabled(state);
+	statsLevel = level;
 }
 
-#endif 
-
-void M2InterruptController::dumpIntCounts(IOTimerEventSource *caller)
+static OSArray *arrayFromCounts(const UInt32 *counts, unsigned int count)
 {
+	OSArray *array;
+	OSNumber *num;
 	unsigned int i;
-	UInt32 c, mask;
-	
-	#define VTGREEN    "\033[32m"
-	#define VTRESET    "\033[0m"
-	#define IntCountLog	IOLog
-	
-	mask = (icr_ien
-		| ((unsigned long) cached_via1_ier << 8)
-		| ((unsigned long) cached_via2_ier << 16)
-		| ((unsigned long) via2_slot_ien << 24));
 
-	IntCountLog(VTGREEN "00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D IC TO\n");
-	for (i = 0; i < 0x1E; i++) {
-		c = intCounts[i];
-		intCounts[i] = 0;
-		IntCountLog("%02X%c", c, (mask & (1 << i)) ? 'e' : ' ');
+	array = OSArray::withCapacity(count);
+	if (!array)
+		return 0;
+	for (i = 0; i < count; i++) {
+		if ((num = OSNumber::withNumber(counts[i], 32))) {
+			array->setObject(num);
+			num->release();
+		}
 	}
-	c = totalInts;
-	totalInts = 0;
-	IntCountLog("%02X %X", *icr, c);
-//	IntCountLog("%02X %02X", whitney_ps_icr, whitney_ps_xc);
-//	OSSynchronizeIO();
-	IntCountLog("\n" VTRESET);
-	
-	if (dumpCount & 1)
-		dumpRegs();
-	
-	dumpCount++;
-	caller->setTimeoutMS(INT_COUNT_PERIOD);
+	return array;
 }
 
-void M2InterruptController::dumpRegs()
+static void setCount(OSDictionary *dict, const char *key, UInt32 count)
 {
-	UInt8 ricr, re1, re2, rf1, rf2, rfs;
-	
-	ricr = *icr; OSSynchronizeIO();
-	re1 = *via1_ier; OSSynchronizeIO();
-	re2 = *via2_ier; OSSynchronizeIO();
-	rf1 = *via1_ifr; OSSynchronizeIO();
-	rf2 = *via2_ifr; OSSynchronizeIO();
-	rfs = ~(*via2_slot_ifr) & 0x3F; OSSynchronizeIO();
-	
-	IntCountLog(VTGREEN "=== ICR:%x EI: %x E1:%x E2:%x F1:%x F2:%x ES:%x FS:%x E1_cache:%x E2_cache:%x\n" VTRESET, ricr, icr_ien, re1, re2, rf1, rf2, via2_slot_ien, rfs, cached_via1_ier, cached_via2_ier);
+	OSNumber *num = OSNumber::withNumber(count, 32);
+
+	if (num) {
+		dict->setObject(key, num);
+		num->release();
+	}
+}
+
+static void setCounts(OSDictionary *dict, const char *key, const UInt32 *counts, unsigned int count)
+{
+	OSArray *array = arrayFromCounts(counts, count);
+
+	if (array) {
+		dict->setObject(key, array);
+		array->release();
+	}
+}
+
+bool M2InterruptController::serializeStatistics(void *target, void * /*ref*/, OSSerialize *s)
+{
+	M2InterruptController *controller = OSDynamicCast(M2InterruptController, (OSObject *) target);
+	OSDictionary *dict, *vectorDict;
+	M2VectorStats *stats;
+	char key[16];
+	bool ok;
+	int i;
+
+	if (!controller)
+		return false;
+
+	dict = OSDictionary::withCapacity(8);
+	if (!dict)
+		return false;
+
+	setCount(dict, "Level", controller->statsLevel);
+	setCount(dict, "Interrupts", controller->interrupts);
+	setCount(dict, "ICRReads", controller->icrReads);
+	setCount(dict, "PMUStillPending", controller->pmuStillPending);
+	setCount(dict, "WakeEnableMismatches", controller->enableSnapshot.mismatches);
+	setCounts(dict, "PassesPerInterrupt", controller->passHist, kNumPassBuckets);
+	if (controller->statsLevel >= kStatsTimes)
+		setCounts(dict, "DispatchHistogram", controller->dispatchHist, kNumHistBuckets);
+
+	for (i = 0; i < kNumVectors; i++) {
+		stats = controller->vectorStats ? &controller->vectorStats[i] : 0;
+		if ((!stats || !stats->calls) && !controller->starveCounts[i] && !controller->storms[i].storms)
+			continue;
+
+		vectorDict = OSDictionary::withCapacity(4);
+		if (!vectorDict)
+			continue;
+
+		setCount(vectorDict, "Priority", controller->vectorPriority[i]);
+		setCount(vectorDict, "Deferred", controller->starveCounts[i]);
+		setCount(vectorDict, "Storms", controller->storms[i].storms);
+		if (controller->stormedMask & (1 << i))
+			setCount(vectorDict, "MaskedForMS", controller->storms[i].backoffMS);
+		if (stats) {
+			setCount(vectorDict, "Calls", stats->calls);
+			if (controller->statsLevel >= kStatsTimes) {
+				setCounts(vectorDict, "ArrivalHistogram", stats->arrivalHist, kNumHistBuckets);
+				setCounts(vectorDict, "DurationHistogram", stats->durationHist, kNumHistBuckets);
+				setCount(vectorDict, "MaxLatency", stats->maxLatency);
+			}
+		}
+
+		sprintf(key, "Vector%d", i);
+		dict->setObject(key, vectorDict);
+		vectorDict->release();
+	}
+
+	ok = dict->serialize(s);
+	dict->release();
+	return ok;
 }
-#endif
@@ -7,14 +7,83 @@
 #include <IOKit/IOTimerEventSource.h>
 #include <IOKit/IOWorkLoop.h>
 
+#include "../M2PE/M2RegisterSnapshot.h"
 
-#define LOG_INT_COUNTS 1
-#define INT_COUNT_PERIOD 2000
 
 #define kNumVectors 32
 
+// Interrupt statistics, published as the "InterruptStatistics" property
+//  and switched with "InterruptStatisticsLevel" (setProperties)
+enum {
+	kStatsOff = 0,		// nothing is collected
+	kStatsCounts,		// calls per vector and ICR passes
+	kStatsTimes		// also arrival and handler time histograms
+};
+
+#define kNumHistBuckets 16	// bucket n: 4^n to 4^(n+1)-1 timebase ticks
+#define kNumPassBuckets 8	// ICR passes per interrupt, the last is "or more"
+
+// Storm detection: a vector called more than kStormCalls times within
+//  kStormWindowMS is masked for a backoff period, doubled for every storm
+//  that follows soon after the last one.  Only the VIA and slot vectors
+//  are watched: an ICR level (the SCC, the NMI) cannot be masked at its
+//  source, and the SCC at 230.4 kbaud, a call per character, makes 2304
+//  calls a window.  The busiest of the watched vectors working as it
+//  should is a PC Card Ethernet taking minimum size frames at 10 Mbit/s,
+//  1488 a window; a stuck level-triggered line calls its vector as fast
+//  as handleInterrupt comes back, some tens of microseconds a call, or
+//  5000 and more a window.
+#define kStormCalls 4096
+#define kStormWindowMS 100
+#define kStormBackoffMinMS 50
+#define kStormBackoffMaxMS 6400
+
+// The VIA1 interrupt enables belong to M2InterruptController, the PMU
+//  driver changes its own bits (SR and CB1) with
+//  callPlatformFunction(kWhitneyUpdateVIA1Enables, false,
+//  (void *) setBits, (void *) clearBits, 0, 0) on any nub below Whitney,
+//  so the interrupt path can trust the shadow copy.
+#define kWhitneyUpdateVIA1Enables "WhitneyUpdateVIA1Enables"
+
+// M2CPU calls this on wake, after it restored the rest of the VIAs, to
+//  have the enables rebuilt from the shadow copies
+#define kWhitneyRestoreEnables "WhitneyRestoreEnables"
+
+struct M2StormState {
+	UInt32 calls;			// since windowStart
+	UInt32 windowStart;		// timebase
+	UInt32 releaseAt;		// timebase, while masked
+	UInt32 lastStorm;		// timebase
+	UInt32 backoffMS;
+	UInt32 storms;
+};
+
+struct M2VectorStats {
+	UInt32 calls;
+	UInt32 lastArrival;			// timebase
+	UInt32 maxLatency;			// handleInterrupt entry to call, timebase
+	UInt32 arrivalHist[kNumHistBuckets];	// time since the previous call
+	UInt32 durationHist[kNumHistBuckets];	// time in the handler
+};
+
+// Dispatch priorities, 0 (lowest) to kNumPriorities-1
+#define kNumPriorities 8
+#define kDefaultDispatchBudget 16
+
 class M2InterruptController;
 
+// If WHITNEY_IC_MODEL is defined the Whitney registers are not touched
+//  directly: every access goes to these functions, which a model of the
+//  ICR and the two VIAs has to provide, along with the timebase so that
+//  a replayed trace runs on the model's time.
+#ifdef WHITNEY_IC_MODEL
+extern "C" {
+UInt32 WhitneyModelRead(volatile void *reg, int size);
+void WhitneyModelWrite(volatile void *reg, int size, UInt32 value);
+UInt32 WhitneyModelTimebase(void);
+}
+#endif
+
 
 class Whitney : public IOService
 {
@@ -29,10 +98,14 @@ public:
 	void publishBelow(IORegistryEntry *root);
 	bool compareNubName(const IOService *nub, OSString *name, OSString **matched) const;
 	IOReturn getNubResources(IOService *nub);
+	IOReturn setProperties(OSObject *properties);
+	IOReturn callPlatformFunction(const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
 	
 protected:
         void testIntController(volatile UInt8 *ioBase, M2InterruptController *ic);
 	IOMemoryMap *ioMemoryMap;
+	M2InterruptController *interruptController;
 };
 
 class WhitneyDevice : public AppleMacIODevice
@@ -74,6 +147,14 @@ public:
         int getVectorType(long vectorNumber, IOInterruptVector */*vector*/);
 
         IOWorkLoop *getWorkLoop(void);
+
+	void setVectorPriority(long vectorNumber, UInt8 priority);
+	void setVectorPriorities(OSData *priorities);
+	void setDispatchBudget(UInt32 budget);
+	void setStatisticsLevel(UInt32 level);
+	bool updateVIA1Enables(UInt8 setBits, UInt8 clearBits);
+	bool restoreEnables(void);
+	static bool serializeStatistics(void *target, void *ref, OSSerialize *s);
         
 
 //protected:
@@ -85,29 +166,99 @@ public:
 	volatile UInt8 *via1_ifr;
 	volatile UInt8 *via2_ifr;
 	volatile UInt8 *via2_slot_ifr;
+	volatile UInt8 *via1_pcr;
+	volatile UInt8 *via2_pcr;
 	volatile UInt32 *icr;
+
+	// All the accesses to the registers go through these, each followed
+	//  by the eieio the hardware needs
+	inline UInt8 readReg(volatile UInt8 *reg)
+	{
+#ifdef WHITNEY_IC_MODEL
+		return WhitneyModelRead(reg, 1);
+#else
+		UInt8 value = *reg;
+		eieio();
+		return value;
+#endif
+	}
+	inline void writeReg(volatile UInt8 *reg, UInt8 value)
+	{
+#ifdef WHITNEY_IC_MODEL
+		WhitneyModelWrite(reg, 1, value);
+#else
+		*reg = value;
+		eieio();
+#endif
+	}
+	inline UInt32 readICR(void)
+	{
+#ifdef WHITNEY_IC_MODEL
+		return WhitneyModelRead(icr, 4);
+#else
+		UInt32 value = *icr;
+		eieio();
+		return value;
+#endif
+	}
+	inline void writeICR(UInt32 value)
+	{
+#ifdef WHITNEY_IC_MODEL
+		WhitneyModelWrite(icr, 4, value);
+#else
+		*icr = value;
+		eieio();
+#endif
+	}
+	inline UInt32 timebase(void)
+	{
+#ifdef WHITNEY_IC_MODEL
+		return WhitneyModelTimebase();
+#else
+		return mftb();
+#endif
+	}
 	
+	// Shadows of the VIA enables: the hardware is only written with the
+	//  bits that change, one write to set and one to clear
 	UInt8 cached_via1_ier;
 	UInt8 cached_via2_ier;
+	M2Snapshot enableSnapshot;		// writes the shadows back on wake
+	UInt32 enableValues[4];
 	UInt8 icr_ien;
 	UInt8 via2_slot_ien;
 	UInt32 pending_ints;
         
         IOWorkLoop *workLoop;
+
+	UInt8 vectorPriority[kNumVectors];
+	UInt32 priorityMask[kNumPriorities];	// vectors at each priority
+	UInt32 dispatchBudget;			// handler calls per interrupt
+	UInt32 starveCounts[kNumVectors];	// times deferred for lack of budget
+						//  or hidden behind an ICR level
         
-	inline void set_via1_ier_from_cache(void);
-	inline void set_via2_ier_from_cache(void);
+	inline void update_ier(volatile UInt8 *ier, UInt8 *cache, UInt8 setBits, UInt8 clearBits);
 	void callVector(long vectorNumber);
-    
-#if LOG_INT_COUNTS
-        IOTimerEventSource *dumpTimer;
-        UInt32 intCounts[kNumVectors];
-        UInt32 totalInts;
-        UInt16 dumpCount;
-        
-        void dumpIntCounts(IOTimerEventSource *caller);
-        void dumpRegs();
-#endif
+	UInt32 readLevelSources(UInt8 level);
+	void dispatchVectors(UInt32 vectors, UInt32 *budget);
+
+	M2StormState storms[kNumVectors];
+	UInt32 stormTicksPerMS;			// timebase ticks per millisecond
+	UInt32 stormedMask;			// vectors masked by storm detection
+	UInt32 unreportedMask;			// storms not yet logged
+	IOTimerEventSource *stormTimer;
+
+	void stormDetected(long vectorNumber, UInt32 now);
+	void stormTimerFired(IOTimerEventSource *sender);
+
+	UInt32 statsLevel;
+	M2VectorStats *vectorStats;		// kNumVectors, allocated on first use
+	UInt32 interrupts;			// calls to handleInterrupt
+	UInt32 entryTime;			// of the current handleInterrupt, timebase
+	UInt32 dispatchHist[kNumHistBuckets];	// time in handleInterrupt
+	UInt32 icrReads;			// ICR levels taken
+	UInt32 passHist[kNumPassBuckets];	// ICR passes per interrupt
+	UInt32 pmuStillPending;			// PMU int still up after a PMU SR pass
 };
 
 #endif
\ No newline at end of file